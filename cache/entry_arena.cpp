@@ -0,0 +1,378 @@
+#include "entry_arena.hpp"
+#include "hash/hash_map.hpp"
+
+#include <algorithm>
+#include <map>
+#include <stdexcept>
+#include <string.h>
+#include <assert.h>
+
+using namespace Cache;
+using namespace Spread;
+
+/* One entry. The file size is kept apart from the hash size, since
+   compressed objects (see Packed) are smaller than their data.
+ */
+struct Slot
+{
+  Hash hash;
+  int64_t writeTime, mtime, ctime;
+  uint64_t size, inode, device;
+
+  // Directory id, and offset of the leaf name in the name pool
+  uint32_t dir, name;
+  uint16_t nameLen;
+  uint8_t flags;
+};
+
+enum
+  {
+    F_USED      = 1,
+    F_RACY      = 2
+  };
+
+// Entries per block, and bytes per name pool chunk
+static const uint32_t BLOCK_BITS = 16;
+static const uint32_t BLOCK = 1 << BLOCK_BITS;
+static const uint32_t CHUNK = 1 << 20;
+
+/* Lookup tables hold nothing but entry ids, under a 32-bit tag. The
+   caller compares keys through a functor taking an id.
+ */
+typedef FlatTable<uint32_t, uint32_t> IdTable;
+
+struct SameId
+{
+  uint32_t id;
+  bool operator()(uint32_t other) const { return other == id; }
+};
+
+struct EntryArena::_Internal
+{
+  std::vector<Slot*> blocks;
+  uint32_t top, num;
+  std::vector<uint32_t> freeIds;
+
+  std::vector<char*> chunks;
+  uint64_t poolUsed, wasted;
+
+  // Directories, with the trailing slash
+  std::vector<std::string> dirs;
+  std::map<std::string, uint32_t> dirIds;
+
+  IdTable byPath, byHash;
+
+  // Append states are rare, so they are kept on the side
+  struct App
+  {
+    HashState state;
+    Hash check;
+  };
+  std::map<uint32_t, App> apps;
+
+  _Internal() : top(0), num(0), poolUsed(0), wasted(0) {}
+
+  ~_Internal()
+  {
+    for(int i=0; i<blocks.size(); i++) delete[] blocks[i];
+    for(int i=0; i<chunks.size(); i++) delete[] chunks[i];
+  }
+
+  Slot &slot(uint32_t id)
+  {
+    id--;
+    return blocks[id >> BLOCK_BITS][id & (BLOCK-1)];
+  }
+
+  const Slot &slot(uint32_t id) const
+  {
+    id--;
+    return blocks[id >> BLOCK_BITS][id & (BLOCK-1)];
+  }
+
+  const char *name(const Slot &s) const
+  { return chunks[s.name / CHUNK] + s.name % CHUNK; }
+
+  std::string path(const Slot &s) const
+  { return dirs[s.dir] + std::string(name(s), s.nameLen); }
+
+  // Store a name in the pool, and return its offset
+  uint32_t store(const char *str, uint16_t len)
+  {
+    // Names never cross chunk boundaries
+    if(poolUsed + len > chunks.size() * (uint64_t)CHUNK)
+      {
+        if(chunks.size() >= 0xffffffffULL / CHUNK)
+          throw std::runtime_error("Cache index name pool is full");
+        poolUsed = chunks.size() * (uint64_t)CHUNK;
+        chunks.push_back(new char[CHUNK]);
+      }
+    memcpy(chunks.back() + poolUsed % CHUNK, str, len);
+    uint32_t off = poolUsed;
+    poolUsed += len;
+    return off;
+  }
+
+  // Copy all live names to a fresh pool
+  void repack()
+  {
+    std::vector<char*> old;
+    old.swap(chunks);
+    poolUsed = wasted = 0;
+
+    for(uint32_t id=1; id<=top; id++)
+      {
+        Slot &s = slot(id);
+        if(!(s.flags & F_USED)) continue;
+        const char *str = old[s.name / CHUNK] + s.name % CHUNK;
+        s.name = store(str, s.nameLen);
+      }
+
+    for(int i=0; i<old.size(); i++) delete[] old[i];
+  }
+
+  static uint32_t pathTag(uint32_t dir, const char *leaf, size_t len)
+  {
+    // FNV-1a. Tag 0 marks an empty table slot, so it is never used.
+    uint32_t h = 2166136261u ^ dir;
+    for(size_t i=0; i<len; i++)
+      h = (h ^ (uint8_t)leaf[i]) * 16777619u;
+    return h ? h : 1;
+  }
+
+  static uint32_t hashTag(const Hash &hash)
+  {
+    uint32_t tag;
+    memcpy(&tag, hash.getData(), 4);
+    tag ^= (uint32_t)(hash.size() * 0x9E3779B1u);
+    return tag ? tag : 1;
+  }
+
+  // Split a path into a directory (with the slash) and a leaf name
+  static size_t split(const std::string &file)
+  {
+    size_t slash = file.rfind('/');
+    return slash == std::string::npos ? 0 : slash+1;
+  }
+
+  struct SamePath
+  {
+    const _Internal *owner;
+    uint32_t dir;
+    const char *leaf;
+    size_t len;
+
+    bool operator()(uint32_t id) const
+    {
+      const Slot &s = owner->slot(id);
+      return s.dir == dir && s.nameLen == len &&
+        memcmp(owner->name(s), leaf, len) == 0;
+    }
+  };
+
+  struct SameHash
+  {
+    const _Internal *owner;
+    const Hash *hash;
+
+    bool operator()(uint32_t id) const
+    { return owner->slot(id).hash == *hash; }
+  };
+};
+
+EntryArena::EntryArena() : ptr(new _Internal) {}
+
+uint32_t EntryArena::size() const { return ptr->num; }
+
+uint32_t EntryArena::find(const std::string &file) const
+{
+  size_t leaf = ptr->split(file);
+  std::map<std::string, uint32_t>::const_iterator dir =
+    ptr->dirIds.find(file.substr(0, leaf));
+  if(dir == ptr->dirIds.end()) return 0;
+
+  _Internal::SamePath eq = { ptr.get(), dir->second, file.c_str() + leaf,
+                             file.size() - leaf };
+  long i = ptr->byPath.findSlot(ptr->pathTag(eq.dir, eq.leaf, eq.len), eq);
+  return i < 0 ? 0 : ptr->byPath.value(i);
+}
+
+void EntryArena::find(const Hash &hash, std::vector<uint32_t> &out) const
+{
+  const IdTable &tab = ptr->byHash;
+  _Internal::SameHash eq = { ptr.get(), &hash };
+  uint32_t tag = ptr->hashTag(hash);
+  long i = tab.findSlot(tag, eq);
+  while(i >= 0)
+    {
+      out.push_back(tab.value(i));
+      i = tab.findSlot(tag, eq, tab.next(i));
+    }
+}
+
+uint32_t EntryArena::add(const JournalRecord &rec)
+{
+  assert(!find(rec.file));
+
+  size_t leaf = ptr->split(rec.file);
+  size_t len = rec.file.size() - leaf;
+  if(len > 0xffff)
+    throw std::runtime_error("File name too long: " + rec.file);
+
+  std::string dirName = rec.file.substr(0, leaf);
+  std::map<std::string, uint32_t>::iterator dir = ptr->dirIds.find(dirName);
+  if(dir == ptr->dirIds.end())
+    {
+      dir = ptr->dirIds.insert(std::make_pair(dirName, (uint32_t)ptr->dirs.size())).first;
+      ptr->dirs.push_back(dirName);
+    }
+
+  uint32_t id;
+  if(ptr->freeIds.size())
+    {
+      id = ptr->freeIds.back();
+      ptr->freeIds.pop_back();
+    }
+  else
+    {
+      if(ptr->top == 0xffffffff)
+        throw std::runtime_error("Too many cache index entries");
+      id = ++ptr->top;
+      if(((id-1) >> BLOCK_BITS) == ptr->blocks.size())
+        ptr->blocks.push_back(new Slot[BLOCK]);
+    }
+
+  Slot &s = ptr->slot(id);
+  s.hash = rec.hash;
+  s.writeTime = rec.writeTime;
+  s.mtime = rec.st.mtime;
+  s.ctime = rec.st.ctime;
+  s.size = rec.st.size;
+  s.inode = rec.st.inode;
+  s.device = rec.st.device;
+  s.dir = dir->second;
+  s.nameLen = len;
+  s.name = ptr->store(rec.file.c_str() + leaf, len);
+  s.flags = F_USED;
+  if(rec.racy) s.flags |= F_RACY;
+
+  uint32_t tag = ptr->pathTag(s.dir, rec.file.c_str() + leaf, len);
+  ptr->byPath.value(ptr->byPath.addSlot(tag)) = id;
+  ptr->byHash.value(ptr->byHash.addSlot(ptr->hashTag(s.hash))) = id;
+
+  if(rec.state.isSet())
+    {
+      _Internal::App &app = ptr->apps[id];
+      app.state = rec.state;
+      app.check = rec.check;
+    }
+
+  ptr->num++;
+  return id;
+}
+
+void EntryArena::remove(uint32_t id)
+{
+  Slot &s = ptr->slot(id);
+  assert(s.flags & F_USED);
+
+  SameId eq = { id };
+  long i = ptr->byPath.findSlot(ptr->pathTag(s.dir, ptr->name(s), s.nameLen), eq);
+  assert(i >= 0);
+  ptr->byPath.eraseSlot(i);
+  i = ptr->byHash.findSlot(ptr->hashTag(s.hash), eq);
+  assert(i >= 0);
+  ptr->byHash.eraseSlot(i);
+
+  ptr->apps.erase(id);
+  s.flags = 0;
+  ptr->freeIds.push_back(id);
+  ptr->num--;
+
+  // Names of removed entries are left in the pool until it's half empty
+  ptr->wasted += s.nameLen;
+  if(ptr->wasted > CHUNK && ptr->wasted*2 > ptr->poolUsed)
+    ptr->repack();
+}
+
+void EntryArena::get(uint32_t id, JournalRecord &out) const
+{
+  const Slot &s = ptr->slot(id);
+  assert(s.flags & F_USED);
+
+  out.file = ptr->path(s);
+  out.hash = s.hash;
+  out.writeTime = s.writeTime;
+  out.st = FileStat();
+  if(s.mtime)
+    {
+      out.st.size = s.size;
+      out.st.mtime = s.mtime;
+      out.st.ctime = s.ctime;
+      out.st.inode = s.inode;
+      out.st.device = s.device;
+    }
+  out.racy = (s.flags & F_RACY) != 0;
+
+  std::map<uint32_t, _Internal::App>::const_iterator it = ptr->apps.find(id);
+  if(it != ptr->apps.end())
+    {
+      out.state = it->second.state;
+      out.check = it->second.check;
+    }
+  else
+    {
+      out.state = HashState();
+      out.check = Hash();
+    }
+}
+
+std::string EntryArena::getPath(uint32_t id) const
+{ return ptr->path(ptr->slot(id)); }
+
+void EntryArena::getAll(JRVector &out) const
+{
+  std::vector<std::pair<std::string, uint32_t> > list;
+  list.reserve(ptr->num);
+  for(uint32_t id=1; id<=ptr->top; id++)
+    if(ptr->slot(id).flags & F_USED)
+      list.push_back(std::make_pair(getPath(id), id));
+  std::sort(list.begin(), list.end());
+
+  out.resize(list.size());
+  for(size_t i=0; i<list.size(); i++)
+    get(list[i].second, out[i]);
+}
+
+void EntryArena::getAfter(const std::string &after, uint32_t max,
+                          JRVector &out) const
+{
+  std::vector<std::pair<std::string, uint32_t> > list;
+  for(uint32_t id=1; id<=ptr->top; id++)
+    if(ptr->slot(id).flags & F_USED)
+      {
+        std::string path = getPath(id);
+        if(path > after)
+          list.push_back(std::make_pair(path, id));
+      }
+
+  size_t num = list.size() < max ? list.size() : max;
+  std::partial_sort(list.begin(), list.begin()+num, list.end());
+
+  out.resize(num);
+  for(size_t i=0; i<num; i++)
+    get(list[i].second, out[i]);
+}
+
+uint64_t EntryArena::memUsage() const
+{
+  uint64_t res = ptr->blocks.size() * (uint64_t)BLOCK * sizeof(Slot) +
+    ptr->chunks.size() * (uint64_t)CHUNK +
+    ptr->byPath.bytes() + ptr->byHash.bytes() +
+    ptr->freeIds.capacity() * 4 +
+    ptr->apps.size() * (sizeof(_Internal::App) + 48);
+
+  for(int i=0; i<ptr->dirs.size(); i++)
+    res += 2*ptr->dirs[i].size() + 100;
+  return res;
+}
@@ -0,0 +1,60 @@
+#ifndef __SPREAD_CACHE_ENTRY_ARENA_HPP_
+#define __SPREAD_CACHE_ENTRY_ARENA_HPP_
+
+#include "journal.hpp"
+
+/* Compact in-memory storage for CacheIndex entries.
+
+   Entries are fixed size records stored in large blocks, and are
+   referred to by 32-bit ids. Removed ids are reused. Paths are split
+   into a directory and a leaf name. Each directory is stored once,
+   and entries only hold its id and the leaf name, which lives in a
+   shared character pool.
+
+   Lookups by path and by hash go through open addressing tables that
+   hold nothing but entry ids and a 32-bit tag. Keys are compared
+   against the entries themselves.
+
+   Ids start at 1, so 0 can be used for "not found". Ids of removed
+   entries are invalid until handed out again by add().
+
+   Not thread safe.
+ */
+
+namespace Cache
+{
+  class EntryArena
+  {
+    struct _Internal;
+    boost::shared_ptr<_Internal> ptr;
+
+  public:
+    EntryArena();
+
+    // Number of entries
+    uint32_t size() const;
+
+    // Find the entry for a path. Returns 0 if there is none.
+    uint32_t find(const std::string &file) const;
+
+    // Find all entries with the given hash, oldest first
+    void find(const Spread::Hash &hash, std::vector<uint32_t> &out) const;
+
+    // Add an entry. The path must not be listed already.
+    uint32_t add(const JournalRecord &rec);
+    void remove(uint32_t id);
+
+    void get(uint32_t id, JournalRecord &out) const;
+    std::string getPath(uint32_t id) const;
+
+    // Get all entries, sorted by path
+    void getAll(JRVector &out) const;
+
+    // Get up to 'max' entries with paths that sort after 'after'
+    void getAfter(const std::string &after, uint32_t max, JRVector &out) const;
+
+    // Approximate number of bytes allocated
+    uint64_t memUsage() const;
+  };
+}
+#endif
@@ -0,0 +1,177 @@
+#include "evict.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <sys/time.h>
+
+//#define PRINT_DEBUG
+
+#ifdef PRINT_DEBUG
+#include <iostream>
+#define PRINT(a) std::cout << a << "\n";
+#else
+#define PRINT(a)
+#endif
+
+using namespace Cache;
+using namespace Spread;
+
+namespace bfs = boost::filesystem;
+
+static const int64_t NS = 1000000000;
+
+struct Candidate
+{
+  std::string file;
+  uint64_t size;
+  CIAccess access;
+};
+
+struct ByLRU
+{
+  bool operator()(const Candidate &a, const Candidate &b) const
+  {
+    if(a.access.last != b.access.last) return a.access.last < b.access.last;
+    return a.file < b.file;
+  }
+};
+
+struct ByLFU
+{
+  bool operator()(const Candidate &a, const Candidate &b) const
+  {
+    if(a.access.count != b.access.count) return a.access.count < b.access.count;
+    return ByLRU()(a, b);
+  }
+};
+
+static double now()
+{
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+// How much to remove to get from 'cur' down to the low water mark
+static uint64_t excess(uint64_t cur, uint64_t limit, double lowWater)
+{
+  if(!limit || cur <= limit) return 0;
+  return cur - (uint64_t)(limit * lowWater);
+}
+
+void EvictJob::doJob()
+{
+  setBusy("Checking cache size");
+
+  std::string base = bfs::absolute(files.basedir).string();
+  if(base.size() && base[base.size()-1] != '/')
+    base += "/";
+
+  // Find everything in the store
+  CIVector all;
+  index.getEntries(all);
+
+  uint64_t bytes = 0, num = 0;
+  std::vector<Candidate> cands;
+  for(int i=0; i<all.size(); i++)
+    {
+      const CIEntry &e = all[i];
+      if(e.file.compare(0, base.size(), base) != 0)
+        continue;
+
+      /* Count what the file takes on disk, which is less than the
+         data for packed objects. Entries without a stat only know
+         the data size.
+       */
+      uint64_t size = e.st.mtime ? e.st.size : e.hash.size();
+      bytes += size;
+      num++;
+
+      if(pinned.count(e.hash))
+        continue;
+
+      Candidate c;
+      c.file = e.file;
+      c.size = size;
+      if(!index.getAccess(e.hash, c.access))
+        c.access.last = e.writeTime * NS;
+      cands.push_back(c);
+    }
+
+  uint64_t needBytes = excess(bytes, quota.maxBytes, quota.lowWater);
+  uint64_t needFiles = excess(num, quota.maxFiles, quota.lowWater);
+
+  PRINT("Store has " << num << " files, " << bytes << " bytes. Removing "
+        << needFiles << " files, " << needBytes << " bytes");
+
+  if(needBytes || needFiles)
+    {
+      setBusy("Removing old files from the cache");
+
+      if(quota.policy == Quota::LFU)
+        std::sort(cands.begin(), cands.end(), ByLFU());
+      else
+        std::sort(cands.begin(), cands.end(), ByLRU());
+
+      StrSet rem;
+      double start = now();
+      for(int i=0; i<cands.size(); i++)
+        {
+          if(bytesRemoved >= needBytes && filesRemoved >= needFiles)
+            break;
+          if(checkStatus())
+            break;
+
+          const Candidate &c = cands[i];
+          PRINT("Removing " << c.file);
+
+          /* Keep the index entry of a file we failed to remove, and
+             try another one instead. A file that was already gone
+             leaves the index, but frees nothing.
+           */
+          boost::system::error_code ec;
+          bool removed = bfs::remove(c.file, ec);
+          if(ec)
+            {
+              PRINT("  failed: " << ec.message());
+              continue;
+            }
+          rem.insert(c.file);
+          if(!removed) continue;
+          filesRemoved++;
+          bytesRemoved += c.size;
+
+          if(needBytes) setProgress(bytesRemoved, needBytes);
+          else setProgress(filesRemoved, needFiles);
+
+          // Save the changes now and then
+          if(rem.size() >= 1000)
+            {
+              index.addMany(Hash::DirMap(), rem);
+              rem.clear();
+            }
+
+          // Sleep if we're ahead of the allowed rate
+          double wait = 0;
+          if(quota.filesPerSec)
+            wait = filesRemoved / (double)quota.filesPerSec;
+          if(quota.bytesPerSec)
+            wait = std::max(wait, bytesRemoved / (double)quota.bytesPerSec);
+          wait -= now() - start;
+          if(wait > 0)
+            boost::this_thread::sleep(boost::posix_time::microseconds((int64_t)(wait*1000000)));
+        }
+
+      if(rem.size())
+        index.addMany(Hash::DirMap(), rem);
+
+      // Drop the statistics of removed objects. They are only hints,
+      // so failing to save them is not an error.
+      try { index.saveAccess(); }
+      catch(...) {}
+    }
+
+  if(!info->isNonSuccess())
+    setDone();
+}
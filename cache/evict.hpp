@@ -0,0 +1,72 @@
+#ifndef __SPREAD_CACHE_EVICT_HPP_
+#define __SPREAD_CACHE_EVICT_HPP_
+
+#include "index.hpp"
+#include "files.hpp"
+#include <job/job.hpp>
+#include <set>
+
+namespace Cache
+{
+  typedef std::set<Spread::Hash> HashSet;
+
+  /* Size limits for the cache store. Zero means no limit. Sizes are
+     the space files take in the store, so compressed objects (see
+     Packed) count with their packed size.
+   */
+  struct Quota
+  {
+    uint64_t maxBytes, maxFiles;
+
+    // Least recently used, or least frequently used, goes first
+    enum Policy { LRU, LFU };
+    Policy policy;
+
+    /* When over a limit, evict down to this fraction of it, so we
+       don't have to run again right away.
+     */
+    double lowWater;
+
+    /* Throttling. At most this many files, and this many bytes, are
+       deleted per second. Zero means no limit.
+     */
+    uint32_t filesPerSec;
+    uint64_t bytesPerSec;
+
+    Quota() : maxBytes(0), maxFiles(0), policy(LRU), lowWater(0.9),
+              filesPerSec(0), bytesPerSec(0) {}
+  };
+
+  /* Delete files from the cache store (Files::basedir) until it fits
+     within a Quota.
+
+     Files are picked in order of the access statistics kept by the
+     CacheIndex (see CacheIndex::getAccess()). Files that were never
+     looked up count as accessed when they were last written. Objects
+     with a hash in 'pinned' are never removed.
+
+     Only files listed in the index are considered, so the store
+     should have been indexed first (see Files::cacheAll()). Removed
+     files are taken out of the index.
+   */
+  struct EvictJob : Spread::Job
+  {
+    EvictJob(const Files &_files, CacheIndex &_index, const Quota &_quota,
+             const HashSet &_pinned = HashSet())
+      : filesRemoved(0), bytesRemoved(0), files(_files), index(_index),
+        quota(_quota), pinned(_pinned) {}
+
+    // Results
+    uint64_t filesRemoved, bytesRemoved;
+
+  private:
+    void doJob();
+
+    const Files &files;
+    CacheIndex &index;
+    Quota quota;
+    HashSet pinned;
+  };
+}
+
+#endif
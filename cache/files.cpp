@@ -1,13 +1,35 @@
 #include "files.hpp"
+#include "packed.hpp"
 
 #include <boost/filesystem.hpp>
 #include <dir/from_fs.hpp>
 #include <assert.h>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+#include <stdlib.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+
+#ifdef __linux__
+#include <linux/fs.h>
+#endif
 
 using namespace Cache;
 using namespace Spread;
 namespace bf = boost::filesystem;
 
+void Files::setBaseDir(const std::string &dir)
+{
+  basedir = dir;
+  if(basedir != "")
+    Packed::addStore(basedir);
+}
+
 std::string Files::makePath(const Hash &hash) const
 {
   assert(hash.isSet());
@@ -31,20 +53,266 @@ void Files::cacheAll() const
   Dir::fromFS(list, basedir, index);
 }
 
+static const int64_t NS = 1000000000;
+static const char SCAN_MAGIC[] = "SPSCAN1";
+
+typedef std::map<std::string, uint64_t> CountMap;
+
+struct ScanInfo
+{
+  int64_t mtime;
+  uint64_t count;
+};
+typedef std::map<std::string, ScanInfo> ScanMap;
+
+// Directory modification time in nanoseconds, or 0 on failure
+static int64_t dirTime(const std::string &dir)
+{
+  struct stat st;
+  if(::stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) return 0;
+  return st.st_mtim.tv_sec * NS + st.st_mtim.tv_nsec;
+}
+
+static std::string absBase(const std::string &basedir)
+{
+  std::string base = bf::absolute(basedir).string();
+  if(base.size() && base[base.size()-1] != '/')
+    base += "/";
+  return base;
+}
+
+/* Name of the subdirectory of 'base' that 'file' is in, or "" for
+   files directly in 'base'. Returns false if 'file' is not below
+   'base' at all.
+ */
+static bool getGroup(const std::string &file, const std::string &base,
+                     std::string &group)
+{
+  if(file.compare(0, base.size(), base) != 0) return false;
+  size_t slash = file.find('/', base.size());
+  if(slash == std::string::npos) group = "";
+  else group = file.substr(base.size(), slash-base.size());
+  return true;
+}
+
+// Count the indexed files in each subdirectory of 'base'
+static void countFiles(const CIVector &all, const std::string &base, CountMap &out)
+{
+  std::string group;
+  for(int i=0; i<all.size(); i++)
+    if(getGroup(all[i].file, base, group))
+      out[group]++;
+}
+
+/* The state file has the magic string and the base directory on the
+   first two lines, then one line per subdirectory: the name, the
+   modification time and the number of indexed files, separated by
+   spaces.
+ */
+static bool loadState(const std::string &file, const std::string &base, ScanMap &out)
+{
+  std::ifstream inf(file.c_str());
+  std::string line;
+  if(!std::getline(inf, line) || line != SCAN_MAGIC) return false;
+  if(!std::getline(inf, line) || line != base) return false;
+
+  while(std::getline(inf, line))
+    {
+      size_t s2 = line.rfind(' ');
+      if(s2 == std::string::npos || s2 == 0) return false;
+      size_t s1 = line.rfind(' ', s2-1);
+      if(s1 == std::string::npos) return false;
+
+      ScanInfo &si = out[line.substr(0, s1)];
+      si.mtime = atoll(line.c_str() + s1+1);
+      si.count = strtoull(line.c_str() + s2+1, NULL, 10);
+    }
+  return true;
+}
+
+void Files::cacheChanged(const std::string &stateFile) const
+{
+  assert(basedir != "");
+  std::string base = absBase(basedir);
+
+  ScanMap old;
+  bool haveState = loadState(stateFile, base, old);
+
+  // Anything that happens from now on is not covered by the state
+  boost::system::error_code ec;
+  bf::remove(stateFile, ec);
+
+  if(!haveState)
+    {
+      cacheAll();
+      return;
+    }
+
+  CIVector all;
+  index.getEntries(all);
+  CountMap counts;
+  countFiles(all, base, counts);
+
+  /* Find the subdirectories to scan. Files directly in basedir are
+     always checked.
+   */
+  Hash::DirMap files;
+  std::set<std::string> scan, present;
+  scan.insert("");
+
+  bf::directory_iterator it(base), end;
+  for(; it != end; ++it)
+    {
+      std::string path = it->path().string();
+      if(bf::is_directory(it->status()))
+        {
+          std::string name = it->path().filename().string();
+          present.insert(name);
+
+          ScanMap::const_iterator o = old.find(name);
+          CountMap::const_iterator c = counts.find(name);
+          uint64_t count = (c == counts.end()) ? 0 : c->second;
+          if(o == old.end() || o->second.count != count ||
+             o->second.mtime != dirTime(path))
+            {
+              scan.insert(name);
+              bf::recursive_directory_iterator sub(path), send;
+              for(; sub != send; ++sub)
+                if(bf::is_regular_file(sub->status()))
+                  files[sub->path().string()];
+            }
+        }
+      else if(bf::is_regular_file(it->status()))
+        files[path];
+    }
+
+  // Entries in scanned or deleted directories are checked too, so
+  // the ones that are gone get removed.
+  std::string group;
+  for(int i=0; i<all.size(); i++)
+    if(getGroup(all[i].file, base, group) &&
+       (scan.count(group) || !present.count(group)))
+      files[all[i].file];
+
+  index.checkMany(files);
+}
+
+void Files::saveScan(const std::string &stateFile) const
+{
+  assert(basedir != "");
+  std::string base = absBase(basedir);
+
+  CIVector all;
+  index.getEntries(all);
+  CountMap counts;
+  countFiles(all, base, counts);
+
+  std::string newFile = stateFile + ".new";
+  {
+    std::ofstream of(newFile.c_str());
+    of << SCAN_MAGIC << "\n" << base << "\n";
+
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    int64_t now = ts.tv_sec * NS + ts.tv_nsec;
+    bf::directory_iterator it(base), end;
+    for(; it != end; ++it)
+      {
+        if(!bf::is_directory(it->status())) continue;
+
+        /* A change made in the same clock tick as the one we see here
+           would not update the time stamp, so leave out directories
+           that changed just now. They are scanned the next time.
+         */
+        int64_t mtime = dirTime(it->path().string());
+        if(!mtime || now - mtime < 2*NS) continue;
+
+        std::string name = it->path().filename().string();
+        of << name << " " << mtime << " " << counts[name] << "\n";
+      }
+
+    if(!of)
+      throw std::runtime_error("Cannot write " + newFile);
+  }
+  bf::rename(newFile, stateFile);
+}
+
 std::string Files::storePath(const Hash &hash) const
 {
   std::string path = makePath(hash);
   bf::create_directories(bf::path(path).parent_path());
 
-  Hash fhash = index.checkFile(path);
+  std::string packed = Packed::packedName(path);
 
-  if(fhash != hash)
-    // Remove existing file if there is a mismatch
-    bf::remove(path);
-  else
-    // Otherwise, return an empty string, signalling that this file is
-    // already OK.
-    path = "";
+  // Return an empty string if either version of the file is already
+  // OK.
+  if(index.checkFile(path) == hash || index.checkFile(packed) == hash)
+    return "";
 
+  // Otherwise remove whatever is there
+  bf::remove(path);
+  bf::remove(packed);
   return path;
 }
+
+void Files::addStored(const std::string &file, const Hash &hash) const
+{
+  if(compress && Packed::pack(file))
+    index.addFile(Packed::packedName(file), hash);
+  else
+    index.addFile(file, hash);
+}
+
+/* Make 'to' share the data of 'from', see LinkMode. Returns false if
+   the file system can't do it, in which case 'to' is not created.
+ */
+static bool shareData(const std::string &from, const std::string &to, int mode)
+{
+#ifdef FICLONE
+  if(mode == LM_Reflink)
+    {
+      int in = ::open(from.c_str(), O_RDONLY);
+      if(in < 0) return false;
+      int out = ::open(to.c_str(), O_WRONLY | O_CREAT | O_EXCL, 0644);
+      bool ok = out >= 0 && ioctl(out, FICLONE, in) == 0;
+      if(out >= 0)
+        {
+          if(::close(out) != 0) ok = false;
+          if(!ok) ::unlink(to.c_str());
+        }
+      ::close(in);
+      return ok;
+    }
+#endif
+
+  return false;
+}
+
+std::string Files::linkStored(const Hash &hash, const std::string &dest, int mode) const
+{
+  if(mode == LM_Copy) return "";
+
+  // Only use objects the index agrees with. Packed objects have
+  // another name, so they are never used here.
+  std::string src = makePath(hash);
+  if(index.checkFile(src) != hash)
+    return "";
+
+  bf::create_directories(bf::path(dest).parent_path());
+  boost::system::error_code ec;
+  bf::remove(dest, ec);
+  if(!shareData(src, dest, mode))
+    return "";
+  return src;
+}
+
+std::string Files::adoptFile(const std::string &file, const Hash &hash, int mode) const
+{
+  if(mode == LM_Copy) return "";
+
+  std::string dest = storePath(hash);
+  if(dest == "" || !shareData(file, dest, mode))
+    return "";
+  index.addFile(dest, hash);
+  return dest;
+}
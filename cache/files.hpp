@@ -5,15 +5,45 @@
 
 namespace Cache
 {
+  /* How stored objects are placed elsewhere by linkStored() and
+     adoptFile().
+
+     LM_Reflink makes copy-on-write clones (FICLONE), on file systems
+     that support it (Btrfs, XFS and others.) Clones are separate
+     files that share their data on disk, so writing to one never
+     affects the other, and every install gets its own file.
+
+     LM_Copy (the default) makes plain copies.
+
+     There is deliberately no hard link mode. A hard link shares the
+     file itself, so any write in place to an installed file would
+     damage the store, and every install of an object would be the
+     same file.
+   */
+  enum LinkMode
+    {
+      LM_Copy,
+      LM_Reflink
+    };
+
   struct Files
   {
     Files(ICacheIndex &_index, const std::string &_dir = "")
-      : basedir(_dir), index(_index) {}
+      : compress(false), index(_index) { setBaseDir(_dir); }
 
-    /* Set this (directly or through the constructor) before using the
-       object.
+    /* Set this (through setBaseDir() or the constructor) before using
+       the object. Also registers the directory as a store for packed
+       objects, see Packed.
      */
     std::string basedir;
+    void setBaseDir(const std::string &dir);
+
+    /* Store objects compressed, where it pays off (see Packed.) This
+       only affects objects stored through addStored() from now on.
+       Existing objects are read the same way whether they are packed
+       or not, so it can be changed at any time.
+     */
+    bool compress;
 
     /* Browse through basedir and make sure all files there are added
        to the cache index. Typically you would call this immediately
@@ -21,20 +51,69 @@ namespace Cache
      */
     void cacheAll() const;
 
+    /* Faster version of cacheAll() for startup, which trusts the
+       index for subdirectories that haven't changed.
+
+       saveScan() records the modification time of each subdirectory
+       of basedir in 'stateFile', along with how many files the index
+       lists in it. cacheChanged() then only scans the subdirectories
+       where either of these changed, plus the files directly in
+       basedir. Index entries for files that are gone from a scanned
+       directory are removed.
+
+       The state file is deleted when read, so it only covers the time
+       between saveScan() and the next cacheChanged(). Save it on a
+       clean shutdown, and nowhere else. Without a state file,
+       cacheChanged() does a full cacheAll().
+
+       Only the first level of subdirectories is checked, which is all
+       makePath() uses. Changes to existing files, as opposed to added
+       or removed ones, don't touch the directory, but are caught by
+       the index when the files are looked up.
+     */
+    void cacheChanged(const std::string &stateFile) const;
+    void saveScan(const std::string &stateFile) const;
+
     /* Produce cache path for a given hash. This does not read or
-       write the filesystem, it just creates the path string.
+       write the filesystem, it just creates the path string. A packed
+       object is stored at Packed::packedName() of this path instead.
      */
     std::string makePath(const Spread::Hash &hash) const;
 
     /* Get a path ready for storing files. This will check if the file
-       already exists, with the right hash. If it does, the function
-       returns "". If a string is returned, the file is guaranteed not
-       to exist.
+       already exists, plain or packed, with the right hash. If it
+       does, the function returns "". If a string is returned, neither
+       the file nor its packed version exist.
 
        All necessary parent directories will be created.
      */
     std::string storePath(const Spread::Hash &hash) const;
 
+    /* Call this after writing an object to a path obtained from
+       storePath(). Compresses the file if 'compress' is set, which
+       moves it to its packed name, and adds the result to the index.
+     */
+    void addStored(const std::string &file, const Spread::Hash &hash) const;
+
+    /* Create 'dest' from the stored object for 'hash', sharing its
+       data instead of copying it (see LinkMode.) Any existing 'dest'
+       is replaced. Returns the path of the stored object, or "" if
+       nothing was done: when the mode is LM_Copy, there is no intact
+       plain stored object, or the file system can't do it. The caller then has to copy the file the usual way.
+
+       'dest' is not added to the index.
+     */
+    std::string linkStored(const Spread::Hash &hash, const std::string &dest,
+                           int mode) const;
+
+    /* Put 'file', which must contain 'hash', into the store by
+       sharing its data, so that linkStored() can use it later.
+       Returns the path of the new object, or "" if the object is
+       already stored or it can't be done without copying.
+     */
+    std::string adoptFile(const std::string &file, const Spread::Hash &hash,
+                          int mode) const;
+
   private:
     ICacheIndex &index;
   };
@@ -2,6 +2,7 @@
 #define __SPREAD_ICACHEINDEX_HPP_
 
 #include <hash/hash.hpp>
+#include <job/jobinfo.hpp>
 #include <stdint.h>
 #include <vector>
 #include <set>
@@ -30,28 +31,112 @@ namespace Cache
                         */
     };
 
+  /* File information from a single stat call, see
+     FSystem::getStat(). Times are in nanoseconds since the epoch.
+     Fields the file system can't provide are zero.
+   */
+  struct FileStat
+  {
+    uint64_t size;
+    int64_t mtime, ctime;
+    uint64_t inode, device;
+
+    FileStat() : size(0), mtime(0), ctime(0), inode(0), device(0) {}
+
+    // Same file, unchanged since the other stat was taken
+    bool same(const FileStat &o) const
+    {
+      return size == o.size && mtime == o.mtime && ctime == o.ctime &&
+        inode == o.inode && device == o.device;
+    }
+  };
+
+  /* 'st' is the file as it was when hashed, and 'racy' is set if that
+     stat can't be trusted (see CacheIndex::addFile().) Entries from
+     older versions only have writeTime, and st.mtime is zero.
+   */
   struct CIEntry
   {
     Spread::Hash hash;
     std::string file;
     int64_t writeTime;
+    FileStat st;
+    bool racy;
+  };
+
+  // Per file results from FSystem::statMany()
+  enum StatResult
+    {
+      FS_UNKNOWN,       // Not checked, or not a regular file
+      FS_FOUND,         // File exists, FileStat is filled in
+      FS_MISSING        // File does not exist
+    };
+
+  /* Lookup statistics for a hash, see CacheIndex::getAccess(). 'last'
+     is in nanoseconds since the epoch.
+   */
+  struct CIAccess
+  {
+    int64_t last;
+    uint32_t count;
+
+    CIAccess() : last(0), count(0) {}
+  };
+
+  /* One lookup for ICacheIndex::resolveMany(). 'hash' and the
+     optional 'target' are the input. 'source' is set to a file with
+     the given hash, or to "" if there is none. If the target already
+     matches, 'source' is set to 'target'.
+   */
+  struct CIResolve
+  {
+    Spread::Hash hash;
+    std::string target;
+    std::string source;
   };
 
   typedef std::vector<CIEntry> CIVector;
+  typedef std::vector<CIResolve> CIResolveList;
   typedef std::set<std::string> StrSet;
 
   struct ICacheIndex
   {
+    virtual ~ICacheIndex() {}
+
     virtual int getStatus(const std::string &where, const Spread::Hash &hash) = 0;
     virtual std::string findHash(const Spread::Hash &hash) = 0;
     virtual Spread::Hash addFile(std::string where, const Spread::Hash &h = Spread::Hash(),
                                  bool allowMissing=false) = 0;
     virtual void addMany(const Spread::Hash::DirMap &files,
-                         const StrSet &remove = StrSet()) = 0;
-    virtual void checkMany(Spread::Hash::DirMap &files) = 0;
+                         const StrSet &remove = StrSet(),
+                         Spread::JobInfoPtr info = Spread::JobInfoPtr()) = 0;
+    virtual void checkMany(Spread::Hash::DirMap &files,
+                           Spread::JobInfoPtr info = Spread::JobInfoPtr()) = 0;
     virtual void removeFile(const std::string &where) = 0;
     virtual void getEntries(CIVector &result) const = 0;
 
+    /* Resolve a list of hashes in one go. The result is the same as
+       calling getStatus() on every element with a target, and
+       findHash() on those that didn't match. The default does
+       exactly that.
+     */
+    virtual void resolveMany(CIResolveList &list,
+                             Spread::JobInfoPtr info = Spread::JobInfoPtr())
+    {
+      for(int i=0; i<list.size(); i++)
+        {
+          CIResolve &r = list[i];
+          r.source = "";
+          int stat = CI_ElseWhere;
+          if(r.target != "")
+            stat = getStatus(r.target, r.hash);
+          if(stat == CI_Match)
+            r.source = r.target;
+          else if(stat == CI_ElseWhere)
+            r.source = findHash(r.hash);
+        }
+    }
+
     // Convenience version of addFile() for when you expect the file to be missing
     Spread::Hash checkFile(const std::string &where, const Spread::Hash &h = Spread::Hash())
     { return addFile(where, h, true); }
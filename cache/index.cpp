@@ -3,11 +3,30 @@
 #include <ctime>
 #include <boost/filesystem.hpp>
 #include "hash/hash_stream.hpp"
-#include <boost/thread/recursive_mutex.hpp>
+#include "hash/hash_batch.hpp"
+#include "hash/hash_map.hpp"
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/thread/shared_mutex.hpp>
 #ifdef NEED_LOCKGUARD
 #include <boost/thread/lock_guard.hpp>
 #endif
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
 #include "misc/jconfig.hpp"
+#include "misc/mapped_stream.hpp"
+#include "journal.hpp"
+#include "snapshot.hpp"
+#include "entry_arena.hpp"
+#include "stat_batch.hpp"
+#include "watcher.hpp"
+#include "packed.hpp"
 
 //#define PRINT_DEBUG
 #ifdef PRINT_DEBUG
@@ -22,78 +41,717 @@ using namespace Spread;
 
 namespace bfs = boost::filesystem;
 
+static const int64_t NS = 1000000000;
+
+// Current time in nanoseconds
+static int64_t nowNS()
+{
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * NS + ts.tv_nsec;
+}
+
+// Header of the access statistics file, see loadAccess()
+static const char ACCESS_MAGIC[] = "SPACC001";
+
+/* Check if a file was hashed too soon after it was written. Time
+   stamps are only updated once per clock tick (a few ms on Linux),
+   so a write right after we looked at the file might not change
+   them. Whole second time stamps most likely come from a file system
+   that can't do better, and get a larger window.
+ */
+static bool isRacy(const FileStat &st, int64_t checked)
+{
+  static const int64_t RACY_NS = 20000000;
+  int64_t window = (st.mtime % NS) ? RACY_NS : 2*NS;
+  return checked - st.mtime < window;
+}
+
+// True if an entry was not changed between two reads, see addEntry()
+static bool sameRecord(const JournalRecord &a, const JournalRecord &b)
+{
+  return a.hash == b.hash && a.writeTime == b.writeTime &&
+    a.st.same(b.st) && a.racy == b.racy;
+}
+
 struct BoostFSystem : FSystem
 {
-  std::string abs(const std::string &file) { return bfs::absolute(file).string(); }
+  std::string abs(const std::string &file)
+  {
+    // Skip the getcwd() call when there's nothing to do
+    if(bfs::path(file).is_absolute()) return file;
+    return bfs::absolute(file).string();
+  }
   bool exists(const std::string &file) { return bfs::exists(file); }
   uint64_t file_size(const std::string &file) { return bfs::file_size(file); }
-  Hash hashSum(const std::string &file) { return HashStream::sum(file); }
+  Hash hashSum(const std::string &file) { return Packed::hashSum(file); }
+  uint64_t dataSize(const std::string &file) { return Packed::dataSize(file); }
   bool equivalent(const std::string &file1, const std::string &file2)
   { return bfs::equivalent(file1, file2); }
   uint64_t last_write_time(const std::string &file)
   { return bfs::last_write_time(file); }
-};
 
-struct Entry
-{
-  Hash hash;
-  std::string file;
-  std::time_t writeTime;
-};
+  void statMany(const std::vector<std::string> &files,
+                std::vector<FileStat> &out, std::vector<int> &res)
+  { StatBatch::run(files, out, res); }
+
+  bool getStat(const std::string &file, FileStat &out)
+  {
+    struct stat st;
+    if(::stat(file.c_str(), &st) != 0)
+      {
+        if(errno == ENOENT || errno == ENOTDIR) return false;
+        throw std::runtime_error("Cannot stat " + file + ": " + strerror(errno));
+      }
+    if(!S_ISREG(st.st_mode))
+      throw std::runtime_error("Not a regular file: " + file);
+
+    out.size = st.st_size;
+    out.mtime = st.st_mtim.tv_sec * NS + st.st_mtim.tv_nsec;
+    out.ctime = st.st_ctim.tv_sec * NS + st.st_ctim.tv_nsec;
+    out.inode = st.st_ino;
+    out.device = st.st_dev;
+    return true;
+  }
+
+  /* Reads small files whole and hashes them through a HashBatch.
+     Larger files are left alone, so that addEntry() can hash them on
+     several threads.
+   */
+  void hashMany(const std::vector<std::string> &files, std::vector<Hash> &out)
+  {
+    out.clear();
+    out.resize(files.size());
+
+    std::vector<char> buf(HashBatch::SMALL_LIMIT+1);
+    HashBatch batch;
+
+    for(int i=0; i<files.size(); i++)
+      {
+        if(Packed::isPacked(files[i])) continue;
+        FILE *f = fopen(files[i].c_str(), "rb");
+        if(!f) continue;
+        size_t num = fread(&buf[0], 1, buf.size(), f);
+        bool small = num <= HashBatch::SMALL_LIMIT && feof(f);
+        fclose(f);
+
+        if(small) batch.add(&buf[0], num, &out[i]);
+      }
+  }
+
+  Hash hashAppend(const std::string &file, AppendState &app)
+  {
+    if(Packed::isPacked(file))
+      {
+        app = AppendState();
+        return Packed::hashSum(file);
+      }
+
+    Misc::MappedFileStream inf(file);
+    uint64_t size = inf.size();
+    HashBuilder hash;
 
-typedef std::multimap<Hash, Entry*> HashToEntry;
-typedef std::map<std::string, Entry*> PathToEntry;
+    // Skip the old data if the bytes right before its end still match
+    uint64_t pos = 0;
+    if(app.state.isSet() && app.state.size <= size &&
+       checkRegion(inf, app.state.size) == app.check)
+      {
+        hash.setState(app.state);
+        pos = app.state.size;
+      }
 
-typedef HashToEntry::iterator HTE_it;
-typedef PathToEntry::iterator PTE_it;
+    // Save the state at the last block boundary on the way
+    uint64_t end = size & ~(uint64_t)63;
+    feed(inf, hash, pos, end);
+    app.state = hash.getState();
+    feed(inf, hash, end, size);
+
+    if(app.state.isSet()) app.check = checkRegion(inf, end);
+    else app = AppendState();
+
+    return hash.finish();
+  }
+
+  // Hash the given range of a file
+  static void feed(Misc::MappedFileStream &inf, HashBuilder &hash,
+                   uint64_t from, uint64_t to)
+  {
+    if(from >= to) return;
+
+    std::vector<char> buf(to-from < 1024*1024 ? to-from : 1024*1024);
+    inf.seek(from);
+    while(from < to)
+      {
+        size_t num = to-from < buf.size() ? to-from : buf.size();
+        num = inf.read(&buf[0], num);
+        if(num == 0)
+          throw std::runtime_error("Unexpected end of file");
+        hash.update(&buf[0], num);
+        from += num;
+      }
+  }
 
-typedef std::pair<Hash, Entry*> HTE_val;
-typedef std::pair<HTE_it,HTE_it> HTE_pair;
+  static Hash checkRegion(Misc::MappedFileStream &inf, uint64_t end)
+  {
+    uint64_t start = end > AppendState::CHECK_SIZE ?
+      end - AppendState::CHECK_SIZE : 0;
+    HashBuilder hash;
+    feed(inf, hash, start, end);
+    return hash.finish();
+  }
+};
 
-typedef boost::lock_guard<boost::recursive_mutex> LOCK;
+/* Lookups share the index lock, changes take it exclusively. The
+   lock is never held while touching the file system (other than our
+   own config files), so a thread hashing a large file doesn't hold
+   up anyone else.
+ */
+typedef boost::shared_lock<boost::shared_mutex> RLOCK;
+typedef boost::unique_lock<boost::shared_mutex> WLOCK;
 
-typedef std::map<std::string,std::string> StrMap;
+/* Entries live in two layers. The bulk of them are usually in an
+   IndexSnapshot, which is mapped straight from disk and searched
+   in place. Entries added or changed since the snapshot was
+   written are kept in 'ents'.
 
+   Once a snapshot entry has been replaced or removed, it is marked
+   as 'shadowed' and ignored from then on.
+ */
 struct CacheIndex::_CacheIndex_Hidden
 {
-  PathToEntry paths;
-  HashToEntry hashes;
+  EntryArena ents;
+
+  IndexSnapshot snap;
+  std::vector<bool> shadowed;
+  uint32_t numShadowed;
+  std::string snapFile;
 
-  Misc::JConfig conf;
-  boost::recursive_mutex mutex;
+  boost::shared_mutex mutex;
 
-  std::string makeConf(const Hash &hash, time_t wtime)
+  // Minimum file size for append hashing, or 0 if disabled
+  uint64_t appendMin;
+
+  // See setThreads(). ownSys is set if we use BoostFSystem.
+  int threads;
+  bool ownSys;
+
+  // Where changes are saved, or NULL if we have no config file
+  boost::shared_ptr<IndexJournal> journal;
+
+  // Set if the journal is shared with other processes, see load()
+  bool shared;
+
+  // Set by watch(), and never reset after that
+  boost::shared_ptr<DirWatcher> watcher;
+
+  /* Lookup statistics, see getAccess(). These are only hints, so
+     they have their own lock and are saved in one go to 'accessFile'
+     instead of going through the journal. 'accessNew' holds the
+     lookups made since the last save, which saveAccess() adds to
+     whatever is in the file by then.
+   */
+  HashMap<CIAccess> access, accessNew;
+  mutable boost::mutex accessMutex;
+  std::string accessFile;
+  bool accessChanged;
+
+  // See getHashStats()
+  mutable boost::mutex statMutex;
+  uint64_t hashedFiles, hashedBytes;
+
+  /* Background compaction. The journal is compacted when it holds
+     more than twice as many records as the index has entries. If a
+     compaction fails, we wait until the journal has grown some more
+     before trying again.
+   */
+  static const uint64_t COMPACT_MIN = 1000;
+  boost::thread compactor;
+  boost::mutex compactMutex;
+  bool compactRunning, compactFailed;
+  uint64_t retryAt;
+
+  struct Compactor
+  {
+    _CacheIndex_Hidden *owner;
+    std::string snapFile;
+    boost::shared_ptr<JRVector> live;
+    uint64_t pos;
+
+    void operator()()
+    {
+      bool failed = false;
+      try { owner->compact(snapFile, *live, pos); }
+      catch(std::exception &e)
+        {
+          PRINT("Compaction failed: " << e.what());
+          failed = true;
+        }
+
+      boost::lock_guard<boost::mutex> lock(owner->compactMutex);
+      owner->compactRunning = false;
+      owner->compactFailed = failed;
+    }
+  };
+
+  _CacheIndex_Hidden()
+    : numShadowed(0), appendMin(0), threads(0), ownSys(false), shared(false), accessChanged(false),
+      hashedFiles(0), hashedBytes(0), compactRunning(false), compactFailed(false), retryAt(0) {}
+
+  ~_CacheIndex_Hidden() { waitCompact(); }
+
+  void waitCompact()
+  {
+    if(compactor.joinable()) compactor.join();
+  }
+
+  // Number of entries in both layers
+  uint64_t size() const
+  { return ents.size() + snap.size() - numShadowed; }
+
+  // All current entries, sorted by name
+  void snapshot(JRVector &out) const
   {
-    char buf[16];
-    snprintf(buf, 16, "%ld", wtime);
-    return hash.toString() + " " + std::string(buf);
+    out.reserve(size());
+
+    JRVector mem;
+    ents.getAll(mem);
+    merge(mem, 0, size(), out);
   }
 
-  void addConf(const std::string &file, const Hash &hash, time_t wtime)
+  // Up to 'max' entries with names after 'after', sorted by name
+  void range(const std::string &after, uint64_t max, JRVector &out) const
   {
-    PRINT("addConf: file=" << file << " str=" << makeConf(hash, wtime));
-    conf.set(file, makeConf(hash, wtime));
+    JRVector mem;
+    ents.getAfter(after, max, mem);
+    merge(mem, snap.upperBound(after), max, out);
   }
 
-  void addConf(const StrMap &entries,
+  /* Merge the sorted entries in 'mem' with the snapshot entries from
+     number 'i' on, until 'out' holds 'max' entries.
+   */
+  void merge(const JRVector &mem, uint32_t i, uint64_t max, JRVector &out) const
+  {
+    JRVector::const_iterator it = mem.begin();
+    while(out.size() < max)
+      {
+        while(i < snap.size() && shadowed[i]) i++;
+
+        if(i < snap.size())
+          {
+            JournalRecord rec;
+            snap.get(i, rec);
+            if(it == mem.end() || rec.file < it->file)
+              {
+                out.push_back(rec);
+                i++;
+                continue;
+              }
+          }
+
+        if(it == mem.end()) break;
+        out.push_back(*it);
+        it++;
+      }
+  }
+
+  // Switch to a new snapshot file. Called with the lock held.
+  void openSnap()
+  {
+    // Pull in anything we still need from the old one
+    for(uint32_t i=0; i<snap.size(); i++)
+      if(!shadowed[i]) fault(i);
+
+    // A broken snapshot only means files have to be hashed again
+    try { snap.open(snapFile); }
+    catch(std::exception &e)
+      {
+        PRINT("Ignoring snapshot: " << e.what());
+        snap.close();
+      }
+    shadowed.assign(snap.size(), false);
+    numShadowed = 0;
+  }
+
+  // Copy snapshot entry 'i' into 'ents'
+  void fault(uint32_t i)
+  {
+    assert(!shadowed[i]);
+    shadowed[i] = true;
+    numShadowed++;
+
+    JournalRecord rec;
+    snap.get(i, rec);
+    insert(rec);
+  }
+
+  // Start a background compaction if the journal needs it
+  void checkCompact()
+  {
+    uint64_t recs = journal->records();
+    uint64_t limit = 2*size();
+    if(limit < COMPACT_MIN) limit = COMPACT_MIN;
+    if(recs < limit) return;
+
+    {
+      boost::lock_guard<boost::mutex> lock(compactMutex);
+      if(compactRunning) return;
+      if(compactFailed)
+        {
+          retryAt = recs + limit;
+          compactFailed = false;
+        }
+    }
+    if(recs < retryAt) return;
+    waitCompact();
+
+    PRINT("Compacting journal, " << recs << " records for " << size() << " entries");
+    Compactor c;
+    c.owner = this;
+    c.snapFile = snapFile;
+    c.live.reset(new JRVector);
+    snapshot(*c.live);
+    c.pos = journal->mark();
+    retryAt = 0;
+    compactRunning = true;
+    compactor = boost::thread(c);
+  }
+
+  /* Write all entries to a new snapshot, then drop the journal
+     records up to 'pos'. If we crash in between, the journal is
+     replayed on top of the new snapshot. That gives the same result,
+     since each record holds the complete entry.
+
+     Several processes sharing the journal may compact at the same
+     time. Each one then writes its own snapshot, and only the first
+     to swap in its journal gets to keep it.
+   */
+  void compact(const std::string &snapFile, const JRVector &live, uint64_t pos)
+  {
+    if(!shared)
+      {
+        IndexSnapshot::write(snapFile, live);
+        journal->compact(JRVector(), pos);
+        return;
+      }
+
+    char pid[32];
+    snprintf(pid, sizeof(pid), ".%d", (int)getpid());
+    std::string tmp = snapFile + pid;
+    try
+      {
+        IndexSnapshot::write(tmp, live);
+        if(!journal->compact(JRVector(), pos, tmp, snapFile))
+          {
+            PRINT("Compacted by someone else");
+            bfs::remove(tmp);
+          }
+      }
+    catch(...)
+      {
+        boost::system::error_code ec;
+        bfs::remove(tmp, ec);
+        throw;
+      }
+  }
+
+  // Compact right away
+  void compact()
+  {
+    if(!journal) return;
+    waitCompact();
+    JRVector live;
+    snapshot(live);
+    compact(snapFile, live, journal->mark());
+  }
+
+  void addConf(const std::string &file)
+  {
+    if(!journal) return;
+    uint32_t id = ents.find(file);
+    if(!id) return;
+    PRINT("addConf: file=" << file);
+    JournalRecord rec;
+    ents.get(id, rec);
+    journal->add(rec);
+    checkCompact();
+  }
+
+  // Save the current entries for 'files', and remove 'remove'
+  void addConf(const std::vector<std::string> &files,
                const StrSet &remove)
   {
-    PRINT("addConf: entries=" << entries.size() << " remove=" << remove.size());
-    conf.setMany(entries, remove);
+    if(!journal) return;
+    PRINT("addConf: entries=" << files.size() << " remove=" << remove.size());
+
+    JRVector recs;
+    recs.reserve(files.size() + remove.size());
+    for(int i=0; i<files.size(); i++)
+      {
+        uint32_t id = ents.find(files[i]);
+        if(!id) continue;
+        recs.resize(recs.size()+1);
+        ents.get(id, recs.back());
+      }
+    for(StrSet::const_iterator it = remove.begin(); it != remove.end(); it++)
+      {
+        JournalRecord rec;
+        rec.file = *it;
+        recs.push_back(rec);
+      }
+
+    journal->append(recs);
+    checkCompact();
   }
 
   void removeConf(const std::string &file)
-  { conf.remove(file); }
+  {
+    if(!journal) return;
+    journal->remove(file);
+    checkCompact();
+  }
+
+  void loadConf(const std::string &file, bool share)
+  {
+    waitCompact();
+
+    /* An unshared load cleans up after crashed compactions and cuts
+       off damaged journal tails, which would break any process still
+       using the file. The lock file tells us it has been shared.
+     */
+    if(!share && bfs::exists(file + ".lock"))
+      {
+        PRINT("loadConf: " << file << " is shared, loading it as shared");
+        share = true;
+      }
+    shared = share;
+    journal.reset(new IndexJournal(file, shared));
+    snapFile = file + ".snap";
+    loadAccess(file + ".access");
+
+    JRVector recs;
+    if(!journal->load(recs))
+      {
+        // This is an index from an older version. Convert it.
+        loadJson(file);
+        compact();
+
+        if(bfs::exists(file + ".old"))
+          bfs::remove(file + ".old");
+        return;
+      }
+
+    // Apply the changes made since the snapshot was written
+    openSnap();
+    apply(recs);
+  }
+
+  void apply(const JRVector &recs)
+  {
+    for(int i=0; i<recs.size(); i++)
+      {
+        const JournalRecord &r = recs[i];
+        if(r.hash.isNull())
+          remove(r.file);
+        else
+          add(r);
+      }
+  }
+
+  /* Pick up the changes other processes made to a shared index.
+     Called without the lock held, at the start of each public
+     function that uses the entries.
+
+     After a compaction, by anyone, we drop everything and start
+     over from the new snapshot. That also frees up the memory held
+     by entries that were moved into it.
+   */
+  void refresh()
+  {
+    if(!shared) return;
+    {
+      RLOCK lock(mutex);
+      if(!journal->changed()) return;
+    }
+
+    WLOCK lock(mutex);
+    JRVector recs;
+    if(journal->update(recs))
+      {
+        PRINT("refresh: " << recs.size() << " new records");
+        apply(recs);
+        return;
+      }
+
+    PRINT("refresh: reloading");
+    if(!journal->load(recs)) return;
+    ents = EntryArena();
+    snap.close();
+    openSnap();
+    apply(recs);
+  }
+
+  /* The access file is a magic string followed by fixed size
+     records: the 40 byte hash, then 'last' and 'count' in native
+     byte order. A missing or broken file just means we start over.
+   */
+  static const int ACCESS_REC = 40 + 8 + 4;
+
+  static void readAccess(const std::string &file, HashMap<CIAccess> &out)
+  {
+    FILE *f = fopen(file.c_str(), "rb");
+    if(!f) return;
+
+    char magic[8];
+    if(fread(magic, 8, 1, f) == 1 && memcmp(magic, ACCESS_MAGIC, 8) == 0)
+      {
+        char buf[ACCESS_REC];
+        while(fread(buf, ACCESS_REC, 1, f) == 1)
+          {
+            Hash h;
+            h.copy(buf);
+            CIAccess &a = out[h];
+            memcpy(&a.last, buf+40, 8);
+            memcpy(&a.count, buf+48, 4);
+          }
+      }
+    fclose(f);
+  }
+
+  void loadAccess(const std::string &file)
+  {
+    boost::lock_guard<boost::mutex> lock(accessMutex);
+    accessFile = file;
+    access = HashMap<CIAccess>();
+    accessNew = HashMap<CIAccess>();
+    accessChanged = false;
+    readAccess(file, access);
+  }
+
+  // Adds our new lookups to the statistics read back from the file
+  struct AccessMerger
+  {
+    HashMap<CIAccess> *out;
+
+    void operator()(const Hash &h, const CIAccess &a)
+    {
+      CIAccess &m = (*out)[h];
+      if(a.last > m.last) m.last = a.last;
+      m.count += a.count;
+    }
+  };
+
+  /* Holds an flock() on the access lock file of a shared index
+     until destroyed. Does nothing for unshared ones.
+   */
+  struct AccessLock
+  {
+    int fd;
+
+    AccessLock(const std::string &file, bool shared) : fd(-1)
+    {
+      if(!shared) return;
+      fd = ::open(file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+      if(fd < 0)
+        throw std::runtime_error("Cannot open " + file + ": " + strerror(errno));
+      int res;
+      do res = flock(fd, LOCK_EX);
+      while(res != 0 && errno == EINTR);
+      if(res != 0)
+        {
+          std::string err = strerror(errno);
+          ::close(fd);
+          throw std::runtime_error("Cannot lock " + file + ": " + err);
+        }
+    }
+    ~AccessLock() { if(fd >= 0) ::close(fd); }
+  };
+
+  // Collects the records to save, skipping hashes we no longer have
+  struct AccessWriter
+  {
+    const _CacheIndex_Hidden *owner;
+    std::string data;
+
+    void operator()(const Hash &h, const CIAccess &a)
+    {
+      std::vector<uint32_t> list;
+      owner->ents.find(h, list);
+      if(list.empty())
+        {
+          owner->snap.find(h, list);
+          bool found = false;
+          for(int i=0; i<list.size() && !found; i++)
+            found = !owner->shadowed[list[i]];
+          if(!found) return;
+        }
+
+      data.append((const char*)h.getData(), 40);
+      data.append((const char*)&a.last, 8);
+      data.append((const char*)&a.count, 4);
+    }
+  };
 
-  void loadConf(const std::string &file)
+  /* Called with 'mutex' held for reading. Other processes sharing
+     the index may have saved their own lookups since we read the
+     file, so the file is read again and ours are added on top. The
+     lock keeps two processes from doing this at the same time.
+   */
+  void saveAccess()
+  {
+    boost::lock_guard<boost::mutex> lock(accessMutex);
+    if(!accessChanged || accessFile == "") return;
+
+    AccessLock fileLock(accessFile + ".lock", shared);
+    HashMap<CIAccess> merged;
+    readAccess(accessFile, merged);
+    AccessMerger m = { &merged };
+    accessNew.forEach(m);
+
+    AccessWriter w = { this, std::string(ACCESS_MAGIC, 8) };
+    merged.forEach(w);
+
+    std::string newFile = accessFile + ".new";
+    FILE *f = fopen(newFile.c_str(), "wb");
+    if(!f)
+      throw std::runtime_error("Cannot open " + newFile + ": " + strerror(errno));
+    bool ok = fwrite(w.data.data(), w.data.size(), 1, f) == 1;
+    ok = (fclose(f) == 0) && ok;
+    if(!ok || ::rename(newFile.c_str(), accessFile.c_str()) != 0)
+      {
+        std::string err = strerror(errno);
+        ::remove(newFile.c_str());
+        throw std::runtime_error("Cannot write " + accessFile + ": " + err);
+      }
+    access = merged;
+    accessNew.clear();
+    accessChanged = false;
+  }
+
+  void touch(const Hash &h)
   {
-    conf.load(file);
+    boost::lock_guard<boost::mutex> lock(accessMutex);
+    int64_t now = nowNS();
+    CIAccess &a = access[h];
+    a.last = now;
+    a.count++;
+    CIAccess &n = accessNew[h];
+    n.last = now;
+    n.count++;
+    accessChanged = true;
+  }
+
+  /* Old indices were JSON files, with values "HASH TIME", optionally
+     followed by " STATE CHECK" for entries with an AppendState.
+     Broken entries are skipped.
+   */
+  void loadJson(const std::string &file)
+  {
+    Misc::JConfig conf(file, true);
 
     // Insert into the list
     std::vector<std::string> names;
     names = conf.getNames();
 
-    StrSet rem;
     for(int i=0; i<names.size(); i++)
       {
         const std::string &file = names[i];
@@ -105,88 +763,101 @@ struct CacheIndex::_CacheIndex_Hidden
             Hash hash(val.substr(0,split));
             time_t wtime = atoll(val.substr(split+1).c_str());
 
-            if(file == "" || split == 0 || wtime == 0 || hash.isNull())
-              // Remove broken entries
-              rem.insert(file);
-            else
-              add(file, hash, wtime);
-          }
-        catch(...)
-          {
-            // Remove broken entries
-            rem.insert(file);
+            JournalRecord rec;
+            rec.file = file;
+            rec.hash = hash;
+            rec.writeTime = wtime;
+
+            // Optional append state. Ignore it if it's broken.
+            int split2 = val.find(' ', split+1);
+            int split3 = val.find(' ', split2+1);
+            if(split2 > 0 && split3 > 0)
+              try
+                {
+                  rec.state.fromString(val.substr(split2+1, split3-split2-1));
+                  rec.check.fromString(val.substr(split3+1));
+                }
+              catch(...) { rec.state = HashState(); }
+
+            if(file != "" && split != 0 && wtime != 0 && !hash.isNull())
+              add(rec);
           }
+        catch(...) {}
       }
+  }
 
-    if(rem.size())
-      addConf(StrMap(), rem);
+  // Copy out the entry for 'file', if any
+  bool get(const std::string &file, JournalRecord &out) const
+  {
+    uint32_t id = ents.find(file);
+    if(id)
+      {
+        ents.get(id, out);
+        return true;
+      }
+
+    int64_t i = snap.find(file);
+    if(i < 0 || shadowed[i]) return false;
+    snap.get(i, out);
+    return true;
   }
 
-  Entry *find(const std::string &file)
+  bool has(const std::string &file) const
   {
-    PTE_it it = paths.find(file);
-    if(it == paths.end()) return NULL;
-    return it->second;
+    if(ents.find(file)) return true;
+    int64_t i = snap.find(file);
+    return i >= 0 && !shadowed[i];
   }
 
-  Entry *find(const Hash &h)
+  // All files listed with the given hash
+  void findAll(const Hash &h, std::vector<std::string> &out) const
   {
-    HTE_it it = hashes.find(h);
-    if(it == hashes.end()) return NULL;
-    return it->second;
+    std::vector<uint32_t> list;
+    ents.find(h, list);
+    for(int i=0; i<list.size(); i++)
+      out.push_back(ents.getPath(list[i]));
+
+    list.clear();
+    snap.find(h, list);
+    for(int i=0; i<list.size(); i++)
+      if(!shadowed[list[i]])
+        out.push_back(snap.getPath(list[i]));
   }
 
   /* FIXED BUG: At this point, it's possible the 'file' passed to us
      is a reference to ent->file, which may get deleted by
      remove(file). So to avoid referencing deleted objects, this
-     function takes value parameters rather than references.
+     function takes its parameter by value rather than reference.
    */
-  void add(std::string file, Hash hash, time_t writeTime)
+  void add(JournalRecord rec)
   {
     // Remove any existing entry first
-    remove(file);
-
-    Entry *ent = new Entry;
-
-    ent->hash = hash;
-    ent->file = file;
-    ent->writeTime = writeTime;
-
-    paths[file] = ent;
-    hashes.insert(HTE_val(hash, ent));
+    remove(rec.file);
+    insert(rec);
   }
 
-  // Get a HashToEntry iterator for a given file/hash pair. Asserts if
-  // not found.
-  HTE_it getHashIt(const std::string &file, const Hash &hash)
+  // Add an entry to 'ents', which must not have it already
+  void insert(const JournalRecord &rec)
   {
-    HTE_it hit;
-    HTE_pair range = hashes.equal_range(hash);
-    for(hit = range.first; hit != range.second; ++hit)
-      if(hit->second->file == file)
-        return hit;
-    assert(0);
+    ents.add(rec);
   }
 
   // Returns true if an entry was removed
   bool remove(const std::string &file)
   {
-    PTE_it it = paths.find(file);
-
-    // Ignore missing entries
-    if(it == paths.end()) return false;
-
-    // Get the entry and remove it
-    Entry *ent = it->second;
-    paths.erase(it);
+    uint32_t id = ents.find(file);
 
-    // Next remove the entry from the hash lookup
-    HTE_it hit = getHashIt(file, ent->hash);
-    hashes.erase(hit);
-
-    // Kill the entry
-    delete ent;
+    if(!id)
+      {
+        // Entries still in the snapshot are just hidden
+        int64_t i = snap.find(file);
+        if(i < 0 || shadowed[i]) return false;
+        shadowed[i] = true;
+        numShadowed++;
+        return true;
+      }
 
+    ents.remove(id);
     return true;
   }
 };
@@ -196,14 +867,78 @@ CacheIndex::CacheIndex(const std::string &conf, FSystem *_sys)
 {
   ptr = new _CacheIndex_Hidden;
   if(conf != "") load(conf);
-  if(!sys) sys = new BoostFSystem;
+  if(!sys)
+    {
+      sys = new BoostFSystem;
+      ptr->ownSys = true;
+    }
+}
+CacheIndex::~CacheIndex()
+{
+  try { saveAccess(); }
+  catch(...) {}
+  delete ptr;
+}
+
+bool CacheIndex::getAccess(const Hash &hash, CIAccess &out) const
+{
+  boost::lock_guard<boost::mutex> lock(ptr->accessMutex);
+  const CIAccess *a = ptr->access.find(hash);
+  if(!a) return false;
+  out = *a;
+  return true;
+}
+
+void CacheIndex::getHashStats(uint64_t &files, uint64_t &bytes) const
+{
+  boost::lock_guard<boost::mutex> lock(ptr->statMutex);
+  files = ptr->hashedFiles;
+  bytes = ptr->hashedBytes;
+}
+
+void CacheIndex::saveAccess()
+{
+  RLOCK lock(ptr->mutex);
+  ptr->saveAccess();
+}
+
+void CacheIndex::setAppendHashing(uint64_t minSize)
+{
+  WLOCK lock(ptr->mutex);
+  ptr->appendMin = minSize;
+}
+
+void CacheIndex::setThreads(int num)
+{
+  WLOCK lock(ptr->mutex);
+  ptr->threads = num;
+}
+
+bool CacheIndex::watch(const std::string &dir)
+{
+  // Custom file systems may not be on disk at all
+  if(!ptr->ownSys) return false;
+
+  boost::shared_ptr<DirWatcher> watcher;
+  {
+    WLOCK lock(ptr->mutex);
+    if(!ptr->watcher)
+      ptr->watcher.reset(new DirWatcher);
+    watcher = ptr->watcher;
+  }
+  return watcher->watch(sys->abs(dir));
 }
-CacheIndex::~CacheIndex() { delete ptr; }
 
-void CacheIndex::load(const std::string &conf)
+void CacheIndex::load(const std::string &conf, bool shared)
 {
-  LOCK lock(ptr->mutex);
-  ptr->loadConf(conf);
+  WLOCK lock(ptr->mutex);
+  ptr->loadConf(conf, shared);
+}
+
+void CacheIndex::compact()
+{
+  WLOCK lock(ptr->mutex);
+  ptr->compact();
 }
 
 int CacheIndex::getStatus(const std::string &_where, const Hash &hash)
@@ -211,14 +946,25 @@ int CacheIndex::getStatus(const std::string &_where, const Hash &hash)
   PRINT("Cache::getStatus(" << _where << ", " << hash << ")");
   std::string where = sys->abs(_where);
   PRINT("where=" << where);
-
-  LOCK lock(ptr->mutex);
+  ptr->refresh();
 
   // Check the index first if we think this is a match.
-  Entry *ent = ptr->find(where);
-  bool exists = sys->exists(where);
+  JournalRecord ent;
+  bool found, clean;
+  boost::shared_ptr<DirWatcher> watcher;
+  {
+    RLOCK lock(ptr->mutex);
+    watcher = ptr->watcher;
+  }
+  if(watcher) watcher->sync();
+  {
+    RLOCK lock(ptr->mutex);
+    found = ptr->get(where, ent);
+    clean = found && watcher && watcher->isClean(where);
+  }
+  bool exists = clean || sys->exists(where);
   bool checkAlt = false;
-  if(!ent || ent->hash != hash || !exists)
+  if(!found || ent.hash != hash || !exists)
     {
       /* If there probably isn't a match, then it's more efficient to
          check for alternatives first, rather than hashing a file we
@@ -234,7 +980,7 @@ int CacheIndex::getStatus(const std::string &_where, const Hash &hash)
              though the strings are different. Boost lets us check
              for this.
            */
-          if(sys->equivalent(alt, where))
+          if(alt == where || sys->equivalent(alt, where))
             return CI_Match;
 
           return CI_ElseWhere;
@@ -250,7 +996,10 @@ int CacheIndex::getStatus(const std::string &_where, const Hash &hash)
 
   // If it turns out it's a match after all, we're done.
   if(real == hash)
-    return CI_Match;
+    {
+      ptr->touch(hash);
+      return CI_Match;
+    }
 
   /* So the file exists and it doesn't match the requested hash. This
      means it's either CI_Diff or CI_Elsewhere. Do the alternatives
@@ -261,7 +1010,7 @@ int CacheIndex::getStatus(const std::string &_where, const Hash &hash)
       std::string alt = findHash(hash);
       if(alt != "")
         {
-          if(sys->equivalent(alt, where))
+          if(alt == where || sys->equivalent(alt, where))
             return CI_Match;
           return CI_ElseWhere;
         }
@@ -271,141 +1020,571 @@ int CacheIndex::getStatus(const std::string &_where, const Hash &hash)
   return CI_Diff;
 }
 
-void CacheIndex::getEntries(CIVector &result) const
+uint64_t CacheIndex::size() const
 {
-  LOCK lock(ptr->mutex);
-
-  result.reserve(ptr->paths.size());
+  ptr->refresh();
+  RLOCK lock(ptr->mutex);
+  return ptr->size();
+}
 
-  PathToEntry::const_iterator it;
-  for(it = ptr->paths.begin(); it != ptr->paths.end(); it++)
+static void toEntries(const JRVector &recs, CIVector &result)
+{
+  result.reserve(result.size() + recs.size());
+  for(int i=0; i<recs.size(); i++)
     {
-      Entry &e = *(it->second);
-      CIEntry e2 = { e.hash, e.file, e.writeTime };
-      result.push_back(e2);
+      const JournalRecord &r = recs[i];
+      CIEntry e = { r.hash, r.file, r.writeTime, r.st, r.racy };
+      result.push_back(e);
     }
 }
 
+void CacheIndex::getEntries(CIVector &result) const
+{
+  ptr->refresh();
+  JRVector all;
+  {
+    RLOCK lock(ptr->mutex);
+    ptr->snapshot(all);
+  }
+  toEntries(all, result);
+}
+
+void CacheIndex::getEntries(CIVector &result, const std::string &after,
+                            uint32_t max) const
+{
+  ptr->refresh();
+  JRVector some;
+  {
+    RLOCK lock(ptr->mutex);
+    ptr->range(after, max, some);
+  }
+  toEntries(some, result);
+}
+
 std::string CacheIndex::findHash(const Hash &hash)
 {
   PRINT("Cache::findHash(" << hash << ")");
-  LOCK lock(ptr->mutex);
+  ptr->refresh();
+
+  std::vector<std::string> cands;
+  {
+    RLOCK lock(ptr->mutex);
+    ptr->findAll(hash, cands);
+  }
 
-  Entry *ent = ptr->find(hash);
-  while(ent)
+  for(int i=0; i<cands.size(); i++)
     {
-      std::string file = ent->file;
+      const std::string &file = cands[i];
 
       PRINT("Found " << file);
 
       // Does the file still exist, and does it match?
-      if(sys->exists(file) && addFile(file) == hash)
-        return file;
-
-      // That file didn't match after all. Try another one.
-      Entry *ent2 = ptr->find(hash);
+      if(addFile(file, Hash(), true) == hash)
+        {
+          ptr->touch(hash);
+          return file;
+        }
 
-      /* If this still returned the same entry, we KNOW that this
-         entry is invalid (since we just tested it above.) So remove
-         it.
+      /* That file didn't match after all. If the entry is still
+         listed with this hash, we KNOW that it is invalid (since we
+         just tested it above.) So remove it.
 
          This happens in several cases (non-existing file, non-
          matching file) and when the new entry added/replaced by
-         addFile doesn't overwrite or remove the old one.
+         addFile doesn't overwrite or remove the old one. Another
+         thread may have replaced the entry in the meantime, in which
+         case we leave it alone.
       */
-      while(ent2 && ent2->file == file)
+      WLOCK lock(ptr->mutex);
+      JournalRecord ent;
+      if(ptr->get(file, ent) && ent.hash == hash && ptr->remove(file))
         {
-          ptr->remove(file);
           ptr->removeConf(file);
           PRINT("Removed " << file);
-          ent2 = ptr->find(hash);
         }
-      ent = ent2;
     }
   return "";
 }
 
+void CacheIndex::resolveMany(CIResolveList &list, JobInfoPtr info)
+{
+  ptr->refresh();
+
+  struct Cand
+  {
+    // First indexed file with the hash, if any
+    std::string file;
+
+    // 'more' is set if there are other files to try. 'ok' is set
+    // once 'file' is known to match.
+    bool more, checked, ok, touched;
+
+    Cand() : more(false), checked(false), ok(false), touched(false) {}
+  };
+
+  HashMap<Cand> cands;
+  std::vector<std::string> targets(list.size());
+  Hash::DirMap check;
+
+  for(int i=0; i<list.size(); i++)
+    {
+      list[i].source.clear();
+      if(list[i].target != "")
+        targets[i] = sys->abs(list[i].target);
+    }
+
+  // Find what to check, in one go
+  {
+    RLOCK lock(ptr->mutex);
+    std::vector<std::string> files;
+    for(int i=0; i<list.size(); i++)
+      {
+        const Hash &hash = list[i].hash;
+        if(!cands.count(hash))
+          {
+            files.clear();
+            ptr->findAll(hash, files);
+            Cand &c = cands[hash];
+            if(files.size())
+              {
+                c.file = files[0];
+                c.more = files.size() > 1;
+                check[c.file];
+              }
+          }
+
+        JournalRecord ent;
+        if(targets[i] != "" && ptr->get(targets[i], ent) && ent.hash == hash)
+          check[targets[i]];
+      }
+  }
+
+  checkMany(check, info);
+
+  /* Targets that aren't indexed with the right hash may still match
+     on disk. Hash them, but only if there's nothing else.
+   */
+  Hash::DirMap again;
+  for(int i=0; i<list.size(); i++)
+    {
+      CIResolve &r = list[i];
+      Cand &c = *cands.find(r.hash);
+      if(!c.checked)
+        {
+          c.checked = true;
+          c.ok = c.file != "" && check[c.file] == r.hash;
+        }
+
+      Hash::DirMap::const_iterator it;
+      if(targets[i] != "" && (it = check.find(targets[i])) != check.end() &&
+         it->second == r.hash)
+        r.source = r.target;
+      else if(c.ok)
+        r.source = c.file;
+      else if(targets[i] != "" && !check.count(targets[i]) && !c.more)
+        again[targets[i]];
+    }
+
+  if(again.size())
+    checkMany(again, info);
+
+  // Targets that matched can be used by the other lookups too
+  for(int i=0; i<list.size(); i++)
+    {
+      CIResolve &r = list[i];
+      Hash::DirMap::const_iterator it;
+      if(targets[i] != "" && (it = again.find(targets[i])) != again.end() &&
+         it->second == r.hash)
+        {
+          r.source = r.target;
+          Cand &c = *cands.find(r.hash);
+          if(!c.ok)
+            {
+              c.file = targets[i];
+              c.ok = true;
+            }
+        }
+    }
+
+  for(int i=0; i<list.size(); i++)
+    {
+      CIResolve &r = list[i];
+      Cand &c = *cands.find(r.hash);
+
+      if(r.source == "")
+        {
+          // The first file was outdated, so try the others. This
+          // records the access itself.
+          if(c.more)
+            {
+              c.more = false;
+              c.file = findHash(r.hash);
+              c.ok = c.touched = c.file != "";
+            }
+
+          if(c.ok)
+            r.source = c.file;
+          else if(targets[i] != "" && !check.count(targets[i]) &&
+                  !again.count(targets[i]) && checkFile(targets[i]) == r.hash)
+            r.source = r.target;
+        }
+
+      if(r.source != "" && !c.touched)
+        {
+          ptr->touch(r.hash);
+          c.touched = true;
+        }
+    }
+}
+
 void CacheIndex::removeFile(const std::string &_where)
 {
   std::string where = sys->abs(_where);
-  LOCK lock(ptr->mutex);
-  ptr->remove(where);
-  ptr->removeConf(where);
+  ptr->refresh();
+  WLOCK lock(ptr->mutex);
+  if(ptr->watcher) ptr->watcher->setDirty(where);
+  if(ptr->remove(where))
+    ptr->removeConf(where);
 }
 
-void CacheIndex::verify()
+void CacheIndex::verify(JobInfoPtr info)
 {
   CIVector vec;
   Hash::DirMap names;
   getEntries(vec);
   for(int i=0; i<vec.size(); i++)
     names[vec[i].file];
-  checkMany(names);
+  checkMany(names, info);
 }
 
-void CacheIndex::checkMany(Hash::DirMap &files)
+/* Hash all files in the list that aren't indexed yet in one go,
+   through FSystem::hashMany(). This is mostly useful when indexing
+   lots of new files, since small files can then be hashed together.
+
+   The results are only hints for addEntry(). Files that already have
+   an index entry, or were given a hash, are left to addEntry() as
+   usual.
+ */
+void CacheIndex::hashNew(const Hash::DirMap &files, Hash::DirMap &out)
+{
+  std::vector<std::string> list;
+  Hash::DirMap::const_iterator it;
+  {
+    RLOCK lock(ptr->mutex);
+    for(it = files.begin(); it != files.end(); it++)
+      {
+        if(!it->second.isNull()) continue;
+        std::string file = sys->abs(it->first);
+        if(!ptr->has(file))
+          list.push_back(file);
+      }
+  }
+
+  if(list.size() < 2) return;
+
+  PRINT("hashNew: hashing " << list.size() << " new files");
+  std::vector<Hash> res;
+  sys->hashMany(list, res);
+  for(int i=0; i<list.size(); i++)
+    if(!res[i].isNull())
+      out[list[i]] = res[i];
+}
+
+/* Shared state for checkMany() and addMany(). The worker threads
+   take files off the list one at a time and run addEntry() on
+   them. The results are kept in the list, and saved in one batch by
+   the caller once all the threads are done.
+ */
+/* A stat of a file taken before addEntry() was called, see
+   runBulk(). 'token' is from DirWatcher::begin(), called before the
+   stat.
+ */
+struct CacheIndex::_Known
+{
+  FileStat st;
+  int64_t at;
+  uint64_t token;
+};
+
+struct CacheIndex::_Bulk
+{
+  struct Item
+  {
+    std::string file;
+    Hash given, hash;
+    const Hash *pre;
+    const _Known *known;
+    uint64_t time;
+    bool done, missing;
+    std::string error;
+
+    Item() : pre(NULL), known(NULL), time(0), done(false), missing(false) {}
+  };
+
+  struct Worker
+  {
+    _Bulk *bulk;
+    void operator()() { bulk->run(); }
+  };
+
+  CacheIndex *owner;
+  std::vector<Item> items;
+
+  // Set by checkMany(), where missing files are not an error
+  bool check;
+
+  // Results from FSystem::statMany()
+  std::vector<_Known> known;
+
+  JobInfoPtr info;
+  boost::mutex mutex;
+  size_t next, finished;
+  bool stop;
+
+  _Bulk(CacheIndex *o, bool c)
+    : owner(o), check(c), next(0), finished(0), stop(false) {}
+
+  // Get the next item to work on, or NULL if there is none
+  Item *take()
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    if(stop || next == items.size()) return NULL;
+    if(info)
+      {
+        info->checkStatus();
+        if(info->isNonSuccess())
+          {
+            stop = true;
+            return NULL;
+          }
+      }
+    return &items[next++];
+  }
+
+  void finish(Item *it)
+  {
+    boost::lock_guard<boost::mutex> lock(mutex);
+    it->done = true;
+    finished++;
+    if(info) info->setProgress(finished, items.size());
+  }
+
+  void run()
+  {
+    Item *it;
+    while((it = take()))
+      {
+        try
+          {
+            if(!it->missing)
+              it->hash = owner->addEntry(it->file, it->given, it->time, it->pre,
+                                         check ? &it->missing : NULL,
+                                         it->known);
+          }
+        catch(std::exception &e)
+          {
+            it->error = e.what();
+          }
+        finish(it);
+      }
+  }
+};
+
+// Run addEntry() on all the files in 'bulk'
+void CacheIndex::runBulk(_Bulk &bulk, JobInfoPtr info)
+{
+  /* Stat everything up front. With the built-in file system this
+     keeps many requests in flight at once, which matters a lot on
+     cold or networked disks.
+   */
+  boost::shared_ptr<DirWatcher> watcher;
+  {
+    RLOCK lock(ptr->mutex);
+    watcher = ptr->watcher;
+  }
+  DirWatcher::Pass pass(watcher.get());
+  if(watcher) watcher->sync();
+
+  if(bulk.items.size() > 1)
+    {
+      // Files the watcher knows are unchanged don't need it
+      std::vector<std::string> names;
+      std::vector<int> which;
+      for(int i=0; i<bulk.items.size(); i++)
+        if(!watcher || !watcher->isClean(bulk.items[i].file))
+          {
+            names.push_back(bulk.items[i].file);
+            which.push_back(i);
+          }
+
+      std::vector<FileStat> stats;
+      std::vector<int> res;
+      int64_t checked = nowNS();
+      if(names.size())
+        sys->statMany(names, stats, res);
+
+      bulk.known.resize(names.size());
+      for(int i=0; i<names.size(); i++)
+        {
+          _Bulk::Item &item = bulk.items[which[i]];
+          if(res[i] == FS_FOUND)
+            {
+              _Known &k = bulk.known[i];
+              k.st = stats[i];
+              k.at = checked;
+              k.token = pass.token;
+              item.known = &k;
+            }
+          else if(res[i] == FS_MISSING && bulk.check)
+            item.missing = true;
+        }
+    }
+
+  bulk.info = info;
+  if(info) info->setProgress(0, bulk.items.size());
+
+  int threads;
+  {
+    RLOCK lock(ptr->mutex);
+    threads = ptr->threads;
+    if(threads <= 0 && !ptr->ownSys) threads = 1;
+  }
+  if(threads <= 0) threads = boost::thread::hardware_concurrency();
+  if(threads <= 0) threads = 1;
+  if(threads > bulk.items.size()) threads = bulk.items.size();
+
+  PRINT("runBulk: " << bulk.items.size() << " files on " << threads << " threads");
+
+  if(threads <= 1)
+    bulk.run();
+  else
+    {
+      boost::thread_group group;
+      for(int t=0; t<threads; t++)
+        {
+          _Bulk::Worker w = { &bulk };
+          group.create_thread(w);
+        }
+      group.join_all();
+    }
+}
+
+void CacheIndex::checkMany(Hash::DirMap &files, JobInfoPtr info)
 {
   PRINT("checkMany: " << files.size() << " entries");
-  LOCK lock(ptr->mutex);
+  ptr->refresh();
 
-  // This is the list fed to the config file
-  StrMap entries;
-  StrSet rem;
+  Hash::DirMap hashed;
+  hashNew(files, hashed);
 
+  _Bulk bulk(this, true);
+  bulk.items.resize(files.size());
   Hash::DirMap::iterator it;
-  for(it = files.begin(); it != files.end(); it++)
+  int i = 0;
+  for(it = files.begin(); it != files.end(); it++, i++)
     {
-      std::string file = sys->abs(it->first);
+      _Bulk::Item &item = bulk.items[i];
+      item.file = sys->abs(it->first);
+      item.given = it->second;
+      Hash::DirMap::iterator pre = hashed.find(item.file);
+      if(pre != hashed.end()) item.pre = &pre->second;
+    }
+
+  runBulk(bulk, info);
 
-      if(!sys->exists(file))
+  // Changes to save
+  std::vector<std::string> entries;
+  StrSet rem;
+  std::string error;
+
+  WLOCK lock(ptr->mutex);
+  for(i = 0, it = files.begin(); it != files.end(); it++, i++)
+    {
+      const _Bulk::Item &item = bulk.items[i];
+      if(!item.done) continue;
+
+      if(item.missing)
         {
-          PRINT("checkMany: file NOT found: " << file);
+          PRINT("checkMany: file NOT found: " << item.file);
           it->second = Hash();
-          if(ptr->remove(file))
+          if(ptr->remove(item.file))
             {
               PRINT("  File found and removed from list");
-              rem.insert(file);
+              rem.insert(item.file);
             }
-          continue;
         }
-
-      PRINT("checkMany: file found - passing to addEntry");
-      uint64_t time;
-      Hash hash = addEntry(file, it->second, time);
-      it->second = hash;
-      if(time)
-        entries[file] = ptr->makeConf(hash, time);
+      else if(item.error != "")
+        {
+          if(error == "") error = item.error;
+        }
+      else
+        {
+          it->second = item.hash;
+          if(item.time)
+            entries.push_back(item.file);
+        }
     }
 
   if(entries.size() || rem.size())
     ptr->addConf(entries, rem);
+
+  if(error != "")
+    throw std::runtime_error(error);
 }
 
 void CacheIndex::addMany(const Hash::DirMap &files,
-                         const StrSet &remove)
+                         const StrSet &remove, JobInfoPtr info)
 {
   PRINT("addMany: " << files.size() << " entries, " << remove.size() << " to remove");
-  LOCK lock(ptr->mutex);
+  ptr->refresh();
 
-  // This is the list fed to the config file
-  StrMap entries;
+  Hash::DirMap hashed;
+  hashNew(files, hashed);
 
-  for(Hash::DirMap::const_iterator it = files.begin(); it != files.end(); it++)
+  _Bulk bulk(this, false);
+  bulk.items.resize(files.size());
+  Hash::DirMap::const_iterator it;
+  int i = 0;
+  for(it = files.begin(); it != files.end(); it++, i++)
     {
-      std::string file = sys->abs(it->first);
-      uint64_t time;
-      Hash hash = addEntry(file, it->second, time);
-      if(time)
-        entries[file] = ptr->makeConf(hash, time);
+      _Bulk::Item &item = bulk.items[i];
+      item.file = sys->abs(it->first);
+      item.given = it->second;
+      Hash::DirMap::iterator pre = hashed.find(item.file);
+      if(pre != hashed.end()) item.pre = &pre->second;
+    }
+
+  runBulk(bulk, info);
+
+  // Changes to save
+  std::vector<std::string> entries;
+  StrSet rem;
+  std::string error;
+
+  for(i = 0; i < bulk.items.size(); i++)
+    {
+      const _Bulk::Item &item = bulk.items[i];
+      if(item.error != "")
+        {
+          if(error == "") error = item.error;
+        }
+      else if(item.time)
+        entries.push_back(item.file);
     }
+
+  WLOCK lock(ptr->mutex);
   for(StrSet::const_iterator it = remove.begin(); it != remove.end(); it++)
     {
       std::string file = sys->abs(*it);
-      ptr->remove(file);
+      if(ptr->remove(file))
+        rem.insert(file);
     }
 
-  if(entries.size() || remove.size())
-    ptr->addConf(entries, remove);
+  if(entries.size() || rem.size())
+    ptr->addConf(entries, rem);
+
+  if(error != "")
+    throw std::runtime_error(error);
 }
 
 /* This is the main 'workhorse' of the indexer, and the function that
@@ -413,8 +1592,31 @@ void CacheIndex::addMany(const Hash::DirMap &files,
 
    Also returns the file time if the entry is to be added to
    config. If not, time is set to 0.
+
+   If 'pre' is set, it is a hash computed earlier by hashNew(), and is
+   used instead of rehashing the file as long as the size still
+   matches.
+
+   If 'missing' is set, a missing file sets it to true and returns a
+   null hash, instead of removing the entry and throwing.
+
+   If 'known' is set, it is a stat of the file taken earlier (by
+   FSystem::statMany()), and is used instead of stat'ing it again.
+
+   Files the watcher (if any) reports as clean, once queued events
+   are handled, are answered straight from the index. Otherwise, once the file is checked, it is marked
+   clean for next time.
+
+   The index is only locked briefly, to look up the old entry and to
+   store the new one. Stat calls and hashing happen without the
+   lock. If another thread changed the entry for the same file while
+   we were hashing, we keep its version. Time stamps can't decide
+   this, since a file may be replaced by one with an older write time
+   (cp -p, tar, rsync -t.) Either way the stored stat tells whether
+   the entry is still valid next time.
  */
-Hash CacheIndex::addEntry(std::string &where, const Hash &given, uint64_t &time)
+Hash CacheIndex::addEntry(std::string &where, const Hash &given, uint64_t &time,
+                          const Hash *pre, bool *missing, const _Known *known)
 {
   PRINT("addEntry: where=" << where << "  given=" << given);
 
@@ -423,9 +1625,54 @@ Hash CacheIndex::addEntry(std::string &where, const Hash &given, uint64_t &time)
 
   PRINT("  abs path=" << where);
 
-  // First things first: does the file even exist?
-  if(!sys->exists(where))
+  // Nothing has happened to clean files since they were checked
+  boost::shared_ptr<DirWatcher> watcher;
+  {
+    RLOCK lock(ptr->mutex);
+    watcher = ptr->watcher;
+  }
+
+  /* Handle events that are already queued, so a change made just
+     before this call isn't missed. runBulk() did this for us if it
+     stat'ed the file.
+   */
+  if(watcher && !known) watcher->sync();
+
+  {
+    RLOCK lock(ptr->mutex);
+    JournalRecord ent;
+    if(watcher && watcher->isClean(where) && ptr->get(where, ent) &&
+       (given.isNull() || given == ent.hash))
+      {
+        PRINT("  clean, entry matches");
+        time = 0;
+        return ent.hash;
+      }
+  }
+
+  // Take the watcher token before the stat, see DirWatcher
+  DirWatcher::Pass pass(known ? NULL : watcher.get());
+  uint64_t token = known ? known->token : pass.token;
+
+  // Get file information. This also tells us if the file exists.
+  int64_t checked;
+  FileStat st;
+  if(known)
+    {
+      st = known->st;
+      checked = known->at;
+    }
+  else
+    checked = nowNS();
+  if(!known && !sys->getStat(where, st))
     {
+      time = 0;
+      if(missing)
+        {
+          *missing = true;
+          return Hash();
+        }
+
       // Make sure we haven't indexed it
       removeFile(where);
 
@@ -433,51 +1680,72 @@ Hash CacheIndex::addEntry(std::string &where, const Hash &given, uint64_t &time)
       throw std::runtime_error("Cannot index non-existing file: " + where);
     }
 
-  PRINT("File exists, getting stats");
-
-  // Get file information
-  time = sys->last_write_time(where);
-  uint64_t size = sys->file_size(where);
+  time = st.mtime / NS;
+  uint64_t size = st.size;
 
-  PRINT("time=" << time << " size=" << size);
+  PRINT("mtime=" << st.mtime << " size=" << size);
 
   // Check that the given hash, if any, isn't wrong.
-  if(!given.isNull() && given.size() != size)
+  if(!given.isNull() && given.size() != size && given.size() != sys->dataSize(where))
     throw std::runtime_error("Given hash doesn't match real file size: " + where);
 
   // Find the index entry, if any
-  Entry *ent = ptr->find(where);
-  if(ent)
+  JournalRecord ent;
+  bool found;
+  uint64_t appendMin;
+  {
+    RLOCK lock(ptr->mutex);
+    found = ptr->get(where, ent);
+    appendMin = ptr->appendMin;
+  }
+
+  // Set if the entry is right, but was stored by an older version
+  bool upgrade = false;
+
+  if(found)
     {
       PRINT("File entry found");
 
       // The entry already exists. Check if it matches reality.
-      bool match=true;
-      if(ent->writeTime != time ||
-         ent->hash.size() != size) match = false;
-      if(!given.isNull() && given != ent->hash)
+      // Compressed objects (see Packed) are smaller than their
+      // data. For those, the stat check below has to do.
+      bool match = ent.st.mtime || ent.hash.size() == size;
+      if(!given.isNull() && given != ent.hash)
         match = false;
 
-      /* Workaround fix: If the file is written several times in less
-         than one second, with addFile() called in between, an entry
-         may be stored with the right time/size stamp (because we
-         can't detect time changes of less than a second), causing us
-         to get a match when there shouldn't be one.
-
-         We ASSUME that since the previous write was immediately
-         followed by addFile(), then THIS call to addFile() is
-         immediate as well. This isn't a perfect solution but it's ok.
-       */
-      std::time_t tdiff = std::time(NULL) - time;
-      if(tdiff == 0 || tdiff == 1)
-        match = false;
+      if(ent.st.mtime)
+        {
+          // Entries that were racy when stored must be checked again
+          if(ent.racy || !ent.st.same(st))
+            match = false;
+        }
+      else
+        {
+          /* Entries from older versions only have a write time in
+             whole seconds. If the file is written several times in
+             less than one second, with addFile() called in between,
+             an entry may be stored with the right time/size stamp,
+             causing us to get a match when there shouldn't be one.
+
+             We ASSUME that since the previous write was immediately
+             followed by addFile(), then THIS call to addFile() is
+             immediate as well. This isn't a perfect solution but it's
+             ok. If the entry matches, it is stored again with the full
+             file identity.
+           */
+          std::time_t tdiff = std::time(NULL) - time;
+          if(ent.writeTime != time || tdiff == 0 || tdiff == 1)
+            match = false;
+          upgrade = match;
+        }
 
-      if(match)
+      if(match && !upgrade)
         {
           // The existing entry looks right. We're done.
           time = 0;
           PRINT("Existing entry matches, keep it.");
-          return ent->hash;
+          if(watcher) watcher->setClean(where, token);
+          return ent.hash;
         }
     }
 
@@ -485,17 +1753,80 @@ Hash CacheIndex::addEntry(std::string &where, const Hash &given, uint64_t &time)
      reality. Create a new one. ptr->add() will kill any existing
      entry by the same name.
    */
+  JournalRecord rec;
+  rec.file = where;
+  rec.writeTime = time;
+  rec.st = st;
+  rec.racy = isRacy(st, checked);
+
   Hash hash = given;
+  if(upgrade)
+    {
+      hash = ent.hash;
+      rec.state = ent.state;
+      rec.check = ent.check;
+    }
+  bool hashed = false;
+  if(hash.isNull() && pre && pre->size() == size)
+    {
+      hash = *pre;
+      hashed = true;
+    }
+
+  // Large append-only files can pick up where we left off
+  if(hash.isNull() && appendMin && size >= appendMin)
+    {
+      AppendState app;
+      if(found && ent.state.isSet())
+        {
+          app.state = ent.state;
+          app.check = ent.check;
+        }
+      PRINT("Hashing appended data from " << app.state.size);
+      hash = sys->hashAppend(where, app);
+      rec.state = app.state;
+      rec.check = app.check;
+      hashed = true;
+    }
+
   if(hash.isNull())
     {
       // No hash provided. Hash the file ourselves.
       PRINT("Hashing the file...");
       hash = sys->hashSum(where);
       PRINT("  Done.");
+      hashed = true;
     }
   assert(!hash.isNull());
-  PRINT("Adding to index");
-  ptr->add(where, hash, time);
+  rec.hash = hash;
+
+  if(hashed)
+    {
+      boost::lock_guard<boost::mutex> lock(ptr->statMutex);
+      ptr->hashedFiles++;
+      ptr->hashedBytes += hash.size();
+    }
+
+  WLOCK lock(ptr->mutex);
+
+  // Don't overwrite an entry stored by someone else while we were
+  // hashing
+  JournalRecord cur;
+  bool curFound = ptr->get(where, cur);
+  if(curFound != found || (found && !sameRecord(cur, ent)))
+    {
+      PRINT("Entry was changed meanwhile, keep it.");
+      time = 0;
+      return hash;
+    }
+
+  PRINT("Adding to index" << (rec.racy ? " (racy)" : ""));
+  ptr->add(rec);
+  if(watcher)
+    {
+      if(rec.racy) watcher->setDirty(where);
+      else watcher->setClean(where, token);
+    }
   PRINT("Done, returning hash=" << hash);
   return hash;
 }
@@ -503,17 +1834,17 @@ Hash CacheIndex::addEntry(std::string &where, const Hash &given, uint64_t &time)
 Hash CacheIndex::addFile(std::string where, const Hash &given, bool allowMissing)
 {
   PRINT("addFile(" << where << ", " << given << ")");
+  ptr->refresh();
 
-  if(allowMissing && !sys->exists(where))
-    return Hash();
-
-  LOCK lock(ptr->mutex);
   uint64_t time;
-  Hash hash = addEntry(where, given, time);
+  bool missing = false;
+  Hash hash = addEntry(where, given, time, NULL,
+                       allowMissing ? &missing : NULL);
   if(time)
     {
       PRINT("Entry added, now adding to config.");
-      ptr->addConf(where, hash, time);
+      WLOCK lock(ptr->mutex);
+      ptr->addConf(where);
     }
   return hash;
 }
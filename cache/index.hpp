@@ -10,11 +10,28 @@
    The index doesn't actually store, write or modify any files (except
    for its own config file), it just indexes existing files.
 
-   The class is thread safe.
+   The class is thread safe. Lookups from several threads run in
+   parallel, and stat calls and hashing are done without holding the
+   index lock, so one thread hashing a large file doesn't block the
+   others. If two threads index the same file at the same time, the
+   entry with the newest write time wins.
  */
 
 namespace Cache
 {
+  /* Saved hashing state for files that only ever grow. 'check' is
+     the Hash of the CHECK_SIZE bytes (or less, for small files) right
+     before the state's block boundary, and is used as a cheap test
+     that the file prefix is still intact.
+   */
+  struct AppendState
+  {
+    static const uint32_t CHECK_SIZE = 64*1024;
+
+    Spread::HashState state;
+    Spread::Hash check;
+  };
+
   struct FSystem
   {
     virtual std::string abs(const std::string &file) = 0;
@@ -23,6 +40,72 @@ namespace Cache
     virtual bool equivalent(const std::string &file1, const std::string &file2) = 0;
     virtual uint64_t last_write_time(const std::string &file) = 0;
     virtual Spread::Hash hashSum(const std::string &file) = 0;
+
+    /* Get size, times and identity of a file in one go. Returns
+       false if the file doesn't exist.
+
+       The default builds the result from exists(), file_size() and
+       last_write_time(), with a whole second mtime and the other
+       fields zero.
+     */
+    virtual bool getStat(const std::string &file, FileStat &out)
+    {
+      if(!exists(file)) return false;
+      out = FileStat();
+      out.size = file_size(file);
+      out.mtime = last_write_time(file) * (int64_t)1000000000;
+      return true;
+    }
+
+    /* Stat a list of files in one go, see StatBatch. 'res' gets a
+       StatResult for each file, and 'out' the stat of the files that
+       were found. Files left as FS_UNKNOWN are stat'ed later through
+       getStat(). The default does nothing, ie. returns FS_UNKNOWN for
+       everything.
+     */
+    virtual void statMany(const std::vector<std::string> &files,
+                          std::vector<FileStat> &out, std::vector<int> &res)
+    {
+      out.clear();
+      out.resize(files.size());
+      res.clear();
+      res.resize(files.size(), FS_UNKNOWN);
+    }
+
+    /* Hash a list of files in one go, so that many small files can
+       be hashed together (see HashBatch.) 'out' is resized to match
+       'files'. Files that cannot be read, or that are better hashed
+       on their own, get null hashes, and are later hashed one by one
+       through hashSum(). The default does nothing, ie. returns null
+       hashes for everything.
+     */
+    virtual void hashMany(const std::vector<std::string> &files,
+                          std::vector<Spread::Hash> &out)
+    {
+      out.clear();
+      out.resize(files.size());
+    }
+
+    /* Hash a file that may have been appended to since 'app' was
+       saved. If 'app' is set and its check region still matches, only
+       the data after the saved state is hashed. Otherwise the whole
+       file is hashed. On return 'app' describes the current file.
+
+       The default just calls hashSum() and clears 'app'.
+     */
+    virtual Spread::Hash hashAppend(const std::string &file, AppendState &app)
+    {
+      app = AppendState();
+      return hashSum(file);
+    }
+
+    /* Size of the data in a file. This only differs from file_size()
+       for compressed objects (see Packed), and is only called when an
+       entry doesn't match the file size. The default returns
+       file_size().
+     */
+    virtual uint64_t dataSize(const std::string &file)
+    { return file_size(file); }
   };
 
   struct CacheIndex : ICacheIndex
@@ -45,8 +128,11 @@ namespace Cache
     /* Add the given location to our cache, or confirm/refresh the
        entry if it already exists.
 
-       The function uses last_write_time() and file_size() to detect
-       whether a file needs to be rehashed.
+       The function uses FSystem::getStat() to detect whether a file
+       needs to be rehashed. The file is trusted if its size, mtime,
+       ctime, inode and device all match the entry. Files hashed
+       within the time stamp resolution of their last write are
+       checked again the next time.
 
        Throws if the file does not exist, unless if allowMissing=true,
        in which case a missing file causes a null hash return value.
@@ -73,24 +159,52 @@ namespace Cache
        non-null hashes must match the data in the file system.
 
        For large groups of files, this is potentially much faster than
-       running addFile() on each individual file. This is because
-       addFile() will normally write out the cache config file after
-       each addition, which can be very time consuming when the index
-       is large.
+       running addFile() on each individual file. Small files are
+       hashed together, and all the changes are saved to the config
+       file in one write.
 
        You can also specify an optional list of files to remove from
        the index.
+
+       The files are checked and hashed on several threads (see
+       setThreads()). If any of them fail, the rest are still added,
+       and the first error is thrown at the end.
+
+       If 'info' is given, it is updated with the number of files
+       done so far. If the job is aborted, the remaining files are
+       skipped, but anything done up to that point is kept.
      */
-    void addMany(const Spread::Hash::DirMap &files, const StrSet &remove = StrSet());
+    void addMany(const Spread::Hash::DirMap &files, const StrSet &remove = StrSet(),
+                 Spread::JobInfoPtr info = Spread::JobInfoPtr());
 
     /* Check a list of files. The given list is modified to contain
        up-to-date hashes for all the listed files, or null hashes if
        the file doesn't exist.
 
        Similarly to addMany(), this is more effective when checking
-       multiple files.
+       multiple files, and uses the same threads and 'info'
+       handling. Files skipped because of an abort keep the hash they
+       had on input, so check 'info' before using the result.
      */
-    void checkMany(Spread::Hash::DirMap &files);
+    void checkMany(Spread::Hash::DirMap &files,
+                   Spread::JobInfoPtr info = Spread::JobInfoPtr());
+
+    /* Resolve a list of hashes and optional targets at once, see
+       CIResolve. This gives the same results as running getStatus()
+       and findHash() on each element, but is much faster for long
+       lists. Each hash is only looked up once, no matter how many
+       times it is listed, and all the files are checked with a single
+       checkMany() call.
+
+       Only the first indexed file for each hash is checked up front.
+       If it turns out to be outdated, the remaining files are tried
+       through findHash(). Targets that aren't indexed with the right
+       hash are only hashed if no other source was found.
+
+       The 'info' parameter works like for checkMany().
+     */
+    void resolveMany(CIResolveList &list,
+                     Spread::JobInfoPtr info = Spread::JobInfoPtr());
 
     /* Remove a file entry from the cache. Doesn't actually delete the
        file.
@@ -104,21 +218,116 @@ namespace Cache
        - left alone if correct
        - updated if necessary
        - removed if files no longer exist
+
+       This runs through checkMany(), see above.
      */
-    void verify();
+    void verify(Spread::JobInfoPtr info = Spread::JobInfoPtr());
 
     /* Load data from a file. This file will be kept continually
        updated with changes from this point on.
 
        It's OK to specify a file that doesn't exist; it will be
        created on demand.
+
+       The file is a journal (see journal.hpp) that every change is
+       appended to. It is compacted in the background as it grows.
+       Config files in the old JSON format are converted on load.
+
+       If 'shared' is set, several processes can use the same file at
+       once. Changes made by one of them are seen by the others on
+       their next call, and compactions are coordinated through a
+       lock file. Most entries live in the snapshot, which every
+       process maps from the same file, so the memory for it is
+       shared as well. Only the lookup statistics (see getAccess())
+       are kept per process. Each process adds its own lookups to the
+       .access file when saving, but doesn't see those of the others
+       until it loads the file again.
+
+       All processes using a file must load it as shared. A file that
+       has been loaded as shared before (it has a FILE.lock next to
+       it) is always loaded as shared.
+     */
+    void load(const std::string &conf, bool shared=false);
+
+    /* Compact the config file right away, instead of waiting for the
+       background compaction. Useful before copying or backing up the
+       file.
+     */
+    void compact();
+
+    /* Enable resumable hashing for files of 'minSize' bytes or more.
+       The index then stores the hashing state of these files, and
+       when one of them changes, only the data past the old end of
+       the file is hashed, after a quick check of the bytes just
+       before it.
+
+       This is only safe for files that are never modified except by
+       appending, like logs and captures. Changes further back in the
+       file are NOT detected. A minSize of 0 (the default) turns the
+       feature off.
+     */
+    void setAppendHashing(uint64_t minSize);
+
+    /* Number of threads used by addMany(), checkMany() and verify()
+       to check and hash files. The default (0) uses one thread per
+       CPU core with the built-in file system, and a single thread
+       with a custom FSystem, since those are not required to be
+       thread safe.
      */
-    void load(const std::string &conf);
+    void setThreads(int num);
+
+    /* Watch a directory tree for changes, using inotify (see
+       DirWatcher.) Files in watched directories that have been
+       checked once are then trusted until a change is reported, so
+       lookups of them need no system calls at all. This is meant for
+       long-running processes, with the cache store and install
+       directories watched.
+
+       Files the watcher can't cover, eg. beyond the system watch
+       limit or after the event queue overflowed, are checked with
+       stat as usual. Returns false if the tree couldn't be watched
+       completely, or if we don't use the built-in file system.
+
+       Changes are picked up by a background thread, so a change made
+       right before a lookup may not be seen by it. If you changed a
+       file yourself, pass the new hash along with it.
+     */
+    bool watch(const std::string &dir);
 
     /* Get a complete list of all the entries in the index.
      */
     void getEntries(CIVector &result) const;
 
+    /* Get up to 'max' entries, in order of their file names, starting
+       after the file 'after' (which doesn't have to be in the index.)
+       Use "" to start from the beginning. Large indices can be walked
+       through this way without copying all the entries at once.
+     */
+    void getEntries(CIVector &result, const std::string &after,
+                    uint32_t max) const;
+
+    // Number of entries in the index
+    uint64_t size() const;
+
+    /* Get lookup statistics for a hash. Every successful findHash(),
+       and every getStatus() that finds a match, counts as an access
+       to the hash. Returns false if the hash was never looked up.
+
+       The statistics are used to pick files for eviction from the
+       cache store (see EvictJob.) They are kept in memory, and are
+       saved to CONF.access by saveAccess() and when the index is
+       destroyed. Entries for hashes that are no longer in the index
+       are dropped when saving.
+     */
+    bool getAccess(const Spread::Hash &hash, CIAccess &out) const;
+    void saveAccess();
+
+    /* Number of files, and bytes of data, that this object has read
+       from disk and hashed so far. Any other hash it returned came
+       straight from the index (or was given by the caller.)
+     */
+    void getHashStats(uint64_t &files, uint64_t &bytes) const;
+
     /* The optional 'conf' parameter is passed on to load() and is
        loaded as a config file. If the file does not exist, it will be
        created when the first cache entry is added.
@@ -135,8 +344,14 @@ namespace Cache
     FSystem *sys;
     struct _CacheIndex_Hidden;
     _CacheIndex_Hidden *ptr;
+    struct _Known;
     Spread::Hash addEntry(std::string &where, const Spread::Hash &given,
-                          uint64_t &time);
+                          uint64_t &time, const Spread::Hash *pre = NULL,
+                          bool *missing = NULL, const _Known *known = NULL);
+    void hashNew(const Spread::Hash::DirMap &files, Spread::Hash::DirMap &out);
+
+    struct _Bulk;
+    void runBulk(_Bulk &bulk, Spread::JobInfoPtr info);
 
   };
 }
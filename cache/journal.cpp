@@ -0,0 +1,782 @@
+#include "journal.hpp"
+
+#include <boost/thread/mutex.hpp>
+#include <boost/filesystem.hpp>
+#include <boost/crc.hpp>
+#include <stdexcept>
+#include <map>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef NEED_LOCKGUARD
+#include <boost/thread/lock_guard.hpp>
+#endif
+
+//#define PRINT_DEBUG
+#ifdef PRINT_DEBUG
+#include <iostream>
+#define PRINT(a) std::cout << a << "\n";
+#else
+#define PRINT(a)
+#endif
+
+using namespace Cache;
+using namespace Spread;
+
+namespace bfs = boost::filesystem;
+
+/* File layout:
+
+   8 byte header "SPIDXJ01"
+
+   Records, each:
+     uint32_t    payload length
+     uint32_t    CRC32 of payload
+     payload:
+       uint8_t   type (REC_ADD or REC_REMOVE)
+       uint32_t  name length, followed by the name
+     REC_ADD only:
+       40 bytes  hash
+       int64_t   write time
+       uint8_t   flags, see below
+     if FL_STATE:
+       40 bytes  state (8 x uint32_t words, then uint64_t size)
+       40 bytes  check hash
+     if FL_STAT:
+       int64_t   mtime, ctime (nanoseconds)
+       uint64_t  inode, device
+     if FL_SIZE:
+       uint64_t  file size, when it differs from the hash size
+
+   Older versions wrote the flags byte as 0 or 1 (FL_STATE), so their
+   records read the same way.
+
+   All numbers are in host byte order, like the binary Hash values.
+
+   Shared journals also have a FILE.lock, holding a SharedHeader.
+ */
+
+static const char HEADER[] = "SPIDXJ01";
+static const size_t HEADER_SIZE = 8;
+
+static const char LOCK_MAGIC[] = "SPIDXL01";
+
+/* Mapped by every process using a shared journal. The fields are
+   only changed while holding an exclusive lock on the file, but are
+   read without one by changed().
+ */
+struct SharedHeader
+{
+  char magic[8];
+
+  // Incremented by every compaction
+  volatile uint64_t epoch;
+
+  // End of the last complete record, and the number of records
+  volatile uint64_t size, count;
+};
+
+enum RecordType
+  {
+    REC_ADD = 1,
+    REC_REMOVE = 2
+  };
+
+enum RecordFlags
+  {
+    FL_STATE = 1,
+    FL_STAT = 2,
+    FL_RACY = 4,
+    FL_SIZE = 8
+  };
+
+// Anything larger than this is taken as a damaged length field
+static const uint32_t MAX_RECORD = 1024*1024;
+
+static uint32_t crc(const char *p, size_t num)
+{
+  boost::crc_32_type c;
+  c.process_bytes(p, num);
+  return c.checksum();
+}
+
+template <typename T>
+static void put(std::string &out, const T &val)
+{ out.append((const char*)&val, sizeof(T)); }
+
+static void putRecord(std::string &out, const JournalRecord &rec)
+{
+  std::string pl;
+  if(rec.hash.isNull())
+    put<uint8_t>(pl, REC_REMOVE);
+  else
+    put<uint8_t>(pl, REC_ADD);
+
+  put<uint32_t>(pl, rec.file.size());
+  pl += rec.file;
+
+  if(!rec.hash.isNull())
+    {
+      pl.append((const char*)rec.hash.getData(), 40);
+      put<int64_t>(pl, rec.writeTime);
+
+      uint8_t flags = 0;
+      if(rec.state.isSet()) flags |= FL_STATE;
+      if(rec.st.mtime) flags |= FL_STAT;
+      if(rec.st.mtime && rec.st.size != rec.hash.size()) flags |= FL_SIZE;
+      if(rec.racy) flags |= FL_RACY;
+      put<uint8_t>(pl, flags);
+
+      if(flags & FL_STATE)
+        {
+          pl.append((const char*)rec.state.h, 32);
+          put<uint64_t>(pl, rec.state.size);
+          pl.append((const char*)rec.check.getData(), 40);
+        }
+      if(flags & FL_STAT)
+        {
+          put<int64_t>(pl, rec.st.mtime);
+          put<int64_t>(pl, rec.st.ctime);
+          put<uint64_t>(pl, rec.st.inode);
+          put<uint64_t>(pl, rec.st.device);
+        }
+      if(flags & FL_SIZE)
+        put<uint64_t>(pl, rec.st.size);
+    }
+
+  put<uint32_t>(out, pl.size());
+  put<uint32_t>(out, crc(pl.data(), pl.size()));
+  out += pl;
+}
+
+// Reads values from a record payload, checking that they fit
+struct Reader
+{
+  const char *p, *end;
+
+  bool get(void *out, size_t num)
+  {
+    if((size_t)(end-p) < num) return false;
+    memcpy(out, p, num);
+    p += num;
+    return true;
+  }
+
+  template <typename T>
+  bool get(T &out) { return get(&out, sizeof(T)); }
+
+  bool get(Hash &out)
+  {
+    uint8_t buf[40];
+    if(!get(buf, 40)) return false;
+    out.copy(buf);
+    return true;
+  }
+};
+
+// Decodes a payload. Returns false if it doesn't make sense.
+static bool getRecord(const char *p, uint32_t len, JournalRecord &rec)
+{
+  Reader r = { p, p+len };
+
+  uint8_t type;
+  uint32_t nlen;
+  if(!r.get(type) || !r.get(nlen) || nlen > len)
+    return false;
+  if(type != REC_ADD && type != REC_REMOVE)
+    return false;
+
+  rec = JournalRecord();
+  rec.file.resize(nlen);
+  if(nlen && !r.get(&rec.file[0], nlen)) return false;
+
+  if(type == REC_REMOVE)
+    return r.p == r.end;
+
+  uint8_t flags;
+  if(!r.get(rec.hash) || !r.get(rec.writeTime) || !r.get(flags))
+    return false;
+  if((flags & FL_STATE) &&
+     (!r.get(rec.state.h, 32) || !r.get(rec.state.size) ||
+      !r.get(rec.check)))
+    return false;
+  if((flags & FL_STAT) &&
+     (!r.get(rec.st.mtime) || !r.get(rec.st.ctime) ||
+      !r.get(rec.st.inode) || !r.get(rec.st.device)))
+    return false;
+  rec.racy = (flags & FL_RACY) != 0;
+
+  // The size is only stored when it isn't the hash size
+  if(flags & FL_STAT) rec.st.size = rec.hash.size();
+  if((flags & FL_SIZE) && !r.get(rec.st.size))
+    return false;
+
+  return r.p == r.end && !rec.hash.isNull();
+}
+
+/* Decode the records in 'data' starting at 'pos', until the end or
+   the first incomplete or damaged record. Each record is passed to
+   'out' in order. Returns the end of the last good record, and adds
+   the number of records read to 'count'.
+ */
+template <typename F>
+static uint64_t readRecords(const std::string &data, uint64_t pos,
+                            uint64_t &count, F &out)
+{
+  while(true)
+    {
+      uint32_t len, sum;
+      if(data.size() - pos < 8) break;
+      memcpy(&len, &data[pos], 4);
+      memcpy(&sum, &data[pos+4], 4);
+      if(len > MAX_RECORD || data.size() - pos - 8 < len) break;
+
+      const char *p = &data[pos+8];
+      JournalRecord rec;
+      if(crc(p, len) != sum || !getRecord(p, len, rec))
+        break;
+
+      out(rec);
+
+      pos += 8 + len;
+      count++;
+    }
+  return pos;
+}
+
+// Keeps the last record for each file
+struct LastRecord
+{
+  std::map<std::string, JournalRecord> last;
+  void operator()(const JournalRecord &rec) { last[rec.file] = rec; }
+};
+
+// Keeps all records in order
+struct AllRecords
+{
+  JRVector &out;
+  void operator()(const JournalRecord &rec) { out.push_back(rec); }
+};
+
+// Only counts the records
+struct NoRecords
+{
+  void operator()(const JournalRecord &) {}
+};
+
+/* Holds an flock() on a file until destroyed. Does nothing if the
+   file descriptor is -1, which is what unshared journals use.
+ */
+struct FileLock
+{
+  int fd;
+
+  FileLock() : fd(-1) {}
+  FileLock(int f, bool excl) : fd(-1) { lock(f, excl); }
+  ~FileLock() { unlock(); }
+
+  void lock(int f, bool excl)
+  {
+    unlock();
+    if(f < 0) return;
+    int res;
+    do res = flock(f, excl ? LOCK_EX : LOCK_SH);
+    while(res != 0 && errno == EINTR);
+    if(res != 0)
+      throw std::runtime_error(std::string("Cannot lock index journal: ") + strerror(errno));
+    fd = f;
+  }
+
+  void unlock()
+  {
+    if(fd >= 0) flock(fd, LOCK_UN);
+    fd = -1;
+  }
+};
+struct IndexJournal::_Internal
+{
+  std::string file;
+  boost::mutex mutex;
+
+  // Open for appending, or -1 if not opened yet
+  int fd;
+
+  /* Bytes and records in the file. For shared journals, this is
+     how far we have read, which may be behind the end of the file.
+   */
+  uint64_t size, count;
+
+  // Record count at the last mark()
+  uint64_t markCount;
+
+  /* Only used by shared journals. 'lockFd' is the open lock file,
+     and 'shared' its mapped header. 'readEpoch' is the epoch 'size'
+     refers to, 'fdEpoch' that of the file 'fd' is open on, and
+     'markEpoch' the one at the last mark().
+   */
+  int lockFd;
+  SharedHeader *shared;
+  uint64_t readEpoch, fdEpoch, markEpoch;
+
+  _Internal() : fd(-1), size(0), count(0), markCount(0), lockFd(-1), shared(NULL),
+                readEpoch(0), fdEpoch(0), markEpoch(0) {}
+  ~_Internal()
+  {
+    close();
+    if(shared) munmap(shared, sizeof(SharedHeader));
+    if(lockFd >= 0) ::close(lockFd);
+  }
+
+  void close()
+  {
+    if(fd >= 0) ::close(fd);
+    fd = -1;
+  }
+
+  void fail(const std::string &msg, const std::string &name)
+  {
+    throw std::runtime_error(msg + " " + name + ": " + strerror(errno));
+  }
+
+  static int openFile(const std::string &name, int flags)
+  {
+    int res;
+    do res = ::open(name.c_str(), flags, 0644);
+    while(res < 0 && errno == EINTR);
+    return res;
+  }
+
+  void writeAll(int f, const char *p, size_t num, const std::string &name)
+  {
+    while(num)
+      {
+        ssize_t res = ::write(f, p, num);
+        if(res < 0 && errno == EINTR) continue;
+        if(res <= 0) fail("Error writing", name);
+        p += res;
+        num -= res;
+      }
+  }
+
+  void readAt(int f, std::string &out, uint64_t pos, const std::string &name)
+  {
+    size_t done = 0;
+    while(done < out.size())
+      {
+        ssize_t res = ::pread(f, &out[done], out.size()-done, pos+done);
+        if(res < 0 && errno == EINTR) continue;
+        if(res <= 0) fail("Error reading", name);
+        done += res;
+      }
+  }
+
+  uint64_t fileSize(int f, const std::string &name)
+  {
+    struct stat st;
+    if(fstat(f, &st) != 0) fail("Cannot stat", name);
+    return st.st_size;
+  }
+
+  // Open and map the lock file of a shared journal
+  void openShared()
+  {
+    std::string name = file + ".lock";
+    bfs::path parent = bfs::path(name).parent_path();
+    if(!parent.empty()) bfs::create_directories(parent);
+
+    lockFd = openFile(name, O_RDWR | O_CREAT);
+    if(lockFd < 0) fail("Cannot open", name);
+
+    FileLock lock(lockFd, true);
+    if(fileSize(lockFd, name) < sizeof(SharedHeader))
+      {
+        if(ftruncate(lockFd, sizeof(SharedHeader)) != 0)
+          fail("Cannot resize", name);
+      }
+
+    void *p = mmap(NULL, sizeof(SharedHeader), PROT_READ | PROT_WRITE,
+                   MAP_SHARED, lockFd, 0);
+    if(p == MAP_FAILED) fail("Cannot map", name);
+    shared = (SharedHeader*)p;
+
+    // A new file. The size is filled in by the next load().
+    if(memcmp(shared->magic, LOCK_MAGIC, 8) != 0)
+      {
+        shared->epoch = shared->size = shared->count = 0;
+        memcpy(shared->magic, LOCK_MAGIC, 8);
+      }
+  }
+
+  /* Open the file for appending, creating it if necessary. Shared
+     journals must hold the lock, and reopen the file if it was
+     replaced by a compaction.
+   */
+  void open()
+  {
+    if(fd >= 0 && (!shared || fdEpoch == shared->epoch)) return;
+    close();
+
+    bfs::path parent = bfs::path(file).parent_path();
+    if(!parent.empty()) bfs::create_directories(parent);
+
+    fd = openFile(file, O_RDWR | O_CREAT | O_APPEND);
+    if(fd < 0) fail("Cannot open", file);
+
+    uint64_t end = fileSize(fd, file);
+    if(end == 0)
+      {
+        writeAll(fd, HEADER, HEADER_SIZE, file);
+        end = HEADER_SIZE;
+      }
+
+    if(shared)
+      fdEpoch = shared->epoch;
+    else
+      size = end;
+  }
+
+  /* Find the end of a shared journal, with the lock held. If the
+     file goes on past the end in the header, a process died while
+     appending. Keep any complete records it wrote, and cut off the
+     rest.
+   */
+  uint64_t sharedEnd()
+  {
+    open();
+    uint64_t end = fileSize(fd, file);
+    uint64_t pos = shared->size;
+    if(end == pos) return end;
+
+    if(end > pos && pos >= HEADER_SIZE)
+      {
+        std::string data(end - pos, 0);
+        readAt(fd, data, pos, file);
+        NoRecords none;
+        uint64_t num = 0;
+        uint64_t good = pos + readRecords(data, 0, num, none);
+        if(good < end)
+          {
+            PRINT("Journal " << file << ": dropping " << end-good << " bytes");
+            if(ftruncate(fd, good) != 0)
+              fail("Cannot truncate", file);
+          }
+        shared->count += num;
+        end = good;
+      }
+    shared->size = end;
+    return end;
+  }
+
+  // Must be called with the mutex held
+  void append(const std::string &data, uint64_t num)
+  {
+    FileLock lock(lockFd, true);
+    if(!shared)
+      {
+        open();
+        writeAll(fd, data.data(), data.size(), file);
+        size += data.size();
+        count += num;
+        return;
+      }
+
+    uint64_t end = sharedEnd();
+    writeAll(fd, data.data(), data.size(), file);
+
+    // If we were up to date, there is no need to read our own
+    // records back later
+    if(readEpoch == shared->epoch && size == end)
+      {
+        size += data.size();
+        count += num;
+      }
+    shared->size = end + data.size();
+    shared->count += num;
+  }
+
+  // Read the whole file into 'out'. Returns false if it's missing.
+  static bool slurp(const std::string &name, std::string &out)
+  {
+    int f = openFile(name, O_RDONLY);
+    if(f < 0) return false;
+
+    out.clear();
+    char buf[64*1024];
+    while(true)
+      {
+        ssize_t res = ::read(f, buf, sizeof(buf));
+        if(res < 0 && errno == EINTR) continue;
+        if(res < 0)
+          {
+            ::close(f);
+            throw std::runtime_error("Error reading " + name);
+          }
+        if(res == 0) break;
+        out.append(buf, res);
+      }
+    ::close(f);
+    return true;
+  }
+};
+
+IndexJournal::IndexJournal(const std::string &file, bool shared)
+  : ptr(new _Internal)
+{
+  ptr->file = file;
+  if(shared) ptr->openShared();
+}
+
+bool IndexJournal::isJournal(const std::string &file)
+{
+  char buf[HEADER_SIZE];
+  int f = _Internal::openFile(file, O_RDONLY);
+  if(f < 0) return false;
+  bool res = ::read(f, buf, HEADER_SIZE) == HEADER_SIZE &&
+    memcmp(buf, HEADER, HEADER_SIZE) == 0;
+  ::close(f);
+  return res;
+}
+
+bool IndexJournal::load(JRVector &out)
+{
+  boost::lock_guard<boost::mutex> lock(ptr->mutex);
+  FileLock shared(ptr->lockFd, true);
+  const std::string &file = ptr->file;
+  out.clear();
+
+  ptr->close();
+  ptr->size = ptr->count = 0;
+
+  // Leftovers from an interrupted compaction
+  if(bfs::exists(file + ".new"))
+    bfs::remove(file + ".new");
+
+  /* Shared journals are created up front, so that all readers start
+     out past the header. Leave a legacy .old file for the caller to
+     find, though.
+   */
+  if(ptr->shared)
+    {
+      ptr->readEpoch = ptr->shared->epoch;
+      if(!bfs::exists(file + ".old"))
+        ptr->open();
+    }
+
+  std::string data;
+  if(!_Internal::slurp(file, data))
+    // A legacy config may have been left as .old by a crash
+    return !bfs::exists(file + ".old");
+
+  if(data.size() == 0)
+    return true;
+
+  if(data.size() < HEADER_SIZE || memcmp(data.data(), HEADER, HEADER_SIZE) != 0)
+    {
+      // Don't read the legacy data back as records
+      ptr->size = data.size();
+      return false;
+    }
+
+  // Replay all records, later ones replacing earlier ones
+  LastRecord recs;
+  uint64_t count = 0;
+  uint64_t pos = readRecords(data, HEADER_SIZE, count, recs);
+
+  // Cut off anything we couldn't read, so new records follow the
+  // last good one.
+  if(pos < data.size())
+    {
+      PRINT("Journal " << file << ": dropping " << data.size()-pos << " bytes");
+      if(truncate(file.c_str(), pos) != 0)
+        ptr->fail("Cannot truncate", file);
+    }
+
+  ptr->size = pos;
+  ptr->count = count;
+
+  if(ptr->shared)
+    {
+      ptr->shared->size = pos;
+      ptr->shared->count = count;
+    }
+
+  out.reserve(recs.last.size());
+  std::map<std::string, JournalRecord>::iterator it;
+  for(it = recs.last.begin(); it != recs.last.end(); it++)
+    out.push_back(it->second);
+
+  return true;
+}
+
+bool IndexJournal::changed() const
+{
+  const SharedHeader *sh = ptr->shared;
+  if(!sh) return false;
+
+  boost::lock_guard<boost::mutex> lock(ptr->mutex);
+  return sh->epoch != ptr->readEpoch || sh->size != ptr->size;
+}
+
+bool IndexJournal::update(JRVector &out)
+{
+  if(!ptr->shared) return true;
+
+  boost::lock_guard<boost::mutex> lock(ptr->mutex);
+  FileLock shared(ptr->lockFd, false);
+  if(ptr->shared->epoch != ptr->readEpoch)
+    return false;
+
+  uint64_t end = ptr->shared->size;
+  if(end <= ptr->size)
+    return true;
+
+  // The file can't have been replaced, since the epoch still matches
+  ptr->open();
+  std::string data(end - ptr->size, 0);
+  ptr->readAt(ptr->fd, data, ptr->size, ptr->file);
+
+  AllRecords all = { out };
+  ptr->size += readRecords(data, 0, ptr->count, all);
+  return true;
+}
+
+void IndexJournal::append(const JRVector &recs)
+{
+  if(recs.size() == 0) return;
+
+  std::string data;
+  for(int i=0; i<recs.size(); i++)
+    putRecord(data, recs[i]);
+
+  boost::lock_guard<boost::mutex> lock(ptr->mutex);
+  ptr->append(data, recs.size());
+}
+
+void IndexJournal::add(const JournalRecord &rec)
+{
+  assert(!rec.hash.isNull());
+  std::string data;
+  putRecord(data, rec);
+
+  boost::lock_guard<boost::mutex> lock(ptr->mutex);
+  ptr->append(data, 1);
+}
+
+void IndexJournal::remove(const std::string &file)
+{
+  JournalRecord rec;
+  rec.file = file;
+  std::string data;
+  putRecord(data, rec);
+
+  boost::lock_guard<boost::mutex> lock(ptr->mutex);
+  ptr->append(data, 1);
+}
+
+uint64_t IndexJournal::records() const
+{
+  boost::lock_guard<boost::mutex> lock(ptr->mutex);
+  if(ptr->shared) return ptr->shared->count;
+  return ptr->count;
+}
+
+uint64_t IndexJournal::mark()
+{
+  boost::lock_guard<boost::mutex> lock(ptr->mutex);
+  if(!ptr->shared) ptr->open();
+  ptr->markCount = ptr->count;
+  ptr->markEpoch = ptr->readEpoch;
+  return ptr->size;
+}
+
+bool IndexJournal::compact(const JRVector &live, uint64_t pos,
+                           const std::string &from, const std::string &to)
+{
+  const std::string &file = ptr->file;
+  std::string newFile = file + ".new";
+
+  PRINT("Compacting " << file << ": " << live.size() << " entries");
+
+  std::string data(HEADER, HEADER_SIZE);
+  for(int i=0; i<live.size(); i++)
+    putRecord(data, live[i]);
+
+  /* Unshared journals write the live entries before taking the lock,
+     so appends can go on meanwhile. Shared journals hold the lock
+     all along, since all the processes use the same temporary file.
+   */
+  boost::unique_lock<boost::mutex> lock(ptr->mutex, boost::defer_lock);
+  FileLock shared;
+  if(ptr->shared)
+    {
+      lock.lock();
+      shared.lock(ptr->lockFd, true);
+      if(ptr->shared->epoch != ptr->markEpoch)
+        return false;
+    }
+
+  int f = _Internal::openFile(newFile, O_RDWR | O_CREAT | O_TRUNC | O_APPEND);
+  if(f < 0) ptr->fail("Cannot open", newFile);
+
+  try
+    {
+      ptr->writeAll(f, data.data(), data.size(), newFile);
+
+      // Then copy whatever was appended in the meantime, and swap
+      // the files before anything else can be added.
+      if(!lock.owns_lock()) lock.lock();
+      uint64_t end;
+      if(ptr->shared)
+        end = ptr->sharedEnd();
+      else
+        {
+          ptr->open();
+          end = ptr->size;
+        }
+      assert(pos <= end);
+
+      std::string tail(end - pos, 0);
+      ptr->readAt(ptr->fd, tail, pos, file);
+      ptr->writeAll(f, tail.data(), tail.size(), newFile);
+
+      if(fsync(f) != 0) ptr->fail("Cannot sync", newFile);
+      if(from != "" && ::rename(from.c_str(), to.c_str()) != 0)
+        ptr->fail("Cannot rename", from);
+      if(::rename(newFile.c_str(), file.c_str()) != 0)
+        ptr->fail("Cannot rename", newFile);
+
+      ptr->close();
+      ptr->fd = f;
+      uint64_t total = ptr->shared ? ptr->shared->count : ptr->count;
+      total = live.size() + total - ptr->markCount;
+
+      if(ptr->shared)
+        {
+          // Everyone, including us, has to start over from load()
+          ptr->shared->size = data.size() + tail.size();
+          ptr->shared->count = total;
+          ptr->shared->epoch++;
+          ptr->fdEpoch = ptr->shared->epoch;
+        }
+      else
+        {
+          ptr->size = data.size() + tail.size();
+          ptr->count = total;
+          ptr->markCount = ptr->count;
+        }
+    }
+  catch(...)
+    {
+      if(ptr->fd != f) ::close(f);
+      boost::system::error_code ec;
+      bfs::remove(newFile, ec);
+      throw;
+    }
+  return true;
+}
@@ -0,0 +1,150 @@
+#ifndef __SPREAD_CACHE_JOURNAL_HPP_
+#define __SPREAD_CACHE_JOURNAL_HPP_
+
+#include "iindex.hpp"
+#include <boost/shared_ptr.hpp>
+#include <stdint.h>
+#include <vector>
+#include <string>
+
+/* Append-only storage for CacheIndex entries.
+
+   The file is a short header followed by a list of binary records,
+   each either adding (or replacing) one entry, or removing one. Every
+   change to the index is one record appended to the end of the file,
+   so the cost of a change does not depend on the size of the index.
+
+   Each record carries its length and a CRC32 of its contents. If the
+   program dies in the middle of a write, load() stops at the first
+   incomplete or damaged record, and cuts the file off there before
+   anything new is appended.
+
+   Since replaced and removed entries stay in the file, it has to be
+   compacted now and then. compact() writes the given live entries to
+   a new file, copies over anything appended since mark() was called,
+   and then renames the new file into place. The old file stays intact
+   until the rename, so a crash during compaction loses nothing. This
+   makes it possible to take the snapshot under the index lock, and do
+   the actual writing on a background thread while the index keeps
+   appending. (CacheIndex passes no live entries, and writes them to
+   an IndexSnapshot instead.)
+
+   All functions are thread safe, but only one compaction should run
+   at a time.
+
+   A shared journal can be used by several processes at once. Every
+   process appends to the same file, and reads the records the others
+   appended through update(). Appends and compactions are serialized
+   with flock() on FILE.lock, which also holds a small header that
+   all the processes map into memory. It counts the records and
+   compactions, so changed() can tell if there is anything new
+   without a single system call. A process that crashed in the middle
+   of an append leaves a damaged tail, which the next append cuts off.
+
+   All processes using a file must open it as shared. Mixing shared
+   and unshared use of the same file is not safe, which is why
+   CacheIndex::load() opens a journal with a FILE.lock as shared.
+ */
+
+namespace Cache
+{
+  struct JournalRecord
+  {
+    std::string file;
+
+    // A null hash means the entry was removed
+    Spread::Hash hash;
+    int64_t writeTime;
+
+    // Optional append hashing state, see CacheIndex::setAppendHashing()
+    Spread::HashState state;
+    Spread::Hash check;
+
+    /* The file as it was when hashed. Entries from older versions
+       only have writeTime, and st.mtime is zero. 'racy' means the
+       file was hashed so soon after it was written that the stat
+       can't be trusted, see CacheIndex::addEntry().
+     */
+    FileStat st;
+    bool racy;
+
+    JournalRecord() : writeTime(0), racy(false) {}
+  };
+
+  typedef std::vector<JournalRecord> JRVector;
+
+  class IndexJournal
+  {
+    struct _Internal;
+    boost::shared_ptr<_Internal> ptr;
+
+  public:
+    IndexJournal(const std::string &file, bool shared=false);
+
+    /* Read the file, and fill 'out' with the last record for each
+       file, sorted by name. This includes removals (null hashes), so
+       the records can be applied on top of an older IndexSnapshot. A
+       damaged tail is cut off the file.
+
+       A missing file is just empty. If the file exists but is not a
+       journal (or only a legacy .old file exists), nothing is read and
+       false is returned. The caller can then read it some other way
+       and convert it with rewrite().
+     */
+    bool load(JRVector &out);
+
+    // Append records. All the records are written in one go.
+    void append(const JRVector &recs);
+    void add(const JournalRecord &rec);
+    void remove(const std::string &file);
+
+    /* Check if a shared journal has records we haven't read yet,
+       or has been compacted since load(). This only looks at the
+       mapped header. Always false for unshared journals.
+     */
+    bool changed() const;
+
+    /* Get the records appended since load() or the last update(),
+       in the order they were written. These may include our own
+       records, which are then just applied a second time.
+
+       Returns false if the journal was compacted in the meantime
+       (by any process.) Nothing is read then, and the caller must
+       start over with load() and a fresh snapshot.
+     */
+    bool update(JRVector &out);
+
+    // Number of records in the file, including replaced entries
+    uint64_t records() const;
+
+    /* Current end of the file, for compact(). For shared journals,
+       this is as far as we have read, not counting records from
+       other processes that update() hasn't picked up yet.
+     */
+    uint64_t mark();
+
+    /* Replace the file with 'live', plus any records appended after
+       'pos' (as returned by mark()). Throws on errors, in which case
+       the old file is kept.
+
+       If 'from' is given, it is renamed to 'to' right before the
+       new file is moved into place, so that a file written for this
+       compaction (like a snapshot) changes together with the
+       journal. For shared journals, both renames happen while the
+       other processes are locked out.
+
+       Returns false if the journal was compacted by someone else
+       since mark(). Nothing is changed then.
+     */
+    bool compact(const JRVector &live, uint64_t pos,
+                 const std::string &from = "", const std::string &to = "");
+
+    // Compact right now. The caller makes sure nothing is appended
+    // while this runs.
+    void rewrite(const JRVector &live) { compact(live, mark()); }
+
+    // Check if a file starts with a journal header
+    static bool isJournal(const std::string &file);
+  };
+}
+#endif
@@ -0,0 +1,318 @@
+#include "packed.hpp"
+
+#include "hash/hash_stream.hpp"
+#include "misc/mapped_stream.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/thread/mutex.hpp>
+#ifdef NEED_LOCKGUARD
+#include <boost/thread/lock_guard.hpp>
+#endif
+#include <stdexcept>
+#include <new>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <zlib.h>
+
+using namespace Cache;
+using namespace Spread;
+using namespace Mangle::Stream;
+
+namespace bfs = boost::filesystem;
+
+static const char MAGIC[4] = { 'S', 'P', 'Z', '1' };
+const char Packed::SUFFIX[] = ".spz";
+static const size_t HEADER = 12;
+static const size_t BLOCK = 256*1024;
+
+// Closes the file when going out of scope
+struct StdFile
+{
+  FILE *f;
+  StdFile(const std::string &name, const char *mode)
+  { f = fopen(name.c_str(), mode); }
+  ~StdFile() { if(f) fclose(f); }
+};
+
+// Read the header. Returns false if it isn't there.
+static bool readHeader(FILE *f, uint64_t &size)
+{
+  unsigned char buf[HEADER];
+  if(fread(buf, 1, HEADER, f) != HEADER || memcmp(buf, MAGIC, 4) != 0)
+    return false;
+
+  size = 0;
+  for(int i=7; i>=0; i--)
+    size = (size << 8) | buf[4+i];
+  return true;
+}
+
+static void writeHeader(FILE *f, uint64_t size)
+{
+  unsigned char buf[HEADER];
+  memcpy(buf, MAGIC, 4);
+  for(int i=0; i<8; i++)
+    buf[4+i] = (size >> (8*i)) & 0xff;
+  fwrite(buf, 1, HEADER, f);
+}
+
+// Decompressing read stream for packed files
+struct PackedStream : Stream
+{
+  StdFile inf;
+  z_stream z;
+  std::vector<unsigned char> buf;
+  uint64_t len, pos;
+  bool done;
+  std::string name;
+
+  PackedStream(const std::string &file)
+    : inf(file, "rb"), buf(BLOCK), len(0), pos(0), done(false), name(file)
+  {
+    if(!inf.f)
+      throw Misc::FileError("Cannot read " + file, errno);
+    if(!readHeader(inf.f, len))
+      {
+        if(ferror(inf.f))
+          throw Misc::FileError("Cannot read " + file, errno);
+        throw PackedError(file);
+      }
+
+    memset(&z, 0, sizeof(z));
+    if(inflateInit(&z) != Z_OK)
+      throw std::runtime_error("inflateInit() failed");
+
+    isSeekable = false;
+    hasPosition = true;
+    hasSize = true;
+    hasPtr = false;
+    isReadable = true;
+    isWritable = false;
+  }
+
+  ~PackedStream() { inflateEnd(&z); }
+
+  size_t read(void *data, size_t count)
+  {
+    unsigned char *out = (unsigned char*)data;
+    size_t got = 0;
+    while(got < count && !done)
+      {
+        if(z.avail_in == 0)
+          {
+            z.next_in = &buf[0];
+            z.avail_in = fread(&buf[0], 1, buf.size(), inf.f);
+            if(z.avail_in == 0)
+              {
+                if(ferror(inf.f))
+                  throw Misc::FileError("Cannot read " + name, errno);
+                throw PackedError(name);
+              }
+          }
+
+        size_t num = count-got;
+        if(num > 0x40000000) num = 0x40000000;
+        z.next_out = out+got;
+        z.avail_out = num;
+        int res = inflate(&z, Z_NO_FLUSH);
+        got += num - z.avail_out;
+
+        if(res == Z_STREAM_END) done = true;
+        else if(res == Z_MEM_ERROR)
+          throw std::bad_alloc();
+        else if(res != Z_OK)
+          throw PackedError(name);
+      }
+    pos += got;
+    return got;
+  }
+
+  size_t tell() const { return pos; }
+  size_t size() const { return len; }
+  bool eof() const { return done || pos >= len; }
+};
+
+// Registered store directories, absolute and ending in a slash
+struct Stores
+{
+  boost::mutex mutex;
+  std::vector<std::string> dirs;
+};
+
+static Stores &stores()
+{
+  static Stores s;
+  return s;
+}
+
+void Packed::addStore(const std::string &dir)
+{
+  std::string abs = bfs::absolute(dir).string();
+  while(abs.size() > 1 && abs[abs.size()-1] == '/')
+    abs.resize(abs.size()-1);
+  abs += "/";
+
+  Stores &s = stores();
+  boost::lock_guard<boost::mutex> lock(s.mutex);
+  for(int i=0; i<s.dirs.size(); i++)
+    if(s.dirs[i] == abs) return;
+  s.dirs.push_back(abs);
+}
+
+bool Packed::isPacked(const std::string &file)
+{
+  // Most files are ruled out by the name alone
+  size_t slen = sizeof(SUFFIX)-1;
+  if(file.size() <= slen ||
+     file.compare(file.size()-slen, slen, SUFFIX) != 0)
+    return false;
+
+  std::string abs = bfs::absolute(file).string();
+  Stores &s = stores();
+  boost::lock_guard<boost::mutex> lock(s.mutex);
+  for(int i=0; i<s.dirs.size(); i++)
+    if(abs.compare(0, s.dirs[i].size(), s.dirs[i]) == 0)
+      return true;
+  return false;
+}
+
+uint64_t Packed::dataSize(const std::string &file)
+{
+  if(!isPacked(file))
+    return bfs::file_size(file);
+
+  StdFile inf(file, "rb");
+  uint64_t size;
+  if(!inf.f)
+    throw Misc::FileError("Cannot read " + file, errno);
+  if(!readHeader(inf.f, size))
+    throw PackedError(file);
+  return size;
+}
+
+Hash Packed::hashSum(const std::string &file, bool map)
+{
+  if(!isPacked(file))
+    return HashStream::sum(file, HashStream::FILESIZE, map);
+
+  PackedStream inf(file);
+  HashBuilder hash;
+  std::vector<char> buf(BLOCK);
+  while(!inf.eof())
+    {
+      size_t num = inf.read(&buf[0], buf.size());
+      if(num == 0) break;
+      hash.update(&buf[0], num);
+    }
+  return hash.finish();
+}
+
+bool Packed::pack(const std::string &file, double ratio, int level)
+{
+  // Only plain objects inside a store can be packed
+  if(isPacked(file) || !isPacked(packedName(file))) return false;
+  uint64_t size = bfs::file_size(file);
+  if(size < MIN_SIZE) return false;
+
+  StdFile inf(file, "rb");
+  if(!inf.f)
+    throw std::runtime_error("Cannot read " + file);
+  std::vector<unsigned char> in(BLOCK), out(compressBound(BLOCK));
+
+  // Try the first block on its own, to weed out incompressible data
+  {
+    size_t num = fread(&in[0], 1, in.size(), inf.f);
+    uLongf outLen = out.size();
+    if(compress2(&out[0], &outLen, &in[0], num, level) != Z_OK ||
+       outLen > num*ratio)
+      return false;
+    rewind(inf.f);
+  }
+
+  std::string tmp = file + ".pack";
+  uint64_t total = HEADER;
+  {
+    StdFile outf(tmp, "wb");
+    if(!outf.f)
+      throw std::runtime_error("Cannot write " + tmp);
+    writeHeader(outf.f, size);
+
+    z_stream z;
+    memset(&z, 0, sizeof(z));
+    if(deflateInit(&z, level) != Z_OK)
+      throw std::runtime_error("deflateInit() failed");
+
+    int flush = Z_NO_FLUSH;
+    while(flush != Z_FINISH)
+      {
+        z.next_in = &in[0];
+        z.avail_in = fread(&in[0], 1, in.size(), inf.f);
+        if(feof(inf.f) || ferror(inf.f)) flush = Z_FINISH;
+
+        do
+          {
+            z.next_out = &out[0];
+            z.avail_out = out.size();
+            deflate(&z, flush);
+            size_t num = out.size() - z.avail_out;
+            fwrite(&out[0], 1, num, outf.f);
+            total += num;
+          }
+        while(z.avail_out == 0);
+      }
+    deflateEnd(&z);
+
+    bool failed = ferror(inf.f) || ferror(outf.f) || z.total_in != size;
+    if(fflush(outf.f) != 0 || failed)
+      {
+        bfs::remove(tmp);
+        throw std::runtime_error("Failed to pack " + file);
+      }
+  }
+
+  // Not worth it after all
+  if(total > size*ratio)
+    {
+      bfs::remove(tmp);
+      return false;
+    }
+
+  bfs::rename(tmp, packedName(file));
+  bfs::remove(file);
+  return true;
+}
+
+StreamPtr Packed::open(const std::string &file, bool map)
+{
+  if(isPacked(file))
+    return StreamPtr(new PackedStream(file));
+  return Misc::MappedFileStream::Open(file, map);
+}
+
+void Packed::unpackTo(const std::string &file, const std::string &to)
+{
+  if(!isPacked(file))
+    {
+      bfs::copy_file(file, to);
+      return;
+    }
+
+  PackedStream inf(file);
+  StdFile outf(to, "wb");
+  if(!outf.f)
+    throw std::runtime_error("Cannot write " + to);
+
+  std::vector<char> buf(BLOCK);
+  uint64_t total = 0;
+  while(!inf.eof())
+    {
+      size_t num = inf.read(&buf[0], buf.size());
+      if(num == 0) break;
+      if(fwrite(&buf[0], 1, num, outf.f) != num)
+        throw std::runtime_error("Cannot write " + to);
+      total += num;
+    }
+  if(total != inf.size() || fflush(outf.f) != 0)
+    throw std::runtime_error("Failed to unpack " + file);
+}
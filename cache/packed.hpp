@@ -0,0 +1,87 @@
+#ifndef __SPREAD_CACHE_PACKED_HPP_
+#define __SPREAD_CACHE_PACKED_HPP_
+
+#include <hash/hash.hpp>
+#include <mangle/stream/stream.hpp>
+#include <stdexcept>
+
+namespace Cache
+{
+  // Thrown when a packed file holds data that can't be decoded
+  struct PackedError : std::runtime_error
+  {
+    PackedError(const std::string &file)
+      : std::runtime_error("Packed file is damaged: " + file) {}
+  };
+
+  /* Compressed objects for the cache store (see Files::compress.)
+
+     A packed file starts with a 12 byte header: the magic string
+     "SPZ1", then the size of the uncompressed data as a 64 bit little
+     endian number. The rest is the data, compressed with zlib.
+
+     Packed files are only ever recognized by name, never by their
+     contents: a packed object is the store path of the object plus
+     SUFFIX, inside a store directory registered with addStore(). Any
+     other file is plain, whatever it contains.
+
+     The cache index hashes packed files by their uncompressed data,
+     so a packed object is found under the same Hash as a plain copy
+     would be. Anything that reads a file found through the cache must
+     therefore go through open() or unpackTo() below, which pass plain
+     files through untouched.
+   */
+  struct Packed
+  {
+    // Files smaller than this are never packed
+    static const uint64_t MIN_SIZE = 4096;
+
+    // Added to the store path of packed objects
+    static const char SUFFIX[];
+
+    /* Register a cache store directory. Only files inside one of
+       these can be packed. Files does this for its basedir.
+     */
+    static void addStore(const std::string &dir);
+
+    // Name of the packed version of a store object
+    static std::string packedName(const std::string &file)
+    { return file + SUFFIX; }
+
+    /* True if 'file' is a packed object, ie. it ends in SUFFIX and is
+       inside a registered store. Does not look at the file.
+     */
+    static bool isPacked(const std::string &file);
+
+    // Size of the (uncompressed) data in a file
+    static uint64_t dataSize(const std::string &file);
+
+    /* Hash of the (uncompressed) data in a file. Set 'map' only for
+       files in the store, see Misc::MappedFileStream.
+     */
+    static Spread::Hash hashSum(const std::string &file, bool map = false);
+
+    /* Compress a store object into packedName(file), and remove
+       the original. The file is left as it is if it's already
+       packed, is smaller than MIN_SIZE, or doesn't shrink to at most
+       'ratio' of its size. Returns true if the file was packed.
+
+       Incompressible data is detected from the first part of the
+       file, so large archives and the like are not compressed in full
+       just to find that it didn't help.
+     */
+    static bool pack(const std::string &file, double ratio = 0.9, int level = 6);
+
+    /* Open a file for reading. Packed files are decompressed on the
+       fly. The stream is not seekable, but has a size. Plain files are
+       memory mapped if 'map' is set, as for hashSum().
+     */
+    static Mangle::Stream::StreamPtr open(const std::string &file,
+                                          bool map = false);
+
+    // Write the (uncompressed) data in 'file' to a new file 'to'
+    static void unpackTo(const std::string &file, const std::string &to);
+  };
+}
+
+#endif
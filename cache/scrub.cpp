@@ -0,0 +1,372 @@
+#include "scrub.hpp"
+#include "packed.hpp"
+#include "stat_batch.hpp"
+#include "misc/mapped_stream.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include <algorithm>
+#include <errno.h>
+#include <fstream>
+#include <stdexcept>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <time.h>
+
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+//#define PRINT_DEBUG
+
+#ifdef PRINT_DEBUG
+#include <iostream>
+#define PRINT(a) std::cout << a << "\n";
+#else
+#define PRINT(a)
+#endif
+
+using namespace Cache;
+using namespace Spread;
+
+namespace bfs = boost::filesystem;
+
+static const char SCRUB_MAGIC[] = "SPSCRUB2";
+
+// How often the state is saved while running, in seconds
+static const double SAVE_EVERY = 30;
+
+// Number of index entries fetched at a time
+static const uint32_t BATCH = 4096;
+
+/* Where we are. 'started' is when the current round started (in
+   seconds since the epoch), or 0 if none has. 'cursor' is the last
+   file handled in the round, or "" if the round is done.
+ */
+struct State
+{
+  int64_t started;
+  std::string cursor;
+
+  State() : started(0) {}
+};
+
+static double now()
+{
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+// Sleep in short steps, so an abort is noticed. Returns true if the
+// job was aborted.
+static bool pause(JobInfoPtr info, double secs)
+{
+  while(secs > 0)
+    {
+      if(info->checkStatus()) return true;
+      double step = std::min(secs, 0.1);
+      boost::this_thread::sleep(boost::posix_time::microseconds((int64_t)(step*1000000)));
+      secs -= step;
+    }
+  return info->checkStatus();
+}
+
+/* Keeps the reads within the budget in ScrubOptions, by sleeping
+   whenever we're ahead of the allowed rate.
+ */
+struct Throttle
+{
+  const ScrubOptions &opts;
+  JobInfoPtr info;
+  double start;
+  uint64_t bytes, ops;
+
+  Throttle(const ScrubOptions &o, JobInfoPtr i) : opts(o), info(i) { reset(); }
+
+  void reset()
+  {
+    start = now();
+    bytes = ops = 0;
+  }
+
+  // Count one operation of 'len' bytes. Returns true on abort.
+  bool add(uint64_t len)
+  {
+    ops++;
+    bytes += len;
+    double wait = 0;
+    if(opts.opsPerSec)
+      wait = ops / (double)opts.opsPerSec;
+    if(opts.bytesPerSec)
+      wait = std::max(wait, bytes / (double)opts.bytesPerSec);
+    return pause(info, start + wait - now());
+  }
+};
+
+/* Puts the calling thread at idle I/O priority, and restores the old
+   priority when destroyed. On Linux the I/O priority is per thread,
+   so this doesn't affect the rest of the process. Does nothing on
+   other systems.
+ */
+struct LowPriority
+{
+  int old;
+
+#if defined(__linux__) && defined(SYS_ioprio_set)
+  // From linux/ioprio.h, which isn't always installed
+  enum { WHO_PROCESS = 1, CLASS_IDLE = 3, CLASS_SHIFT = 13 };
+
+  LowPriority(bool enable) : old(-1)
+  {
+    if(!enable) return;
+    old = syscall(SYS_ioprio_get, WHO_PROCESS, 0);
+    if(old >= 0)
+      syscall(SYS_ioprio_set, WHO_PROCESS, 0, CLASS_IDLE << CLASS_SHIFT);
+  }
+
+  ~LowPriority()
+  {
+    if(old >= 0)
+      syscall(SYS_ioprio_set, WHO_PROCESS, 0, old);
+  }
+#else
+  LowPriority(bool) : old(-1) {}
+#endif
+};
+
+/* The state file has the magic string, the start time of the round
+   and the cursor on one line each. A missing or broken state file
+   (including one from older versions) means we start over.
+ */
+static void loadState(const std::string &file, State &out)
+{
+  std::ifstream inf(file.c_str());
+  std::string line, start, cursor;
+  if(!std::getline(inf, line) || line != SCRUB_MAGIC) return;
+  if(!std::getline(inf, start) || !std::getline(inf, cursor)) return;
+  out.started = atoll(start.c_str());
+  out.cursor = cursor;
+}
+
+static void saveState(const std::string &file, const State &st)
+{
+  std::string newFile = file + ".new";
+  {
+    std::ofstream of(newFile.c_str());
+    of << SCRUB_MAGIC << "\n" << st.started << "\n" << st.cursor << "\n";
+    if(!of)
+      throw std::runtime_error("Cannot write " + newFile);
+  }
+  bfs::rename(newFile, file);
+}
+
+// Move a bad file out of the store, or delete it if that fails
+static void quarantine(const std::string &file, const Hash &hash, const std::string &dir)
+{
+  boost::system::error_code ec;
+  if(dir != "")
+    {
+      bfs::create_directories(dir, ec);
+      bfs::rename(file, bfs::path(dir) / hash.toString(), ec);
+      if(!ec) return;
+    }
+  bfs::remove(file, ec);
+}
+
+/* Files are verified in rounds, walking the index in order of file
+   names, a batch at a time. Only the position in the round is kept,
+   so the job uses the same small amount of memory no matter how
+   large the index is.
+ */
+void ScrubJob::doJob()
+{
+  LowPriority prio(opts.lowPriority);
+
+  std::string base;
+  if(files.basedir != "")
+    {
+      base = bfs::absolute(files.basedir).string();
+      if(base[base.size()-1] != '/')
+        base += "/";
+    }
+
+  State state;
+  loadState(stateFile, state);
+
+  Throttle thr(opts, info);
+  double lastSave = now();
+  std::vector<char> buf(opts.readSize ? opts.readSize : 64*1024);
+  uint64_t done = 0;
+  bool idle = false;
+
+  bool aborted = false;
+  while(!aborted && !checkStatus())
+    {
+      if(state.cursor == "")
+        {
+          /* Wait for the next round. After a round with nothing in
+             it, look again once a minute at most.
+           */
+          int64_t wait = opts.interval;
+          if(idle && wait < 60) wait = 60;
+          int64_t next = state.started + wait;
+          int64_t cur = time(NULL);
+          if(state.started && next > cur)
+            {
+              if(!opts.loop) break;
+              setBusy("Waiting");
+              if(pause(info, std::min<int64_t>(next - cur, 60)))
+                break;
+              // Don't make up for the time spent waiting
+              thr.reset();
+              continue;
+            }
+
+          PRINT("Starting a new round");
+          state.started = cur;
+          done = 0;
+        }
+
+      setBusy("Verifying cache files");
+
+      CIVector batch;
+      index.getEntries(batch, state.cursor, BATCH);
+      if(batch.empty())
+        {
+          PRINT("Round done");
+          idle = (done == 0);
+          state.cursor = "";
+          saveState(stateFile, state);
+          lastSave = now();
+          if(!opts.loop) break;
+          continue;
+        }
+
+      // Stat the whole batch in one go
+      std::vector<std::string> names(batch.size());
+      for(int i=0; i<batch.size(); i++)
+        names[i] = batch[i].file;
+      std::vector<FileStat> stats;
+      std::vector<int> res;
+      StatBatch::run(names, stats, res);
+
+      uint64_t total = index.size();
+      std::string before = state.cursor;
+      for(int i=0; i<batch.size(); i++)
+        {
+          if(checkStatus())
+            {
+              aborted = true;
+              break;
+            }
+
+          const CIEntry &e = batch[i];
+          state.cursor = e.file;
+          setProgress(++done, std::max(total, done));
+
+          if(now() - lastSave >= SAVE_EVERY)
+            {
+              saveState(stateFile, state);
+              lastSave = now();
+            }
+
+          if(res[i] == FS_MISSING)
+            {
+              PRINT("Missing: " << e.file);
+              index.removeFile(e.file);
+              continue;
+            }
+          if(res[i] != FS_FOUND)
+            continue;
+
+          /* Files that were changed the normal way are re-indexed,
+             using the same test as the index. So are entries from
+             older versions, and entries stored too soon after a
+             write for their stat to be trusted.
+           */
+          const FileStat &st = stats[i];
+          if(!e.st.mtime || e.racy || !e.st.same(st))
+            {
+              PRINT("Changed: " << e.file);
+              aborted = thr.add(st.size);
+              index.checkFile(e.file);
+              continue;
+            }
+
+          // Opening the file counts as an operation
+          if(thr.add(0))
+            {
+              aborted = true;
+              break;
+            }
+
+          /* Damaged packed data and I/O errors count as a mismatch.
+             Other failures (out of file handles or memory, no
+             permission) say nothing about the file, so it is skipped
+             and checked again next round. Only our own store files
+             are safe to map.
+           */
+          bool inStore = base != "" && e.file.compare(0, base.size(), base) == 0;
+          HashBuilder hb;
+          bool good = true, skip = false;
+          try
+            {
+              Mangle::Stream::StreamPtr inf = Packed::open(e.file, inStore);
+              while(!inf->eof() && !aborted)
+                {
+                  size_t n = inf->read(&buf[0], buf.size());
+                  if(n == 0) break;
+                  hb.update(&buf[0], n);
+                  bytesChecked += n;
+                  aborted = thr.add(n);
+                }
+            }
+          catch(PackedError &) { good = false; }
+          catch(Misc::FileError &err)
+            {
+              if(err.err == EIO) good = false;
+              else skip = true;
+            }
+          catch(...) { skip = true; }
+          if(aborted)
+            {
+              // Do this one again next time
+              state.cursor = i ? batch[i-1].file : before;
+              break;
+            }
+          if(skip)
+            {
+              PRINT("Skipped: " << e.file);
+              continue;
+            }
+          filesChecked++;
+
+          if(good && hb.finish() == e.hash)
+            continue;
+
+          // Make sure the file wasn't just changed under us
+          std::vector<std::string> one(1, e.file);
+          std::vector<FileStat> after;
+          std::vector<int> ares;
+          StatBatch::run(one, after, ares);
+          if(ares[0] != FS_FOUND || !after[0].same(st))
+            {
+              index.checkFile(e.file);
+              continue;
+            }
+
+          PRINT("Corrupt: " << e.file);
+          filesBad++;
+          index.removeFile(e.file);
+          if(inStore)
+            quarantine(e.file, e.hash, opts.quarantine);
+        }
+    }
+
+  saveState(stateFile, state);
+
+  if(!info->isNonSuccess())
+    setDone();
+}
@@ -0,0 +1,93 @@
+#ifndef __SPREAD_CACHE_SCRUB_HPP_
+#define __SPREAD_CACHE_SCRUB_HPP_
+
+#include "index.hpp"
+#include "files.hpp"
+#include <job/job.hpp>
+
+namespace Cache
+{
+  /* Settings for ScrubJob. Zero means no limit, unless otherwise
+     noted.
+   */
+  struct ScrubOptions
+  {
+    /* I/O budget. At most this many bytes are read, and this many
+       read operations (opening a file counts as one) issued, per
+       second.
+     */
+    uint64_t bytesPerSec;
+    uint32_t opsPerSec;
+
+    // Size of each read, in bytes
+    uint32_t readSize;
+
+    /* Files in the store that fail verification are moved here. If
+       empty, they are deleted instead.
+     */
+    std::string quarantine;
+
+    /* Don't start a new round until this many seconds have passed
+       since the last one started.
+     */
+    int64_t interval;
+
+    /* Keep going until aborted. Otherwise the job finishes at the end
+       of the current round, or right away if no round is due.
+     */
+    bool loop;
+
+    /* Run at idle I/O priority where the system supports it, so only
+       otherwise unused disk time is spent on scrubbing.
+     */
+    bool lowPriority;
+
+    ScrubOptions() : bytesPerSec(0), opsPerSec(0), readSize(1024*1024),
+                     interval(0), loop(false), lowPriority(true) {}
+  };
+
+  /* Re-hash the files in the cache index in the background, to catch
+     files that were corrupted on disk after they were indexed.
+
+     Unlike CacheIndex::verify(), which only re-hashes files that
+     changed, this reads every file. Files are verified in rounds,
+     each of which goes through the index in order of file names. A
+     file added behind the current position waits for the next round.
+
+     The position in the round is kept in 'stateFile', and saved
+     regularly while running. An aborted or interrupted job therefore
+     picks up where it left off the next time it is started.
+
+     A file whose contents no longer match the index, even though the
+     file is unchanged according to the index (see FileStat), is
+     considered corrupt and is removed from the index. If it is in the
+     cache store (Files::basedir), it is also moved to the quarantine
+     directory, or deleted. Corrupt files outside the store are left
+     alone. Files that were changed the normal way are re-indexed
+     instead, and missing files are removed from the index.
+
+     Read errors (EIO) and damaged packed data count as corruption.
+     A file that can't be read for any other reason, such as running
+     out of file handles, is skipped and tried again next round.
+   */
+  struct ScrubJob : Spread::Job
+  {
+    ScrubJob(const Files &_files, CacheIndex &_index, const std::string &_state,
+             const ScrubOptions &_opts = ScrubOptions())
+      : filesChecked(0), bytesChecked(0), filesBad(0), files(_files),
+        index(_index), stateFile(_state), opts(_opts) {}
+
+    // Results
+    uint64_t filesChecked, bytesChecked, filesBad;
+
+  private:
+    void doJob();
+
+    const Files &files;
+    CacheIndex &index;
+    std::string stateFile;
+    ScrubOptions opts;
+  };
+}
+
+#endif
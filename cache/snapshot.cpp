@@ -0,0 +1,391 @@
+#include "snapshot.hpp"
+
+#include <boost/filesystem.hpp>
+#include <algorithm>
+#include <stdexcept>
+#include <string.h>
+#include <stddef.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+using namespace Cache;
+using namespace Spread;
+
+namespace bfs = boost::filesystem;
+
+/* File layout:
+
+   Header, see below.
+
+   Entries, 'count' x Record, sorted by path.
+
+   Hash order, 'count' x uint32_t entry numbers, sorted by hash.
+
+   Path pool, the path strings back to back, without terminators.
+
+   All numbers are in host byte order, like the binary Hash values.
+
+   Older files have shorter records. Version 1 ("SPIDXS01") lacks
+   the file identity fields at the end, and version 2 ("SPIDXS02")
+   the file size, which is then taken to be the hash size. They are
+   still read, but only version 3 is written.
+ */
+
+static const char MAGIC[] = "SPIDXS03";
+static const char MAGIC2[] = "SPIDXS02";
+static const char MAGIC1[] = "SPIDXS01";
+
+struct Header
+{
+  char magic[8];
+  uint32_t count;
+  uint32_t unused;
+  uint64_t entryOff, hashOff, poolOff, poolSize;
+};
+
+enum RecordFlags
+  {
+    FL_STATE = 1,
+    FL_STAT = 2,
+    FL_RACY = 4
+  };
+
+struct Record
+{
+  uint64_t pathOff;
+  uint32_t pathLen;
+
+  // RecordFlags. Version 1 only used FL_STATE.
+  uint32_t flags;
+
+  uint8_t hash[40];
+  int64_t writeTime;
+  uint32_t stateH[8];
+  uint64_t stateSize;
+  uint8_t check[40];
+
+  // Version 2 and later
+  int64_t mtime, ctime;
+  uint64_t inode, device;
+
+  // Version 3 only
+  uint64_t size;
+};
+
+static const size_t RECORD1_SIZE = offsetof(Record, mtime);
+static const size_t RECORD2_SIZE = offsetof(Record, size);
+
+struct IndexSnapshot::_Internal
+{
+  const char *map;
+  size_t len;
+
+  const Header *head;
+  const char *ents;
+  size_t recSize;
+  const uint32_t *byHash;
+  const char *pool;
+
+  _Internal() : map(NULL), len(0) {}
+  ~_Internal() { close(); }
+
+  void close()
+  {
+    if(map) munmap((void*)map, len);
+    map = NULL;
+    len = 0;
+  }
+
+  uint32_t count() const { return map ? head->count : 0; }
+
+  const Record &rec(uint32_t i) const
+  { return *(const Record*)(ents + i*recSize); }
+
+  // Compare the path of entry 'i' with a string
+  int cmpPath(uint32_t i, const char *str, size_t slen) const
+  {
+    const Record &r = rec(i);
+    size_t n = r.pathLen < slen ? r.pathLen : slen;
+    int res = memcmp(pool + r.pathOff, str, n);
+    if(res) return res;
+    if(r.pathLen < slen) return -1;
+    if(r.pathLen > slen) return 1;
+    return 0;
+  }
+
+  int cmpHash(uint32_t i, const Hash &h) const
+  { return memcmp(rec(byHash[i]).hash, h.getData(), 40); }
+};
+
+IndexSnapshot::IndexSnapshot() : ptr(new _Internal) {}
+
+void IndexSnapshot::close() { ptr->close(); }
+
+bool IndexSnapshot::open(const std::string &file)
+{
+  close();
+
+  int fd = ::open(file.c_str(), O_RDONLY);
+  if(fd < 0)
+    {
+      if(errno == ENOENT) return false;
+      throw std::runtime_error("Cannot open " + file + ": " + strerror(errno));
+    }
+
+  struct stat st;
+  if(fstat(fd, &st) != 0)
+    {
+      ::close(fd);
+      throw std::runtime_error("Cannot stat " + file);
+    }
+
+  size_t len = st.st_size;
+  if(len < sizeof(Header))
+    {
+      ::close(fd);
+      throw std::runtime_error("Invalid index snapshot " + file);
+    }
+
+  void *p = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if(p == MAP_FAILED)
+    throw std::runtime_error("Cannot map " + file + ": " + strerror(errno));
+
+  // Lookups jump all over the file
+  madvise(p, len, MADV_RANDOM);
+
+  ptr->map = (const char*)p;
+  ptr->len = len;
+
+  const Header *h = (const Header*)p;
+  uint64_t count = h->count;
+  size_t recSize = sizeof(Record);
+  if(memcmp(h->magic, MAGIC1, 8) == 0)
+    recSize = RECORD1_SIZE;
+  else if(memcmp(h->magic, MAGIC2, 8) == 0)
+    recSize = RECORD2_SIZE;
+  else if(memcmp(h->magic, MAGIC, 8) != 0)
+    recSize = 0;
+
+  if(recSize == 0 ||
+     h->entryOff != sizeof(Header) ||
+     h->hashOff != h->entryOff + count*recSize ||
+     h->poolOff != h->hashOff + count*4 ||
+     h->poolOff + h->poolSize != len)
+    {
+      close();
+      throw std::runtime_error("Invalid index snapshot " + file);
+    }
+
+  ptr->head = h;
+  ptr->ents = ptr->map + h->entryOff;
+  ptr->recSize = recSize;
+  ptr->byHash = (const uint32_t*)(ptr->map + h->hashOff);
+  ptr->pool = ptr->map + h->poolOff;
+  return true;
+}
+
+uint32_t IndexSnapshot::size() const { return ptr->count(); }
+
+std::string IndexSnapshot::getPath(uint32_t i) const
+{
+  assert(i < size());
+  const Record &r = ptr->rec(i);
+  if(r.pathOff + r.pathLen > ptr->head->poolSize)
+    throw std::runtime_error("Invalid path in index snapshot");
+  return std::string(ptr->pool + r.pathOff, r.pathLen);
+}
+
+void IndexSnapshot::get(uint32_t i, JournalRecord &out) const
+{
+  const Record &r = ptr->rec(i);
+  out = JournalRecord();
+  out.file = getPath(i);
+  out.hash.copy(r.hash);
+  out.writeTime = r.writeTime;
+  if(r.flags & FL_STATE)
+    {
+      memcpy(out.state.h, r.stateH, 32);
+      out.state.size = r.stateSize;
+      out.check.copy(r.check);
+    }
+  if((r.flags & FL_STAT) && ptr->recSize >= RECORD2_SIZE)
+    {
+      if(ptr->recSize == sizeof(Record))
+        out.st.size = r.size;
+      else
+        out.st.size = out.hash.size();
+      out.st.mtime = r.mtime;
+      out.st.ctime = r.ctime;
+      out.st.inode = r.inode;
+      out.st.device = r.device;
+      out.racy = (r.flags & FL_RACY) != 0;
+    }
+}
+
+int64_t IndexSnapshot::find(const std::string &file) const
+{
+  uint32_t lo = 0, hi = size();
+  while(lo < hi)
+    {
+      uint32_t mid = lo + (hi-lo)/2;
+      int c = ptr->cmpPath(mid, file.data(), file.size());
+      if(c == 0) return mid;
+      if(c < 0) lo = mid+1;
+      else hi = mid;
+    }
+  return -1;
+}
+
+uint32_t IndexSnapshot::upperBound(const std::string &file) const
+{
+  uint32_t lo = 0, hi = size();
+  while(lo < hi)
+    {
+      uint32_t mid = lo + (hi-lo)/2;
+      if(ptr->cmpPath(mid, file.data(), file.size()) <= 0) lo = mid+1;
+      else hi = mid;
+    }
+  return lo;
+}
+
+void IndexSnapshot::find(const Hash &hash, std::vector<uint32_t> &out) const
+{
+  out.clear();
+
+  // Find the first match
+  uint32_t lo = 0, hi = size();
+  while(lo < hi)
+    {
+      uint32_t mid = lo + (hi-lo)/2;
+      if(ptr->cmpHash(mid, hash) < 0) lo = mid+1;
+      else hi = mid;
+    }
+
+  for(; lo < size() && ptr->cmpHash(lo, hash) == 0; lo++)
+    out.push_back(ptr->byHash[lo]);
+}
+
+// Sort entry numbers by path or hash
+struct PathLess
+{
+  const JRVector *ents;
+  bool operator()(uint32_t a, uint32_t b) const
+  { return (*ents)[a].file < (*ents)[b].file; }
+};
+
+struct HashLess
+{
+  const std::vector<Record> *recs;
+  bool operator()(uint32_t a, uint32_t b) const
+  { return memcmp((*recs)[a].hash, (*recs)[b].hash, 40) < 0; }
+};
+
+static void writeAll(int fd, const void *data, size_t num, const std::string &file)
+{
+  const char *p = (const char*)data;
+  while(num)
+    {
+      ssize_t res = ::write(fd, p, num);
+      if(res < 0 && errno == EINTR) continue;
+      if(res <= 0)
+        throw std::runtime_error("Error writing " + file + ": " + strerror(errno));
+      p += res;
+      num -= res;
+    }
+}
+
+void IndexSnapshot::write(const std::string &file, const JRVector &entries)
+{
+  uint32_t count = entries.size();
+
+  std::vector<uint32_t> order(count);
+  for(uint32_t i=0; i<count; i++) order[i] = i;
+  PathLess pl = { &entries };
+  std::sort(order.begin(), order.end(), pl);
+
+  std::vector<Record> recs(count);
+  std::string pool;
+  for(uint32_t i=0; i<count; i++)
+    {
+      const JournalRecord &e = entries[order[i]];
+      Record &r = recs[i];
+      memset(&r, 0, sizeof(r));
+
+      r.pathOff = pool.size();
+      r.pathLen = e.file.size();
+      pool += e.file;
+
+      memcpy(r.hash, e.hash.getData(), 40);
+      r.writeTime = e.writeTime;
+      if(e.state.isSet())
+        {
+          r.flags |= FL_STATE;
+          memcpy(r.stateH, e.state.h, 32);
+          r.stateSize = e.state.size;
+          memcpy(r.check, e.check.getData(), 40);
+        }
+      if(e.st.mtime)
+        {
+          r.flags |= FL_STAT;
+          if(e.racy) r.flags |= FL_RACY;
+          r.mtime = e.st.mtime;
+          r.ctime = e.st.ctime;
+          r.inode = e.st.inode;
+          r.device = e.st.device;
+          r.size = e.st.size;
+        }
+    }
+
+  std::vector<uint32_t> byHash(count);
+  for(uint32_t i=0; i<count; i++) byHash[i] = i;
+  HashLess hl = { &recs };
+  std::sort(byHash.begin(), byHash.end(), hl);
+
+  Header h;
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, MAGIC, 8);
+  h.count = count;
+  h.entryOff = sizeof(Header);
+  h.hashOff = h.entryOff + (uint64_t)count*sizeof(Record);
+  h.poolOff = h.hashOff + (uint64_t)count*4;
+  h.poolSize = pool.size();
+
+  bfs::path parent = bfs::path(file).parent_path();
+  if(!parent.empty()) bfs::create_directories(parent);
+
+  std::string newFile = file + ".new";
+  int fd = ::open(newFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if(fd < 0)
+    throw std::runtime_error("Cannot open " + newFile + ": " + strerror(errno));
+
+  try
+    {
+      writeAll(fd, &h, sizeof(h), newFile);
+      if(count)
+        {
+          writeAll(fd, &recs[0], count*sizeof(Record), newFile);
+          writeAll(fd, &byHash[0], count*4, newFile);
+        }
+      writeAll(fd, pool.data(), pool.size(), newFile);
+
+      if(fsync(fd) != 0)
+        throw std::runtime_error("Cannot sync " + newFile + ": " + strerror(errno));
+      ::close(fd);
+      fd = -1;
+
+      if(::rename(newFile.c_str(), file.c_str()) != 0)
+        throw std::runtime_error("Cannot rename " + newFile + ": " + strerror(errno));
+    }
+  catch(...)
+    {
+      if(fd >= 0) ::close(fd);
+      boost::system::error_code ec;
+      bfs::remove(newFile, ec);
+      throw;
+    }
+}
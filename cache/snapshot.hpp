@@ -0,0 +1,65 @@
+#ifndef __SPREAD_CACHE_SNAPSHOT_HPP_
+#define __SPREAD_CACHE_SNAPSHOT_HPP_
+
+#include "journal.hpp"
+
+/* Read-only, memory mapped table of CacheIndex entries.
+
+   The file holds fixed size entry records sorted by path, a list of
+   entry numbers sorted by hash, and a pool with the path strings.
+   Opening it only maps the file, so it costs the same no matter how
+   many entries there are. Lookups by path or by hash are binary
+   searches straight on the mapped data, and only touch the pages
+   they need.
+
+   Snapshots are never changed once written. CacheIndex keeps its
+   changes in memory and in an IndexJournal, and writes a new
+   snapshot when it compacts the journal. write() creates the file
+   under a temporary name and renames it into place, so an open
+   snapshot of the old file stays valid.
+
+   Damaged files are not detected beyond basic sanity checks of the
+   header and offsets. The file is only ever replaced whole, by
+   rename, so it should never be partially written.
+ */
+
+namespace Cache
+{
+  class IndexSnapshot
+  {
+    struct _Internal;
+    boost::shared_ptr<_Internal> ptr;
+
+  public:
+    IndexSnapshot();
+
+    /* Map a snapshot file, replacing any previously opened one.
+       Returns false if the file doesn't exist. Throws if it isn't a
+       valid snapshot.
+     */
+    bool open(const std::string &file);
+    void close();
+
+    // Number of entries
+    uint32_t size() const;
+
+    // Get entry number 'i'. Entries are sorted by path.
+    void get(uint32_t i, JournalRecord &out) const;
+    std::string getPath(uint32_t i) const;
+
+    // Find the entry for a path. Returns -1 if there is none.
+    int64_t find(const std::string &file) const;
+
+    // Number of the first entry with a path that sorts after 'file'
+    uint32_t upperBound(const std::string &file) const;
+
+    // Find all entries with the given hash
+    void find(const Spread::Hash &hash, std::vector<uint32_t> &out) const;
+
+    /* Write a new snapshot file. The entries do not have to be
+       sorted, but each path must only be listed once.
+     */
+    static void write(const std::string &file, const JRVector &entries);
+  };
+}
+#endif
@@ -0,0 +1,266 @@
+#include "stat_batch.hpp"
+
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define HAVE_IO_URING
+#endif
+#endif
+
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/sysmacros.h>
+#endif
+
+using namespace Cache;
+
+static const int64_t NS = 1000000000;
+
+bool StatBatch::useUring = true;
+
+// Plain stat() of one file
+static int statOne(const std::string &file, FileStat &out)
+{
+  struct stat st;
+  if(::stat(file.c_str(), &st) != 0)
+    return (errno == ENOENT || errno == ENOTDIR) ? FS_MISSING : FS_UNKNOWN;
+  if(!S_ISREG(st.st_mode))
+    return FS_UNKNOWN;
+
+  out.size = st.st_size;
+  out.mtime = st.st_mtim.tv_sec * NS + st.st_mtim.tv_nsec;
+  out.ctime = st.st_ctim.tv_sec * NS + st.st_ctim.tv_nsec;
+  out.inode = st.st_ino;
+  out.device = st.st_dev;
+  return FS_FOUND;
+}
+
+#ifdef HAVE_IO_URING
+
+/* A minimal io_uring, just enough to push STATX requests through.
+   See io_uring_setup(2) for the ring layout.
+ */
+struct Ring
+{
+  int fd;
+
+  // Submission queue
+  void *sqMap;
+  size_t sqLen;
+  unsigned *sqHead, *sqTail, *sqMask, *sqArray;
+  io_uring_sqe *sqes;
+  size_t sqesLen;
+
+  // Completion queue
+  void *cqMap;
+  size_t cqLen;
+  unsigned *cqHead, *cqTail, *cqMask;
+  io_uring_cqe *cqes;
+
+  Ring() : fd(-1), sqMap(MAP_FAILED), sqes((io_uring_sqe*)MAP_FAILED), cqMap(MAP_FAILED) {}
+  ~Ring() { close(); }
+
+  void close()
+  {
+    if(sqes != MAP_FAILED) munmap(sqes, sqesLen);
+    if(cqMap != MAP_FAILED && cqMap != sqMap) munmap(cqMap, cqLen);
+    if(sqMap != MAP_FAILED) munmap(sqMap, sqLen);
+    if(fd >= 0) ::close(fd);
+    fd = -1;
+    sqMap = cqMap = MAP_FAILED;
+    sqes = (io_uring_sqe*)MAP_FAILED;
+  }
+
+  bool open(unsigned entries)
+  {
+    io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    fd = syscall(__NR_io_uring_setup, entries, &p);
+    if(fd < 0) return false;
+
+    sqLen = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqLen = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+    bool single = p.features & IORING_FEAT_SINGLE_MMAP;
+    if(single && cqLen > sqLen) sqLen = cqLen;
+
+    sqMap = mmap(NULL, sqLen, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                 fd, IORING_OFF_SQ_RING);
+    if(sqMap == MAP_FAILED) { close(); return false; }
+
+    if(single) cqMap = sqMap;
+    else
+      {
+        cqMap = mmap(NULL, cqLen, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+                     fd, IORING_OFF_CQ_RING);
+        if(cqMap == MAP_FAILED) { close(); return false; }
+      }
+
+    sqesLen = p.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe*)mmap(NULL, sqesLen, PROT_READ|PROT_WRITE,
+                               MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+    if(sqes == MAP_FAILED) { close(); return false; }
+
+    char *sq = (char*)sqMap, *cq = (char*)cqMap;
+    sqHead = (unsigned*)(sq + p.sq_off.head);
+    sqTail = (unsigned*)(sq + p.sq_off.tail);
+    sqMask = (unsigned*)(sq + p.sq_off.ring_mask);
+    sqArray = (unsigned*)(sq + p.sq_off.array);
+    cqHead = (unsigned*)(cq + p.cq_off.head);
+    cqTail = (unsigned*)(cq + p.cq_off.tail);
+    cqMask = (unsigned*)(cq + p.cq_off.ring_mask);
+    cqes = (io_uring_cqe*)(cq + p.cq_off.cqes);
+    return true;
+  }
+
+  // Queue one statx request. The caller makes sure there is room.
+  void pushStatx(const char *path, struct statx *buf, uint64_t data)
+  {
+    unsigned tail = *sqTail;
+    unsigned idx = tail & *sqMask;
+    io_uring_sqe *sqe = &sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_STATX;
+    sqe->fd = AT_FDCWD;
+    sqe->addr = (uint64_t)(uintptr_t)path;
+    sqe->len = STATX_BASIC_STATS;
+    sqe->off = (uint64_t)(uintptr_t)buf;
+    sqe->user_data = data;
+    sqArray[idx] = idx;
+    __atomic_store_n(sqTail, tail+1, __ATOMIC_RELEASE);
+  }
+
+  // Submit 'num' queued requests and wait for at least one result
+  bool enter(unsigned num)
+  {
+    int res;
+    do res = syscall(__NR_io_uring_enter, fd, num, 1, IORING_ENTER_GETEVENTS,
+                     NULL, 0);
+    while(res < 0 && errno == EINTR);
+    return res >= 0;
+  }
+
+  // Get the next result, if any
+  bool pop(uint64_t &data, int &res)
+  {
+    unsigned head = *cqHead;
+    if(head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE))
+      return false;
+    io_uring_cqe *cqe = &cqes[head & *cqMask];
+    data = cqe->user_data;
+    res = cqe->res;
+    __atomic_store_n(cqHead, head+1, __ATOMIC_RELEASE);
+    return true;
+  }
+};
+
+static int fromStatx(const struct statx &sx, FileStat &out)
+{
+  if(!S_ISREG(sx.stx_mode))
+    return FS_UNKNOWN;
+
+  out.size = sx.stx_size;
+  out.mtime = sx.stx_mtime.tv_sec * NS + sx.stx_mtime.tv_nsec;
+  out.ctime = sx.stx_ctime.tv_sec * NS + sx.stx_ctime.tv_nsec;
+  out.inode = sx.stx_ino;
+  out.device = makedev(sx.stx_dev_major, sx.stx_dev_minor);
+  return FS_FOUND;
+}
+
+// Returns false if the ring couldn't be used at all
+static bool runUring(const std::vector<std::string> &files,
+                     std::vector<FileStat> &out, std::vector<int> &res)
+{
+  Ring ring;
+  if(!ring.open(StatBatch::QUEUE_DEPTH))
+    return false;
+
+  size_t num = files.size();
+  std::vector<struct statx> bufs(StatBatch::QUEUE_DEPTH);
+
+  // Free statx buffers, and the file using each busy one
+  std::vector<unsigned> freeBufs;
+  std::vector<size_t> owner(StatBatch::QUEUE_DEPTH);
+  for(unsigned i=0; i<StatBatch::QUEUE_DEPTH; i++)
+    freeBufs.push_back(i);
+
+  size_t next = 0, done = 0;
+  while(done < num)
+    {
+      unsigned queued = 0;
+      while(next < num && freeBufs.size())
+        {
+          unsigned b = freeBufs.back();
+          freeBufs.pop_back();
+          owner[b] = next;
+          ring.pushStatx(files[next].c_str(), &bufs[b], b);
+          next++;
+          queued++;
+        }
+
+      if(!ring.enter(queued))
+        {
+          /* The requests we just queued may or may not have been
+             taken. Stop here, and stat whatever isn't done yet the
+             plain way.
+           */
+          for(size_t i=0; i<num; i++)
+            if(res[i] == FS_UNKNOWN)
+              res[i] = statOne(files[i], out[i]);
+          return true;
+        }
+
+      uint64_t b;
+      int r;
+      while(ring.pop(b, r))
+        {
+          size_t i = owner[b];
+          if(r == 0)
+            res[i] = fromStatx(bufs[b], out[i]);
+          else if(r == -ENOENT || r == -ENOTDIR)
+            res[i] = FS_MISSING;
+          else
+            // Includes -EINVAL from kernels without STATX support
+            res[i] = statOne(files[i], out[i]);
+          freeBufs.push_back(b);
+          done++;
+        }
+    }
+  return true;
+}
+
+bool StatBatch::hasUring()
+{
+  Ring ring;
+  return ring.open(4);
+}
+
+#else
+
+bool StatBatch::hasUring() { return false; }
+
+#endif
+
+void StatBatch::run(const std::vector<std::string> &files,
+                    std::vector<FileStat> &out, std::vector<int> &res)
+{
+  out.clear();
+  out.resize(files.size());
+  res.clear();
+  res.resize(files.size(), FS_UNKNOWN);
+
+#ifdef HAVE_IO_URING
+  // Not worth setting up a ring for a handful of files
+  if(useUring && files.size() > 8 && runUring(files, out, res))
+    return;
+#endif
+
+  for(size_t i=0; i<files.size(); i++)
+    res[i] = statOne(files[i], out[i]);
+}
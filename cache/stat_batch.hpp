@@ -0,0 +1,45 @@
+#ifndef __SPREAD_CACHE_STATBATCH_HPP_
+#define __SPREAD_CACHE_STATBATCH_HPP_
+
+#include "iindex.hpp"
+#include <vector>
+#include <string>
+
+/* Stat a large list of files with many requests in flight at once.
+
+   Stat calls are cheap when the inodes are cached, but on a cold
+   disk or a network file system each one waits for a round trip. One
+   blocking call at a time then leaves the disk (or server) idle most
+   of the time. StatBatch queues up to QUEUE_DEPTH statx() requests
+   in an io_uring, so the kernel can have them all in flight and
+   complete them in whatever order they arrive.
+
+   io_uring is used through the raw system calls, so there is no
+   library dependency. If it isn't available (old kernel, disabled by
+   the system, or built on something other than Linux), the files are
+   simply stat'ed one by one.
+ */
+
+namespace Cache
+{
+  struct StatBatch
+  {
+    // Number of requests kept in flight
+    static const unsigned QUEUE_DEPTH = 256;
+
+    /* Stat all the files. 'res' gets a StatResult for each file, and
+       'out' the information for files that were found. Directories
+       and other special files, and any errors other than a missing
+       file, give FS_UNKNOWN.
+     */
+    static void run(const std::vector<std::string> &files,
+                    std::vector<FileStat> &out, std::vector<int> &res);
+
+    // Set to false to always use plain stat() calls. For testing.
+    static bool useUring;
+
+    // Check if io_uring can be used on this system
+    static bool hasUring();
+  };
+}
+#endif
@@ -0,0 +1,122 @@
+#include <iostream>
+#include "index.hpp"
+#include "hash/hash_stream.hpp"
+#include "snapshot.hpp"
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <vector>
+#include <ctime>
+
+using namespace Spread;
+using namespace std;
+namespace bf = boost::filesystem;
+
+string file = "_append/data";
+string conf = "_append/index.conf";
+vector<char> buf;
+int step = 0;
+
+// Change the file data, and make sure the write time changes too
+void append(size_t num)
+{
+  {
+    ofstream out(file.c_str(), ios::binary | ios::app);
+    out.write(&buf[0], num);
+  }
+  bf::last_write_time(file, time(NULL) - 1000 + step++);
+}
+
+void poke(size_t pos)
+{
+  fstream f(file.c_str(), ios::binary | ios::in | ios::out);
+  f.seekp(pos);
+  f.put('X');
+}
+
+void test(Cache::CacheIndex &index, const string &what)
+{
+  Hash h = index.addFile(file);
+  cout << what << ": size=" << h.size()
+       << " matches full hash: " << (h == HashStream::sum(file));
+
+  // Look in the journal first, then in the snapshot
+  string name = bf::absolute(file).string();
+  Cache::IndexJournal journal(conf);
+  Cache::JRVector ents;
+  journal.load(ents);
+  Cache::JournalRecord rec;
+  for(int i=0; i<ents.size(); i++)
+    if(ents[i].file == name)
+      rec = ents[i];
+
+  Cache::IndexSnapshot snap;
+  if(rec.file == "" && snap.open(conf + ".snap") && snap.find(name) >= 0)
+    snap.get(snap.find(name), rec);
+
+  HashState st = rec.state;
+  if(st.isSet())
+    cout << " saved state at " << st.size;
+  else
+    cout << " no saved state";
+  cout << endl;
+}
+
+int main()
+{
+  bf::remove_all("_append");
+  bf::create_directories("_append");
+
+  buf.resize(300000);
+  for(size_t i=0; i<buf.size(); i++)
+    buf[i] = i*3 + (i>>9);
+
+  {
+    Cache::CacheIndex index(conf);
+    index.setAppendHashing(100000);
+
+    append(50000);
+    test(index, "Small file");
+
+    append(250000);
+    test(index, "Grown");
+
+    append(1000);
+    test(index, "Appended");
+
+    append(63);
+    test(index, "Appended to boundary");
+
+    // Changes before the check region are not noticed. That's the
+    // deal with append hashing.
+    poke(10);
+    append(100);
+    test(index, "Changed early");
+
+    // Changes right before the old end are
+    poke(bf::file_size(file) - 200);
+    append(100);
+    test(index, "Changed late");
+  }
+
+  // The state survives reloading the index
+  {
+    Cache::CacheIndex index(conf);
+    index.setAppendHashing(100000);
+    append(5000);
+    test(index, "Reloaded");
+
+    bf::resize_file(file, 200000);
+    bf::last_write_time(file, time(NULL) - 1000 + step++);
+    test(index, "Truncated");
+  }
+
+  // Without append hashing, the state is dropped
+  {
+    Cache::CacheIndex index(conf);
+    append(5000);
+    test(index, "Disabled");
+  }
+
+  return 0;
+}
@@ -0,0 +1,142 @@
+#include <iostream>
+
+#include "entry_arena.hpp"
+#include <stdio.h>
+#include <string.h>
+
+using namespace Spread;
+using namespace std;
+using namespace Cache;
+
+EntryArena arena;
+
+Hash hello("hello", 5);
+Hash world("world", 5);
+
+uint32_t add(const string &file, const Hash &hash, int64_t mtime = 0)
+{
+  JournalRecord rec;
+  rec.file = file;
+  rec.hash = hash;
+  rec.writeTime = 10;
+  rec.st.mtime = mtime;
+  rec.st.size = mtime ? hash.size() : 0;
+  rec.st.inode = 7;
+  rec.racy = mtime == 2;
+  return arena.add(rec);
+}
+
+void find(const string &file)
+{
+  uint32_t id = arena.find(file);
+  cout << "  " << file << ": ";
+  if(!id)
+    {
+      cout << "not found\n";
+      return;
+    }
+
+  JournalRecord rec;
+  arena.get(id, rec);
+  cout << rec.file << " " << rec.hash << " time=" << rec.writeTime
+       << " mtime=" << rec.st.mtime << " size=" << rec.st.size
+       << " inode=" << rec.st.inode << (rec.racy?" racy":"")
+       << (rec.state.isSet()?" append":"") << endl;
+}
+
+void find(const Hash &hash)
+{
+  vector<uint32_t> ids;
+  arena.find(hash, ids);
+  cout << "  " << hash << ":";
+  for(int i=0; i<ids.size(); i++)
+    cout << " " << arena.getPath(ids[i]);
+  cout << endl;
+}
+
+void all()
+{
+  JRVector recs;
+  arena.getAll(recs);
+  cout << "All " << arena.size() << " entries:\n";
+  for(int i=0; i<recs.size(); i++)
+    cout << "  " << recs[i].file << endl;
+}
+
+int main()
+{
+  cout << "Adding:\n";
+  add("/a/b/file1", hello);
+  add("/a/b/file2", world, 1000);
+  add("/a/c/file1", hello, 2);
+  add("/file1", world);
+  add("file1", hello);
+
+  JournalRecord rec;
+  rec.file = "/a/app";
+  rec.hash = world;
+  rec.state.size = 64;
+  rec.state.h[0] = 1;
+  arena.add(rec);
+
+  find("/a/b/file1");
+  find("/a/b/file2");
+  find("/a/c/file1");
+  find("/file1");
+  find("file1");
+  find("/a/app");
+  find("/a/b/file3");
+  find("/a/d/file1");
+  find("/a/b/");
+  find(hello);
+  find(world);
+  all();
+
+  cout << "\nRemoving:\n";
+  uint32_t id = arena.find("/a/b/file1");
+  arena.remove(id);
+  arena.remove(arena.find("/a/app"));
+  find("/a/b/file1");
+  find(hello);
+  find(world);
+  cout << "Id reused: " << (add("/a/b/file4", world) == arena.find("/a/b/file4")) << endl;
+  find("/a/b/file4");
+  find(world);
+  all();
+
+  cout << "\nMany entries:\n";
+  for(int i=0; i<200000; i++)
+    {
+      char buf[100];
+      snprintf(buf, 100, "/some/long/directory/name/%d/file_with_a_long_name_%d", i%100, i);
+      add(buf, Hash(buf, strlen(buf)));
+    }
+  cout << "Size: " << arena.size() << endl;
+
+  // Enough to repack the name pool
+  for(int i=0; i<200000; i+=2)
+    {
+      char buf[100];
+      snprintf(buf, 100, "/some/long/directory/name/%d/file_with_a_long_name_%d", i%100, i);
+      arena.remove(arena.find(buf));
+    }
+  cout << "Size: " << arena.size() << endl;
+
+  int bad = 0;
+  for(int i=0; i<200000; i++)
+    {
+      char buf[100];
+      snprintf(buf, 100, "/some/long/directory/name/%d/file_with_a_long_name_%d", i%100, i);
+      uint32_t id = arena.find(buf);
+      if((i%2 == 0) != (id == 0)) bad++;
+      else if(id && arena.getPath(id) != buf) bad++;
+      vector<uint32_t> ids;
+      arena.find(Hash(buf, strlen(buf)), ids);
+      if(ids.size() != (i%2)) bad++;
+    }
+  cout << "Errors: " << bad << endl;
+  find("/a/b/file4");
+  find("/a/c/file1");
+
+  return 0;
+}
@@ -0,0 +1,127 @@
+#include <iostream>
+
+#include "cache.hpp"
+#include <boost/thread/mutex.hpp>
+#include <stdio.h>
+#include <map>
+
+using namespace Spread;
+using namespace std;
+using namespace Cache;
+
+#define FILES 200
+
+// Virtual file system, safe to call from several threads
+struct MyFS : FSystem
+{
+  map<string,Hash> files;
+  boost::mutex mutex;
+  int hashed;
+
+  std::string abs(const std::string &file) { return file; }
+  bool exists(const std::string &file) { return files.count(file) != 0; }
+  uint64_t file_size(const std::string &file) { return files.find(file)->second.size(); }
+  bool equivalent(const std::string &file1, const std::string &file2)
+  { return file1 == file2; }
+  uint64_t last_write_time(const std::string &file) { return 1000; }
+  Hash hashSum(const std::string &file)
+  {
+    boost::mutex::scoped_lock lock(mutex);
+    hashed++;
+    return files.find(file)->second;
+  }
+};
+
+MyFS fs;
+CacheIndex cache("", &fs);
+
+string name(int i)
+{
+  char buf[20];
+  snprintf(buf,20,"file%03d",i);
+  return buf;
+}
+
+void status(const string &what, JobInfoPtr info = JobInfoPtr())
+{
+  CIVector ents;
+  cache.getEntries(ents);
+  int good = 0;
+  for(int i=0; i<ents.size(); i++)
+    if(fs.exists(ents[i].file) && fs.files[ents[i].file] == ents[i].hash)
+      good++;
+  cout << what << ": " << ents.size() << " entries, " << good
+       << " correct, " << fs.hashed << " files hashed";
+  if(info)
+    cout << ", progress " << info->getCurrent() << "/" << info->getTotal();
+  cout << endl;
+  fs.hashed = 0;
+}
+
+int main()
+{
+  fs.hashed = 0;
+  Hash::DirMap all;
+  for(int i=0; i<FILES; i++)
+    {
+      string file = name(i);
+      fs.files[file] = Hash(file.c_str(), file.size());
+      all[file];
+    }
+
+  cache.setThreads(4);
+
+  {
+    JobInfoPtr info(new JobInfo);
+    cache.addMany(all, StrSet(), info);
+    status("Added", info);
+  }
+
+  // Change some files, remove others
+  for(int i=0; i<FILES; i+=10)
+    fs.files[name(i)] = Hash("changed file", 12);
+  for(int i=5; i<FILES; i+=10)
+    fs.files.erase(name(i));
+
+  {
+    JobInfoPtr info(new JobInfo);
+    Hash::DirMap check = all;
+    cache.checkMany(check, info);
+    int missing = 0, changed = 0;
+    for(Hash::DirMap::iterator it = check.begin(); it != check.end(); it++)
+      {
+        if(it->second.isNull()) missing++;
+        else if(it->second == Hash("changed file", 12)) changed++;
+      }
+    status("Checked", info);
+    cout << "  " << missing << " missing, " << changed << " changed\n";
+  }
+
+  // Aborted jobs stop early, and leave the rest of the list alone
+  {
+    JobInfoPtr info(new JobInfo);
+    info->abort();
+    Hash::DirMap check = all;
+    for(int i=1; i<FILES; i+=10)
+      fs.files[name(i)] = Hash("changed again", 13);
+    cache.checkMany(check, info);
+    status("Aborted", info);
+  }
+
+  // Errors don't stop the other files from being added
+  {
+    Hash::DirMap add;
+    add["file001"];
+    add["file005"];
+    add["file011"];
+    add["nofile"];
+    try { cache.addMany(add); }
+    catch(exception &e) { cout << "Error: " << e.what() << endl; }
+    status("Added with errors");
+  }
+
+  cache.verify();
+  status("Verified");
+
+  return 0;
+}
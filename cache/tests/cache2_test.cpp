@@ -1,6 +1,7 @@
 #include <iostream>
 
 #include "index.hpp"
+#include <fstream>
 
 using namespace Spread;
 using namespace std;
@@ -51,7 +52,13 @@ void status(const std::string &file, const Hash &h)
 
 int main()
 {
-  index.load("cache2.conf");
+  // Loading converts the file, so use a copy
+  {
+    ifstream in("cache2.conf");
+    ofstream out("_cache2.conf");
+    out << in.rdbuf();
+  }
+  index.load("_cache2.conf");
 
   Hash hello("hello", 5);
   status("hello2.dat", hello);
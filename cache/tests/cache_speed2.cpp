@@ -0,0 +1,121 @@
+#include <iostream>
+
+#include "index.hpp"
+#include <boost/thread/thread.hpp>
+#include <sys/time.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <map>
+
+/* Lookups while other threads are hashing. Uses a virtual file
+   system where hashing a file just sleeps for a while, so the
+   numbers show how long lookups are held up, not how fast we can
+   hash.
+ */
+
+using namespace Spread;
+using namespace std;
+using namespace Cache;
+
+#define FILES 1000
+#define LOOKUPS 20000
+#define HASHERS 4
+#define HASH_TIME 500000
+
+// Wall clock time, since the other threads are mostly sleeping
+double now()
+{
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+struct SlowFS : FSystem
+{
+  map<string,Hash> files;
+
+  std::string abs(const std::string &file) { return file; }
+  bool exists(const std::string &file) { return files.count(file) != 0; }
+  uint64_t file_size(const std::string &file) { return files[file].size(); }
+  bool equivalent(const std::string &file1, const std::string &file2)
+  { return file1 == file2; }
+  uint64_t last_write_time(const std::string &file) { return 1000; }
+  Hash hashSum(const std::string &file)
+  {
+    usleep(HASH_TIME);
+    return files[file];
+  }
+};
+
+SlowFS fs;
+vector<Hash> hashes;
+
+struct Hasher
+{
+  CacheIndex *index;
+  string file;
+
+  void operator()() { index->addFile(file); }
+};
+
+void lookups(CacheIndex &index, const string &what)
+{
+  double start = now();
+  int found = 0;
+  for(int i=0; i<LOOKUPS; i++)
+    if(index.findHash(hashes[i%FILES]) != "")
+      found++;
+  cout << what << ": " << LOOKUPS << " lookups in " << now()-start
+       << " secs (" << found << " found)\n";
+}
+
+int main()
+{
+  char buf[20];
+  for(int i=0; i<FILES; i++)
+    {
+      snprintf(buf,20,"%d",i);
+      string file = "/small/" + string(buf);
+      Hash h(file.c_str(), file.size());
+      fs.files[file] = h;
+      hashes.push_back(h);
+    }
+  for(int i=0; i<HASHERS; i++)
+    {
+      snprintf(buf,20,"/big/%d",i);
+      fs.files[buf] = Hash(buf, 5);
+    }
+
+  CacheIndex index("", &fs);
+  {
+    Hash::DirMap add;
+    map<string,Hash>::iterator it;
+    for(it = fs.files.begin(); it != fs.files.end(); it++)
+      if(it->first.substr(0,7) == "/small/")
+        add[it->first] = it->second;
+    index.addMany(add);
+  }
+
+  lookups(index, "Idle");
+
+  // Index a few slow files in the background
+  boost::thread_group threads;
+  for(int i=0; i<HASHERS; i++)
+    {
+      Hasher h;
+      h.index = &index;
+      snprintf(buf,20,"/big/%d",i);
+      h.file = buf;
+      threads.create_thread(h);
+    }
+
+  // Give them time to start hashing
+  usleep(HASH_TIME/10);
+  lookups(index, "While hashing");
+
+  double start = now();
+  threads.join_all();
+  cout << "Hashing finished after another " << now()-start << " secs\n";
+
+  return 0;
+}
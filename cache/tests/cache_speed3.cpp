@@ -0,0 +1,86 @@
+#include <iostream>
+
+#include "stat_batch.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <sys/time.h>
+#include <fstream>
+#include <stdio.h>
+#include <unistd.h>
+
+/* Batched vs. one-by-one stat on many files. The cold runs try to
+   drop the kernel caches first, which needs root. Without it, both
+   runs are warm and the numbers only show the per-call overhead.
+ */
+
+using namespace std;
+using namespace Cache;
+namespace bf = boost::filesystem;
+
+#define FILES 20000
+#define DIRS 100
+
+double now()
+{
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+bool dropCaches()
+{
+  sync();
+  FILE *f = fopen("/proc/sys/vm/drop_caches", "w");
+  if(!f) return false;
+  bool ok = fputs("3", f) >= 0;
+  return fclose(f) == 0 && ok;
+}
+
+vector<string> files;
+
+void test(bool uring, bool cold)
+{
+  StatBatch::useUring = uring;
+  if(cold && !dropCaches())
+    cout << "(could not drop caches) ";
+
+  vector<FileStat> out;
+  vector<int> res;
+  double start = now();
+  StatBatch::run(files, out, res);
+  double time = now() - start;
+
+  int found = 0;
+  for(int i=0; i<res.size(); i++)
+    if(res[i] == FS_FOUND) found++;
+
+  cout << (uring?"io_uring":"stat()  ") << (cold?" cold: ":" warm: ")
+       << time << "s, " << found << " found\n";
+}
+
+int main()
+{
+  cout << "io_uring available: " << StatBatch::hasUring() << endl;
+
+  for(int i=0; i<FILES; i++)
+    {
+      char buf[100];
+      snprintf(buf, 100, "_speed3/d%d/f%d", i%DIRS, i);
+      files.push_back(buf);
+    }
+
+  if(!bf::exists("_speed3"))
+    {
+      cout << "Creating " << FILES << " files\n";
+      for(int i=0; i<DIRS; i++)
+        bf::create_directories("_speed3/d" + boost::lexical_cast<string>(i));
+      for(int i=0; i<files.size(); i++)
+        ofstream of(files[i].c_str());
+    }
+
+  test(false, true);
+  test(false, false);
+  test(true, true);
+  test(true, false);
+  return 0;
+}
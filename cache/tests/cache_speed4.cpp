@@ -0,0 +1,80 @@
+#include <iostream>
+
+#include "index.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/lexical_cast.hpp>
+#include <sys/time.h>
+#include <fstream>
+#include <stdio.h>
+
+/* Repeated lookups of indexed files, with and without watching the
+   directory tree.
+ */
+
+using namespace Spread;
+using namespace std;
+using namespace Cache;
+namespace bf = boost::filesystem;
+
+#define FILES 10000
+#define DIRS 100
+#define ROUNDS 10
+
+double now()
+{
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+vector<string> files;
+
+void test(bool watch)
+{
+  CacheIndex cache;
+  if(watch)
+    cout << "Watching: " << cache.watch("_speed4") << endl;
+
+  Hash::DirMap all;
+  for(int i=0; i<files.size(); i++)
+    all[files[i]];
+  cache.addMany(all);
+
+  double start = now();
+  for(int r=0; r<ROUNDS; r++)
+    for(int i=0; i<files.size(); i++)
+      cache.addFile(files[i]);
+  double time = now() - start;
+
+  cout << (watch?"inotify: ":"stat:    ") << time << "s for "
+       << ROUNDS*FILES << " lookups\n";
+}
+
+int main()
+{
+  for(int i=0; i<FILES; i++)
+    {
+      char buf[100];
+      snprintf(buf, 100, "_speed4/d%d/f%d", i%DIRS, i);
+      files.push_back(bf::absolute(buf).string());
+    }
+
+  if(!bf::exists("_speed4"))
+    {
+      cout << "Creating " << FILES << " files\n";
+      for(int i=0; i<DIRS; i++)
+        bf::create_directories("_speed4/d" + boost::lexical_cast<string>(i));
+      for(int i=0; i<files.size(); i++)
+        {
+          ofstream of(files[i].c_str());
+          of << i;
+        }
+      // Old enough to not be racy
+      for(int i=0; i<files.size(); i++)
+        bf::last_write_time(files[i], time(NULL) - 100);
+    }
+
+  test(false);
+  test(true);
+  return 0;
+}
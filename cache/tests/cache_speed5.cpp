@@ -0,0 +1,102 @@
+#include <iostream>
+
+#include "index.hpp"
+#include <malloc.h>
+#include <sys/time.h>
+#include <stdio.h>
+#include <string.h>
+
+/* Memory used by a large index. Entries are added through a virtual
+   file system, so nothing is read from disk. Most of the paths are
+   in the cache store, the rest in a handful of install directories.
+ */
+
+using namespace Spread;
+using namespace std;
+using namespace Cache;
+
+#define ENTRIES 5000000
+#define BATCH 100000
+
+double now()
+{
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+// Heap memory in use, including large mmap'ed blocks
+uint64_t heap()
+{
+  struct mallinfo2 mi = mallinfo2();
+  return mi.uordblks + mi.hblkhd;
+}
+
+struct FakeFS : FSystem
+{
+  std::string abs(const std::string &file) { return file; }
+  bool exists(const std::string &file) { return true; }
+  uint64_t file_size(const std::string &file) { return 100; }
+  bool equivalent(const std::string &file1, const std::string &file2)
+  { return file1 == file2; }
+  uint64_t last_write_time(const std::string &file) { return 1000000; }
+  Hash hashSum(const std::string &file)
+  {
+    Hash h(file.c_str(), file.size());
+    h.size() = 100;
+    return h;
+  }
+  bool getStat(const std::string &file, FileStat &out)
+  {
+    out = FileStat();
+    out.size = 100;
+    out.mtime = 1000000 * (int64_t)1000000000;
+    return true;
+  }
+};
+
+string name(int i)
+{
+  char buf[200];
+  if(i % 5)
+    {
+      // Store files are named by their hash
+      Hash h(&i, 4);
+      string s = h.toString();
+      snprintf(buf, 200, "/home/user/.spread/cache/%s/%s", s.substr(0,2).c_str(), s.c_str());
+    }
+  else
+    snprintf(buf, 200, "/home/user/games/game%d/data/dir%d/file%d.dat",
+             i%20, (i/20)%500, i);
+  return buf;
+}
+
+int main()
+{
+  FakeFS fs;
+  uint64_t start = heap();
+  double time = now();
+  {
+    CacheIndex cache("", &fs);
+    for(int b=0; b<ENTRIES; b+=BATCH)
+      {
+        Hash::DirMap files;
+        for(int i=b; i<b+BATCH; i++)
+          {
+            Hash h(&i, 4);
+            h.size() = 100;
+            files[name(i)] = h;
+          }
+        cache.addMany(files);
+      }
+    uint64_t used = heap() - start;
+    cout << ENTRIES << " entries in " << now()-time << "s\n";
+    cout << "Heap: " << used/(1024*1024) << " MB, " << used/ENTRIES << " bytes per entry\n";
+
+    time = now();
+    for(int i=0; i<ENTRIES; i+=7)
+      cache.addFile(name(i));
+    cout << ENTRIES/7 << " lookups in " << now()-time << "s\n";
+  }
+  return 0;
+}
@@ -0,0 +1,84 @@
+#include <iostream>
+
+#include "index.hpp"
+#include "files.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include <sys/time.h>
+#include <fstream>
+#include <stdio.h>
+
+/* Startup time for a cache store: loading the index and scanning the
+   store with a full cacheAll(), compared to cacheChanged() with
+   nothing or one directory changed.
+ */
+
+using namespace Spread;
+using namespace std;
+using namespace Cache;
+namespace bf = boost::filesystem;
+
+#define FILES 50000
+#define DIRS 256
+
+double now()
+{
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+// Start up like SpreadLib does, with the given scan
+void startup(const string &what, bool full)
+{
+  double start = now();
+  CacheIndex cache("_speed6.conf");
+  Files files(cache, "_speed6");
+  if(full) files.cacheAll();
+  else files.cacheChanged("_speed6.state");
+  double time = now() - start;
+
+  cout << what << time << "s\n";
+
+  // Shut down cleanly. Wait first, or directories that just changed
+  // are left out of the state.
+  boost::this_thread::sleep(boost::posix_time::milliseconds(2100));
+  files.saveScan("_speed6.state");
+}
+
+int main()
+{
+  if(!bf::exists("_speed6"))
+    {
+      cout << "Creating " << FILES << " files\n";
+      for(int i=0; i<FILES; i++)
+        {
+          char buf[100];
+          snprintf(buf, 100, "_speed6/%02x/f%d", i%DIRS, i);
+          if(i < DIRS) bf::create_directories(bf::path(buf).parent_path());
+          ofstream of(buf);
+          of << i;
+        }
+      bf::remove("_speed6.conf");
+      bf::remove("_speed6.conf.snap");
+    }
+  bf::remove("_speed6.state");
+
+  // Index everything once
+  startup("First run:              ", true);
+
+  startup("Full scan:              ", true);
+  startup("Nothing changed:        ", false);
+
+  {
+    ofstream of("_speed6/07/new");
+    of << "new";
+  }
+  startup("One directory changed:  ", false);
+
+  bf::remove("_speed6/07/new");
+  bf::remove("_speed6.state");
+  startup("No state (after crash): ", false);
+
+  return 0;
+}
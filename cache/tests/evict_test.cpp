@@ -0,0 +1,156 @@
+#include <iostream>
+
+#include "evict.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+using namespace std;
+using namespace Cache;
+using namespace Spread;
+namespace bf = boost::filesystem;
+
+CacheIndex *cache;
+Files *files;
+
+Hash make(const string &data)
+{
+  Hash h(data.c_str(), data.size());
+  string file = files->storePath(h);
+  if(file != "")
+    {
+      ofstream of(file.c_str());
+      of << data;
+    }
+  return h;
+}
+
+void find(const string &data)
+{
+  cache->findHash(Hash(data.c_str(), data.size()));
+}
+
+void show()
+{
+  CIVector ents;
+  cache->getEntries(ents);
+  for(int i=0; i<ents.size(); i++)
+    {
+      ifstream inf(ents[i].file.c_str());
+      string data;
+      getline(inf, data);
+      cout << "  " << data << endl;
+    }
+}
+
+void trim(Quota q, const HashSet &pinned = HashSet())
+{
+  EvictJob job(*files, *cache, q, pinned);
+  JobInfoPtr info = job.run();
+  cout << "Removed " << job.filesRemoved << " files, " << job.bytesRemoved
+       << " bytes, success=" << info->isSuccess() << endl;
+  show();
+}
+
+int main()
+{
+  bf::remove_all("_evict");
+  bf::remove("_evict.conf");
+  bf::remove("_evict.conf.access");
+
+  cache = new CacheIndex("_evict.conf");
+  files = new Files(*cache, "_evict");
+
+  for(int i=1; i<=6; i++)
+    make("data" + string(1, '0'+i));
+  files->cacheAll();
+
+  cout << "Initial:\n";
+  show();
+
+  cout << "\nUnder the limit:\n";
+  Quota q;
+  q.maxFiles = 10;
+  trim(q);
+
+  // Files that were never looked up go first, then the oldest
+  cout << "\nLRU:\n";
+  find("data5");
+  find("data1");
+  find("data3");
+  q.maxFiles = 4;
+  q.lowWater = 0.75;
+  trim(q);
+
+  cout << "\nLFU:\n";
+  find("data1");
+  find("data1");
+  find("data5");
+  q.policy = Quota::LFU;
+  q.maxFiles = 2;
+  q.lowWater = 0.5;
+  trim(q);
+
+  cout << "\nPinned:\n";
+  Hash h7 = make("data7");
+  make("data8");
+  files->cacheAll();
+  show();
+  HashSet pinned;
+  pinned.insert(h7);
+  q.policy = Quota::LRU;
+  q.maxFiles = 0;
+  q.maxBytes = 5;
+  q.lowWater = 1;
+  trim(q, pinned);
+
+  cout << "\nSaved statistics:\n";
+  find("data7");
+  delete cache;
+  cache = new CacheIndex("_evict.conf");
+  CIAccess a;
+  cout << "  data7: " << cache->getAccess(Hash("data7",5), a)
+       << " count=" << a.count << endl;
+  cout << "  data3 (removed): " << cache->getAccess(Hash("data3",5), a) << endl;
+
+  /* A file that can't be removed keeps its index entry and doesn't
+     count, and a file that is already gone only leaves the index.
+   */
+  cout << "\nFailed removals:\n";
+  delete files;
+  files = new Files(*cache, "_evict");
+  Hash ha = make("dataA"), hb = make("dataB"), hc = make("dataC");
+  files->cacheAll();
+  string fa = files->makePath(ha);
+  bf::remove(fa);
+  bf::create_directories(fa + "/sub");
+  bf::remove(files->makePath(hb));
+  q.maxBytes = 0;
+  q.maxFiles = 1;
+  trim(q, pinned);
+  CIVector ents;
+  cache->getEntries(ents);
+  cout << "  entries=" << ents.size()
+       << " dataA kept=" << bf::exists(fa) << endl;
+
+  // Packed objects count with the space they take on disk
+  cout << "\nPacked object:\n";
+  string big(100000, 'x');
+  Hash hbig(big.c_str(), big.size());
+  files->compress = true;
+  string fbig = files->storePath(hbig);
+  {
+    ofstream of(fbig.c_str());
+    of << big;
+  }
+  files->addStored(fbig, hbig);
+  q.maxFiles = 0;
+  q.maxBytes = 50000;
+  EvictJob job(*files, *cache, q);
+  job.run();
+  cout << "  removed=" << job.filesRemoved
+       << " found=" << (cache->findHash(hbig) != "") << endl;
+
+  delete files;
+  delete cache;
+  return 0;
+}
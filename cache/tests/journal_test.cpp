@@ -0,0 +1,203 @@
+#include <iostream>
+
+#include "index.hpp"
+#include "journal.hpp"
+#include "misc/jconfig.hpp"
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+using namespace Spread;
+using namespace std;
+using namespace Cache;
+namespace bf = boost::filesystem;
+
+string file = "_journal/index.conf";
+
+Hash hello("hello", 5);
+Hash world("HelloWorld", 10);
+
+// Pretends every file exists, with a content of "hello"
+struct MyFS : FSystem
+{
+  uint64_t time;
+
+  std::string abs(const std::string &file) { return file; }
+  bool exists(const std::string &file) { return true; }
+  uint64_t file_size(const std::string &file) { return hello.size(); }
+  bool equivalent(const std::string &file1, const std::string &file2)
+  { return file1 == file2; }
+  uint64_t last_write_time(const std::string &file) { return time; }
+  Hash hashSum(const std::string &file) { return hello; }
+};
+
+JournalRecord rec(const string &name, const Hash &h, int64_t time)
+{
+  JournalRecord r;
+  r.file = name;
+  r.hash = h;
+  r.writeTime = time;
+  return r;
+}
+
+void print(const string &what)
+{
+  IndexJournal j(file);
+  JRVector ents;
+  bool ok = j.load(ents);
+  cout << what << ": load=" << ok << " records=" << j.records()
+       << " size=" << bf::file_size(file) << endl;
+  for(int i=0; i<ents.size(); i++)
+    {
+      if(ents[i].hash.isNull())
+        {
+          cout << "  " << ents[i].file << " removed\n";
+          continue;
+        }
+      cout << "  " << ents[i].file << " " << ents[i].hash
+           << " " << ents[i].writeTime;
+      if(ents[i].state.isSet())
+        cout << " state=" << ents[i].state.size << " check=" << ents[i].check;
+      cout << endl;
+    }
+}
+
+void listIndex(const string &what)
+{
+  MyFS fs;
+  CacheIndex index(file, &fs);
+  CIVector ents;
+  index.getEntries(ents);
+  cout << what << ": " << ents.size() << " entries\n";
+  for(int i=0; i<ents.size(); i++)
+    cout << "  " << ents[i].file << " " << ents[i].hash
+         << " " << ents[i].writeTime << endl;
+}
+
+void garbage(const string &data)
+{
+  ofstream of(file.c_str(), ios::binary | ios::app);
+  of << data;
+}
+
+void poke(uint64_t pos)
+{
+  fstream f(file.c_str(), ios::binary | ios::in | ios::out);
+  f.seekp(pos);
+  f.put('X');
+}
+
+int main()
+{
+  bf::remove_all("_journal");
+
+  {
+    IndexJournal j(file);
+    JRVector ents;
+    cout << "Missing file: load=" << j.load(ents) << " entries=" << ents.size() << endl;
+
+    j.add(rec("a", hello, 100));
+    j.add(rec("b", world, 200));
+
+    JournalRecord r = rec("c", world, 300);
+    HashBuilder hb;
+    hb.update("HelloWorld", 10);
+    r.state = hb.getState();
+    r.state.size = 64;
+    r.check = hello;
+    j.add(r);
+
+    JRVector many;
+    many.push_back(rec("a", world, 101));
+    many.push_back(rec("d", hello, 400));
+    j.append(many);
+    j.remove("b");
+  }
+  print("Written");
+
+  // A crash in the middle of a write leaves a partial record
+  uint64_t size = bf::file_size(file);
+  garbage("\x20\x00\x00");
+  print("Partial length");
+  garbage(string("\x20\x00\x00\x00\x01\x02\x03\x04\x01", 9));
+  print("Partial record");
+
+  // Appending after a cut off tail works normally
+  {
+    IndexJournal j(file);
+    JRVector ents;
+    j.load(ents);
+    j.add(rec("e", hello, 500));
+  }
+  print("Added after repair");
+
+  // A damaged record is dropped, along with everything after it
+  poke(size + 12);
+  print("Damaged record");
+
+  // Compaction keeps records appended after mark()
+  {
+    IndexJournal j(file);
+    JRVector live;
+    j.load(live);
+    uint64_t pos = j.mark();
+    j.add(rec("f", world, 600));
+    j.remove("a");
+    j.compact(live, pos);
+    j.add(rec("g", hello, 700));
+  }
+  print("Compacted");
+
+  // Old JSON configs are converted on load
+  bf::remove_all("_journal");
+  {
+    Misc::JConfig conf(file);
+    conf.set("x", hello.toString() + " 1000");
+    conf.set("y", world.toString() + " 2000");
+    conf.set("broken", "nothing here");
+    conf.set("z", hello.toString() + " 3000");
+    bf::rename(file, file + ".old");
+  }
+  {
+    MyFS fs;
+    CacheIndex index(file, &fs);
+    CIVector ents;
+    index.getEntries(ents);
+    cout << "Converted: " << ents.size() << " entries, journal="
+         << IndexJournal::isJournal(file) << " old=" << bf::exists(file + ".old")
+         << " snapshot=" << bf::exists(file + ".snap") << endl;
+  }
+  print("Converted journal");
+  listIndex("Converted index");
+
+  // Lots of changes to the same entries are compacted in the background
+  {
+    MyFS fs;
+    CacheIndex index(file, &fs);
+    for(int i=0; i<5000; i++)
+      {
+        fs.time = 10000 + i;
+        index.addFile("x");
+      }
+  }
+  {
+    IndexJournal j(file);
+    JRVector ents;
+    j.load(ents);
+    // How far the compaction gets depends on thread timing
+    cout << "Background compaction: fewer records than changes: "
+         << (j.records() < 5000) << endl;
+  }
+  listIndex("After compaction");
+
+  // And compact() does it right away
+  {
+    MyFS fs;
+    CacheIndex index(file, &fs);
+    index.compact();
+  }
+  print("Compacted journal");
+  listIndex("Compacted index");
+
+  return 0;
+}
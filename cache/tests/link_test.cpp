@@ -0,0 +1,129 @@
+#include <iostream>
+
+#include "index.hpp"
+#include "files.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+using namespace std;
+using namespace Cache;
+using namespace Spread;
+namespace bf = boost::filesystem;
+
+CacheIndex *cache;
+Files *files;
+
+string text(int len, const string &line)
+{
+  string res;
+  while(res.size() < len)
+    res += line;
+  return res.substr(0, len);
+}
+
+void write(const string &file, const string &data)
+{
+  ofstream of(file.c_str(), ios::binary);
+  of << data;
+}
+
+string read(const string &file)
+{
+  ifstream inf(file.c_str(), ios::binary);
+  string res;
+  getline(inf, res, '\0');
+  return res;
+}
+
+Hash store(const string &data)
+{
+  Hash h(data.c_str(), data.size());
+  string file = files->storePath(h);
+  if(file != "")
+    {
+      write(file, data);
+      files->addStored(file, h);
+    }
+  return h;
+}
+
+/* Link 'dest' from the store. Whether cloning works depends on the
+   file system, but either way nothing half done should be left
+   behind: a clone is a separate file with the right data, and
+   otherwise 'dest' is gone.
+ */
+bool clone(const Hash &h, const string &dest)
+{
+  string src = files->linkStored(h, dest, LM_Reflink);
+  if(src == "") return !bf::exists(dest);
+  string data = read(dest);
+  return src == files->makePath(h) && !bf::equivalent(src, dest) &&
+    Hash(data.c_str(), data.size()) == h;
+}
+
+// For objects that must never be linked
+void link(const string &name, const Hash &h, const string &dest, int mode)
+{
+  string src = files->linkStored(h, dest, mode);
+  cout << name << ": linked=" << (src != "")
+       << " exists=" << bf::exists(dest) << endl;
+}
+
+int main()
+{
+  bf::remove_all("_link");
+  bf::remove("_link.conf");
+  bf::create_directories("_link/out");
+
+  cache = new CacheIndex("_link.conf");
+  files = new Files(*cache, "_link/store");
+
+  string data = text(10000, "Data for linking. ");
+  Hash h = store(data);
+
+  cout << "Stored object:\n";
+  link("copy", h, "_link/out/copy", LM_Copy);
+  cout << "reflink: consistent=" << clone(h, "_link/out/clone") << endl;
+
+  cout << "\nReplacing an existing file:\n";
+  write("_link/out/old", "old");
+  cout << "reflink: consistent=" << clone(h, "_link/out/old") << endl;
+
+  cout << "\nUnusable objects:\n";
+  link("missing", Hash("nothing", 7), "_link/out/missing", LM_Reflink);
+
+  files->compress = true;
+  Hash hp = store(text(100000, "Compressed data. "));
+  link("packed", hp, "_link/out/packed", LM_Reflink);
+  files->compress = false;
+
+  string other = text(10000, "Other data here. ");
+  Hash ho = store(other);
+  {
+    // Damage it without changing the size
+    string file = files->makePath(ho);
+    bf::last_write_time(file, bf::last_write_time(file) - 10);
+    write(file, text(10000, "Changed data!!!! "));
+  }
+  link("damaged", ho, "_link/out/damaged", LM_Reflink);
+
+  cout << "\nAdopting new files:\n";
+  string fresh = text(5000, "Freshly fetched. ");
+  Hash hf(fresh.c_str(), fresh.size());
+  write("_link/out/fresh", fresh);
+  string dest = files->adoptFile("_link/out/fresh", hf, LM_Copy);
+  cout << "copy: adopted=" << (dest != "") << endl;
+  dest = files->adoptFile("_link/out/fresh", hf, LM_Reflink);
+  cout << "reflink: consistent="
+       << (dest != "" ? dest == files->makePath(hf) &&
+           !bf::equivalent(dest, "_link/out/fresh") &&
+           cache->findHash(hf) == bf::absolute(dest).string()
+           : cache->findHash(hf) == "") << endl;
+  cout << "  source intact: " << (read("_link/out/fresh") == fresh) << endl;
+  cout << "  again: " << (files->adoptFile("_link/out/fresh", hf, LM_Reflink) == "") << endl;
+  cout << "  link back: " << clone(hf, "_link/out/fresh2") << endl;
+
+  delete files;
+  delete cache;
+  return 0;
+}
@@ -0,0 +1,219 @@
+#include <iostream>
+
+#include "index.hpp"
+#include "files.hpp"
+#include "packed.hpp"
+#include "journal.hpp"
+#include "hash/hash_stream.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <stdlib.h>
+#include <time.h>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace Cache;
+using namespace Spread;
+namespace bf = boost::filesystem;
+
+CacheIndex *cache;
+Files *files;
+
+string text(int len)
+{
+  string res;
+  while(res.size() < len)
+    res += "All work and no play makes Jack a dull boy. ";
+  return res.substr(0, len);
+}
+
+string noise(int len)
+{
+  string res(len, 0);
+  srand(42);
+  for(int i=0; i<len; i++)
+    res[i] = rand() & 0xff;
+  return res;
+}
+
+// Real files, but counts the number of times a file is hashed
+struct CountFS : FSystem
+{
+  int hashed;
+  CountFS() : hashed(0) {}
+
+  std::string abs(const std::string &file)
+  { return bf::absolute(file).string(); }
+  bool exists(const std::string &file) { return bf::exists(file); }
+  uint64_t file_size(const std::string &file) { return bf::file_size(file); }
+  bool equivalent(const std::string &file1, const std::string &file2)
+  { return bf::equivalent(file1, file2); }
+  uint64_t last_write_time(const std::string &file)
+  { return bf::last_write_time(file); }
+  uint64_t dataSize(const std::string &file) { return Packed::dataSize(file); }
+  Hash hashSum(const std::string &file)
+  {
+    hashed++;
+    return Packed::hashSum(file);
+  }
+
+  bool getStat(const std::string &file, FileStat &out)
+  {
+    struct stat st;
+    if(::stat(file.c_str(), &st) != 0) return false;
+    out.size = st.st_size;
+    out.mtime = st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    out.ctime = st.st_ctim.tv_sec * 1000000000LL + st.st_ctim.tv_nsec;
+    out.inode = st.st_ino;
+    out.device = st.st_dev;
+    return true;
+  }
+};
+
+uint64_t journalRecords()
+{
+  IndexJournal j("_packed.conf");
+  JRVector recs;
+  j.load(recs);
+  return j.records();
+}
+
+string readAll(const string &file)
+{
+  Mangle::Stream::StreamPtr inf = Packed::open(file);
+  string res(inf->size(), 0);
+  size_t num = res.size() ? inf->read(&res[0], res.size()) : 0;
+  res.resize(num);
+  return res;
+}
+
+Hash store(const string &name, const string &data)
+{
+  Hash h(data.c_str(), data.size());
+  string file = files->storePath(h);
+  if(file != "")
+    {
+      ofstream of(file.c_str(), ios::binary);
+      of << data;
+      of.close();
+      files->addStored(file, h);
+    }
+
+  // Packed objects are stored under their own name
+  file = files->makePath(h);
+  if(Packed::isPacked(Packed::packedName(file)) &&
+     bf::exists(Packed::packedName(file)))
+    file = Packed::packedName(file);
+  cout << name << ": packed=" << Packed::isPacked(file)
+       << " smaller=" << (bf::file_size(file) < data.size())
+       << " size=" << Packed::dataSize(file)
+       << " found=" << (cache->findHash(h) == bf::absolute(file).string())
+       << " readback=" << (readAll(file) == data) << endl;
+  return h;
+}
+
+int main()
+{
+  bf::remove_all("_packed");
+  bf::remove("_packed.conf");
+  bf::remove("_packed.spz");
+
+  cache = new CacheIndex("_packed.conf");
+  files = new Files(*cache, "_packed");
+
+  string big = text(100000);
+  string rnd = noise(100000);
+  string small = text(1000);
+
+  cout << "Plain store:\n";
+  store("text", big);
+
+  cout << "\nCompressed store:\n";
+  files->compress = true;
+  Hash hbig = store("text", text(200000));
+  Hash hrnd = store("noise", rnd);
+  store("small", small);
+
+  string file = Packed::packedName(files->makePath(hbig));
+  cout << "\nStored again: " << (files->storePath(hbig) == "")
+       << " plain name gone=" << !bf::exists(files->makePath(hbig)) << endl;
+
+  Packed::unpackTo(file, "_packed/copy");
+  cout << "unpackTo: " << (Packed::hashSum("_packed/copy") == hbig)
+       << " packed=" << Packed::isPacked("_packed/copy") << endl;
+
+  cout << "\nFresh index, after a full scan:\n";
+  delete files;
+  delete cache;
+  bf::remove("_packed.conf");
+  bf::remove("_packed/copy");
+  cache = new CacheIndex("_packed.conf");
+  files = new Files(*cache, "_packed");
+  files->cacheAll();
+  CIVector ents;
+  cache->getEntries(ents);
+  cout << "  " << ents.size() << " entries\n";
+  cout << "  text: " << (cache->findHash(hbig) == bf::absolute(file).string()) << endl;
+  cout << "  noise: " << (cache->findHash(hrnd) != "") << endl;
+  cout << "  status: " << cache->getStatus(file, hbig) << endl;
+  delete files;
+  delete cache;
+
+  /* Packed objects are smaller on disk than their data. Once indexed,
+     looking them up again must not hash the file or touch the journal.
+     Move the file out of the racy window first.
+   */
+  cout << "\nRepeated lookups of a packed object:\n";
+  bf::last_write_time(file, time(NULL) - 10);
+  {
+    CountFS fs;
+    CacheIndex index("_packed.conf", &fs);
+    cout << "  first: " << (index.addFile(file) == hbig)
+         << " hashed=" << fs.hashed << endl;
+    uint64_t recs = journalRecords();
+    cout << "  second: " << (index.addFile(file) == hbig)
+         << " hashed=" << fs.hashed
+         << " journal grew=" << (journalRecords() != recs) << endl;
+  }
+  for(int i=0; i<2; i++)
+    {
+      CountFS fs;
+      CacheIndex index("_packed.conf", &fs);
+      uint64_t recs = journalRecords();
+      cout << (i ? "  from snapshot: " : "  from journal: ")
+           << (index.addFile(file) == hbig)
+           << " hashed=" << fs.hashed
+           << " journal grew=" << (journalRecords() != recs) << endl;
+      index.compact();
+    }
+  cache = new CacheIndex("_packed.conf");
+  files = new Files(*cache, "_packed");
+
+  /* Only the name makes a file packed. Files that merely look packed
+     are hashed as they are.
+   */
+  cout << "\nLooks packed, but isn't:\n";
+  store("band", "SPZ1 is the name of my band");
+  bf::copy_file(file, "_packed/raw");
+  bf::copy_file(file, "_packed.spz");
+  const char *raw[] = { "_packed/raw", "_packed.spz" };
+  for(int i=0; i<2; i++)
+    cout << "  " << raw[i] << ": packed=" << Packed::isPacked(raw[i])
+         << " size=" << (Packed::dataSize(raw[i]) == bf::file_size(raw[i]))
+         << " hashed raw=" << (cache->addFile(raw[i]) ==
+                               HashStream::sum(raw[i])) << endl;
+  bf::remove("_packed.spz");
+
+  cout << "\nBroken packed file:\n";
+  {
+    ofstream of(file.c_str(), ios::binary | ios::in);
+    of.seekp(100);
+    of << "garbage";
+  }
+  try { Packed::hashSum(file); }
+  catch(exception &e) { cout << "  " << e.what() << endl; }
+
+  delete files;
+  delete cache;
+  return 0;
+}
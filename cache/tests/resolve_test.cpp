@@ -0,0 +1,111 @@
+#include <iostream>
+
+#include "index.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+
+using namespace std;
+using namespace Cache;
+using namespace Spread;
+namespace bf = boost::filesystem;
+
+CacheIndex cache;
+CIResolveList reqs;
+
+Hash make(const string &file, const string &data)
+{
+  ofstream of(file.c_str());
+  of << data;
+  return Hash(data.c_str(), data.size());
+}
+
+void add(const Hash &h, const string &target = "")
+{
+  CIResolve r;
+  r.hash = h;
+  r.target = target;
+  reqs.push_back(r);
+}
+
+string strip(const string &file)
+{
+  if(file.size() > 5) return file.substr(file.size()-5);
+  return file;
+}
+
+void show()
+{
+  CIResolveList copy = reqs;
+  cache.resolveMany(reqs);
+
+  /* The unbatched version must agree. When there are several copies
+     of a file, it may pick another one though. It also can't use
+     targets that match as sources for lookups listed before them.
+   */
+  cache.ICacheIndex::resolveMany(copy);
+
+  for(int i=0; i<reqs.size(); i++)
+    {
+      const CIResolve &r = reqs[i];
+      cout << "  " << r.hash.toString().substr(0,6) << " "
+           << (r.target == "" ? "(none)" : strip(r.target)) << " => ";
+      if(r.source == "") cout << "not found";
+      else if(r.source == r.target) cout << "in place";
+      else cout << strip(r.source);
+      if((r.source == "") != (copy[i].source == "") ||
+         (r.source == r.target) != (copy[i].source == copy[i].target))
+        cout << "   DIFFERS FROM SINGLE: " << strip(copy[i].source);
+      cout << endl;
+    }
+  reqs.clear();
+}
+
+int main()
+{
+  bf::remove_all("_res");
+  bf::create_directories("_res");
+
+  Hash a = make("_res/a", "aaa");
+  Hash b = make("_res/b", "bbb");
+  make("_res/c", "aaa");
+  Hash d = make("_res/d", "ddd");
+  Hash none("none", 4);
+
+  cache.addFile("_res/a");
+  cache.addFile("_res/b");
+  cache.addFile("_res/c");
+
+  cout << "Lookups:\n";
+  add(a);
+  add(a, "_res/a");
+  add(a, "_res/x");
+  add(b, "_res/a");
+  add(a);
+  add(none);
+  add(none, "_res/a");
+  show();
+
+  cout << "\nTarget not indexed:\n";
+  add(d);
+  add(d, "_res/d");
+  add(d);
+  show();
+
+  cout << "\nFirst file changed:\n";
+  make("_res/a", "changed");
+  add(a);
+  add(a, "_res/x");
+  show();
+
+  cout << "\nAll files gone:\n";
+  bf::remove("_res/c");
+  add(a);
+  add(a, "_res/c");
+  show();
+
+  CIAccess acc;
+  cache.getAccess(b, acc);
+  cout << "\nAccess count for b: " << acc.count << endl;
+
+  return 0;
+}
@@ -0,0 +1,113 @@
+#include <iostream>
+
+#include "index.hpp"
+#include "files.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include <fstream>
+
+using namespace std;
+using namespace Cache;
+using namespace Spread;
+namespace bf = boost::filesystem;
+
+// Passes everything on to a CacheIndex, and reports checkMany() calls
+struct Reporter : ICacheIndex
+{
+  CacheIndex &cache;
+  string base;
+
+  Reporter(CacheIndex &c) : cache(c) {}
+
+  int getStatus(const string &where, const Hash &hash)
+  { return cache.getStatus(where, hash); }
+  string findHash(const Hash &hash) { return cache.findHash(hash); }
+  Hash addFile(string where, const Hash &h, bool allowMissing)
+  { return cache.addFile(where, h, allowMissing); }
+  void addMany(const Hash::DirMap &files, const StrSet &remove, JobInfoPtr info)
+  { cache.addMany(files, remove, info); }
+  void removeFile(const string &where) { cache.removeFile(where); }
+  void getEntries(CIVector &result) const { cache.getEntries(result); }
+
+  void checkMany(Hash::DirMap &files, JobInfoPtr info)
+  {
+    cout << "  Checking:";
+    Hash::DirMap::const_iterator it;
+    for(it = files.begin(); it != files.end(); it++)
+      cout << " " << bf::path(it->first).parent_path().filename().string()
+           << "/" << bf::path(it->first).filename().string();
+    cout << endl;
+    cache.checkMany(files, info);
+  }
+};
+
+CacheIndex cache;
+Reporter rep(cache);
+Files files(rep, "_scan");
+
+void make(const string &file, const string &data)
+{
+  bf::create_directories(bf::path(file).parent_path());
+  ofstream of(file.c_str());
+  of << data;
+}
+
+void show()
+{
+  CIVector ents;
+  cache.getEntries(ents);
+  cout << "  Index:";
+  for(int i=0; i<ents.size(); i++)
+    cout << " " << ents[i].file.substr(rep.base.size());
+  cout << endl;
+}
+
+// Saving leaves out directories that changed in the last two seconds
+void save()
+{
+  boost::this_thread::sleep(boost::posix_time::milliseconds(2100));
+  files.saveScan("_scan.state");
+}
+
+int main()
+{
+  bf::remove_all("_scan");
+  bf::remove("_scan.state");
+  rep.base = bf::absolute("_scan").string() + "/";
+
+  make("_scan/top", "top");
+  make("_scan/aa/1", "one");
+  make("_scan/aa/2", "two");
+  make("_scan/bb/3", "three");
+  make("_scan/cc/4", "four");
+
+  cout << "No state, full scan:\n";
+  files.cacheChanged("_scan.state");
+  show();
+
+  cout << "\nNothing changed:\n";
+  save();
+  files.cacheChanged("_scan.state");
+  cout << "  State left behind: " << bf::exists("_scan.state") << endl;
+
+  cout << "\nState is only used once:\n";
+  files.cacheChanged("_scan.state");
+  show();
+
+  cout << "\nAdded, removed and deleted directories:\n";
+  save();
+  make("_scan/aa/5", "five");
+  bf::remove("_scan/bb/3");
+  bf::remove_all("_scan/cc");
+  make("_scan/dd/6", "six");
+  files.cacheChanged("_scan.state");
+  show();
+
+  cout << "\nEntry missing from the index:\n";
+  save();
+  cache.removeFile("_scan/aa/1");
+  files.cacheChanged("_scan.state");
+  show();
+
+  return 0;
+}
@@ -0,0 +1,137 @@
+#include <iostream>
+
+#include "scrub.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include <sys/time.h>
+#include <fstream>
+
+using namespace std;
+using namespace Cache;
+using namespace Spread;
+namespace bf = boost::filesystem;
+
+CacheIndex *cache;
+Files *files;
+
+Hash make(const string &data)
+{
+  Hash h(data.c_str(), data.size());
+  string file = files->storePath(h);
+  if(file != "")
+    {
+      ofstream of(file.c_str());
+      of << data;
+    }
+  return h;
+}
+
+/* Make the data on disk differ from the index without the file
+   changing otherwise, like a bad disk would. Any write from here
+   would change the ctime, so change the index instead.
+ */
+Hash rot(const string &file, const string &data)
+{
+  Hash h(data.c_str(), data.size());
+  cache->addFile(file, h);
+  return h;
+}
+
+double now()
+{
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec/1000000.0;
+}
+
+void show()
+{
+  CIVector ents;
+  cache->getEntries(ents);
+  cout << "  Index:";
+  for(int i=0; i<ents.size(); i++)
+    {
+      ifstream inf(ents[i].file.c_str());
+      string data;
+      getline(inf, data);
+      cout << " " << data;
+    }
+  cout << endl;
+}
+
+void scrub(ScrubOptions opts = ScrubOptions())
+{
+  opts.quarantine = "_scrub/bad";
+  ScrubJob job(*files, *cache, "_scrub.state", opts);
+  JobInfoPtr info = job.run();
+  cout << "Checked " << job.filesChecked << " files, " << job.bytesChecked
+       << " bytes, " << job.filesBad << " bad, success=" << info->isSuccess() << endl;
+}
+
+int main()
+{
+  bf::remove_all("_scrub");
+  bf::remove("_scrub.conf");
+  bf::remove("_scrub.state");
+
+  cache = new CacheIndex("_scrub.conf");
+  files = new Files(*cache, "_scrub/store");
+
+  Hash h1 = make("data1");
+  Hash h2 = make("data2");
+  make("data3");
+  {
+    ofstream of("_scrub/outside");
+    of << "data4";
+  }
+  files->cacheAll();
+  cache->addFile("_scrub/outside");
+
+  /* Entries stored right after the files were written aren't
+     trusted (see CacheIndex::addFile()), and the scrubber leaves
+     those to the index. Give the time stamps time to settle, and let
+     the index check them again.
+   */
+  boost::this_thread::sleep(boost::posix_time::milliseconds(2100));
+  cache->verify();
+
+  cout << "First pass:\n";
+  scrub();
+  show();
+
+  cout << "\nAgain, with an interval (state is kept):\n";
+  ScrubOptions opts;
+  opts.interval = 3600;
+  scrub(opts);
+
+  cout << "\nCorrupt files:\n";
+  Hash bad = rot(files->makePath(h2), "DATA2");
+  rot("_scrub/outside", "DATA4");
+  scrub();
+  show();
+  cout << "  Quarantined: " << bf::exists(bf::path("_scrub/bad") / bad.toString()) << endl;
+  cout << "  Outside file kept: " << bf::exists("_scrub/outside") << endl;
+
+  cout << "\nMissing and changed files:\n";
+  bf::remove(files->makePath(h1));
+  boost::this_thread::sleep(boost::posix_time::milliseconds(1100));
+  {
+    ofstream of(files->makePath(Hash("data3",5)).c_str());
+    of << "data33";
+  }
+  boost::this_thread::sleep(boost::posix_time::milliseconds(2100));
+  scrub();
+  show();
+
+  cout << "\nWith a budget of 10 operations per second:\n";
+  opts = ScrubOptions();
+  opts.opsPerSec = 10;
+  double start = now();
+  scrub(opts);
+  // One open and one read
+  cout << "  Took at least 0.15s: " << (now()-start >= 0.15) << endl;
+
+  delete files;
+  delete cache;
+  return 0;
+}
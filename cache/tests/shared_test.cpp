@@ -0,0 +1,155 @@
+#include <iostream>
+
+#include "index.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+using namespace std;
+using namespace Cache;
+using namespace Spread;
+namespace bf = boost::filesystem;
+
+const string conf = "_shared.conf";
+
+CacheIndex *a, *b;
+
+CacheIndex *open()
+{
+  CacheIndex *res = new CacheIndex;
+  res->load(conf, true);
+  return res;
+}
+
+string name(int i)
+{
+  char buf[30];
+  snprintf(buf, sizeof(buf), "_shared/file%04d", i);
+  return buf;
+}
+
+Hash make(int i)
+{
+  char buf[30];
+  snprintf(buf, sizeof(buf), "data %d", i);
+  string data = buf;
+  ofstream of(name(i).c_str());
+  of << data;
+  return Hash(data.c_str(), data.size());
+}
+
+int count(CacheIndex *c)
+{
+  CIVector ents;
+  c->getEntries(ents);
+  return ents.size();
+}
+
+bool has(CacheIndex *c, const Hash &h)
+{
+  return c->findHash(h) != "";
+}
+
+// Add files [from, to) in a separate process, compacting halfway
+pid_t child(int from, int to)
+{
+  cout << flush;
+  pid_t pid = fork();
+  if(pid) return pid;
+
+  CacheIndex *c = open();
+  for(int i=from; i<to; i++)
+    {
+      c->addFile(name(i));
+      if(i == (from+to)/2) c->compact();
+    }
+  delete c;
+  _exit(0);
+}
+
+int main()
+{
+  bf::remove_all("_shared");
+  bf::create_directories("_shared");
+  bf::remove(conf);
+  bf::remove(conf + ".snap");
+  bf::remove(conf + ".lock");
+  bf::remove(conf + ".access");
+  bf::remove(conf + ".access.lock");
+
+  const int NUM = 1200;
+  vector<Hash> hashes;
+  for(int i=0; i<NUM; i++)
+    hashes.push_back(make(i));
+
+  a = open();
+  b = open();
+
+  cout << "Two indices on the same file:\n";
+  a->addFile(name(0));
+  cout << "  b sees a's file: " << has(b, hashes[0]) << endl;
+  b->addFile(name(1));
+  cout << "  a sees b's file: " << has(a, hashes[1]) << endl;
+  a->removeFile(name(0));
+  cout << "  b sees the removal: " << !has(b, hashes[0]) << endl;
+  cout << "  Entries: " << count(a) << " " << count(b) << endl;
+
+  cout << "\nAfter a compacts:\n";
+  a->compact();
+  b->addFile(name(2));
+  cout << "  a sees b's file: " << has(a, hashes[2]) << endl;
+  cout << "  b still has the old one: " << has(b, hashes[1]) << endl;
+  cout << "  Entries: " << count(a) << " " << count(b) << endl;
+
+  cout << "\nDamaged tail from a crashed writer:\n";
+  {
+    ofstream of(conf.c_str(), ios::binary | ios::app);
+    of << "\x40\x00\x00\x00garbage";
+  }
+  b->addFile(name(3));
+  cout << "  a sees b's file: " << has(a, hashes[3]) << endl;
+
+  // A shared file is always loaded as shared, so the others see this
+  {
+    CacheIndex fresh(conf);
+    cout << "  Unshared load: " << count(&fresh) << " entries\n";
+    fresh.addFile(name(4));
+  }
+  cout << "  a sees its file: " << has(a, hashes[4]) << endl;
+
+  cout << "\nTwo processes adding and compacting at once:\n";
+  pid_t p1 = child(10, 10+NUM/2-5);
+  pid_t p2 = child(10+NUM/2-5, NUM);
+  a->compact();
+  int s1, s2;
+  waitpid(p1, &s1, 0);
+  waitpid(p2, &s2, 0);
+  cout << "  Exit status: " << s1 << " " << s2 << endl;
+  cout << "  Entries: " << count(a) << " " << count(b) << endl;
+  bool all = true;
+  for(int i=10; i<NUM; i++)
+    if(!has(a, hashes[i])) all = false;
+  cout << "  a has all of them: " << all << endl;
+
+  // a already looked up hashes[10] once above
+  cout << "\nLookup statistics from both:\n";
+  a->getStatus(name(10), hashes[10]);
+  b->getStatus(name(10), hashes[10]);
+  b->getStatus(name(10), hashes[10]);
+  a->saveAccess();
+  b->saveAccess();
+
+  delete a;
+  delete b;
+
+  CacheIndex *c = open();
+  cout << "  Reopened: " << count(c) << " entries\n";
+  CIAccess acc;
+  c->getAccess(hashes[10], acc);
+  cout << "  Lookups: " << acc.count << endl;
+  delete c;
+
+  return 0;
+}
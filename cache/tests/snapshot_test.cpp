@@ -0,0 +1,202 @@
+#include <iostream>
+
+#include "index.hpp"
+#include "snapshot.hpp"
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <map>
+
+using namespace Spread;
+using namespace std;
+using namespace Cache;
+namespace bf = boost::filesystem;
+
+string conf = "_snapshot/index.conf";
+
+Hash hello("hello", 5);
+Hash world("HelloWorld", 10);
+
+// Virtual file system with a fixed set of files
+struct MyFS : FSystem
+{
+  map<string,Hash> files;
+
+  std::string abs(const std::string &file) { return file; }
+  bool exists(const std::string &file) { return files.count(file) != 0; }
+  uint64_t file_size(const std::string &file) { return files[file].size(); }
+  bool equivalent(const std::string &file1, const std::string &file2)
+  { return file1 == file2; }
+  uint64_t last_write_time(const std::string &file) { return 1000; }
+  Hash hashSum(const std::string &file)
+  {
+    cout << "  (hashing " << file << ")\n";
+    return files[file];
+  }
+};
+
+MyFS fs;
+
+JournalRecord rec(const string &name, const Hash &h, int64_t time)
+{
+  JournalRecord r;
+  r.file = name;
+  r.hash = h;
+  r.writeTime = time;
+  return r;
+}
+
+void listIndex(const string &what)
+{
+  CacheIndex index(conf, &fs);
+  CIVector ents;
+  index.getEntries(ents);
+  cout << what << ": " << ents.size() << " entries\n";
+  for(int i=0; i<ents.size(); i++)
+    cout << "  " << ents[i].file << " " << ents[i].hash
+         << " " << ents[i].writeTime << endl;
+}
+
+void listFiles(const string &what)
+{
+  IndexSnapshot snap;
+  bool ok = snap.open(conf + ".snap");
+  IndexJournal j(conf);
+  JRVector recs;
+  j.load(recs);
+  cout << what << ": snapshot=" << ok << " entries=" << snap.size()
+       << " journal records=" << j.records() << endl;
+}
+
+int main()
+{
+  bf::remove_all("_snapshot");
+
+  // Using snapshots directly
+  {
+    JRVector ents;
+    ents.push_back(rec("/b", hello, 2));
+    ents.push_back(rec("/a", world, 1));
+    ents.push_back(rec("/d", hello, 4));
+    ents.push_back(rec("/c", world, 3));
+    ents.push_back(rec("/e", hello, 5));
+    ents[2].state.size = 64;
+    ents[2].state.h[0] = 0x12345678;
+    ents[2].check = world;
+    IndexSnapshot::write("_snapshot/test.snap", ents);
+
+    IndexSnapshot snap;
+    cout << "Missing: " << snap.open("_snapshot/missing.snap") << endl;
+    cout << "Open: " << snap.open("_snapshot/test.snap") << endl;
+    cout << "Size: " << snap.size() << endl;
+    for(int i=0; i<snap.size(); i++)
+      {
+        JournalRecord r;
+        snap.get(i, r);
+        cout << "  " << r.file << " " << r.hash << " " << r.writeTime;
+        if(r.state.isSet())
+          cout << " state=" << r.state.size << " " << hex << r.state.h[0]
+               << dec << " check=" << r.check;
+        cout << endl;
+      }
+
+    cout << "Find /c: " << snap.find("/c") << endl;
+    cout << "Find /x: " << snap.find("/x") << endl;
+    cout << "Find empty: " << snap.find("") << endl;
+
+    vector<uint32_t> list;
+    snap.find(hello, list);
+    cout << "Find hello:";
+    for(int i=0; i<list.size(); i++)
+      cout << " " << snap.getPath(list[i]);
+    cout << endl;
+    snap.find(Hash("nothing", 7), list);
+    cout << "Find other: " << list.size() << endl;
+
+    {
+      ofstream of("_snapshot/bad.snap");
+      of << "This is not a snapshot file, but it is long enough to have a header";
+    }
+    try { snap.open("_snapshot/bad.snap"); }
+    catch(exception &e) { cout << "Bad file: " << e.what() << endl; }
+    cout << "Size after failed open: " << snap.size() << endl;
+  }
+
+  // CacheIndex keeps most entries in a snapshot
+  fs.files["/one"] = hello;
+  fs.files["/two"] = world;
+  fs.files["/three"] = hello;
+  {
+    CacheIndex index(conf, &fs);
+    Hash::DirMap add;
+    add["/one"]; add["/two"]; add["/three"];
+    index.addMany(add);
+    index.compact();
+  }
+  listFiles("Compacted");
+  listIndex("Loaded");
+
+  // Changes go in the journal
+  fs.files["/four"] = world;
+  {
+    CacheIndex index(conf, &fs);
+    cout << "Find world: " << index.findHash(world) << endl;
+    index.removeFile("/three");
+    index.addFile("/four");
+    cout << "Adding /one again: " << index.addFile("/one") << endl;
+  }
+  listFiles("Changed");
+  listIndex("Reloaded");
+
+  // Walking the index in pages merges snapshot and journal entries
+  {
+    CacheIndex index(conf, &fs);
+    cout << "Paged (" << index.size() << " entries):";
+    string after;
+    while(true)
+      {
+        CIVector ents;
+        index.getEntries(ents, after, 2);
+        if(ents.empty()) break;
+        cout << " [";
+        for(int i=0; i<ents.size(); i++)
+          cout << (i?" ":"") << ents[i].file;
+        cout << "]";
+        after = ents.back().file;
+      }
+    cout << endl;
+  }
+
+  // Stale snapshot entries are dropped when found
+  fs.files.erase("/one");
+  {
+    CacheIndex index(conf, &fs);
+    cout << "Find hello: '" << index.findHash(hello) << "'\n";
+  }
+  listIndex("Removed missing");
+
+  /* Compaction writes the snapshot first, then cuts the journal. If
+     we crash in between, replaying the journal on top of the new
+     snapshot gives the same result.
+   */
+  {
+    CIVector ents;
+    CacheIndex index(conf, &fs);
+    index.getEntries(ents);
+    JRVector recs;
+    for(int i=0; i<ents.size(); i++)
+      recs.push_back(rec(ents[i].file, ents[i].hash, ents[i].writeTime));
+    IndexSnapshot::write(conf + ".snap", recs);
+  }
+  listFiles("Interrupted compaction");
+  listIndex("After interrupted compaction");
+
+  // A broken snapshot just loses entries
+  {
+    ofstream of((conf + ".snap").c_str());
+    of << "Not a snapshot";
+  }
+  listIndex("Broken snapshot");
+
+  return 0;
+}
@@ -0,0 +1,193 @@
+#include <iostream>
+
+#include "index.hpp"
+#include "journal.hpp"
+#include "snapshot.hpp"
+
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <string.h>
+#include <time.h>
+
+using namespace Spread;
+using namespace std;
+using namespace Cache;
+namespace bf = boost::filesystem;
+
+string conf = "_stat/index.conf";
+
+Hash hello("hello", 5);
+Hash world("world", 5);
+
+const int64_t NS = 1000000000;
+
+// One virtual file with a full set of stat fields
+struct MyFS : FSystem
+{
+  FileStat st;
+  Hash data;
+
+  std::string abs(const std::string &file) { return file; }
+  bool exists(const std::string &file) { return true; }
+  uint64_t file_size(const std::string &file) { return st.size; }
+  bool equivalent(const std::string &file1, const std::string &file2)
+  { return file1 == file2; }
+  uint64_t last_write_time(const std::string &file) { return st.mtime / NS; }
+  Hash hashSum(const std::string &file)
+  {
+    cout << "  (hashing " << file << ")\n";
+    return data;
+  }
+  bool getStat(const std::string &file, FileStat &out)
+  {
+    out = st;
+    return true;
+  }
+};
+
+MyFS fs;
+
+int64_t now()
+{
+  timespec ts;
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return ts.tv_sec * NS + ts.tv_nsec;
+}
+
+void add(CacheIndex &index, const string &what)
+{
+  cout << what << ":\n";
+  Hash h = index.addFile("file");
+  cout << "  got " << h << endl;
+}
+
+void printJournal()
+{
+  IndexJournal j(conf);
+  JRVector recs;
+  j.load(recs);
+  for(int i=0; i<recs.size(); i++)
+    cout << "  journal: " << recs[i].file << " " << recs[i].hash
+         << " identity=" << (recs[i].st.mtime != 0)
+         << " racy=" << recs[i].racy << endl;
+}
+
+int main()
+{
+  bf::remove_all("_stat");
+
+  fs.data = hello;
+  fs.st.size = 5;
+  fs.st.mtime = 1000*NS + 123456789;
+  fs.st.ctime = fs.st.mtime;
+  fs.st.inode = 17;
+  fs.st.device = 3;
+
+  {
+    CacheIndex index(conf, &fs);
+    add(index, "New file");
+    add(index, "Unchanged");
+
+    fs.data = world;
+    fs.st.mtime += 1000;
+    add(index, "Modified one microsecond later");
+
+    fs.st.ctime += 5;
+    add(index, "Changed ctime");
+
+    fs.st.inode = 18;
+    add(index, "Replaced by another file");
+
+    fs.st.device = 4;
+    add(index, "Moved to another device");
+    add(index, "Unchanged");
+
+    // Copies that keep the time stamp (cp -p, tar) can go back in time
+    fs.data = hello;
+    fs.st.mtime -= 500*NS;
+    fs.st.inode = 19;
+    add(index, "Replaced by an older file");
+    add(index, "Unchanged");
+  }
+  printJournal();
+  fs.data = world;
+
+  /* Files hashed right after they were written are checked again.
+     Use a time stamp in the future, so the test doesn't depend on
+     how fast it runs.
+   */
+  bf::remove_all("_stat");
+  fs.st.mtime = now() + 60*NS;
+  {
+    CacheIndex index(conf, &fs);
+    add(index, "Just written");
+    add(index, "Same stat, but racy");
+  }
+  printJournal();
+
+  // Entries without file identity are from older versions
+  bf::remove_all("_stat");
+  fs.st.mtime = 2000*NS + 5;
+  {
+    JournalRecord r;
+    r.file = "file";
+    r.hash = world;
+    r.writeTime = 2000;
+    IndexJournal j(conf);
+    j.add(r);
+  }
+  {
+    CacheIndex index(conf, &fs);
+    add(index, "Old format entry");
+    add(index, "Upgraded entry");
+  }
+  printJournal();
+
+  // Version 1 snapshots are still read
+  {
+    ofstream of((conf + ".snap").c_str(), ios::binary);
+    uint32_t count = 1, unused = 0;
+    uint64_t entryOff = 48, hashOff = entryOff+144, poolOff = hashOff+4, poolSize = 4;
+    of.write("SPIDXS01", 8);
+    of.write((char*)&count, 4);
+    of.write((char*)&unused, 4);
+    of.write((char*)&entryOff, 8);
+    of.write((char*)&hashOff, 8);
+    of.write((char*)&poolOff, 8);
+    of.write((char*)&poolSize, 8);
+
+    char rec[144];
+    memset(rec, 0, 144);
+    uint32_t len = 4;
+    int64_t time = 2000;
+    memcpy(rec+8, &len, 4);
+    memcpy(rec+16, world.getData(), 40);
+    memcpy(rec+56, &time, 8);
+    of.write(rec, 144);
+
+    uint32_t zero = 0;
+    of.write((char*)&zero, 4);
+    of.write("file", 4);
+  }
+  bf::remove(conf);
+  {
+    IndexSnapshot snap;
+    cout << "Version 1 snapshot: " << snap.open(conf + ".snap")
+         << " entries=" << snap.size() << endl;
+    CacheIndex index(conf, &fs);
+    add(index, "From old snapshot");
+  }
+  printJournal();
+
+  // Real files rewritten right away are still detected
+  {
+    bf::create_directories("_stat/real");
+    CacheIndex index;
+    { ofstream of("_stat/real/a"); of << "hello"; }
+    cout << "Real file: " << index.addFile("_stat/real/a") << endl;
+    { ofstream of("_stat/real/a"); of << "world"; }
+    cout << "Rewritten: " << index.addFile("_stat/real/a") << endl;
+  }
+
+  return 0;
+}
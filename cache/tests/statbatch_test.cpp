@@ -0,0 +1,95 @@
+#include <iostream>
+
+#include "stat_batch.hpp"
+#include <boost/filesystem.hpp>
+#include <fstream>
+#include <sys/stat.h>
+
+using namespace std;
+using namespace Cache;
+namespace bf = boost::filesystem;
+
+vector<string> files;
+vector<FileStat> plain, ring;
+vector<int> plainRes, ringRes;
+
+void make(const string &file, int size)
+{
+  ofstream of(file.c_str());
+  for(int i=0; i<size; i++)
+    of << (char)('a' + i%26);
+}
+
+const char *name(int r)
+{
+  if(r == FS_FOUND) return "found";
+  if(r == FS_MISSING) return "missing";
+  return "unknown";
+}
+
+int main()
+{
+  bf::remove_all("_statbatch");
+  bf::create_directories("_statbatch/dir");
+
+  // Enough files to take the batched path
+  for(int i=0; i<300; i++)
+    {
+      char buf[50];
+      snprintf(buf, 50, "_statbatch/file%d", i);
+      files.push_back(buf);
+      if(i % 3 != 2)
+        make(buf, i);
+    }
+  files.push_back("_statbatch/dir");
+  files.push_back("_statbatch/nodir/file");
+  files.push_back("_statbatch/file0/file");
+
+  StatBatch::useUring = false;
+  StatBatch::run(files, plain, plainRes);
+  StatBatch::useUring = true;
+  StatBatch::run(files, ring, ringRes);
+
+  int found = 0, missing = 0, unknown = 0, diff = 0;
+  for(int i=0; i<files.size(); i++)
+    {
+      if(plainRes[i] == FS_FOUND) found++;
+      else if(plainRes[i] == FS_MISSING) missing++;
+      else unknown++;
+
+      if(plainRes[i] != ringRes[i] ||
+         (plainRes[i] == FS_FOUND && !plain[i].same(ring[i])))
+        diff++;
+    }
+  cout << "Found: " << found << "\nMissing: " << missing
+       << "\nUnknown: " << unknown << "\nDifferences: " << diff << endl;
+
+  cout << "\nSome files:\n";
+  int show[] = { 0, 1, 2, 299, 300, 301, 302 };
+  for(int i=0; i<7; i++)
+    {
+      int k = show[i];
+      cout << "  " << files[k] << ": " << name(ringRes[k]);
+      if(ringRes[k] == FS_FOUND)
+        cout << " size=" << ring[k].size;
+      cout << endl;
+    }
+
+  // Compare with a direct stat
+  struct stat st;
+  stat("_statbatch/file10", &st);
+  const FileStat &f = ring[10];
+  cout << "\nMatches stat(): "
+       << (f.size == st.st_size && f.inode == st.st_ino && f.device == st.st_dev &&
+           f.mtime / 1000000000 == st.st_mtime) << endl;
+
+  // Small lists, and an empty one
+  files.resize(1);
+  StatBatch::run(files, ring, ringRes);
+  cout << "One file: " << name(ringRes[0]) << endl;
+  files.clear();
+  StatBatch::run(files, ring, ringRes);
+  cout << "No files: " << ringRes.size() << endl;
+
+  return 0;
+}
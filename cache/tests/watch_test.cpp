@@ -0,0 +1,125 @@
+#include <iostream>
+
+#include "watcher.hpp"
+#include "index.hpp"
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include <fstream>
+
+using namespace std;
+using namespace Cache;
+namespace bf = boost::filesystem;
+
+DirWatcher w;
+string dir;
+
+void make(const string &file, const string &data)
+{
+  ofstream of(file.c_str());
+  of << data;
+}
+
+void clean(const string &file)
+{
+  w.sync();
+  cout << "  " << file << ": " << (w.isClean(dir + file) ? "clean" : "dirty") << endl;
+}
+
+void mark(const string &file)
+{
+  DirWatcher::Pass pass(&w);
+  w.setClean(dir + file, pass.token);
+}
+
+// Give the background thread time to see the changes
+void wait()
+{
+  boost::this_thread::sleep(boost::posix_time::milliseconds(200));
+}
+
+int main()
+{
+  bf::remove_all("_watch");
+  bf::create_directories("_watch/sub");
+  make("_watch/a", "hello");
+  make("_watch/sub/b", "world");
+  make("_watch_out", "outside");
+
+  dir = bf::absolute("_watch").string();
+  cout << "Watching: " << w.watch(dir + "/") << endl;
+  cout << "Non-existing dir: " << w.watch(dir + "/nothing") << endl;
+
+  cout << "\nMarking files:\n";
+  mark("/a");
+  mark("/sub/b");
+  mark("/../_watch_out");
+  clean("/a");
+  clean("/sub/b");
+  clean("/../_watch_out");
+
+  cout << "\nChanging a:\n";
+  make("_watch/a", "HELLO");
+  clean("/a");
+  clean("/sub/b");
+
+  cout << "\nChanged while being checked:\n";
+  {
+    DirWatcher::Pass pass(&w);
+    make("_watch/a", "hello again");
+    w.sync();
+    w.setClean(dir + "/a", pass.token);
+  }
+  clean("/a");
+
+  cout << "\nNew directory:\n";
+  bf::create_directories("_watch/new");
+  make("_watch/new/c", "new file");
+  w.sync();
+  mark("/new/c");
+  clean("/new/c");
+  make("_watch/new/c", "changed");
+  clean("/new/c");
+
+  cout << "\nRemoving sub:\n";
+  bf::remove_all("_watch/sub");
+  clean("/sub/b");
+  bf::create_directories("_watch/sub");
+  make("_watch/sub/b", "world");
+  w.sync();
+  mark("/sub/b");
+  clean("/sub/b");
+
+  cout << "\nRenaming sub:\n";
+  bf::rename("_watch/sub", "_watch/sub2");
+  clean("/sub/b");
+  mark("/sub2/b");
+  clean("/sub2/b");
+  make("_watch/sub2/b", "WORLD");
+  clean("/sub2/b");
+
+  cout << "\nThrough CacheIndex:\n";
+  {
+    CacheIndex cache;
+    cout << "Watching: " << cache.watch("_watch") << endl;
+
+    // Make sure the file isn't racy
+    make("_watch/d", "data");
+    bf::last_write_time("_watch/d", time(NULL) - 100);
+    cout << "d: " << cache.addFile("_watch/d") << endl;
+    cout << "again: " << cache.addFile("_watch/d") << endl;
+
+    make("_watch/d", "DATA");
+    bf::last_write_time("_watch/d", time(NULL) - 100);
+    wait();
+    cout << "changed: " << cache.addFile("_watch/d") << endl;
+    cout << "status: " << cache.getStatus("_watch/d", Spread::Hash("DATA", 4)) << endl;
+
+    bf::remove("_watch/d");
+    wait();
+    cout << "removed: " << cache.checkFile("_watch/d") << endl;
+
+    cout << "Custom FSystem: " << CacheIndex("", (FSystem*)1).watch("_watch") << endl;
+  }
+
+  return 0;
+}
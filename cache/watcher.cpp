@@ -0,0 +1,347 @@
+#include "watcher.hpp"
+
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#ifdef NEED_LOCKGUARD
+#include <boost/thread/lock_guard.hpp>
+#endif
+#include <map>
+#include <set>
+#include <errno.h>
+#include <unistd.h>
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <fcntl.h>
+#endif
+
+//#define PRINT_DEBUG
+
+#ifdef PRINT_DEBUG
+#include <iostream>
+#define PRINT(a) std::cout << a << "\n";
+#else
+#define PRINT(a)
+#endif
+
+using namespace Cache;
+
+namespace bfs = boost::filesystem;
+
+typedef boost::lock_guard<boost::mutex> LOCK;
+
+/* Clean files are kept in a sorted set, so everything below a
+   directory can be dropped in one go.
+
+   Every event, and every new watch, bumps 'seq'. A token from
+   begin() is the value of 'seq' at the time. While any begin() is
+   outstanding, events for files that aren't clean are remembered in
+   'recent', so setClean() can tell if the file changed after the
+   token was taken. 'recent' is cleared when the last end() is
+   called.
+ */
+struct DirWatcher::_Internal
+{
+  struct Watch
+  {
+    int wd;
+
+    // Value of 'seq' when the watch was added
+    uint64_t since;
+  };
+
+  std::map<int, std::string> dirs;
+  std::map<std::string, Watch> paths;
+
+  std::set<std::string> clean;
+  std::map<std::string, uint64_t> recent;
+
+  uint64_t seq, floor;
+  int pending;
+
+  // Protects all of the above
+  mutable boost::mutex mutex;
+
+  // Held while reading events, so they are handled in order
+  boost::mutex readMutex;
+
+  int fd, wake[2];
+  boost::thread reader;
+
+  struct Reader
+  {
+    _Internal *owner;
+    void operator()() { owner->run(); }
+  };
+
+  _Internal() : seq(1), floor(0), pending(0), fd(-1)
+  {
+    wake[0] = wake[1] = -1;
+#ifdef __linux__
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if(fd < 0)
+      {
+        PRINT("inotify not available, errno=" << errno);
+        return;
+      }
+    if(pipe(wake) != 0)
+      {
+        ::close(fd);
+        fd = -1;
+        return;
+      }
+    Reader r = { this };
+    reader = boost::thread(r);
+#endif
+  }
+
+  ~_Internal()
+  {
+    if(fd < 0) return;
+    char c = 0;
+    if(write(wake[1], &c, 1) == 1)
+      reader.join();
+    else
+      reader.detach();
+    ::close(wake[0]);
+    ::close(wake[1]);
+    ::close(fd);
+  }
+
+  // Forget all clean files in 'dir' and below
+  void dropClean(const std::string &dir)
+  {
+    std::string pre = dir + "/";
+    std::set<std::string>::iterator it = clean.lower_bound(pre);
+    while(it != clean.end() && it->compare(0, pre.size(), pre) == 0)
+      clean.erase(it++);
+  }
+
+  void dropWatch(std::map<std::string, Watch>::iterator it, bool remove)
+  {
+#ifdef __linux__
+    if(remove) inotify_rm_watch(fd, it->second.wd);
+#endif
+    dirs.erase(it->second.wd);
+    dropClean(it->first);
+    paths.erase(it);
+  }
+
+  // Stop watching 'dir' and everything below it
+  void dropTree(const std::string &dir)
+  {
+    std::map<std::string, Watch>::iterator it = paths.find(dir);
+    if(it != paths.end()) dropWatch(it, true);
+
+    std::string pre = dir + "/";
+    it = paths.lower_bound(pre);
+    while(it != paths.end() && it->first.compare(0, pre.size(), pre) == 0)
+      dropWatch(it++, true);
+  }
+
+  // Watch 'dir' and everything below it. Returns false on failure.
+  bool addTree(const std::string &dir)
+  {
+#ifdef __linux__
+    const uint32_t mask = IN_MODIFY | IN_ATTRIB | IN_CREATE | IN_DELETE |
+      IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF |
+      IN_ONLYDIR | IN_DONT_FOLLOW;
+
+    int wd = inotify_add_watch(fd, dir.c_str(), mask);
+    if(wd < 0)
+      {
+        PRINT("Cannot watch " << dir << ", errno=" << errno);
+
+        // Directories that vanished are no loss
+        return errno == ENOENT;
+      }
+
+    // The same directory may already be watched, possibly by another name
+    std::map<int, std::string>::iterator old = dirs.find(wd);
+    if(old == dirs.end())
+      {
+        dirs[wd] = dir;
+        Watch w = { wd, ++seq };
+        paths[dir] = w;
+      }
+    else if(old->second != dir)
+      return false;
+
+    bool ok = true;
+    boost::system::error_code ec;
+    bfs::directory_iterator it(dir, ec), end;
+    if(ec) return false;
+    for(; it != end; it.increment(ec))
+      {
+        if(ec) return false;
+        if(bfs::is_directory(it->symlink_status()))
+          ok = addTree(it->path().string()) && ok;
+      }
+    return ok;
+#else
+    return false;
+#endif
+  }
+
+#ifdef __linux__
+  void handle(const inotify_event *ev)
+  {
+    LOCK lock(mutex);
+    seq++;
+
+    if(ev->mask & IN_Q_OVERFLOW)
+      {
+        PRINT("Event queue overflow, forgetting all clean files");
+        clean.clear();
+        recent.clear();
+        floor = seq;
+        return;
+      }
+
+    std::map<int, std::string>::iterator d = dirs.find(ev->wd);
+    if(d == dirs.end()) return;
+    const std::string dir = d->second;
+
+    if(ev->mask & IN_IGNORED)
+      {
+        std::map<std::string, Watch>::iterator it = paths.find(dir);
+        if(it != paths.end()) dropWatch(it, false);
+        return;
+      }
+    if(ev->mask & (IN_DELETE_SELF | IN_MOVE_SELF))
+      {
+        dropTree(dir);
+        return;
+      }
+    if(ev->len == 0) return;
+
+    std::string file = dir + "/" + ev->name;
+    PRINT("Event " << std::hex << ev->mask << std::dec << " on " << file);
+
+    if(ev->mask & IN_ISDIR)
+      {
+        if(ev->mask & (IN_DELETE | IN_MOVED_FROM))
+          dropTree(file);
+        else if(ev->mask & (IN_CREATE | IN_MOVED_TO))
+          addTree(file);
+        return;
+      }
+
+    clean.erase(file);
+    if(pending) recent[file] = seq;
+  }
+
+  void readEvents()
+  {
+    LOCK lock(readMutex);
+
+    char buf[64*1024]
+      __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+    while(true)
+      {
+        ssize_t len = read(fd, buf, sizeof(buf));
+        if(len <= 0) break;
+
+        for(char *p = buf; p < buf + len;)
+          {
+            const inotify_event *ev = (const inotify_event*)p;
+            handle(ev);
+            p += sizeof(inotify_event) + ev->len;
+          }
+      }
+  }
+
+  void run()
+  {
+    pollfd fds[2];
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = wake[0];
+    fds[1].events = POLLIN;
+
+    while(true)
+      {
+        if(poll(fds, 2, -1) < 0)
+          {
+            if(errno == EINTR) continue;
+            break;
+          }
+        if(fds[1].revents) break;
+        if(fds[0].revents) readEvents();
+      }
+  }
+#endif
+};
+
+DirWatcher::DirWatcher() : ptr(new _Internal) {}
+
+bool DirWatcher::watch(const std::string &_dir)
+{
+  if(ptr->fd < 0) return false;
+
+  std::string dir = _dir;
+  while(dir.size() > 1 && dir[dir.size()-1] == '/')
+    dir.resize(dir.size()-1);
+
+  if(!bfs::is_directory(dir)) return false;
+
+  LOCK lock(ptr->mutex);
+  return ptr->addTree(dir);
+}
+
+uint64_t DirWatcher::begin()
+{
+  LOCK lock(ptr->mutex);
+  ptr->pending++;
+  return ptr->seq;
+}
+
+void DirWatcher::end()
+{
+  LOCK lock(ptr->mutex);
+  if(--ptr->pending == 0)
+    ptr->recent.clear();
+}
+
+void DirWatcher::setClean(const std::string &file, uint64_t token)
+{
+  LOCK lock(ptr->mutex);
+
+  // Events may have been lost since the token was taken
+  if(token < ptr->floor) return;
+
+  // The directory must have been watched the whole time
+  size_t slash = file.rfind('/');
+  if(slash == std::string::npos) return;
+  std::map<std::string, _Internal::Watch>::const_iterator dir =
+    ptr->paths.find(file.substr(0, slash));
+  if(dir == ptr->paths.end() || dir->second.since > token) return;
+
+  // And nothing must have happened to the file
+  std::map<std::string, uint64_t>::const_iterator it = ptr->recent.find(file);
+  if(it != ptr->recent.end() && it->second > token) return;
+
+  ptr->clean.insert(file);
+}
+
+void DirWatcher::setDirty(const std::string &file)
+{
+  LOCK lock(ptr->mutex);
+  ptr->clean.erase(file);
+}
+
+bool DirWatcher::isClean(const std::string &file) const
+{
+  LOCK lock(ptr->mutex);
+  return ptr->clean.count(file) != 0;
+}
+
+void DirWatcher::sync()
+{
+#ifdef __linux__
+  if(ptr->fd >= 0) ptr->readEvents();
+#endif
+}
@@ -0,0 +1,82 @@
+#ifndef __SPREAD_CACHE_WATCHER_HPP_
+#define __SPREAD_CACHE_WATCHER_HPP_
+
+#include <boost/shared_ptr.hpp>
+#include <stdint.h>
+#include <string>
+
+/* Keeps track of which files are known to be unchanged, using
+   inotify on whole directory trees.
+
+   The user marks a file as clean after checking it, and the file
+   stays clean until the watcher sees an event for it. Asking whether
+   a file is clean is a plain in-memory lookup. Events are read on a
+   background thread as they arrive, so isClean() may lag behind a
+   change that was just made. Call sync() first when that matters.
+
+   To avoid missing a change that happens while a file is being
+   checked, call begin() BEFORE stat'ing the file, and pass the token
+   to setClean() afterwards. If anything happened to the file in
+   between, it is not marked clean. Every begin() must be matched by
+   an end(), see Pass.
+
+   Files are only ever reported clean if their directory is watched,
+   so anything the watcher can't cover simply falls back to the
+   caller's normal checks. That includes directories beyond the
+   system watch limit, trees added while the event queue overflowed
+   (which also forgets all clean files), and non-Linux systems, where
+   nothing is watched.
+
+   inotify does not report writes through memory maps, or changes
+   made through hard links in directories that aren't watched. Don't
+   watch trees where that happens.
+ */
+
+namespace Cache
+{
+  class DirWatcher
+  {
+    struct _Internal;
+    boost::shared_ptr<_Internal> ptr;
+
+  public:
+    DirWatcher();
+
+    /* Watch 'dir' (an absolute path) and all directories below
+       it. Directories created later are picked up automatically.
+       Returns false if the tree couldn't be watched completely.
+     */
+    bool watch(const std::string &dir);
+
+    // Get a token for setClean(). Call before checking the file.
+    uint64_t begin();
+    void end();
+
+    // Mark a file as clean, if nothing has happened to it since 'token'
+    void setClean(const std::string &file, uint64_t token);
+
+    // Forget that a file is clean
+    void setDirty(const std::string &file);
+
+    // Only reflects the events handled so far, see sync()
+    bool isClean(const std::string &file) const;
+
+    /* Handle all events that are already queued, without waiting for
+       the background thread. After this, isClean() sees every change
+       that finished before the call. Costs one read() when nothing is
+       queued.
+     */
+    void sync();
+
+    // Calls begin() and end() for you. 'w' may be NULL.
+    struct Pass
+    {
+      DirWatcher *w;
+      uint64_t token;
+
+      Pass(DirWatcher *_w) : w(_w), token(w ? w->begin() : 0) {}
+      ~Pass() { if(w) w->end(); }
+    };
+  };
+}
+#endif
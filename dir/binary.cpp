@@ -3,6 +3,8 @@
 #include <mangle/stream/servers/outfile_stream.hpp>
 #include <mangle/stream/servers/null_stream.hpp>
 #include "hash/hash_stream.hpp"
+#include "misc/mapped_stream.hpp"
+#include <string.h>
 #include <vector>
 
 using namespace Spread;
@@ -17,8 +19,58 @@ static void fail(const std::string &msg) { throw std::runtime_error(msg); }
 static void failDir(const std::string &msg)
 { fail("Error parsing directory file: " + msg); }
 
+/* Parse a dir file that is already in memory. Same format as the
+   stream version below, but without a virtual call per field. Only
+   the bytes that make up the directory are hashed.
+ */
+static Hash parse(DirMap &dir, const char *data, size_t size)
+{
+  const char *p = data, *end = data+size;
+  int tmp;
+
+  if(end-p < 8)
+    failDir("file too short");
+
+  // Magic number
+  memcpy(&tmp, p, 4);
+  if(tmp != MAGIC_NUMBER)
+    failDir("invalid magic number");
+
+  // Number of hashes
+  int num;
+  memcpy(&num, p+4, 4);
+  p += 8;
+
+  if(num > 1024*1024)
+    failDir("too many directory hashes");
+
+  Hash h;
+  for(int i=0; i<num; i++)
+    {
+      if(end-p < 42)
+        failDir("unexpected end of file");
+
+      h.copy((const uint8_t*)p);
+      int len = 0;
+      memcpy(&len, p+40, 2);
+      p += 42;
+
+      if(end-p < len)
+        failDir("unexpected end of file");
+
+      dir[string(p, len)] = h;
+      p += len;
+    }
+
+  return Hash(data, p-data);
+}
+
 Hash Spread::Dir::read(Hash::DirMap &dir, StreamPtr strm)
 {
+  // Memory streams can be parsed in place
+  if(strm->hasPtr && strm->hasSize)
+    return parse(dir, (const char*)strm->getPtr(), strm->size());
+
   HashStream inf(strm);
 
   int tmp;
@@ -88,7 +140,16 @@ Hash Spread::Dir::write(const Hash::DirMap &dir, StreamPtr strm)
 }
 
 Hash Spread::Dir::read(Hash::DirMap &dir, const std::string &file)
-{ return read(dir, FileStream::Open(file)); }
+{
+  /* Slurp the file with one read() call, which is a lot cheaper than
+     reading it field by field. It isn't mapped, since we don't know
+     who else might be writing to it.
+   */
+  Misc::MappedFileStream inf(file);
+  vector<char> buf(inf.size());
+  size_t num = buf.size() ? inf.read(&buf[0], buf.size()) : 0;
+  return parse(dir, buf.size() ? &buf[0] : NULL, num);
+}
 
 Hash Spread::Dir::write(const Hash::DirMap &dir, const std::string &file)
 { return write(dir, OutFileStream::Open(file)); }
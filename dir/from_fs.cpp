@@ -2,6 +2,7 @@
 
 #include <boost/filesystem.hpp>
 #include <assert.h>
+#include <vector>
 
 using namespace Spread;
 namespace bf = boost::filesystem;
@@ -35,6 +36,13 @@ void Dir::fromFS(Hash::DirMap &dir, const std::string &where,
    */
   int pathlen = addSlash(where).size();
 
+  /* Collect all the files first, then hash them with one call to
+     checkMany(). That lets the cache hash small files in batches,
+     and only write its config file once.
+   */
+  Hash::DirMap files;
+  std::vector<std::pair<std::string,std::string> > locals;
+
   bf::recursive_directory_iterator iter(where), end;
   for(; iter != end; ++iter)
     {
@@ -59,11 +67,20 @@ void Dir::fromFS(Hash::DirMap &dir, const std::string &where,
       // Otherwise only process normal files
       if(!bf::is_regular_file(file)) continue;
 
-      // Get the file hash
-      Hash hash = cache.addFile(file);
-      assert(hash.isSet());
+      files[file];
+      locals.push_back(std::make_pair(file, local));
+    }
+
+  cache.checkMany(files);
+
+  for(int i=0; i<locals.size(); i++)
+    {
+      const Hash &hash = files[locals[i].first];
+
+      // Files that vanished while we were working get null hashes
+      if(hash.isNull()) continue;
 
       // We're done, add it!
-      dir[local] = hash;
+      dir[locals[i].second] = hash;
     }
 }
@@ -4,6 +4,7 @@
 #include <mangle/stream/servers/outfile_stream.hpp>
 #include <mangle/stream/servers/null_stream.hpp>
 #include "hash/hash_stream.hpp"
+#include "hash/codec.hpp"
 #include <vector>
 
 using namespace Spread;
@@ -16,14 +17,18 @@ typedef Hash::DirMap DirMap;
 void Directory::parseJson(const Value &root)
 {
   Value::Members keys = root.getMemberNames();
-  Value::Members::iterator it;
-  for(it = keys.begin(); it != keys.end(); it++)
-    {
-      const string &key = *it;
-      const string &val = root[key].asString();
 
-      dir[key] = Hash(val);
-    }
+  // Decode all the hash strings in one batch
+  vector<string> vals(keys.size());
+  for(int i=0; i<keys.size(); i++)
+    vals[i] = root[keys[i]].asString();
+
+  vector<Hash> hashes(keys.size());
+  if(keys.size())
+    Codec::decodeMany(&vals[0], &hashes[0], keys.size());
+
+  for(int i=0; i<keys.size(); i++)
+    dir[keys[i]] = hashes[i];
 }
 
 Value Directory::makeJson() const
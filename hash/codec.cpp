@@ -0,0 +1,208 @@
+#include "codec.hpp"
+#include "hash.hpp"
+
+#include <string.h>
+#include <stdexcept>
+#include <assert.h>
+
+using namespace Spread;
+
+// Implemented in codec_x86.cpp
+namespace Spread
+{
+  namespace Codec
+  {
+    bool haveSSSE3();
+    size_t encodeHexSSSE3(const uint8_t *in, size_t bytes, char *out);
+    size_t decodeHexSSSE3(const char *in, size_t bytes, uint8_t *out);
+    void encodeHashSSSE3(const uint8_t *in, char *out);
+    bool decodeHashSSSE3(const char *in, uint8_t *out);
+  }
+}
+
+static int current = -1;
+
+bool Codec::isSupported(int backend)
+{
+  if(backend == CB_Portable) return true;
+  if(backend == CB_SSSE3) return haveSSSE3();
+  return false;
+}
+
+bool Codec::setBackend(int backend)
+{
+  if(!isSupported(backend)) return false;
+  current = backend;
+  return true;
+}
+
+int Codec::getBackend()
+{
+  // Harmless if two threads race here, see sha256.cpp
+  if(current == -1)
+    current = haveSSSE3() ? CB_SSSE3 : CB_Portable;
+  return current;
+}
+
+const char *Codec::getName(int backend)
+{
+  if(backend == CB_Portable) return "portable";
+  if(backend == CB_SSSE3) return "ssse3";
+  return "unknown";
+}
+
+static bool useSSSE3() { return Codec::getBackend() == Codec::CB_SSSE3; }
+
+static char hexDigit(int i)
+{
+  assert(i >= 0 && i < 16);
+  if(i < 10) return '0' + i;
+  return 'a' + i - 10;
+}
+
+static uint8_t dehexDig(char c)
+{
+  if(c >= '0' && c <= '9')
+    return c - '0';
+  if(c >= 'a' && c <= 'f')
+    return c - 'a' + 10;
+  if(c >= 'A' && c <= 'F')
+    return c - 'A' + 10;
+
+  throw std::runtime_error(std::string("Invalid hex character '") + c + "'");
+}
+
+static uint8_t dehex(const char *s)
+{
+  return (dehexDig(*s)<<4) | dehexDig(s[1]);
+}
+
+void Codec::encodeHex(const void *input, size_t bytes, char *out)
+{
+  const uint8_t *in = (const uint8_t*)input;
+
+  size_t done = 0;
+  if(useSSSE3())
+    done = encodeHexSSSE3(in, bytes, out);
+
+  for(size_t i=done; i<bytes; i++)
+    {
+      out[i*2] = hexDigit(in[i] >> 4);
+      out[i*2+1] = hexDigit(in[i] & 0xf);
+    }
+}
+
+void Codec::decodeHex(const char *in, size_t bytes, void *output)
+{
+  uint8_t *out = (uint8_t*)output;
+
+  // The SIMD version stops at the first block with invalid input, and
+  // leaves the error reporting to us.
+  size_t done = 0;
+  if(useSSSE3())
+    done = decodeHexSSSE3(in, bytes, out);
+
+  for(size_t i=done; i<bytes; i++)
+    out[i] = dehex(in + i*2);
+}
+
+/* Base64 characters. Notice that we use an URL-friendly variant with
+   -_ at the end instead of +/. But our decoding routine supports both.
+ */
+static const char cb64[]="ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
+
+// Converts 3 input bytes to 4 output characters
+static void toBase(const uint8_t *in, char *out)
+{
+  out[0] = cb64[ in[0] >> 2 ];
+  out[1] = cb64[ ((in[0] & 0x03) << 4) | ((in[1] & 0xf0) >> 4) ];
+  out[2] = cb64[ ((in[1] & 0x0f) << 2) | ((in[2] & 0xc0) >> 6) ];
+  out[3] = cb64[ in[2] & 0x3f ];
+}
+
+// Decode character
+static uint8_t bval(char c)
+{
+  if(c >= 'A' && c <= 'Z') return c-'A';
+  if(c >= 'a' && c <= 'z') return c-'a'+26;
+  if(c >= '0' && c <= '9') return c-'0'+52;
+  if(c == '-' || c == '+') return 62;
+  if(c == '/' || c == '_') return 63;
+  if(c == '=') return 0;
+
+  throw std::runtime_error(std::string("Invalid base64 character '") + c + "'");
+}
+
+// Converts 4 input characters to 3 output bytes
+static void fromBase(const char *in, uint8_t *out)
+{
+  uint8_t v0 = bval(in[0]);
+  uint8_t v1 = bval(in[1]);
+  uint8_t v2 = bval(in[2]);
+  uint8_t v3 = bval(in[3]);
+  out[0] = (v0 << 2) | ((v1 & 0x30) >> 4);
+  out[1] = ((v1 & 0x0f) << 4) | ((v2 & 0x3c) >> 2);
+  out[2] = ((v2 & 0x03) << 6) | v3;
+}
+
+void Codec::encodeHash(const void *input, char *out)
+{
+  const uint8_t *in = (const uint8_t*)input;
+
+  if(useSSSE3())
+    {
+      // The SIMD version reads 48 bytes and writes 64 characters
+      uint8_t ibuf[64];
+      char obuf[64];
+      memcpy(ibuf, in, 40);
+      memset(ibuf+40, 0, 24);
+      encodeHashSSSE3(ibuf, obuf);
+      memcpy(out, obuf, 56);
+      return;
+    }
+
+  for(int i=0; i<13; i++)
+    toBase(in+i*3, out+i*4);
+  uint8_t last[3];
+  last[0] = in[39];
+  last[1] = last[2] = 0;
+  toBase(last, out+52);
+}
+
+void Codec::decodeHash(const char *in, size_t len, void *output)
+{
+  assert(len <= 56);
+
+  // Pad out with zero digits
+  char buf[64];
+  memcpy(buf, in, len);
+  memset(buf+len, 'A', 64-len);
+
+  if(useSSSE3())
+    {
+      uint8_t obuf[48];
+      if(decodeHashSSSE3(buf, obuf))
+        {
+          memcpy(output, obuf, 40);
+          return;
+        }
+    }
+
+  // Portable version, also used for anything the SIMD code rejected
+  uint8_t obuf[42];
+  for(int i=0; i<14; i++)
+    fromBase(buf+i*4, obuf+i*3);
+  memcpy(output, obuf, 40);
+}
+
+void Codec::decodeMany(const std::string *in, Hash *out, size_t count)
+{
+  for(size_t i=0; i<count; i++)
+    out[i].fromString(in[i]);
+}
+
+void Codec::encodeMany(const Hash *in, std::string *out, size_t count)
+{
+  for(size_t i=0; i<count; i++)
+    out[i] = in[i].toString();
+}
@@ -0,0 +1,69 @@
+#ifndef _SPREAD_CODEC_HPP
+#define _SPREAD_CODEC_HPP
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+/* Text encodings for hashes and other binary data.
+
+   This is what Hash::toString(), Hash::fromString() and friends use
+   internally. Large loaders (rule lists, directory files, the cache
+   index) can also call the batch functions directly, to convert many
+   strings in one go.
+
+   Like SHA256, the fastest implementation the CPU supports is picked
+   at runtime. The SSSE3 versions convert 16 characters at a time,
+   and hand anything unusual (invalid characters, '=' padding) over to
+   the portable code, so both backends give the exact same results and
+   error messages.
+ */
+
+namespace Spread
+{
+  struct Hash;
+
+  namespace Codec
+  {
+    enum Backends
+      {
+        CB_Portable,
+        CB_SSSE3,
+
+        CB_Count
+      };
+
+    bool isSupported(int backend);
+    bool setBackend(int backend);
+    int getBackend();
+    const char *getName(int backend);
+
+    /* Lowercase hex. 'bytes' is the binary size, the text is twice as
+       long. decodeHex() accepts both cases, and throws on invalid
+       characters.
+     */
+    void encodeHex(const void *in, size_t bytes, char *out);
+    void decodeHex(const char *in, size_t bytes, void *out);
+
+    /* The URL friendly base64 used for Hash strings. 40 bytes are
+       encoded as 56 characters, of which the last 3 are only there to
+       pad out the final group.
+
+       decodeHash() takes up to 56 characters. Missing characters at
+       the end count as 'A' (zero bits.) Both "-_" and "+/" are
+       accepted for the last two digits, and '=' counts as zero.
+       Throws on invalid characters.
+     */
+    void encodeHash(const void *in, char *out);
+    void decodeHash(const char *in, size_t len, void *out);
+
+    /* Convert many Hash strings at once. decodeMany() accepts the
+       same formats as Hash::fromString(), and throws on the first
+       invalid string. encodeMany() gives the same strings as
+       Hash::toString().
+     */
+    void decodeMany(const std::string *in, Hash *out, size_t count);
+    void encodeMany(const Hash *in, std::string *out, size_t count);
+  }
+}
+#endif
@@ -0,0 +1,188 @@
+#include <stdint.h>
+#include <stddef.h>
+
+/* SSSE3 versions of the hex and base64 codecs in codec.cpp. Compiled
+   with target attributes and picked at runtime, like the transforms
+   in sha256_x86.cpp.
+
+   The decoders validate all input in the vector registers. On any
+   unexpected character they give up and let the portable code deal
+   with it (and report the error.)
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPREAD_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+namespace Spread
+{
+namespace Codec
+{
+
+#ifdef SPREAD_X86
+
+bool haveSSSE3()
+{
+  unsigned int a, b, c, d;
+  if(!__get_cpuid(1, &a, &b, &c, &d)) return false;
+  return (c & bit_SSSE3) != 0;
+}
+
+// Mask of bytes in [lo,hi]. Only valid for ASCII ranges.
+__attribute__((target("ssse3")))
+static inline __m128i inRange(__m128i v, char lo, char hi)
+{
+  return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo-1)),
+                       _mm_cmplt_epi8(v, _mm_set1_epi8(hi+1)));
+}
+
+__attribute__((target("ssse3")))
+size_t encodeHexSSSE3(const uint8_t *in, size_t bytes, char *out)
+{
+  const __m128i digits = _mm_setr_epi8('0','1','2','3','4','5','6','7',
+                                       '8','9','a','b','c','d','e','f');
+  const __m128i low = _mm_set1_epi8(0x0f);
+
+  size_t i;
+  for(i=0; i+8 <= bytes; i+=8)
+    {
+      __m128i v = _mm_loadl_epi64((const __m128i*)(in+i));
+      __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low);
+      __m128i lo = _mm_and_si128(v, low);
+      __m128i nib = _mm_unpacklo_epi8(hi, lo);
+      _mm_storeu_si128((__m128i*)(out+i*2), _mm_shuffle_epi8(digits, nib));
+    }
+  return i;
+}
+
+__attribute__((target("ssse3")))
+size_t decodeHexSSSE3(const char *in, size_t bytes, uint8_t *out)
+{
+  size_t i;
+  for(i=0; i+8 <= bytes; i+=8)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*)(in+i*2));
+
+      __m128i dig = inRange(v, '0', '9');
+      __m128i lower = inRange(v, 'a', 'f');
+      __m128i upper = inRange(v, 'A', 'F');
+      __m128i ok = _mm_or_si128(dig, _mm_or_si128(lower, upper));
+      if(_mm_movemask_epi8(ok) != 0xffff)
+        break;
+
+      // Subtract the right offset for each range
+      __m128i off = _mm_or_si128(_mm_and_si128(dig, _mm_set1_epi8('0')),
+                    _mm_or_si128(_mm_and_si128(lower, _mm_set1_epi8('a'-10)),
+                                 _mm_and_si128(upper, _mm_set1_epi8('A'-10))));
+      __m128i nib = _mm_sub_epi8(v, off);
+
+      // Combine nibble pairs into bytes: hi*16 + lo
+      __m128i w = _mm_maddubs_epi16(nib, _mm_set1_epi16(0x0110));
+      _mm_storel_epi64((__m128i*)(out+i), _mm_packus_epi16(w, w));
+    }
+  return i;
+}
+
+/* Base64, 12 bytes to 16 characters. Based on the method by Wojciech
+   Mula: spread each 3 byte group over a 32 bit lane, shift the four 6
+   bit fields into place with multiplies, then map the values to
+   ASCII with a few compares.
+ */
+__attribute__((target("ssse3")))
+static inline __m128i enc64(__m128i in)
+{
+  in = _mm_shuffle_epi8(in, _mm_set_epi8(10,11,9,10, 7,8,6,7,
+                                         4,5,3,4, 1,2,0,1));
+  __m128i t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+  __m128i t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+  __m128i t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+  __m128i t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+  __m128i idx = _mm_or_si128(t1, t3);
+
+  // A-Z, then a-z (+6), 0-9 (-75), '-' (-13) and '_' (+49)
+  __m128i res = _mm_add_epi8(idx, _mm_set1_epi8('A'));
+  res = _mm_add_epi8(res, _mm_and_si128(_mm_cmpgt_epi8(idx, _mm_set1_epi8(25)),
+                                        _mm_set1_epi8(6)));
+  res = _mm_add_epi8(res, _mm_and_si128(_mm_cmpgt_epi8(idx, _mm_set1_epi8(51)),
+                                        _mm_set1_epi8(-75)));
+  res = _mm_add_epi8(res, _mm_and_si128(_mm_cmpgt_epi8(idx, _mm_set1_epi8(61)),
+                                        _mm_set1_epi8(-13)));
+  res = _mm_add_epi8(res, _mm_and_si128(_mm_cmpgt_epi8(idx, _mm_set1_epi8(62)),
+                                        _mm_set1_epi8(49)));
+  return res;
+}
+
+// 16 characters to 12 bytes. Returns false on unexpected input.
+__attribute__((target("ssse3")))
+static inline bool dec64(__m128i v, uint8_t *out)
+{
+  __m128i upper = inRange(v, 'A', 'Z');
+  __m128i lower = inRange(v, 'a', 'z');
+  __m128i dig = inRange(v, '0', '9');
+  __m128i c62 = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('-')),
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8('+')));
+  __m128i c63 = _mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8('_')),
+                             _mm_cmpeq_epi8(v, _mm_set1_epi8('/')));
+
+  __m128i ok = _mm_or_si128(_mm_or_si128(upper, lower),
+                            _mm_or_si128(dig, _mm_or_si128(c62, c63)));
+  if(_mm_movemask_epi8(ok) != 0xffff)
+    return false;
+
+  __m128i val = _mm_and_si128(upper, _mm_sub_epi8(v, _mm_set1_epi8('A')));
+  val = _mm_or_si128(val, _mm_and_si128(lower, _mm_sub_epi8(v, _mm_set1_epi8('a'-26))));
+  val = _mm_or_si128(val, _mm_and_si128(dig, _mm_add_epi8(v, _mm_set1_epi8(52-'0'))));
+  val = _mm_or_si128(val, _mm_and_si128(c62, _mm_set1_epi8(62)));
+  val = _mm_or_si128(val, _mm_and_si128(c63, _mm_set1_epi8(63)));
+
+  // Pack four 6 bit values into 24 bits per lane, then gather the
+  // three bytes of each lane in big endian order.
+  __m128i w = _mm_maddubs_epi16(val, _mm_set1_epi32(0x01400140));
+  __m128i d = _mm_madd_epi16(w, _mm_set1_epi32(0x00011000));
+  d = _mm_shuffle_epi8(d, _mm_setr_epi8(2,1,0, 6,5,4, 10,9,8, 14,13,12,
+                                        -1,-1,-1,-1));
+
+  uint8_t tmp[16];
+  _mm_storeu_si128((__m128i*)tmp, d);
+  for(int i=0; i<12; i++) out[i] = tmp[i];
+  return true;
+}
+
+// Reads 48 bytes (zero padded by the caller), writes 64 characters
+__attribute__((target("ssse3")))
+void encodeHashSSSE3(const uint8_t *in, char *out)
+{
+  for(int i=0; i<4; i++)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*)(in + i*12));
+      _mm_storeu_si128((__m128i*)(out + i*16), enc64(v));
+    }
+}
+
+// Reads 64 characters (padded with 'A' by the caller), writes 48 bytes
+__attribute__((target("ssse3")))
+bool decodeHashSSSE3(const char *in, uint8_t *out)
+{
+  for(int i=0; i<4; i++)
+    {
+      __m128i v = _mm_loadu_si128((const __m128i*)(in + i*16));
+      if(!dec64(v, out + i*12))
+        return false;
+    }
+  return true;
+}
+
+#else
+
+bool haveSSSE3() { return false; }
+size_t encodeHexSSSE3(const uint8_t*, size_t, char*) { return 0; }
+size_t decodeHexSSSE3(const char*, size_t, uint8_t*) { return 0; }
+void encodeHashSSSE3(const uint8_t*, char*) {}
+bool decodeHashSSSE3(const char*, uint8_t*) { return false; }
+
+#endif
+
+}
+}
@@ -2,71 +2,62 @@
 
 using namespace Spread;
 
-#include "../libs/sha2/sha2.h"
+#include "sha256.hpp"
+#include "codec.hpp"
 #include <string.h>
 #include <stdexcept>
 
 void Hash::hash(const void *input, uint32_t len)
 {
-  dealloc();
-  sha256((const unsigned char*)input, len, data);
+  SHA256::hash(input, len, data);
   size() = len;
 }
 
-void Hash::update(const void *input, uint32_t len)
+void HashBuilder::reset()
 {
-  // Create a new context if this is the first call
-  if(context == NULL)
-    {
-      clear();
-      context = new sha256_ctx;
-      sha256_init((sha256_ctx*)context);
-      size() = 0;
-    }
-
-  // Update the context with the new data
-  sha256_update((sha256_ctx*)context, (const unsigned char*)input, len);
-  size() += len;
+  SHA256::init(&ctx);
+  total = 0;
 }
 
-Hash Hash::finish()
+void HashBuilder::update(const void *input, uint32_t len)
 {
-  /* If finish is called without update() being called first, we need
-     to treat it as if we are hashing a zero-length buffer.
-
-     Finish may be preceded by any number of update() calls, including
-     zero.
+  SHA256::update(&ctx, input, len);
+  total += len;
+}
 
-     Note that the hash of a zero-length buffer is NOT the same as an
-     empty (zero) hash!
-   */
-  if(!context)
-    hash(NULL, 0);
-  else
-    {
-      sha256_ctx *ctx = (sha256_ctx*)context;
+Hash HashBuilder::finish()
+{
+  uint8_t raw[40];
+  SHA256::finish(&ctx, raw);
+  memcpy(raw+32, &total, 8);
+  reset();
 
-      // Finish up and delete the context
-      sha256_final(ctx, data);
-      dealloc();
-    }
+  Hash res;
+  res.copy(raw);
+  return res;
+}
 
-  return *this;
+HashState HashBuilder::getState() const
+{
+  HashState res;
+  memcpy(res.h, ctx.h, 32);
+  res.size = total - ctx.len;
+  return res;
 }
 
-void Hash::dealloc()
+void HashBuilder::setState(const HashState &state)
 {
-  if(context)
-    {
-      sha256_ctx *ctx = (sha256_ctx*)context;
-      delete ctx;
-      context = NULL;
-    }
+  assert(state.size % 64 == 0);
+  reset();
+  memcpy(ctx.h, state.h, 32);
+
+  // Only the lower bits matter, see the note in sha256.hpp
+  ctx.tot_len = state.size;
+  total = state.size;
 }
 
 void Hash::clear()
 {
-  dealloc();
   memset(data, 0, 40);
 }
 
@@ -79,128 +70,15 @@ bool Hash::isNull() const
 
 void Hash::copy(const void* source)
 {
-  dealloc();
   memcpy(data, source, 40);
 }
 
-void Hash::copy(const Hash &other)
-{
-  copy(other.data);
-
-  // Copy context if any
-  sha256_ctx *them = (sha256_ctx*)other.context;
-  if(them)
-    {
-      assert(!context);
-      sha256_ctx *us = new sha256_ctx;
-      context = us;
-      *us = *them;
-    }
-}
-
-static char hexDigit(int i)
-{
-  assert(i >= 0 && i < 16);
-  if(i < 10) return '0' + i;
-  return 'a' + i - 10;
-}
-
-static uint8_t dehexDig(char c)
-{
-  if(c >= '0' && c <= '9')
-    return c - '0';
-  if(c >= 'a' && c <= 'f')
-    return c - 'a' + 10;
-  if(c >= 'A' && c <= 'F')
-    return c - 'A' + 10;
-
-  throw std::runtime_error(std::string("Invalid hex character '") + c + "'");
-}
-
-static uint8_t dehex(const char *s)
-{
-  return (dehexDig(*s)<<4) | dehexDig(s[1]);
-}
-
-/* Base64 characters. Notice that we use an URL-friendly variant with
-   -_ at the end instead of +/. But our decoding routine supports both.
- */
-static const char cb64[]="ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
-
-// Converts 3 input bytes to 4 output characters
-void toBase(const uint8_t *in, char *out)
-{
-  out[0] = cb64[ in[0] >> 2 ];
-  out[1] = cb64[ ((in[0] & 0x03) << 4) | ((in[1] & 0xf0) >> 4) ];
-  out[2] = cb64[ ((in[1] & 0x0f) << 2) | ((in[2] & 0xc0) >> 6) ];
-  out[3] = cb64[ in[2] & 0x3f ];
-}
-
-// Decode character
-uint8_t bval(char c)
-{
-  if(c >= 'A' && c <= 'Z') return c-'A';
-  if(c >= 'a' && c <= 'z') return c-'a'+26;
-  if(c >= '0' && c <= '9') return c-'0'+52;
-  if(c == '-' || c == '+') return 62;
-  if(c == '/' || c == '_') return 63;
-  if(c == '=') return 0;
-
-  throw std::runtime_error(std::string("Invalid base64 character '") + c + "'");
-}
-
-// Converts 4 input characters to 3 output bytes
-void fromBase(const char *in, uint8_t *out)
-{
-  uint8_t v0 = bval(in[0]);
-  uint8_t v1 = bval(in[1]);
-  uint8_t v2 = bval(in[2]);
-  uint8_t v3 = bval(in[3]);
-  out[0] = (v0 << 2) | ((v1 & 0x30) >> 4);
-  out[1] = ((v1 & 0x0f) << 4) | ((v2 & 0x3c) >> 2);
-  out[2] = ((v2 & 0x03) << 6) | v3;
-}
-
-static void decodeBase(const std::string &str, uint8_t *out)
-{
-  assert(str.size() <= 56);
-
-  int pos = 0;
-  int outleft = 40;
-
-  while(pos < str.size() && outleft > 0)
-    {
-      char buf[5] = "AAAA";
-      str.copy(buf, 4, pos);
-
-      uint8_t obuf[3];
-      fromBase(buf, obuf);
-
-      if(outleft >= 3)
-        memcpy(out, obuf, 3);
-      else
-        memcpy(out, obuf, outleft);
-
-      outleft -= 3;
-      out += 3;
-      pos += 4;
-    }
-}
-
 std::string Hash::toBase64() const
 {
   if(isNull()) return "00";
 
-  const uint8_t *ptr = data;
-
   char output[56];
-
-  for(int i=0; i<13; i++)
-    toBase(ptr+i*3, output+i*4);
-  uint8_t last[3];
-  last[0] = ptr[39];
-  last[1] = last[2] = 0;
-  toBase(last, output+52);
+  Codec::encodeHash(data, output);
 
   // Trim trailing As
   int end = 55;
@@ -211,17 +89,9 @@ std::string Hash::toBase64() const
 
 std::string Hash::toHex() const
 {
-  std::string result;
-  result.reserve(80);
-
-  for(int i=0; i<40; i++)
-    {
-      uint8_t byte = data[i];
-      result += hexDigit(byte >> 4);
-      result += hexDigit(byte & 0xf);
-    }
-
-  return result;
+  char output[80];
+  Codec::encodeHex(data, 40, output);
+  return std::string(output, 80);
 }
 
 std::string Hash::toString() const
@@ -239,19 +109,52 @@ void Hash::fromString(const std::string &str)
 
   if(str.size() <= 56)
     {
-      decodeBase(str, data);
+      Codec::decodeHash(str.c_str(), str.size(), data);
       return;
     }
 
   if(str.size() != 80)
     throw std::runtime_error("String is not a valid Hash");
 
-  const char* s = str.c_str();
-  for(int i=0; i<40; i++)
+  Codec::decodeHex(str.c_str(), 40, data);
+}
+
+// Stored as the eight chaining values followed by the size, all
+// little endian
+std::string HashState::toString() const
+{
+  uint8_t raw[40];
+  for(int i=0; i<8; i++)
+    for(int j=0; j<4; j++)
+      raw[i*4+j] = h[i] >> (8*j);
+  for(int j=0; j<8; j++)
+    raw[32+j] = size >> (8*j);
+
+  char output[80];
+  Codec::encodeHex(raw, 40, output);
+  return std::string(output, 80);
+}
+
+void HashState::fromString(const std::string &str)
+{
+  if(str.size() != 80)
+    throw std::runtime_error("String is not a valid HashState");
+
+  uint8_t raw[40];
+  Codec::decodeHex(str.c_str(), 40, raw);
+
+  for(int i=0; i<8; i++)
     {
-      data[i] = dehex(s);
-      s += 2;
+      h[i] = 0;
+      for(int j=0; j<4; j++)
+        h[i] |= (uint32_t)raw[i*4+j] << (8*j);
     }
+  size = 0;
+  for(int j=0; j<8; j++)
+    size |= (uint64_t)raw[32+j] << (8*j);
+
+  if(size % 64)
+    throw std::runtime_error("String is not a valid HashState");
 }
 
 std::ostream& operator<< (std::ostream& out, const Hash &hash)
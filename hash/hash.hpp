@@ -6,6 +6,7 @@
 #include <assert.h>
 #include <ostream>
 #include <map>
+#include "sha256.hpp"
 
 namespace Spread
 {
@@ -17,27 +18,20 @@ namespace Spread
      SHA-256 hash of the object data, and the last 8 bytes represent
      the object's size.
 
-     Hashes can be computed in one go, or iteratively through
-     update()/finish().
+     Hashes are computed in one go with hash(), or iteratively through
+     HashBuilder (see below.)
 
-     Hashes are fully usable as value types, and can safely be copied
-     and passed by value. They can also be used as key values in STL
+     Hashes are plain 40 byte values with no other state. They can be
+     copied with memcpy, passed by value and used as key values in STL
      containers.
-
-     NOTE: Copying partial hashes (where you have called update() but
-     not finish()) will work, but make sure the assignment operator=
-     or the copy constructor is invoked (ie. NOT a bitwise copy.)
-     Otherwise results are undefined.
    */
   struct Hash
   {
     typedef std::map<std::string,Hash> DirMap;
 
-    Hash() : context(NULL) { clear(); }
-    Hash(const std::string &hex) : context(NULL) { fromString(hex); }
-    Hash(const void *input, uint32_t len) : context(NULL) { hash(input, len); }
-    Hash(const Hash &h) : context(NULL) { copy(h); }
-    ~Hash() { dealloc(); }
+    Hash() { clear(); }
+    Hash(const std::string &hex) { fromString(hex); }
+    Hash(const void *input, uint32_t len) { hash(input, len); }
 
     // Zeros out the hash digest
     void clear();
@@ -55,38 +49,12 @@ namespace Spread
     // long.
     void copy(const void* source);
 
-    // Copy contents from another Hash. Will also copy partial hash
-    // state (from update()/finish() functions), if any.
-    void copy(const Hash &other);
+    // Copy contents from another Hash. Same as assignment.
+    void copy(const Hash &other) { copy(other.data); }
 
     // Hash a complete buffer, and store the result in this struct.
     void hash(const void *input, uint32_t len);
 
-    /* Perform and finish partial hashing. You can call update()
-       sequentially on parts of your buffer. After calling finish(),
-       the result will be the same as if you had called hash() on the
-       entire buffer.
-
-       There is no 'start' step. Just call update() to begin a new
-       hash sequence, and finish() to get the result. The latter
-       returns this struct for convenience.
-
-       Calling update() again after finish() starts a new hash
-       sequence. Calling finish() with no preceding update() step
-       counts as hashing a zero-length buffer.
-
-       Calls to clear(), copy(), hash() and fromString() will also
-       abort the sequence.
-    */
-    void update(const void *input, uint32_t len);
-    Hash finish();
-
-    Hash operator=(const Hash &other)
-    {
-      copy(other);
-      return *this;
-    }
-
     // Compare two hashes for equality
     bool operator==(const Hash &other) const
     {
@@ -138,14 +106,68 @@ namespace Spread
 
   private:
     uint8_t data[40];
+  };
+
+  /* Snapshot of a HashBuilder at a 64 byte block boundary, ie. the
+     raw SHA-256 chaining values after 'size' bytes. Used to resume
+     hashing of files that have grown since they were last hashed
+     (see CacheIndex::setAppendHashing().)
+
+     A state with size == 0 is unset.
+   */
+  struct HashState
+  {
+    uint32_t h[8];
+    uint64_t size;
 
-    // Internal pointer used by update() and finish()
-    void *context;
+    HashState() : size(0) {}
 
-    // Discard all partial hash information created by update(). This
-    // has the same effect as calling finish(), except the result is
-    // discarded.
-    void dealloc();
+    bool isSet() const { return size != 0; }
+
+    // 80 character hex string. fromString() throws on invalid input.
+    std::string toString() const;
+    void fromString(const std::string &str);
+  };
+
+  /* Computes a Hash iteratively. You can call update() sequentially
+     on parts of your buffer. After calling finish(), the result will
+     be the same as if you had called Hash::hash() on the entire
+     buffer.
+
+     There is no 'start' step. finish() resets the builder, so calling
+     update() again afterwards starts a new hash sequence. Calling
+     finish() with no preceding update() counts as hashing a
+     zero-length buffer.
+
+     All the state is kept inside the object (no heap allocations), so
+     builders are cheap to put on the stack. Copying a builder forks
+     the partial hash, and both copies can be continued and finished
+     independently.
+   */
+  struct HashBuilder
+  {
+    HashBuilder() { reset(); }
+
+    void update(const void *input, uint32_t len);
+    Hash finish();
+
+    // Discard the current sequence, if any
+    void reset();
+
+    // Number of bytes passed to update() since the last reset
+    uint64_t size() const { return total; }
+
+    /* Get the state at the last 64 byte block boundary. Up to 63
+       bytes passed to update() after that boundary are not included.
+     */
+    HashState getState() const;
+
+    // Reset, then continue from a state saved with getState()
+    void setState(const HashState &state);
+
+  private:
+    SHA256::Context ctx;
+    uint64_t total;
   };
 }
 
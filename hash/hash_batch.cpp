@@ -0,0 +1,84 @@
+#include "hash_batch.hpp"
+#include "sha256.hpp"
+
+#include <string.h>
+#include <algorithm>
+
+using namespace Spread;
+
+void HashBatch::add(const void *input, uint32_t len, Hash *out)
+{
+  assert(out);
+
+  if(len > SMALL_LIMIT)
+    {
+      out->hash(input, len);
+      return;
+    }
+
+  if(buf.size() + len > MAX_BUFFERED)
+    flush();
+
+  Item it;
+  it.offset = buf.size();
+  it.len = len;
+  it.out = out;
+  items.push_back(it);
+
+  buf.resize(buf.size() + len);
+  if(len) memcpy(&buf[it.offset], input, len);
+}
+
+struct LenLess
+{
+  const uint32_t *lens;
+  bool operator()(int a, int b) const { return lens[a] < lens[b]; }
+};
+
+void HashBatch::flush()
+{
+  if(items.empty()) return;
+
+  int num = items.size();
+  const uint8_t *base = buf.empty() ? NULL : &buf[0];
+
+  /* Sort the buffers by size, so that buffers of similar length end
+     up in the same set of SIMD lanes. Otherwise one large buffer
+     would keep the lanes of seven small ones busy doing nothing.
+   */
+  std::vector<uint32_t> lens(num);
+  std::vector<int> order(num);
+  for(int i=0; i<num; i++)
+    {
+      lens[i] = items[i].len;
+      order[i] = i;
+    }
+  LenLess cmp;
+  cmp.lens = &lens[0];
+  std::sort(order.begin(), order.end(), cmp);
+
+  std::vector<const void*> inputs(num);
+  std::vector<uint32_t> slens(num);
+  for(int i=0; i<num; i++)
+    {
+      const Item &it = items[order[i]];
+      inputs[i] = base + it.offset;
+      slens[i] = it.len;
+    }
+
+  std::vector<uint8_t> digests(32*num);
+  SHA256::hashMany(&inputs[0], &slens[0], &digests[0], num);
+
+  for(int i=0; i<num; i++)
+    {
+      const Item &it = items[order[i]];
+      uint8_t raw[40];
+      memcpy(raw, &digests[32*i], 32);
+      uint64_t size = it.len;
+      memcpy(raw+32, &size, 8);
+      it.out->copy(raw);
+    }
+
+  items.clear();
+  buf.clear();
+}
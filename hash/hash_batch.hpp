@@ -0,0 +1,50 @@
+#ifndef _SPREAD_HASH_BATCH_HPP
+#define _SPREAD_HASH_BATCH_HPP
+
+#include "hash.hpp"
+#include <vector>
+
+namespace Spread
+{
+  /* Collects many small buffers and hashes them all in one go through
+     SHA256::hashMany(). This is a lot faster than hashing small files
+     one by one on CPUs where the multi-buffer backend is available.
+
+     Data passed to add() is copied, so the caller may reuse its
+     buffer immediately. The resulting Hash is written to 'out' when
+     the batch is flushed, so 'out' must stay valid until then. The
+     batch is flushed automatically when the buffered data grows too
+     large, and when the object is destroyed.
+
+     Buffers larger than SMALL_LIMIT gain nothing from batching, and
+     are hashed immediately.
+   */
+  struct HashBatch
+  {
+    static const uint32_t SMALL_LIMIT = 64*1024;
+    static const uint32_t MAX_BUFFERED = 4*1024*1024;
+
+    HashBatch() {}
+    ~HashBatch() { flush(); }
+
+    void add(const void *input, uint32_t len, Hash *out);
+
+    // Hash everything added so far, and store the results
+    void flush();
+
+    // Number of buffers waiting to be hashed
+    int pending() const { return items.size(); }
+
+  private:
+    struct Item
+    {
+      size_t offset;
+      uint32_t len;
+      Hash *out;
+    };
+
+    std::vector<uint8_t> buf;
+    std::vector<Item> items;
+  };
+}
+#endif
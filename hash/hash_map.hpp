@@ -0,0 +1,352 @@
+#ifndef _SPREAD_HASH_MAP_HPP
+#define _SPREAD_HASH_MAP_HPP
+
+#include "hash.hpp"
+#include <vector>
+#include <utility>
+#include <string.h>
+
+/* Flat hash tables keyed by Hash.
+
+   Hash keys are SHA-256 digests, which are already uniformly
+   distributed. So instead of comparing 40 byte keys in a binary tree
+   (like std::map does), we use the first 8 bytes of the digest as a
+   ready-made hash value, and store everything in flat arrays with
+   open addressing (linear probing.)
+
+   The tags are kept in their own array, so probing only touches a
+   few cache lines. Full keys are only compared when the tags match.
+
+   Deleted slots are filled by shifting later entries backwards, so
+   there are no tombstones, and values stored under the same key are
+   always found in insertion order.
+
+   FlatTable is the table itself. It only knows about tags and
+   values, and leaves key comparisons to a functor passed in by the
+   caller. This lets users like Cache::EntryArena store nothing but
+   small ids, and compare keys against data kept elsewhere.
+
+   HashMap works like std::map<Hash,T> with a smaller interface, and
+   HashMultiMap like std::multimap<Hash,T>. T must be default
+   constructible and assignable. Pointers returned by find() are only
+   valid until the table is modified.
+
+   None of the classes are thread safe.
+ */
+
+namespace Spread
+{
+  /* Open addressing table of values with an integer tag each. Tag 0
+     marks an empty slot, so callers must never use it. V must be
+     default constructible and assignable.
+   */
+  template <class Tag, class V>
+  class FlatTable
+  {
+  protected:
+    std::vector<Tag> tags;            // 0 means empty
+    std::vector<V> values;
+    size_t used;
+    size_t mask;
+
+    void grow()
+    {
+      std::vector<Tag> otags;
+      std::vector<V> ovalues;
+      otags.swap(tags);
+      ovalues.swap(values);
+
+      size_t cap = otags.size() ? otags.size()*2 : 16;
+      tags.resize(cap);
+      values.resize(cap);
+      mask = cap-1;
+
+      /* Start right after an empty slot, so probe chains that wrap
+         around the end are moved in order. This keeps duplicate keys
+         in insertion order.
+       */
+      size_t start = 0;
+      while(start < otags.size() && otags[start]) start++;
+
+      for(size_t n=0; n<otags.size(); n++)
+        {
+          size_t i = (start+n) & (otags.size()-1);
+          if(otags[i])
+            {
+              size_t j = home(otags[i]);
+              while(tags[j]) j = (j+1) & mask;
+              tags[j] = otags[i];
+              values[j] = ovalues[i];
+            }
+        }
+    }
+
+  public:
+    FlatTable() : used(0), mask(0) {}
+
+    size_t home(Tag tag) const
+    {
+      // Fold the upper bits in, so small tables use all of the tag
+      uint64_t t = tag;
+      return (t ^ (t >> 32)) & mask;
+    }
+
+    size_t next(size_t i) const { return (i+1) & mask; }
+
+    const V &value(size_t i) const { return values[i]; }
+    V &value(size_t i) { return values[i]; }
+
+    /* Find the next slot with the given tag where eq(value) is true,
+       starting the probe at 'start'. Returns -1 if none.
+     */
+    template <class Eq>
+    long findSlot(Tag tag, const Eq &eq, size_t start) const
+    {
+      if(!used) return -1;
+
+      for(size_t i=start; tags[i]; i = (i+1) & mask)
+        if(tags[i] == tag && eq(values[i]))
+          return i;
+
+      return -1;
+    }
+
+    template <class Eq>
+    long findSlot(Tag tag, const Eq &eq) const
+    { return used ? findSlot(tag, eq, home(tag)) : -1; }
+
+    // Always adds a new slot, after any existing ones with this tag.
+    size_t addSlot(Tag tag)
+    {
+      // Keep the load factor below 3/4
+      if((used+1)*4 > tags.size()*3)
+        grow();
+
+      size_t i = home(tag);
+      while(tags[i]) i = (i+1) & mask;
+
+      tags[i] = tag;
+      used++;
+      return i;
+    }
+
+    void eraseSlot(size_t i)
+    {
+      // Shift later entries in the probe chain back into the hole
+      size_t j = i;
+      while(true)
+        {
+          j = (j+1) & mask;
+          if(!tags[j]) break;
+
+          // Entries whose home lies cyclically within (i, j] must
+          // stay where they are.
+          size_t h = home(tags[j]);
+          if(i <= j ? (i < h && h <= j) : (i < h || h <= j))
+            continue;
+
+          tags[i] = tags[j];
+          values[i] = values[j];
+          i = j;
+        }
+
+      tags[i] = 0;
+      values[i] = V();
+      used--;
+    }
+
+    size_t size() const { return used; }
+    bool empty() const { return used == 0; }
+
+    // Memory held by the table arrays
+    uint64_t bytes() const
+    { return tags.capacity() * sizeof(Tag) + values.capacity() * sizeof(V); }
+
+    void clear()
+    {
+      tags.clear();
+      values.clear();
+      used = 0;
+      mask = 0;
+    }
+
+    // Make room for at least 'num' entries without rehashing
+    void reserve(size_t num)
+    {
+      while(num*4 > tags.size()*3)
+        grow();
+    }
+  };
+
+  template <class T>
+  class HashTable : protected FlatTable<uint64_t, std::pair<Hash,T> >
+  {
+  protected:
+    typedef std::pair<Hash,T> Entry;
+    typedef FlatTable<uint64_t, Entry> Flat;
+
+    struct SameKey
+    {
+      const Hash *key;
+      bool operator()(const Entry &e) const { return e.first == *key; }
+    };
+
+    static uint64_t getTag(const Hash &key)
+    {
+      const uint8_t *p = key.getData();
+      uint64_t tag;
+      memcpy(&tag, p, 8);
+
+      /* Mix in the size, in case we get lots of keys with a null
+         digest (these show up in tests and for directories.)
+       */
+      tag ^= key.size() * 0x9E3779B97F4A7C15ULL;
+      return tag ? tag : 1;
+    }
+
+    // Find the next slot holding 'key', starting the probe at
+    // 'start'. Returns -1 if none.
+    long findSlot(const Hash &key, uint64_t tag, size_t start) const
+    {
+      SameKey eq = { &key };
+      return Flat::findSlot(tag, eq, start);
+    }
+
+    long findSlot(const Hash &key) const
+    {
+      SameKey eq = { &key };
+      return Flat::findSlot(getTag(key), eq);
+    }
+
+    // Always adds a new slot for 'key', after any existing ones.
+    size_t addSlot(const Hash &key)
+    {
+      size_t i = Flat::addSlot(getTag(key));
+      this->values[i].first = key;
+      return i;
+    }
+
+  public:
+    using Flat::size;
+    using Flat::empty;
+    using Flat::clear;
+    using Flat::reserve;
+
+    /* Call func(key, value) for every entry, in no particular
+       order. The table must not be modified during the loop.
+     */
+    template <class F>
+    void forEach(F &func) const
+    {
+      for(size_t i=0; i<this->tags.size(); i++)
+        if(this->tags[i]) func(this->values[i].first, this->values[i].second);
+    }
+  };
+
+  template <class T>
+  class HashMap : public HashTable<T>
+  {
+    typedef HashTable<T> Base;
+
+  public:
+    // Returns NULL if the key was not found
+    T *find(const Hash &key)
+    {
+      long i = Base::findSlot(key);
+      return i < 0 ? NULL : &this->values[i].second;
+    }
+
+    const T *find(const Hash &key) const
+    {
+      long i = Base::findSlot(key);
+      return i < 0 ? NULL : &this->values[i].second;
+    }
+
+    size_t count(const Hash &key) const
+    { return Base::findSlot(key) < 0 ? 0 : 1; }
+
+    // Inserts a default value if the key is missing
+    T &operator[](const Hash &key)
+    {
+      long i = Base::findSlot(key);
+      if(i < 0) i = Base::addSlot(key);
+      return this->values[i].second;
+    }
+
+    // Returns true if an entry was removed
+    bool erase(const Hash &key)
+    {
+      long i = Base::findSlot(key);
+      if(i < 0) return false;
+      Base::eraseSlot(i);
+      return true;
+    }
+  };
+
+  template <class T>
+  class HashMultiMap : public HashTable<T>
+  {
+    typedef HashTable<T> Base;
+
+  public:
+    // Add a value. Existing values under the same key are kept.
+    void insert(const Hash &key, const T &value)
+    {
+      size_t i = Base::addSlot(key);
+      this->values[i].second = value;
+    }
+
+    // Returns the first (oldest) value stored under 'key', or NULL
+    T *find(const Hash &key)
+    {
+      long i = Base::findSlot(key);
+      return i < 0 ? NULL : &this->values[i].second;
+    }
+
+    const T *find(const Hash &key) const
+    {
+      long i = Base::findSlot(key);
+      return i < 0 ? NULL : &this->values[i].second;
+    }
+
+    // Get all values stored under 'key', oldest first
+    void findAll(const Hash &key, std::vector<T> &out) const
+    {
+      if(!this->used) return;
+      uint64_t tag = Base::getTag(key);
+      long i = Base::findSlot(key, tag, Base::home(tag));
+      while(i >= 0)
+        {
+          out.push_back(this->values[i].second);
+          i = Base::findSlot(key, tag, (i+1) & this->mask);
+        }
+    }
+
+    size_t count(const Hash &key) const
+    {
+      std::vector<T> tmp;
+      findAll(key, tmp);
+      return tmp.size();
+    }
+
+    // Remove one specific key/value pair. Returns true if it was
+    // found.
+    bool erase(const Hash &key, const T &value)
+    {
+      if(!this->used) return false;
+      uint64_t tag = Base::getTag(key);
+      long i = Base::findSlot(key, tag, Base::home(tag));
+      while(i >= 0)
+        {
+          if(this->values[i].second == value)
+            {
+              Base::eraseSlot(i);
+              return true;
+            }
+          i = Base::findSlot(key, tag, (i+1) & this->mask);
+        }
+      return false;
+    }
+  };
+}
+#endif
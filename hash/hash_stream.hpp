@@ -6,15 +6,17 @@
 #include <mangle/stream/filters/pure_filter.hpp>
 #include <mangle/stream/servers/file_stream.hpp>
 #include <mangle/stream/servers/outfile_stream.hpp>
+#include "misc/mapped_stream.hpp"
+#include <vector>
 
 /*
   Hash sum wrapping Mangle Stream.
 
   This filter stream computes the hash sum of all data read or written
   through it. It has one control function finish(), which is
-  documented below. The hash sum is computed in the .hash member, and
-  also returned by finish(). Otherwise the stream does not affect the
-  data flow in any way.
+  documented below. The data is fed to the HashBuilder in the .hash
+  member, and finish() returns the resulting hash sum. Otherwise the
+  stream does not affect the data flow in any way.
 
   The class also hosts two static sum() functions, which hash a stream
   (or a file) in one go with no persistant information.
@@ -56,10 +58,10 @@
 namespace Spread
 {
 
-template <class Hash>
+template <class Builder>
 struct HashStreamT : Mangle::Stream::PureFilter
 {
-  Hash hash;
+  Builder hash;
 
   // Total number of bytes summed (read + written). It is NEVER reset
   // to zero outside the constructor, so if you want to reset the
@@ -94,11 +96,11 @@ struct HashStreamT : Mangle::Stream::PureFilter
     hasPtr = false;
   }
 
-  /* Finish and reset the hash summing sequence. The result is
-     returned, as well as stored in the .hash member.
+  /* Finish and reset the hash summing sequence, and return the
+     result.
 
      Any read/write operations after finish() restarts the summing
-     process, as per update()/finish() in the Hash struct.
+     process, as per update()/finish() in HashBuilder.
    */
   Hash finish()
   {
@@ -126,6 +128,10 @@ struct HashStreamT : Mangle::Stream::PureFilter
   // Buffer size used for the sum() functions
   static const int DEFSIZE = 16*1024;
 
+  // Buffer size used when summing files. Files are read through
+  // MappedFileStream, in blocks of this size unless they are mapped.
+  static const int FILESIZE = 1024*1024;
+
   /* Directly sum THIS stream. See the static sum() function for more
      details.
   */
@@ -148,49 +154,61 @@ struct HashStreamT : Mangle::Stream::PureFilter
   {
     assert(str.isReadable);
 
+    Builder result;
+
     // Is this a memory stream?
     if(str.hasPtr)
       {
         assert(str.hasSize);
 
-        // Pointer streams makes life easy
-        return Hash(str.getPtr(), str.size());
+        // Pointer streams makes life easy. Feed the data in pieces,
+        // since update() takes 32 bit lengths.
+        const char *ptr = (const char*)str.getPtr();
+        uint64_t left = str.size();
+        while(left)
+          {
+            uint32_t num = left < 0x40000000 ? left : 0x40000000;
+            result.update(ptr, num);
+            ptr += num;
+            left -= num;
+          }
+        return result.finish();
       }
 
     // No pointers today. Create a buffer and hash in increments.
-    char *buf = new char[bufsize];
-
-    Hash result;
+    std::vector<char> buf(bufsize);
 
     // We do not depend on the stream size, only on eof().
     while(!str.eof())
       {
-        size_t num = str.read(buf, bufsize);
+        size_t num = str.read(&buf[0], bufsize);
 
         // If we read less than expected, we should be at the
         // end of the stream
         assert(num == bufsize || (num < bufsize && str.eof()));
 
         // Hash the data
-        result.update(buf, num);
+        result.update(&buf[0], num);
       }
 
-    // Clean up and return
-    delete[] buf;
     return result.finish();
   }
   static Hash sum(Mangle::Stream::StreamPtr str, int bufsize = DEFSIZE)
   { return sum(*str, bufsize); }
 
-  // Filename version of sum(), through FileStream.
-  static Hash sum(const std::string &filename, int buf = DEFSIZE)
+  /* Filename version of sum(). With 'map' set, large files are
+     memory mapped. Only do that for files nobody else can truncate,
+     see MappedFileStream.
+   */
+  static Hash sum(const std::string &filename, int buf = FILESIZE,
+                  bool map = false)
   {
-    using namespace Mangle::Stream;
-    return sum(FileStreamPtr(new FileStream(filename)), buf);
+    Misc::MappedFileStream str(filename, map);
+    return sum(str, buf);
   }
 };
 
-typedef HashStreamT<Hash> HashStream;
+typedef HashStreamT<HashBuilder> HashStream;
 typedef boost::shared_ptr<HashStream> HashStreamPtr;
 }
 #endif
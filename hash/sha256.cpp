@@ -0,0 +1,280 @@
+#include "sha256.hpp"
+
+#include <string.h>
+#include <assert.h>
+
+using namespace Spread;
+
+/* The portable transform lives in libs/sha2. It's not listed in
+   sha2.h, so declare it here.
+ */
+extern "C" void sha256_transf(sha256_ctx *ctx, const unsigned char *message,
+                              unsigned int block_nb);
+
+// Implemented in sha256_x86.cpp
+namespace Spread
+{
+  namespace SHA256
+  {
+    bool haveSHANI();
+    void transfSHANI(sha256_ctx *ctx, const unsigned char *message,
+                     unsigned int block_nb);
+    bool haveAVX2();
+    void transfAVX2x8(uint32_t state[8][8], const unsigned char *blocks[8]);
+  }
+}
+
+typedef void (*TransfFunc)(sha256_ctx*, const unsigned char*, unsigned int);
+
+/* Both of these are zero-initialized before any static constructors
+   run, so it's safe to hash from static Hash objects in other
+   translation units. The selection itself is idempotent, so a race
+   between two threads on the first call is harmless.
+ */
+static TransfFunc transf = NULL;
+static int current = -1;
+static int batchCurrent = -1;
+
+static TransfFunc getFunc(int backend)
+{
+  if(backend == SHA256::SB_SHANI)
+    return SHA256::transfSHANI;
+  return sha256_transf;
+}
+
+static TransfFunc getTransf()
+{
+  if(!transf)
+    {
+      int best = SHA256::SB_Portable;
+      if(SHA256::isSupported(SHA256::SB_SHANI))
+        best = SHA256::SB_SHANI;
+      current = best;
+      transf = getFunc(best);
+    }
+  return transf;
+}
+
+bool SHA256::isSupported(int backend)
+{
+  if(backend == SB_Portable) return true;
+  if(backend == SB_SHANI) return haveSHANI();
+  return false;
+}
+
+bool SHA256::setBackend(int backend)
+{
+  if(!isSupported(backend)) return false;
+  current = backend;
+  transf = getFunc(backend);
+  return true;
+}
+
+int SHA256::getBackend()
+{
+  getTransf();
+  return current;
+}
+
+const char *SHA256::getName(int backend)
+{
+  if(backend == SB_Portable) return "portable";
+  if(backend == SB_SHANI) return "sha-ni";
+  return "unknown";
+}
+
+/* The rest mirrors sha256_init/update/final from libs/sha2, except
+   that the block transform goes through getTransf().
+ */
+
+void SHA256::init(Context *ctx)
+{
+  sha256_init(ctx);
+}
+
+void SHA256::update(Context *ctx, const void *input, uint32_t len)
+{
+  const unsigned char *message = (const unsigned char*)input;
+  unsigned int tmp_len = SHA256_BLOCK_SIZE - ctx->len;
+  unsigned int rem_len = len < tmp_len ? len : tmp_len;
+
+  if(rem_len)
+    memcpy(&ctx->block[ctx->len], message, rem_len);
+
+  if(ctx->len + len < SHA256_BLOCK_SIZE)
+    {
+      ctx->len += len;
+      return;
+    }
+
+  unsigned int new_len = len - rem_len;
+  unsigned int block_nb = new_len / SHA256_BLOCK_SIZE;
+  const unsigned char *shifted = message + rem_len;
+
+  TransfFunc tf = getTransf();
+  tf(ctx, ctx->block, 1);
+  if(block_nb)
+    tf(ctx, shifted, block_nb);
+
+  rem_len = new_len % SHA256_BLOCK_SIZE;
+  if(rem_len)
+    memcpy(ctx->block, &shifted[block_nb << 6], rem_len);
+
+  ctx->len = rem_len;
+  ctx->tot_len += (block_nb + 1) << 6;
+}
+
+static void unpack32(uint32_t x, uint8_t *str)
+{
+  str[3] = (uint8_t)(x);
+  str[2] = (uint8_t)(x >> 8);
+  str[1] = (uint8_t)(x >> 16);
+  str[0] = (uint8_t)(x >> 24);
+}
+
+void SHA256::finish(Context *ctx, uint8_t *digest)
+{
+  unsigned int block_nb = (1 + ((SHA256_BLOCK_SIZE - 9)
+                                < (ctx->len % SHA256_BLOCK_SIZE)));
+
+  // See the note in sha256.hpp about the 32 bit length.
+  unsigned int len_b = (ctx->tot_len + ctx->len) << 3;
+  unsigned int pm_len = block_nb << 6;
+
+  memset(ctx->block + ctx->len, 0, pm_len - ctx->len);
+  ctx->block[ctx->len] = 0x80;
+  unpack32(len_b, ctx->block + pm_len - 4);
+
+  getTransf()(ctx, ctx->block, block_nb);
+
+  for(int i=0; i<8; i++)
+    unpack32(ctx->h[i], digest + (i<<2));
+}
+
+void SHA256::hash(const void *input, uint32_t len, uint8_t *digest)
+{
+  Context ctx;
+  init(&ctx);
+  update(&ctx, input, len);
+  finish(&ctx, digest);
+}
+
+bool SHA256::isBatchSupported(int backend)
+{
+  if(backend == MB_Serial) return true;
+  if(backend == MB_AVX2) return haveAVX2();
+  return false;
+}
+
+bool SHA256::setBatchBackend(int backend)
+{
+  if(!isBatchSupported(backend)) return false;
+  batchCurrent = backend;
+  return true;
+}
+
+int SHA256::getBatchBackend()
+{
+  if(batchCurrent == -1)
+    {
+      if(getBackend() != SB_SHANI && haveAVX2())
+        batchCurrent = MB_AVX2;
+      else
+        batchCurrent = MB_Serial;
+    }
+  return batchCurrent;
+}
+
+const char *SHA256::getBatchName(int backend)
+{
+  if(backend == MB_Serial) return "serial";
+  if(backend == MB_AVX2) return "avx2-x8";
+  return "unknown";
+}
+
+/* One SIMD lane in hashMany(). Full blocks are read straight from the
+   input buffer, while the last one or two blocks (with padding and
+   length) are built in 'tail'.
+ */
+struct Lane
+{
+  const unsigned char *data;
+  unsigned int full, blocks;
+  unsigned char tail[128];
+
+  void setup(const void *input, uint32_t len)
+  {
+    data = (const unsigned char*)input;
+    full = len / SHA256_BLOCK_SIZE;
+
+    unsigned int rem = len % SHA256_BLOCK_SIZE;
+    unsigned int tblocks = (rem + 9 > SHA256_BLOCK_SIZE) ? 2 : 1;
+    blocks = full + tblocks;
+
+    // Same padding as finish(), including the 32 bit length
+    memset(tail, 0, sizeof(tail));
+    if(rem) memcpy(tail, data + (full << 6), rem);
+    tail[rem] = 0x80;
+    unpack32(len << 3, tail + (tblocks << 6) - 4);
+  }
+
+  const unsigned char *block(unsigned int i) const
+  {
+    if(i < full) return data + (i << 6);
+    return tail + ((i-full) << 6);
+  }
+};
+
+void SHA256::hashMany(const void * const *inputs, const uint32_t *lens,
+                      uint8_t *digests, int count)
+{
+  if(getBatchBackend() != MB_AVX2 || count < 2)
+    {
+      for(int i=0; i<count; i++)
+        hash(inputs[i], lens[i], digests + 32*i);
+      return;
+    }
+
+  static const unsigned char zero[SHA256_BLOCK_SIZE] = {0};
+  Lane lanes[8];
+
+  for(int start=0; start<count; start+=8)
+    {
+      int num = count-start;
+      if(num > 8) num = 8;
+
+      unsigned int steps = 0;
+      for(int l=0; l<num; l++)
+        {
+          lanes[l].setup(inputs[start+l], lens[start+l]);
+          if(lanes[l].blocks > steps)
+            steps = lanes[l].blocks;
+        }
+
+      // State is stored word-major, ie. state[word][lane]
+      uint32_t state[8][8];
+      Context tmp;
+      init(&tmp);
+      for(int w=0; w<8; w++)
+        for(int l=0; l<8; l++)
+          state[w][l] = tmp.h[w];
+
+      for(unsigned int s=0; s<steps; s++)
+        {
+          // Finished and unused lanes just crunch a dummy block
+          const unsigned char *ptrs[8];
+          for(int l=0; l<8; l++)
+            ptrs[l] = (l < num && s < lanes[l].blocks) ? lanes[l].block(s) : zero;
+
+          transfAVX2x8(state, ptrs);
+
+          for(int l=0; l<num; l++)
+            if(lanes[l].blocks == s+1)
+              {
+                uint8_t *out = digests + 32*(start+l);
+                for(int w=0; w<8; w++)
+                  unpack32(state[w][l], out + (w<<2));
+              }
+        }
+    }
+}
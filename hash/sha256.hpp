@@ -0,0 +1,89 @@
+#ifndef _SPREAD_SHA256_HPP
+#define _SPREAD_SHA256_HPP
+
+#include <stdint.h>
+#include "../libs/sha2/sha2.h"
+
+/* SHA-256 with a runtime selected block transform.
+
+   The streaming logic (block buffering, padding and the final length
+   encoding) is identical to libs/sha2, and produces the exact same
+   digests. Only the inner block transform is swapped out depending
+   on what the CPU supports.
+
+   NOTE: libs/sha2 only stores the lower 32 bits of the total message
+   length (in bits) in the final block. This makes digests of inputs
+   of 512 Mb or more differ from "standard" SHA-256. All hashes in
+   Spread have always been computed this way, so we keep doing it to
+   stay compatible with existing data.
+
+   The best available backend is picked automatically the first time
+   any hashing function is called. You can override it with
+   setBackend(), which is mostly useful for testing and benchmarking.
+ */
+
+namespace Spread
+{
+  namespace SHA256
+  {
+    enum Backends
+      {
+        SB_Portable,    // Plain C transform from libs/sha2
+        SB_SHANI,       // x86 SHA extensions
+
+        SB_Count
+      };
+
+    typedef sha256_ctx Context;
+
+    void init(Context *ctx);
+    void update(Context *ctx, const void *input, uint32_t len);
+    void finish(Context *ctx, uint8_t *digest);
+
+    // Hash a complete buffer in one go
+    void hash(const void *input, uint32_t len, uint8_t *digest);
+
+    // True if the given backend can run on this machine
+    bool isSupported(int backend);
+
+    // Select a backend. Returns false (and changes nothing) if the
+    // backend is not supported.
+    bool setBackend(int backend);
+
+    // Get the currently used backend
+    int getBackend();
+
+    // Human readable backend name
+    const char *getName(int backend);
+
+    /* Multi-buffer hashing. Hashes 'count' independent buffers, and
+       stores the 32 byte digests back to back in 'digests'.
+
+       With the AVX2 backend, up to eight buffers are hashed side by
+       side in SIMD lanes. This is much faster than hashing many small
+       buffers one at a time, but gains little for large buffers, and
+       lanes are wasted if the buffer sizes differ a lot. See
+       HashBatch in hash_batch.hpp for a friendlier interface.
+
+       The serial backend simply hashes each buffer through hash().
+       It is picked per default on CPUs with SHA extensions, since
+       those beat the AVX2 lanes anyway.
+     */
+    void hashMany(const void * const *inputs, const uint32_t *lens,
+                  uint8_t *digests, int count);
+
+    enum BatchBackends
+      {
+        MB_Serial,      // One by one through hash()
+        MB_AVX2,        // Eight lanes at a time
+
+        MB_Count
+      };
+
+    bool isBatchSupported(int backend);
+    bool setBatchBackend(int backend);
+    int getBatchBackend();
+    const char *getBatchName(int backend);
+  }
+}
+#endif
@@ -0,0 +1,243 @@
+#include "sha256.hpp"
+
+#include <assert.h>
+
+/* x86 specific SHA-256 transforms. Each function is compiled with
+   the instruction set it needs through target attributes, so the
+   rest of the code base can still be built for a generic CPU. Whether
+   a transform may actually be called is decided at runtime through
+   cpuid.
+
+   On other compilers or architectures, everything here reports
+   itself as unsupported.
+ */
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define SPREAD_X86
+#include <cpuid.h>
+#include <immintrin.h>
+#endif
+
+extern "C" uint32 sha256_k[64];
+
+namespace Spread
+{
+namespace SHA256
+{
+
+#ifdef SPREAD_X86
+
+bool haveSHANI()
+{
+  unsigned int a, b, c, d;
+
+  // SSSE3 and SSE4.1 are needed for the shuffles and blends
+  if(!__get_cpuid(1, &a, &b, &c, &d)) return false;
+  if(!(c & bit_SSSE3) || !(c & bit_SSE4_1)) return false;
+
+  if(__get_cpuid_max(0, NULL) < 7) return false;
+  __cpuid_count(7, 0, a, b, c, d);
+  return (b & (1 << 29)) != 0;
+}
+
+/* Based on the public domain SHA-NI sample code by Intel (Sean
+   Gulley) and Jeffrey Walton. The message schedule is kept in a four
+   element ring, where each step computes the next four schedule
+   words from the four previous groups.
+ */
+__attribute__((target("sha,ssse3,sse4.1")))
+void transfSHANI(sha256_ctx *ctx, const unsigned char *message,
+                 unsigned int block_nb)
+{
+  const __m128i MASK = _mm_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                      0x0405060700010203ULL);
+
+  // Load state and rearrange it into ABEF / CDGH order
+  __m128i tmp = _mm_loadu_si128((const __m128i*)&ctx->h[0]);
+  __m128i state1 = _mm_loadu_si128((const __m128i*)&ctx->h[4]);
+  tmp = _mm_shuffle_epi32(tmp, 0xB1);
+  state1 = _mm_shuffle_epi32(state1, 0x1B);
+  __m128i state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+  for(unsigned int b=0; b<block_nb; b++)
+    {
+      const __m128i *in = (const __m128i*)(message + (b << 6));
+      __m128i abef = state0, cdgh = state1;
+      __m128i w[4];
+
+      for(int i=0; i<4; i++)
+        w[i] = _mm_shuffle_epi8(_mm_loadu_si128(in+i), MASK);
+
+      for(int i=0; i<16; i++)
+        {
+          __m128i msg = _mm_add_epi32(w[i&3],
+                        _mm_loadu_si128((const __m128i*)&sha256_k[i*4]));
+          state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+          msg = _mm_shuffle_epi32(msg, 0x0E);
+          state0 = _mm_sha256rnds2_epu32(state0, state1, msg);
+
+          // Compute schedule group i+4 into the slot we just used
+          if(i < 12)
+            {
+              __m128i x = _mm_sha256msg1_epu32(w[i&3], w[(i+1)&3]);
+              x = _mm_add_epi32(x, _mm_alignr_epi8(w[(i+3)&3], w[(i+2)&3], 4));
+              w[i&3] = _mm_sha256msg2_epu32(x, w[(i+3)&3]);
+            }
+        }
+
+      state0 = _mm_add_epi32(state0, abef);
+      state1 = _mm_add_epi32(state1, cdgh);
+    }
+
+  // Back to ABCD / EFGH
+  tmp = _mm_shuffle_epi32(state0, 0x1B);
+  state1 = _mm_shuffle_epi32(state1, 0xB1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+
+  _mm_storeu_si128((__m128i*)&ctx->h[0], state0);
+  _mm_storeu_si128((__m128i*)&ctx->h[4], state1);
+}
+
+bool haveAVX2()
+{
+  unsigned int a, b, c, d;
+
+  // The OS must also save the YMM registers on context switches
+  if(!__get_cpuid(1, &a, &b, &c, &d)) return false;
+  if(!(c & bit_OSXSAVE) || !(c & bit_AVX)) return false;
+  unsigned int lo, hi;
+  __asm__("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+  if((lo & 6) != 6) return false;
+
+  if(__get_cpuid_max(0, NULL) < 7) return false;
+  __cpuid_count(7, 0, a, b, c, d);
+  return (b & (1 << 5)) != 0;
+}
+
+/* Eight independent SHA-256 block transforms side by side, one per
+   32 bit lane. 'state' is word-major (state[word][lane]), and
+   blocks[i] points to the 64 byte block for lane i.
+ */
+#define ROTR(x,n) _mm256_or_si256(_mm256_srli_epi32(x,n), _mm256_slli_epi32(x,32-(n)))
+#define SHR(x,n) _mm256_srli_epi32(x,n)
+#define XOR3(a,b,c) _mm256_xor_si256(_mm256_xor_si256(a,b),c)
+#define ADD(a,b) _mm256_add_epi32(a,b)
+
+__attribute__((target("avx2")))
+void transfAVX2x8(uint32_t state[8][8], const unsigned char *blocks[8])
+{
+  const __m256i MASK = _mm256_set_epi64x(0x0c0d0e0f08090a0bULL,
+                                         0x0405060700010203ULL,
+                                         0x0c0d0e0f08090a0bULL,
+                                         0x0405060700010203ULL);
+  __m256i w[16];
+
+  /* Load eight words from each block and transpose, so that w[i]
+     holds word i of all eight blocks.
+   */
+  for(int half=0; half<2; half++)
+    {
+      __m256i r[8];
+      for(int l=0; l<8; l++)
+        r[l] = _mm256_loadu_si256((const __m256i*)(blocks[l] + half*32));
+
+      __m256i t0 = _mm256_unpacklo_epi32(r[0], r[1]);
+      __m256i t1 = _mm256_unpackhi_epi32(r[0], r[1]);
+      __m256i t2 = _mm256_unpacklo_epi32(r[2], r[3]);
+      __m256i t3 = _mm256_unpackhi_epi32(r[2], r[3]);
+      __m256i t4 = _mm256_unpacklo_epi32(r[4], r[5]);
+      __m256i t5 = _mm256_unpackhi_epi32(r[4], r[5]);
+      __m256i t6 = _mm256_unpacklo_epi32(r[6], r[7]);
+      __m256i t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+
+      __m256i u0 = _mm256_unpacklo_epi64(t0, t2);
+      __m256i u1 = _mm256_unpackhi_epi64(t0, t2);
+      __m256i u2 = _mm256_unpacklo_epi64(t1, t3);
+      __m256i u3 = _mm256_unpackhi_epi64(t1, t3);
+      __m256i u4 = _mm256_unpacklo_epi64(t4, t6);
+      __m256i u5 = _mm256_unpackhi_epi64(t4, t6);
+      __m256i u6 = _mm256_unpacklo_epi64(t5, t7);
+      __m256i u7 = _mm256_unpackhi_epi64(t5, t7);
+
+      __m256i *out = w + half*8;
+      out[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+      out[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+      out[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+      out[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+      out[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+      out[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+      out[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+      out[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+
+      for(int i=0; i<8; i++)
+        out[i] = _mm256_shuffle_epi8(out[i], MASK);
+    }
+
+  __m256i v[8];
+  for(int i=0; i<8; i++)
+    v[i] = _mm256_loadu_si256((const __m256i*)state[i]);
+
+  __m256i a=v[0], b=v[1], c=v[2], d=v[3], e=v[4], f=v[5], g=v[6], h=v[7];
+
+  for(int i=0; i<64; i++)
+    {
+      __m256i wi;
+      if(i < 16)
+        wi = w[i];
+      else
+        {
+          __m256i w15 = w[(i-15)&15], w2 = w[(i-2)&15];
+          __m256i s0 = XOR3(ROTR(w15,7), ROTR(w15,18), SHR(w15,3));
+          __m256i s1 = XOR3(ROTR(w2,17), ROTR(w2,19), SHR(w2,10));
+          wi = ADD(ADD(w[i&15], s0), ADD(w[(i-7)&15], s1));
+          w[i&15] = wi;
+        }
+
+      __m256i S1 = XOR3(ROTR(e,6), ROTR(e,11), ROTR(e,25));
+      __m256i ch = _mm256_xor_si256(_mm256_and_si256(e,f),
+                                    _mm256_andnot_si256(e,g));
+      __m256i t1 = ADD(ADD(ADD(h, S1), ADD(ch, wi)),
+                       _mm256_set1_epi32(sha256_k[i]));
+      __m256i S0 = XOR3(ROTR(a,2), ROTR(a,13), ROTR(a,22));
+      __m256i maj = _mm256_or_si256(_mm256_and_si256(a,b),
+                                    _mm256_and_si256(c, _mm256_or_si256(a,b)));
+      __m256i t2 = ADD(S0, maj);
+
+      h = g; g = f; f = e;
+      e = ADD(d, t1);
+      d = c; c = b; b = a;
+      a = ADD(t1, t2);
+    }
+
+  v[0] = ADD(v[0], a); v[1] = ADD(v[1], b);
+  v[2] = ADD(v[2], c); v[3] = ADD(v[3], d);
+  v[4] = ADD(v[4], e); v[5] = ADD(v[5], f);
+  v[6] = ADD(v[6], g); v[7] = ADD(v[7], h);
+
+  for(int i=0; i<8; i++)
+    _mm256_storeu_si256((__m256i*)state[i], v[i]);
+}
+
+#undef ROTR
+#undef SHR
+#undef XOR3
+#undef ADD
+
+#else
+
+bool haveSHANI() { return false; }
+bool haveAVX2() { return false; }
+
+void transfAVX2x8(uint32_t state[8][8], const unsigned char *blocks[8])
+{ assert(0); }
+
+void transfSHANI(sha256_ctx *ctx, const unsigned char *message,
+                 unsigned int block_nb)
+{ assert(0); }
+
+#endif
+
+}
+}
@@ -0,0 +1,70 @@
+#include "hash.hpp"
+#include "sha256.hpp"
+
+#include <assert.h>
+#include <vector>
+#include <iostream>
+using namespace std;
+using namespace Spread;
+
+/* Hash the same data through all the SHA-256 backends available on
+   this machine, and make sure they agree. Only the (common) results
+   are printed, so the output does not depend on the CPU.
+ */
+
+vector<char> buf;
+
+Hash hashWith(int backend, int len, int step)
+{
+  bool ok = SHA256::setBackend(backend);
+  assert(ok);
+
+  if(step == 0)
+    return Hash(&buf[0], len);
+
+  HashBuilder h;
+  for(int pos=0; pos<len; pos+=step)
+    {
+      int num = step;
+      if(pos+num > len) num = len-pos;
+      h.update(&buf[pos], num);
+    }
+  return h.finish();
+}
+
+void test(int len, int step=0)
+{
+  Hash res = hashWith(SHA256::SB_Portable, len, step);
+  for(int b=0; b<SHA256::SB_Count; b++)
+    if(SHA256::isSupported(b))
+      assert(hashWith(b, len, step) == res);
+
+  cout << len << " bytes";
+  if(step) cout << " (in steps of " << step << ")";
+  cout << ":\n  " << res << endl;
+}
+
+int main()
+{
+  buf.resize(100000);
+  for(int i=0; i<buf.size(); i++)
+    buf[i] = (i*7 + i/13) & 0xff;
+
+  test(0);
+  test(3);
+  test(55);
+  test(56);
+  test(63);
+  test(64);
+  test(65);
+  test(119);
+  test(120);
+  test(1000);
+  test(1000, 1);
+  test(1000, 63);
+  test(100000);
+  test(100000, 4096);
+  test(100000, 777);
+
+  return 0;
+}
@@ -0,0 +1,96 @@
+#include "hash_batch.hpp"
+#include "sha256.hpp"
+#include "timer.hpp"
+
+#include <assert.h>
+#include <vector>
+#include <iostream>
+
+using namespace std;
+using namespace Spread;
+
+/* Compare hashing many small buffers one by one against HashBatch,
+   for each batch backend. The buffer sizes are typical for small
+   files (config files, scripts, icons), between 100 bytes and 8 Kb.
+ */
+
+#define COUNT 200000
+
+vector<char> buf;
+vector<int> lens;
+
+void single(vector<Hash> &out)
+{
+  for(int i=0; i<COUNT; i++)
+    out[i].hash(&buf[i], lens[i]);
+}
+
+void batched(vector<Hash> &out)
+{
+  HashBatch batch;
+  for(int i=0; i<COUNT; i++)
+    batch.add(&buf[i], lens[i], &out[i]);
+}
+
+int main()
+{
+  buf.resize(COUNT + 8192);
+  for(int i=0; i<buf.size(); i++)
+    buf[i] = i*31 + (i>>11);
+
+  lens.resize(COUNT);
+  uint64_t total = 0;
+  for(int i=0; i<COUNT; i++)
+    {
+      lens[i] = 100 + (i*7919) % 8092;
+      total += lens[i];
+    }
+  float mb = total/(1024.0*1024.0);
+
+  cout << COUNT << " buffers, " << mb << " Mb total\n";
+
+  vector<Hash> ref(COUNT), res(COUNT);
+  Timer t;
+  float secs;
+
+  for(int b=0; b<SHA256::SB_Count; b++)
+    {
+      cout << "One by one with '" << SHA256::getName(b) << "': ";
+      if(!SHA256::setBackend(b))
+        {
+          cout << "not supported\n";
+          continue;
+        }
+
+      t.reset();
+      single(res);
+      secs = t.total();
+      cout << secs << " secs (" << mb/secs << " Mb/s)\n";
+
+      if(b == 0) ref = res;
+      assert(res == ref);
+    }
+
+  // The serial batch backend uses the fastest single stream backend
+  if(!SHA256::setBackend(SHA256::SB_SHANI))
+    SHA256::setBackend(SHA256::SB_Portable);
+
+  for(int b=0; b<SHA256::MB_Count; b++)
+    {
+      cout << "Batch backend '" << SHA256::getBatchName(b) << "': ";
+      if(!SHA256::setBatchBackend(b))
+        {
+          cout << "not supported\n";
+          continue;
+        }
+
+      t.reset();
+      batched(res);
+      secs = t.total();
+      cout << secs << " secs (" << mb/secs << " Mb/s)\n";
+
+      assert(res == ref);
+    }
+
+  return 0;
+}
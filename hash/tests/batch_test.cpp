@@ -0,0 +1,69 @@
+#include "hash_batch.hpp"
+#include "sha256.hpp"
+
+#include <assert.h>
+#include <vector>
+#include <iostream>
+using namespace std;
+using namespace Spread;
+
+/* Hash a set of buffers through HashBatch with every supported batch
+   backend, and make sure the results match hashing each buffer on
+   its own. Only the common results are printed.
+ */
+
+vector<char> buf;
+
+const int LENS[] = { 0, 1, 55, 56, 63, 64, 65, 119, 120, 128, 1000,
+                     3, 4000, 17, 70000, 64*1024, 200, 9 };
+const int NUM = sizeof(LENS) / sizeof(int);
+
+void runBatch(int backend, vector<Hash> &out)
+{
+  bool ok = SHA256::setBatchBackend(backend);
+  assert(ok);
+
+  out.clear();
+  out.resize(NUM);
+
+  HashBatch batch;
+  for(int i=0; i<NUM; i++)
+    batch.add(&buf[i], LENS[i], &out[i]);
+
+  // Hashes larger than the batch limit are done right away
+  for(int i=0; i<NUM; i++)
+    assert(out[i].isNull() == (LENS[i] <= HashBatch::SMALL_LIMIT));
+
+  batch.flush();
+  assert(batch.pending() == 0);
+}
+
+int main()
+{
+  buf.resize(100000);
+  for(int i=0; i<buf.size(); i++)
+    buf[i] = (i*7 + i/13) & 0xff;
+
+  vector<Hash> res;
+  for(int b=0; b<SHA256::MB_Count; b++)
+    if(SHA256::isBatchSupported(b))
+      {
+        runBatch(b, res);
+        for(int i=0; i<NUM; i++)
+          assert(res[i] == Hash(&buf[i], LENS[i]));
+      }
+
+  for(int i=0; i<NUM; i++)
+    cout << LENS[i] << ": " << res[i] << endl;
+
+  // Destroying the batch flushes it
+  Hash h;
+  {
+    HashBatch batch;
+    batch.add("abcd", 4, &h);
+    assert(h.isNull());
+  }
+  cout << "abcd: " << h << endl;
+
+  return 0;
+}
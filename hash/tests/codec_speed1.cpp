@@ -0,0 +1,51 @@
+#include "hash.hpp"
+#include "codec.hpp"
+#include "timer.hpp"
+
+#include <vector>
+#include <iostream>
+using namespace std;
+using namespace Spread;
+
+/* Compare the codec backends on a million hash strings, the size of
+   a large channel.
+ */
+
+const int NUM = 1000000;
+
+int main()
+{
+  vector<Hash> hashes(NUM);
+  vector<string> b64(NUM), hex(NUM);
+  for(int i=0; i<NUM; i++)
+    {
+      hashes[i] = Hash(&i, sizeof(i));
+      b64[i] = hashes[i].toString();
+      hex[i] = hashes[i].toHex();
+    }
+
+  vector<Hash> out(NUM);
+  for(int b=0; b<Codec::CB_Count; b++)
+    {
+      if(!Codec::isSupported(b)) continue;
+      Codec::setBackend(b);
+      cout << Codec::getName(b) << ":\n";
+
+      Timer t;
+      Codec::decodeMany(&b64[0], &out[0], NUM);
+      cout << "  decode base64: " << t.total() << endl;
+
+      t.reset();
+      for(int i=0; i<NUM; i++) out[i].fromString(hex[i]);
+      cout << "  decode hex:    " << t.total() << endl;
+
+      t.reset();
+      Codec::encodeMany(&hashes[0], &b64[0], NUM);
+      cout << "  encode base64: " << t.total() << endl;
+
+      t.reset();
+      for(int i=0; i<NUM; i++) hex[i] = hashes[i].toHex();
+      cout << "  encode hex:    " << t.total() << endl;
+    }
+  return 0;
+}
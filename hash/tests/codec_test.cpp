@@ -0,0 +1,101 @@
+#include "hash.hpp"
+#include "codec.hpp"
+#include "misc/random.hpp"
+
+#include <assert.h>
+#include <vector>
+#include <iostream>
+using namespace std;
+using namespace Spread;
+
+/* Run string conversions through all the codec backends available on
+   this machine, and make sure they agree. Only the common results are
+   printed, so the output does not depend on the CPU.
+ */
+
+Misc::Random rnd;
+
+// Returns the string, or the error message
+string decode(int backend, const string &str)
+{
+  Codec::setBackend(backend);
+  try { return Hash(str).toHex(); }
+  catch(exception &e) { return string("ERROR: ") + e.what(); }
+}
+
+string check(const string &str)
+{
+  string res = decode(Codec::CB_Portable, str);
+  for(int b=0; b<Codec::CB_Count; b++)
+    if(Codec::isSupported(b))
+      assert(decode(b, str) == res);
+  return res;
+}
+
+void test(const string &str)
+{
+  cout << "'" << str << "'\n  => " << check(str) << endl;
+}
+
+Hash randomHash()
+{
+  uint8_t raw[40];
+  for(int i=0; i<40; i++) raw[i] = rnd.genBelow(256);
+  Hash h;
+  h.copy(raw);
+  return h;
+}
+
+int main()
+{
+  Hash h("hello", 5);
+  test(h.toString());
+  test(h.toHex());
+  test("00");
+  test("");
+  test("abc");
+  test("A+B/C-D_E=");
+  test(string(56, '_'));
+  test(string(80, 'F'));
+  test(h.toString() + "!");
+  test("abc#");
+  test(string(79, '0') + "g");
+  test(string(40, 'f') + "z" + string(39, '0'));
+
+  // Random round trips, with random damage
+  int damaged = 0;
+  for(int i=0; i<20000; i++)
+    {
+      Hash r = randomHash();
+
+      string str[2];
+      for(int b=0; b<Codec::CB_Count; b++)
+        if(Codec::isSupported(b))
+          {
+            Codec::setBackend(b);
+            string s = r.toString(), x = r.toHex();
+            if(b == 0) { str[0] = s; str[1] = x; }
+            assert(s == str[0] && x == str[1]);
+          }
+
+      for(int k=0; k<2; k++)
+        {
+          string s = str[k];
+          assert(check(s) == r.toHex());
+
+          s[rnd.genBelow(s.size())] = rnd.genBelow(128);
+          if(check(s).substr(0,5) == "ERROR") damaged++;
+        }
+    }
+  cout << "Random tests done\n";
+
+  // Batch functions
+  vector<Hash> in(100), out(100);
+  vector<string> strs(100);
+  for(int i=0; i<in.size(); i++) in[i] = randomHash();
+  Codec::encodeMany(&in[0], &strs[0], in.size());
+  Codec::decodeMany(&strs[0], &out[0], strs.size());
+  cout << "Batch round trip: " << (in == out) << endl;
+
+  return 0;
+}
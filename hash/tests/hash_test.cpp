@@ -37,16 +37,19 @@ int main()
   assert(h == h2);
 
   cout << "\nHash of zero buffer:\n" << Hash(NULL,0) << endl;
-  cout << "Finishing early:\n" << h.finish() << endl << h.finish() << endl;
-
-  h.update("ab", 2);
-  h.update("cd", 2);
-  cout << "Hashed abcd in two turns:\n" << h.finish() << endl;
-  h.update("a", 1);
-  h.update("bc", 2);
-  h.update("d", 1);
-  h.finish();
+  HashBuilder b;
+  cout << "Finishing early:\n" << b.finish() << endl << b.finish() << endl;
+
+  b.update("ab", 2);
+  b.update("cd", 2);
+  cout << "Hashed abcd in two turns:\n" << b.finish() << endl;
+  b.update("a", 1);
+  b.update("bc", 2);
+  b.update("d", 1);
+  h = b.finish();
   cout << "Repeat with 3 turns:\n" << h << endl;
 
+  cout << "sizeof(Hash): " << sizeof(Hash) << endl;
+
   return 0;
 }
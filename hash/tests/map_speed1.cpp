@@ -0,0 +1,95 @@
+#include "hash_map.hpp"
+#include "timer.hpp"
+
+#include <map>
+#include <vector>
+#include <iostream>
+
+using namespace std;
+using namespace Spread;
+
+/* Compare std::map<Hash,int> with HashMap<int>, at 1M and 10M
+   entries. Measures inserting all keys, looking up all keys, and the
+   same number of lookups of missing keys.
+ */
+
+vector<Hash> keys, missing;
+
+void makeKeys(int num)
+{
+  keys.resize(num);
+  missing.resize(num);
+  for(int i=0; i<num; i++)
+    {
+      int j = 2*i;
+      keys[i].hash(&j, sizeof(int));
+      j++;
+      missing[i].hash(&j, sizeof(int));
+    }
+}
+
+void report(const char *what, float secs, int num)
+{
+  cout << "    " << what << ": " << secs << " secs ("
+       << num/secs/1000000 << " M ops/s)\n";
+}
+
+void stdMap(int num)
+{
+  cout << "  std::map:\n";
+  std::map<Hash,int> map;
+  Timer t;
+  for(int i=0; i<num; i++)
+    map[keys[i]] = i;
+  report("insert", t.total(), num);
+
+  t.reset();
+  long sum = 0;
+  for(int i=0; i<num; i++)
+    sum += map.find(keys[i])->second;
+  report("find", t.total(), num);
+
+  t.reset();
+  for(int i=0; i<num; i++)
+    sum += (map.find(missing[i]) == map.end());
+  report("miss", t.total(), num);
+
+  if(sum == 42) cout << "\n";
+}
+
+void hashMap(int num)
+{
+  cout << "  HashMap:\n";
+  HashMap<int> map;
+  Timer t;
+  for(int i=0; i<num; i++)
+    map[keys[i]] = i;
+  report("insert", t.total(), num);
+
+  t.reset();
+  long sum = 0;
+  for(int i=0; i<num; i++)
+    sum += *map.find(keys[i]);
+  report("find", t.total(), num);
+
+  t.reset();
+  for(int i=0; i<num; i++)
+    sum += (map.find(missing[i]) == NULL);
+  report("miss", t.total(), num);
+
+  if(sum == 42) cout << "\n";
+}
+
+int main()
+{
+  int sizes[] = { 1000000, 10000000 };
+  for(int s=0; s<2; s++)
+    {
+      int num = sizes[s];
+      cout << num << " entries:\n";
+      makeKeys(num);
+      stdMap(num);
+      hashMap(num);
+    }
+  return 0;
+}
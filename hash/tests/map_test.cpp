@@ -0,0 +1,164 @@
+#include "hash_map.hpp"
+
+#include <assert.h>
+#include <map>
+#include <iostream>
+#include <stdlib.h>
+using namespace std;
+using namespace Spread;
+
+Hash make(int i)
+{
+  return Hash(&i, sizeof(int));
+}
+
+// Hashes with a null digest, only differing in size
+Hash makeNull(int i)
+{
+  Hash h;
+  h.size() = i;
+  return h;
+}
+
+struct Counter
+{
+  int num;
+  Counter() : num(0) {}
+  void operator()(const Hash &key, int val) { num++; }
+};
+
+void testMap()
+{
+  cout << "HashMap:\n";
+  HashMap<int> map;
+  assert(map.empty());
+  assert(map.find(make(1)) == NULL);
+  assert(!map.erase(make(1)));
+
+  map[make(1)] = 10;
+  map[make(2)] = 20;
+  map[Hash()] = 30;
+  cout << "  size=" << map.size() << endl;
+  cout << "  1 => " << *map.find(make(1)) << endl;
+  cout << "  2 => " << *map.find(make(2)) << endl;
+  cout << "  null => " << *map.find(Hash()) << endl;
+  assert(map.count(make(3)) == 0);
+
+  map[make(1)] = 11;
+  cout << "  1 => " << map[make(1)] << " size=" << map.size() << endl;
+
+  assert(map.erase(make(1)));
+  assert(!map.erase(make(1)));
+  cout << "  after erase: size=" << map.size()
+       << " found=" << (map.find(make(1)) != NULL) << endl;
+
+  // Compare against std::map with lots of random operations
+  std::map<Hash,int> ref;
+  map.clear();
+  srand(1);
+  for(int i=0; i<200000; i++)
+    {
+      int k = rand() % 5000;
+      Hash key = (k & 1) ? make(k) : makeNull(k);
+      int op = rand() % 3;
+      if(op == 0)
+        {
+          map[key] = i;
+          ref[key] = i;
+        }
+      else if(op == 1)
+        assert(map.erase(key) == (ref.erase(key) != 0));
+      else
+        {
+          int *p = map.find(key);
+          std::map<Hash,int>::iterator it = ref.find(key);
+          assert((p == NULL) == (it == ref.end()));
+          if(p) assert(*p == it->second);
+        }
+    }
+  assert(map.size() == ref.size());
+
+  Counter c;
+  map.forEach(c);
+  assert(c.num == ref.size());
+  cout << "  random test: ok\n";
+}
+
+void testMulti()
+{
+  cout << "HashMultiMap:\n";
+  HashMultiMap<int> map;
+  map.insert(make(1), 1);
+  map.insert(make(2), 2);
+  map.insert(make(1), 3);
+  map.insert(make(1), 4);
+  cout << "  size=" << map.size() << " count(1)=" << map.count(make(1)) << endl;
+  cout << "  first 1 => " << *map.find(make(1)) << endl;
+
+  assert(map.erase(make(1), 1));
+  assert(!map.erase(make(1), 2));
+  cout << "  first 1 => " << *map.find(make(1)) << endl;
+
+  vector<int> all;
+  map.findAll(make(1), all);
+  cout << "  all 1 =>";
+  for(int i=0; i<all.size(); i++) cout << " " << all[i];
+  cout << endl;
+
+  // Same key many times, with erases from the middle
+  map.clear();
+  for(int i=0; i<1000; i++)
+    {
+      map.insert(makeNull(i%7), i);
+      map.insert(make(i), i);
+    }
+  for(int i=0; i<1000; i+=3)
+    assert(map.erase(makeNull(i%7), i));
+  all.clear();
+  map.findAll(makeNull(5), all);
+  for(int i=1; i<all.size(); i++)
+    assert(all[i-1] < all[i]);
+  cout << "  size=" << map.size() << " count(null 5)=" << all.size()
+       << " first=" << all[0] << endl;
+
+  // Compare against std::multimap, including the value order
+  typedef std::multimap<Hash,int> MM;
+  MM ref;
+  map.clear();
+  srand(2);
+  for(int i=0; i<100000; i++)
+    {
+      int k = rand() % 300;
+      Hash key = (k & 1) ? make(k) : makeNull(k);
+      if(rand() % 3)
+        {
+          map.insert(key, i);
+          ref.insert(std::make_pair(key, i));
+        }
+      else
+        {
+          std::pair<MM::iterator,MM::iterator> r = ref.equal_range(key);
+          if(r.first == r.second)
+            continue;
+          int v = r.first->second;
+          ref.erase(r.first);
+          assert(map.erase(key, v));
+        }
+
+      all.clear();
+      map.findAll(key, all);
+      std::pair<MM::iterator,MM::iterator> r = ref.equal_range(key);
+      for(int j=0; j<all.size(); j++, r.first++)
+        assert(r.first != r.second && r.first->second == all[j]);
+      assert(r.first == r.second);
+    }
+  assert(map.size() == ref.size());
+  cout << "  random test: ok\n";
+}
+
+int main()
+{
+  testMap();
+  testMulti();
+  return 0;
+}
@@ -0,0 +1,86 @@
+#include "hash.hpp"
+#include "sha256.hpp"
+#include "timer.hpp"
+
+#include <assert.h>
+#include <vector>
+#include <iostream>
+#include <string.h>
+
+using namespace std;
+using namespace Spread;
+
+/* Compare the speed of the SHA-256 backends. Uses the same inputs as
+   the hash tests (many small strings), plus one large buffer hashed
+   in one go and in 16 Kb steps like HashStream::sum().
+ */
+
+#define BIG (64*1024*1024)
+#define SMALL_COUNT 1000000
+
+vector<char> big;
+
+void small()
+{
+  const char *inputs[] = { "Hello Dolly", "This is Louis, Dolly\n", "abcd",
+                           "hello", "aaaa", "aaab", "aaac", "" };
+  Hash h;
+  for(int i=0; i<SMALL_COUNT; i++)
+    {
+      const char *p = inputs[i % 8];
+      h.hash(p, strlen(p));
+    }
+}
+
+Hash large(int step)
+{
+  if(step == 0)
+    return Hash(&big[0], big.size());
+
+  HashBuilder h;
+  for(int pos=0; pos<big.size(); pos+=step)
+    h.update(&big[pos], step);
+  return h.finish();
+}
+
+int main()
+{
+  big.resize(BIG);
+  for(int i=0; i<big.size(); i++)
+    big[i] = i*31 + (i>>11);
+
+  Hash ref;
+  for(int b=0; b<SHA256::SB_Count; b++)
+    {
+      cout << "Backend '" << SHA256::getName(b) << "': ";
+      if(!SHA256::setBackend(b))
+        {
+          cout << "not supported\n";
+          continue;
+        }
+      cout << endl;
+
+      Timer t;
+      small();
+      float secs = t.total();
+      cout << "  " << SMALL_COUNT << " small hashes: " << secs << " secs\n";
+
+      t.reset();
+      Hash h = large(0);
+      secs = t.total();
+      cout << "  " << BIG/(1024*1024) << " Mb in one go: " << secs << " secs ("
+           << BIG/(1024*1024)/secs << " Mb/s)\n";
+
+      t.reset();
+      Hash h2 = large(16*1024);
+      secs = t.total();
+      cout << "  " << BIG/(1024*1024) << " Mb in 16 Kb steps: " << secs << " secs ("
+           << BIG/(1024*1024)/secs << " Mb/s)\n";
+
+      assert(h == h2);
+      if(ref.isNull()) ref = h;
+      assert(h == ref);
+    }
+
+  return 0;
+}
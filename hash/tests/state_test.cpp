@@ -0,0 +1,48 @@
+#include <iostream>
+#include "hash.hpp"
+#include <vector>
+
+using namespace Spread;
+using namespace std;
+
+int main()
+{
+  vector<char> buf(10000);
+  for(int i=0; i<buf.size(); i++)
+    buf[i] = i*7;
+
+  Hash full(&buf[0], buf.size());
+  cout << "Full:     " << full << endl;
+
+  // Save the state part way through
+  HashBuilder b;
+  b.update(&buf[0], 1000);
+  HashState st = b.getState();
+  cout << "State at: " << st.size << " set=" << st.isSet() << endl;
+
+  // Round trip through a string
+  string str = st.toString();
+  cout << "String length: " << str.size() << endl;
+  HashState st2;
+  st2.fromString(str);
+  cout << "Same after parsing: " << (st2.toString() == str) << endl;
+
+  // Resume from the boundary
+  HashBuilder b2;
+  b2.setState(st2);
+  b2.update(&buf[st.size], buf.size() - st.size);
+  cout << "Resumed:  " << b2.finish() << endl;
+
+  // The original builder is unaffected by getState()
+  b.update(&buf[1000], buf.size() - 1000);
+  cout << "Original: " << b.finish() << endl;
+
+  HashBuilder b3;
+  b3.update(&buf[0], 63);
+  cout << "Less than one block: set=" << b3.getState().isSet() << endl;
+
+  try { st2.fromString("abc"); }
+  catch(exception &e) { cout << "ERROR: " << e.what() << endl; }
+
+  return 0;
+}
@@ -8,34 +8,25 @@ using namespace Spread;
 int main()
 {
   {
-    Hash h;
+    HashBuilder h;
     h.update("aaa", 3);
-    Hash a = h;
-    // Test that destructors don't double-delete
-  }
-  {
-    Hash h;
-    h.update("aaa", 3);
-    Hash a = h;
+    HashBuilder a = h;
     cout << h.finish() << endl;
-    assert(h == a.finish());
+    assert(h.size() == 0);
+    assert(a.size() == 3);
+    assert(Hash("aaa", 3) == a.finish());
     // Test that finish on both ends work
   }
 
   // Repeat with assignment rather than initialization
   {
-    Hash h;
+    HashBuilder h;
     h.update("aaa", 3);
-    Hash a;
+    HashBuilder a;
     a = h;
-  }
-  {
-    Hash h;
-    h.update("aaa", 3);
-    Hash a;
-    a = h;
-    cout << h.finish() << endl;
-    assert(h == a.finish());
+    Hash res = h.finish();
+    cout << res << endl;
+    assert(res == a.finish());
   }
 
   cout << "aaaa: " << Hash("aaaa", 4) << endl;
@@ -43,14 +34,23 @@ int main()
   cout << "aaac: " << Hash("aaac", 4) << endl;
 
   {
-    Hash a;
+    HashBuilder a;
     a.update("aaa", 3);
-    Hash b = a, c; c=a;
+    HashBuilder b = a, c; c=a;
     b.update("b", 1);
-    b.finish();
+    Hash hb = b.finish();
     a.update("a", 1);
     c.update("c", 1);
-    cout << a.finish() << endl << b << endl << c.finish() << endl;
+    cout << a.finish() << endl << hb << endl << c.finish() << endl;
+  }
+
+  {
+    // Hashes are plain values
+    Hash h("abcd", 4), h2;
+    h2 = h;
+    assert(h2 == h);
+    Hash h3(h);
+    assert(h3 == h);
   }
 
   return 0;
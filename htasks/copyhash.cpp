@@ -1,6 +1,6 @@
 #include "copyhash.hpp"
-#include <mangle/stream/servers/file_stream.hpp>
-#include <mangle/stream/clients/copy_stream.hpp>
+#include "cache/packed.hpp"
+#include <vector>
 
 using namespace Spread;
 using namespace Mangle::Stream;
@@ -16,7 +16,8 @@ struct CopyTask : Job
     setBusy("Copying " + in);
     assert(out);
     setProgress(0,size);
-    size_t cpy = CopyStream::copy(FileStream::Open(in), out);
+    size_t cpy = copy();
+    if(checkStatus()) return;
     setProgress(cpy,size);
     if(cpy != size)
       setError("Size mismatch when copying " + in);
@@ -26,6 +27,34 @@ struct CopyTask : Job
 
 private:
   std::string in;
+
+  static const size_t BLOCK = 4*1024*1024;
+
+  /* Copy in large blocks. The source may be a file that others are
+     writing to, so it is read rather than mapped (see
+     MappedFileStream.) Objects from a compressed cache store are
+     unpacked on the fly.
+   */
+  size_t copy()
+  {
+    return copyStream(*Cache::Packed::open(in));
+  }
+
+  size_t copyStream(Stream &inf)
+  {
+    size_t total = 0;
+    std::vector<char> buf(BLOCK);
+    while(!inf.eof())
+      {
+        size_t num = inf.read(&buf[0], BLOCK);
+        if(num == 0) break;
+        out->write(&buf[0], num);
+        total += num;
+        setProgress(total, size);
+        if(checkStatus()) break;
+      }
+    return total;
+  }
   StreamPtr out;
   size_t size;
 };
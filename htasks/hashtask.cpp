@@ -1,6 +1,7 @@
 #include "hashtask.hpp"
 
 #include "hash/hash_stream.hpp"
+#include "misc/prealloc_stream.hpp"
 #include <boost/filesystem.hpp>
 #include <assert.h>
 #include <stdexcept>
@@ -52,6 +53,7 @@ void HashTask::doJob()
   PRINT("Running job");
   if(runClient(*job)) return;
   PRINT("Closing up");
+  finishJob();
   closeStream();
 
   // Check that all outputs were satisfied
@@ -122,9 +124,12 @@ StreamPtr HashTask::getOutStream(const Hash &h)
   */
   std::string file = it->second;
 
-  // Open the file for output, wrapped in a HashStream
+  /* Open the file for output, wrapped in a HashStream. We know the
+     final size, so let the output preallocate the file and write it
+     back in large blocks.
+   */
   parent(file);
-  res.reset(new HashStream(file, true));
+  res.reset(new HashStream(Misc::PreallocOutStream::Open(file, h.size(), true)));
 
   // Remove the entry from the outputs table, so we won't find it
   // again.
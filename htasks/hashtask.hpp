@@ -45,6 +45,12 @@ namespace Spread
     // Create the job that performs this task.
     virtual Job *createJob() = 0;
 
+    /* Called after the job from createJob() has finished successfully,
+       before this task is marked as done. Use it to complete any
+       output the job left pending.
+     */
+    virtual void finishJob() {}
+
   private:
     void doJob();
     void closeStream();
@@ -1,8 +1,9 @@
 #include "unpackhash.hpp"
 #include "tasks/unpack.hpp"
 #include <mangle/vfs/stream_factory.hpp>
-#include <mangle/stream/servers/null_stream.hpp>
 #include "hash/hash_stream.hpp"
+#include "hash/hash_batch.hpp"
+#include "cache/packed.hpp"
 #include <boost/filesystem.hpp>
 #include <stdexcept>
 
@@ -17,6 +18,59 @@ using namespace Mangle::Stream;
 #define PRINT(a)
 #endif
 
+/* Output stream used when indexing without writing any data. Small
+   files are kept in memory, and hashed together through a HashBatch
+   once they are complete. Files that grow too large for batching are
+   hashed on the fly instead.
+ */
+struct UH_BatchStream : Stream
+{
+  HashBatch batch;
+  std::vector<char> buf;
+  HashBuilder hash;
+  bool direct;
+
+  UH_BatchStream() : direct(false)
+  {
+    isSeekable = false;
+    hasPosition = false;
+    hasSize = false;
+    hasPtr = false;
+    isReadable = false;
+    isWritable = true;
+  }
+
+  size_t write(const void *data, size_t count)
+  {
+    if(!direct && buf.size() + count > HashBatch::SMALL_LIMIT)
+      {
+        direct = true;
+        if(buf.size()) hash.update(&buf[0], buf.size());
+        buf.clear();
+      }
+
+    if(direct) hash.update(data, count);
+    else buf.insert(buf.end(), (const char*)data, (const char*)data + count);
+    return count;
+  }
+
+  /* Hand the current file over to the batch (or finish it directly),
+     and get ready for the next one. The result is stored in 'out'
+     when the batch is flushed.
+   */
+  void finish(Hash *out)
+  {
+    if(direct) *out = hash.finish();
+    else batch.add(buf.size() ? &buf[0] : NULL, buf.size(), out);
+    buf.clear();
+    direct = false;
+  }
+
+  bool eof() const { return true; }
+};
+
+typedef boost::shared_ptr<UH_BatchStream> UH_BatchStreamPtr;
+
 /* This output writer is used for indexing. It stores names + hashes
    in an index, and can optionally write data to files.
  */
@@ -26,6 +80,7 @@ struct UH_ListHasher : Mangle::VFS::StreamFactory
   Hash::DirMap *index;
 
   HashStreamPtr stream;
+  UH_BatchStreamPtr batch;
   std::string lastName;
   bool lastDir;
   std::string where;
@@ -40,17 +95,25 @@ struct UH_ListHasher : Mangle::VFS::StreamFactory
     PRINT("open(" << name << ")  lastName=" << lastName);
 
     // Store the last hash, if any
-    if(stream && lastName != "")
+    if((stream || batch) && lastName != "")
       {
         // Ignore directories
         if(!lastDir)
-          (*index)[lastName] = stream->finish();
+          {
+            if(batch) batch->finish(&(*index)[lastName]);
+            else (*index)[lastName] = stream->finish();
+          }
         lastName = "";
       }
 
     // Allow an empty name to close the last file (above) without
-    // opening a new one here.
-    if(name == "") return StreamPtr();
+    // opening a new one here. Any batched hashes are stored now, so
+    // the index is complete when we return.
+    if(name == "")
+      {
+        if(batch) batch->batch.flush();
+        return StreamPtr();
+      }
 
     // Is this a directory?
     char ch = name[name.size()-1];
@@ -59,10 +122,10 @@ struct UH_ListHasher : Mangle::VFS::StreamFactory
 
     if(where == "")
       {
-        // If we're not writing anything, just reuse a NullStream as
-        // the final output.
-        if(!stream)
-          stream.reset(new HashStream(StreamPtr(new NullStream)));
+        // If we're not writing anything, there is no need to hash
+        // while unpacking. Buffer the data and hash it in batches.
+        if(!batch)
+          batch.reset(new UH_BatchStream);
       }
     else
       {
@@ -88,6 +151,7 @@ struct UH_ListHasher : Mangle::VFS::StreamFactory
       }
 
     if(lastDir) return StreamPtr();
+    if(batch) return batch;
     return stream;
   }
 };
@@ -109,6 +173,19 @@ void UnpackHash::makeIndex(const std::string &arcFile, Hash::DirMap &index,
   unp.failError();
 }
 
+void UnpackHash::finishJob()
+{
+  /* Store the last file and any batched hashes in the blind output,
+     the same way makeIndex() does, instead of leaving it to the
+     writer's destructor.
+   */
+  if(blindWriter)
+    {
+      blindWriter->open("");
+      blindWriter.reset();
+    }
+}
+
 /* This output writer is used for unpacking. It looks up filenames and
    finds their hashes.
  */
@@ -133,12 +210,32 @@ struct UH_ListUser : Mangle::VFS::StreamFactory
   }
 };
 
+UnpackHash::~UnpackHash()
+{
+  if(tmpFile != "")
+    {
+      boost::system::error_code ec;
+      boost::filesystem::remove(tmpFile, ec);
+    }
+}
+
 Job *UnpackHash::createJob()
 {
   // Get the input filename
   assert(inputs.size() == 1);
   std::string file = inputs.begin()->second;
 
+  /* Archives from a compressed cache store are unpacked to a
+     temporary file first, since the unpacker needs random access.
+   */
+  if(Cache::Packed::isPacked(file))
+    {
+      using namespace boost::filesystem;
+      tmpFile = (temp_directory_path() / unique_path("spread-%%%%-%%%%-%%%%")).string();
+      Cache::Packed::unpackTo(file, tmpFile);
+      file = tmpFile;
+    }
+
   desc = "unpacking " + file;
 
   PRINT("UnpackHash::createJob: file=" << file);
@@ -153,10 +250,10 @@ Job *UnpackHash::createJob()
       m->index = blindOut;
       m->where = blindDir;
       m->absPaths = absPaths;
-      Mangle::VFS::StreamFactoryPtr mp(m);
+      blindWriter.reset(m);
 
       PRINT("Returning job");
-      return new UnpackTask(file, mp);
+      return new UnpackTask(file, blindWriter);
     }
 
   // The rest is for non-blind unpacking
@@ -2,6 +2,7 @@
 #define __HASH_UNPACKTASK_HPP_
 
 #include "hashtask.hpp"
+#include <mangle/vfs/stream_factory.hpp>
 #include <set>
 
 /* This class unpacks one archive file, and writes outputs.
@@ -45,6 +46,8 @@ namespace Spread
     UnpackHash(const std::string &dir, Hash::DirMap &output, bool _absPaths=false)
       : blindDir(dir), blindOut(&output), absPaths(_absPaths) {}
 
+    ~UnpackHash();
+
     /* Generate an index from an archive file.
 
        An optional dir 'where' can be used to specify an output
@@ -55,12 +58,17 @@ namespace Spread
 
   private:
     Job *createJob();
+    void finishJob();
     FileList list;
 
     // Only used for blind unpacks
     Hash::DirMap *blindOut;
     bool absPaths;
     std::string blindDir;
+    Mangle::VFS::StreamFactoryPtr blindWriter;
+
+    // Uncompressed copy of a packed input file, if any
+    std::string tmpFile;
   };
 };
 
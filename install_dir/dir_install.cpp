@@ -384,8 +384,10 @@ void DirInstaller::resolveConflicts(HashDir &add, HashDir &del, const DirMap &up
   for(it = del.begin(); it != del.end(); it++)
     lookup[it->second] = Hash();
 
-  // Check all the files in one run
-  index.checkMany(lookup);
+  // Check all the files in one run. This may take a while for
+  // large installs, so let it report progress and check for aborts.
+  index.checkMany(lookup, info);
+  if(checkStatus()) return;
 
   // Go through the list of created elements
   for(it = add.begin(); it != add.end();)
@@ -498,7 +500,11 @@ void DirInstaller::findMoves(HashDir &add, HashDir &del, StrMap &moves)
     }
 }
 
-void DirInstaller::doMovesDeletes(const StrMap &moves, const HashDir &del)
+/* Files listed in 'known' are added to the index along with the
+   moved files, with the given hashes, so they aren't hashed again.
+ */
+void DirInstaller::doMovesDeletes(const StrMap &moves, const HashDir &del,
+                                  const DirMap &known)
 {
   DirMap created;
   StrSet removed;
@@ -513,6 +519,8 @@ void DirInstaller::doMovesDeletes(const StrMap &moves, const HashDir &del)
       ptr->owner->deleteFile(it->second);
       removed.insert(it->second);
     }
+  for(DirMap::const_iterator it = known.begin(); it != known.end(); it++)
+    created[it->first] = it->second;
   index.addMany(created, removed);
 }
 
@@ -580,6 +588,7 @@ void DirInstaller::doJob()
     */
     resolveConflicts(add, del, upgrade, doAsk);
   }
+  if(checkStatus()) return;
 
   /* Optimize add+delte pairs into moves, which are normally much
      faster.
@@ -589,6 +598,7 @@ void DirInstaller::doJob()
 
   /* Perform main file install.
    */
+  DirMap known;
   if(add.size())
     {
       /* Create a new version of our 'add' list, that is identical to
@@ -605,35 +615,60 @@ void DirInstaller::doJob()
          operation, because the system might end up trying to copy
          each file onto the other.
        */
-      HashDir tmpAdd;
+      HashDir tmpAdd, linked;
       for(HashDir::const_iterator it = add.begin(); it != add.end(); it++)
         {
           const std::string &newName = it->second+".___tmp";
-          tmpAdd.insert(HDValue(it->first, newName));
           // Also add an entry to 'moves', so the file is moved into
           // place after a successful fetch
           moves[newName] = it->second;
+
+          /* If the owner can link the file from the cache store,
+             there is nothing to fetch. Linking touches the stored
+             copy as well, so both are indexed again after the move.
+           */
+          std::string src = ptr->owner->linkFile(it->first, newName);
+          if(src != "")
+            {
+              linked.insert(HDValue(it->first, newName));
+              known[it->second] = it->first;
+              known[src] = it->first;
+              continue;
+            }
+
+          tmpAdd.insert(HDValue(it->first, newName));
         }
 
       try
         {
           HashMap tmp;
-          fetchFiles(tmpAdd, tmp);
+          if(tmpAdd.size())
+            fetchFiles(tmpAdd, tmp);
         }
       catch(std::exception &e)
         {
           // Clean up by killing all the files we created
           StrMap tmpMov;
+          tmpAdd.insert(linked.begin(), linked.end());
           doMovesDeletes(tmpMov, tmpAdd);
 
           // Rethrow so our caller gets the error message
           throw std::runtime_error(("Failed installing into " + prefix + ":\n") + e.what());
         }
+
+      // Let the owner keep the new files, so the next install can
+      // link to them
+      for(HashDir::const_iterator it = tmpAdd.begin(); it != tmpAdd.end(); it++)
+        {
+          std::string kept = ptr->owner->keepFile(it->second, it->first);
+          if(kept != "")
+            known[kept] = it->first;
+        }
     }
 
   /* Perform file moves and deletes last.
    */
-  doMovesDeletes(moves, del);
+  doMovesDeletes(moves, del, known);
 
   setDone();
 }
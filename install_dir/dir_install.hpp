@@ -57,7 +57,8 @@ namespace Spread
     void resolveConflicts(HashDir &add, HashDir &del, const Hash::DirMap &upgrade,
                           bool doAsk);
     void findMoves(HashDir &add, HashDir &del, StrMap &moves);
-    void doMovesDeletes(const StrMap &moves, const HashDir &del);
+    void doMovesDeletes(const StrMap &moves, const HashDir &del,
+                        const Hash::DirMap &known = Hash::DirMap());
     int ask(const std::string &question, const std::string &opt0,
             const std::string &opt1 = "", const std::string &opt2 = "",
             const std::string &opt3 = "", const std::string &opt4 = "");
@@ -85,6 +86,22 @@ namespace Spread
        copy+delete.
      */
     virtual void moveFile(const std::string &from, const std::string &to) = 0;
+
+    /* Create 'to' from a stored copy of 'hash' by linking to it
+       instead of copying, if the owner is set up to do so (see
+       JobManager::setLinkMode().) Returns the path of the stored
+       copy, or "" if the file must be fetched the usual way. The
+       default never links.
+     */
+    virtual std::string linkFile(const Hash &hash, const std::string &to)
+    { return ""; }
+
+    /* Offer a newly fetched file to the owner, so it can keep a
+       linked copy for linkFile() to use later. Returns the path of
+       the copy, or "" if none was made.
+     */
+    virtual std::string keepFile(const std::string &file, const Hash &hash)
+    { return ""; }
   };
 }
 #endif
@@ -1,6 +1,10 @@
 #include "dir_install.hpp"
 #include <iostream>
+#include <set>
 #include <boost/thread/recursive_mutex.hpp>
+#ifdef NEED_LOCKGUARD
+#include <boost/thread/lock_guard.hpp>
+#endif
 #include <dir/binary.hpp>
 
 using namespace Spread;
@@ -21,14 +25,14 @@ struct MyCache : Cache::ICacheIndex
     return CI_None;
   }
 
-  void checkMany(Hash::DirMap &dir)
+  void checkMany(Hash::DirMap &dir, JobInfoPtr)
   {
     Hash::DirMap::iterator it;
     for(it = dir.begin(); it != dir.end(); it++)
       it->second = reverse[it->first];
   }
 
-  void addMany(const Hash::DirMap &dir, const Cache::StrSet &rem)
+  void addMany(const Hash::DirMap &dir, const Cache::StrSet &rem, JobInfoPtr)
   {
     cout << "Adding " << dir.size() << " files to cache:\n";
     {
@@ -37,8 +41,13 @@ struct MyCache : Cache::ICacheIndex
         {
           const std::string &file = it->first;
           const Hash &hash = it->second;
-          assert(!hash.isNull());
           assert(file != "");
+          if(hash.isNull())
+            {
+              // Left for the index to hash, like moved files
+              cout << "  (unhashed) " << file << endl;
+              continue;
+            }
           cout << "  " << hash << " " << file << endl;
           files[hash] = file;
           reverse[file] = hash;
@@ -214,6 +223,7 @@ struct MyOwner : DirOwner
   {
     dirs.clear();
     stuff.clear();
+    stored.clear();
   }
 
   std::string getTmpName(const Hash &hash)
@@ -240,10 +250,47 @@ struct MyOwner : DirOwner
 
   bool askWait(AskPtr ask, JobInfoPtr info)
   { if(asker) return asker->askWait(ask); assert(0); }
-  void deleteFile(const std::string &path) { assert(0); }
-  void moveFile(const std::string &from, const std::string &to) { assert(0); }
 
-  MyOwner() : asker(NULL) {}
+  // Only allowed when 'fileOps' is set
+  bool fileOps;
+
+  void deleteFile(const std::string &path)
+  {
+    assert(fileOps);
+    cout << "deleteFile(" << path << ")\n";
+  }
+
+  void moveFile(const std::string &from, const std::string &to)
+  {
+    assert(fileOps);
+    cout << "moveFile(" << from << " => " << to << ")\n";
+  }
+
+  /* Fake cache store for linkFile() and keepFile(). Hashes in
+     'stored' can be linked, and new files are kept if 'keep' is set.
+   */
+  std::set<Hash> stored;
+  bool keep;
+
+  std::string storeName(const Hash &hash)
+  { return "store/" + hash.toString().substr(0,6); }
+
+  std::string linkFile(const Hash &hash, const std::string &to)
+  {
+    if(stored.find(hash) == stored.end()) return "";
+    cout << "linkFile(" << hash << " => " << to << ")\n";
+    return storeName(hash);
+  }
+
+  std::string keepFile(const std::string &file, const Hash &hash)
+  {
+    if(!keep) return "";
+    cout << "keepFile(" << file << ")\n";
+    stored.insert(hash);
+    return storeName(hash);
+  }
+
+  MyOwner() : asker(NULL), fileOps(false), keep(false) {}
 };
 
 template <class T>
@@ -0,0 +1,54 @@
+#include "common.cpp"
+
+Hash ha("FILEX"), hb("FILEY"), hc("FILEZ");
+
+// Run a full install of 'files' into 'prefix'
+void install(const std::string &what, const std::string &prefix,
+             const Hash::DirMap &files)
+{
+  cout << "\n*** " << what << " ***\n";
+  DirInstaller inst(own, rules, cache, prefix, false);
+  for(Hash::DirMap::const_iterator it = files.begin(); it != files.end(); it++)
+    inst.addFile(it->first, it->second);
+  JobInfoPtr info = inst.run();
+  if(info->isSuccess()) cout << "RESULT: success\n";
+  else cout << "RESULT: " << info->getMessage() << endl;
+}
+
+int main()
+{
+  own.fileOps = true;
+  rules.addURL(ha, "http://a");
+  rules.addURL(hb, "http://b");
+
+  Hash::DirMap files;
+  files["a"] = ha;
+  files["b"] = hb;
+
+  /* 'a' is linked from the store, and only 'b' is fetched. Then 'b'
+     is kept. The store files and the linked file are indexed with
+     their known hashes.
+   */
+  own.stored.insert(ha);
+  own.keep = true;
+  install("Linked and fetched", "inst1", files);
+
+  // Both are in the store now, so nothing is fetched
+  install("All linked", "inst2", files);
+
+  // An owner that doesn't link falls back to fetching everything
+  resetAll();
+  own.keep = false;
+  install("Nothing linked", "inst3", files);
+
+  /* When a fetch fails, the linked files are removed along with the
+     fetched ones.
+   */
+  resetAll();
+  own.stored.insert(ha);
+  files.erase("b");
+  files["c"] = hc;
+  install("Fetch failure", "inst4", files);
+
+  return 0;
+}
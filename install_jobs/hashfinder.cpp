@@ -40,6 +40,44 @@ bool HashFinder::findHash(const Hash &hash, HashSource &out, const std::string &
     }
 
   // File does not exist in the file system. Check the rules.
+  return findRule(hash, out);
+}
+
+void HashFinder::findMany(const HashTargets &list, std::vector<HashSource> &out)
+{
+  Cache::CIResolveList res(list.size());
+  HashTargets::const_iterator it;
+  int i = 0;
+  for(it = list.begin(); it != list.end(); it++, i++)
+    {
+      res[i].hash = it->first;
+      res[i].target = it->second;
+    }
+
+  cache.resolveMany(res);
+
+  out.clear();
+  out.resize(list.size());
+  for(i=0; i<res.size(); i++)
+    {
+      const Cache::CIResolve &r = res[i];
+      HashSource &src = out[i];
+      src.hash = r.hash;
+      src.type = TST_None;
+
+      if(r.source != "")
+        {
+          src.type = (r.target != "" && r.source == r.target) ?
+            TST_InPlace : TST_File;
+          src.value = r.source;
+        }
+      else findRule(r.hash, src);
+    }
+}
+
+// Fill in 'out' from the rule set. Returns false if there is no rule.
+bool HashFinder::findRule(const Hash &hash, HashSource &out)
+{
   const Rule *r = rules->findRule(hash);
   if(!r) return false;
 
@@ -19,11 +19,17 @@ namespace Spread
 
     bool findHash(const Hash &hash, HashSource &out, const std::string &target="");
 
+    // Resolves all the files through ICacheIndex::resolveMany()
+    void findMany(const HashTargets &list, std::vector<HashSource> &out);
+
     void brokenURL(const Hash &hash, const std::string &url)
     { rules->reportBrokenURL(hash, url); }
 
     void addToCache(const Hash::DirMap &files)
     { cache.addMany(files); }
+
+  private:
+    bool findRule(const Hash &hash, HashSource &out);
   };
 }
 
@@ -4,6 +4,7 @@
 #include <hash/hash.hpp>
 #include <boost/shared_ptr.hpp>
 #include <vector>
+#include <map>
 
 namespace Spread
 {
@@ -36,6 +37,24 @@ namespace Spread
     virtual bool findHash(const Hash &hash, HashSource &out,
                           const std::string &target="") = 0;
 
+    /* Look up a list of hashes with optional targets in one go. The
+       results are stored in 'out' in the same order as 'list', and
+       are the same as calling findHash() on each element. Hashes
+       that weren't found get type TST_None.
+
+       The default calls findHash() on each element in turn.
+     */
+    typedef std::multimap<Hash, std::string> HashTargets;
+    virtual void findMany(const HashTargets &list, std::vector<HashSource> &out)
+    {
+      out.clear();
+      out.resize(list.size());
+      HashTargets::const_iterator it;
+      int i = 0;
+      for(it = list.begin(); it != list.end(); it++, i++)
+        findHash(it->first, out[i], it->second);
+    }
+
     /* Report a broken URL for a given hash. The URL will no longer be
        suggested by findHash(). You may try calling findHash() again
        to obtain a replacement URL.
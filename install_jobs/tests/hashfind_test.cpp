@@ -32,8 +32,8 @@ struct DummyCache : Cache::ICacheIndex
   string findHash(const Hash &hash) { return files[hash]; }
 
   Hash addFile(string,const Hash&,bool) { assert(0); }
-  void addMany(const Hash::DirMap&, const Cache::StrSet&) { assert(0); }
-  void checkMany(Hash::DirMap&) { assert(0); }
+  void addMany(const Hash::DirMap&, const Cache::StrSet&, JobInfoPtr) { assert(0); }
+  void checkMany(Hash::DirMap&, JobInfoPtr) { assert(0); }
   void removeFile(const string&) { assert(0); }
   void getEntries(Cache::CIVector&) const { assert(0); }
 };
@@ -70,12 +70,8 @@ DummyCache cache;
 HashFinder fnd(RuleFinderPtr(new DummyRules), cache);
 IHashFinder &ifn = fnd;
 
-void test(const Hash &hash, const string &where="")
+void print(const HashSource &out)
 {
-  cout << "\nSearching for HASH=" << hash << " FILE=" << where << endl;
-  HashSource out;
-  ifn.findHash(hash, out, where);
-
   cout << "  ";
   if(out.type == TST_None)
     cout << "Not found";
@@ -91,6 +87,34 @@ void test(const Hash &hash, const string &where="")
   cout << endl;
 }
 
+IHashFinder::HashTargets all;
+
+void test(const Hash &hash, const string &where="")
+{
+  cout << "\nSearching for HASH=" << hash << " FILE=" << where << endl;
+  HashSource out;
+  ifn.findHash(hash, out, where);
+  print(out);
+
+  all.insert(std::make_pair(hash, where));
+}
+
+// Look up everything from test() again, in one go
+void testMany()
+{
+  cout << "\nSearching for everything at once:\n";
+  vector<HashSource> out;
+  ifn.findMany(all, out);
+
+  IHashFinder::HashTargets::const_iterator it;
+  int i = 0;
+  for(it = all.begin(); it != all.end(); it++, i++)
+    {
+      cout << "HASH=" << it->first << " FILE=" << it->second << endl;
+      print(out[i]);
+    }
+}
+
 int main()
 {
   test(file1);
@@ -103,5 +127,6 @@ int main()
   test(file3);
   test(file4);
   test(file5);
+  testMany();
   return 0;
 }
@@ -48,28 +48,48 @@ void TreeBase::fetchFiles(const HashDir &outputs, HashMap &results)
     HashDir::const_iterator it;
 
     TreeOwner::Lock lock = owner.lock();
+
+    /* Wait for targets that already have a system-wide job running,
+       and look up all the rest in one go.
+     */
+    HashDir rest;
     for(it = outputs.begin(); it != outputs.end(); it++)
       {
         const Hash &hash = it->first;
-        const std::string &outfile = it->second;
 
-        // Abort if we have already looked up this hash
+        // Skip hashes we are already waiting for
         if(waitList.find(hash) != waitList.end())
           continue;
 
-        // Check if there is a system-wide job already running for
-        // this target.
-        {
-          JobInfoPtr inf = owner.getRunningTarget(hash);
-          if(inf)
-            {
-              waitList[hash] = inf;
-              continue;
-            }
-        }
+        JobInfoPtr inf = owner.getRunningTarget(hash);
+        if(inf)
+          waitList[hash] = inf;
+        else
+          rest.insert(*it);
+      }
+
+    std::vector<HashSource> srcs;
+    finder->findMany(rest, srcs);
+    assert(srcs.size() == rest.size());
+
+    // Targets we start below, by hash
+    std::map<Hash,JobInfoPtr> started;
+
+    int i = 0;
+    for(it = rest.begin(); it != rest.end(); it++, i++)
+      {
+        const Hash &hash = it->first;
+        const std::string &outfile = it->second;
+
+        // Another output with the same hash already started a job
+        if(started.find(hash) != started.end())
+          {
+            waitList[hash] = started[hash];
+            continue;
+          }
 
-        HashSource src;
-        if(!finder->findHash(hash, src, outfile))
+        const HashSource &src = srcs[i];
+        if(src.type == TST_None)
           fail("No source for target " + hash.toString() + " " + outfile);
         assert(src.hash == hash);
 
@@ -114,6 +134,9 @@ void TreeBase::fetchFiles(const HashDir &outputs, HashMap &results)
 
         // Let the outside world know about our target
         owner.setRunningTarget(hash, job->getInfo());
+        started[hash] = job->getInfo();
+        if(src.deps.size())
+          owner.setRunningInputs(job->getInfo(), src.deps);
 
         // And add the job to our local execution list
         if(!aj) aj = new AndJob;
@@ -143,8 +166,10 @@ void TreeBase::fetchFiles(const HashDir &outputs, HashMap &results)
       const Hash &hash = it->first;
       const std::string &outfile = it->second;
 
-      // Look up and check if the requested file has been created
-      // somewhere.
+      /* Look up and check if the requested file has been created
+         somewhere. This is done one file at a time, since each copy
+         below may give the next lookup a better source.
+       */
       HashSource src;
       if(!finder->findHash(hash, src, outfile) ||
          (src.type != TST_File && src.type != TST_InPlace))
@@ -89,6 +89,11 @@ namespace Spread
      */
     virtual void setRunningTarget(const Hash &hash, JobInfoPtr ptr) = 0;
 
+    /* List the inputs read by a job given to setRunningTarget(), so
+       the owner can keep them around while the job runs.
+     */
+    virtual void setRunningInputs(JobInfoPtr ptr, const std::vector<Hash> &inputs) {}
+
     /* Create a lock pointer. This guarantees that no targets are
        added or removed from the target list while the lock is in
        effect.
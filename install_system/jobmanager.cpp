@@ -6,6 +6,8 @@
 #include <install_dir/dir_install.hpp>
 #include <parent_job/askqueue.hpp>
 #include <boost/filesystem.hpp>
+#include <hash/hash_map.hpp>
+#include <cache/packed.hpp>
 #include <dir/binary.hpp>
 #include <job/thread.hpp>
 #include <stdexcept>
@@ -24,7 +26,10 @@ struct JobManager::_Internal : DirOwner
   Misc::LogPtr logPtr;
   bool logTrd;
 
-  _Internal(Cache::Cache &c) : cache(c), logTrd(true) {}
+  // See setLinkMode()
+  int linkMode;
+
+  _Internal(Cache::Cache &c) : cache(c), logTrd(true), linkMode(Cache::LM_Copy) {}
 
   bool askWait(AskPtr ask, JobInfoPtr info) { return askQueue.pushWait(ask, info); }
   std::string getTmpName(const Hash &hash) { return cache.createTmpFilename(hash); }
@@ -32,7 +37,7 @@ struct JobManager::_Internal : DirOwner
   void loadDir(const std::string &file, Hash::DirMap &output,
                const Hash &check = Hash())
   {
-    Dir::read(output, file);
+    Dir::read(output, Cache::Packed::open(file));
     storeDir(output, check);
   }
 
@@ -48,7 +53,7 @@ struct JobManager::_Internal : DirOwner
     if(file != "")
       {
         Dir::write(dir, file);
-        cache.index.addFile(file, hash);
+        cache.files.addStored(file, hash);
       }
   }
 
@@ -75,6 +80,20 @@ struct JobManager::_Internal : DirOwner
       }
   }
 
+  std::string linkFile(const Hash &hash, const std::string &to)
+  {
+    std::string src = cache.files.linkStored(hash, to, linkMode);
+    if(src != "") log("linkFile(" + src + " => " + to + ")");
+    return src;
+  }
+
+  std::string keepFile(const std::string &file, const Hash &hash)
+  {
+    std::string dest = cache.files.adoptFile(file, hash, linkMode);
+    if(dest != "") log("keepFile(" + file + " => " + dest + ")");
+    return dest;
+  }
+
   TreePtr copyTarget(const std::string &from)
   { return fact.copyTarget(*this, from); }
   TreePtr downloadTarget(const std::string &url)
@@ -99,7 +118,11 @@ struct JobManager::_Internal : DirOwner
   typedef boost::lock_guard<Mutex> LockGuard;
 
   Mutex mutex;
-  std::map<Hash, JobInfoPtr> running;
+  HashMap<JobInfoPtr> running;
+
+  // Inputs of the jobs in 'running', see setRunningInputs()
+  typedef std::map<JobInfoPtr, std::vector<Hash> > InputMap;
+  InputMap inputs;
 
   Lock lock() { return Lock(new LockGuard(mutex)); }
   void notifyFiles(const Hash::DirMap &files)
@@ -125,6 +148,44 @@ struct JobManager::_Internal : DirOwner
     assert(ptr);
     running[hash] = ptr;
   }
+
+  void setRunningInputs(JobInfoPtr ptr, const std::vector<Hash> &inp)
+  {
+    LockGuard l(mutex);
+    std::vector<Hash> &list = inputs[ptr];
+    list.insert(list.end(), inp.begin(), inp.end());
+  }
+
+  // Collects the targets of unfinished jobs
+  struct AddRunning
+  {
+    std::set<Hash> &out;
+    AddRunning(std::set<Hash> &o) : out(o) {}
+
+    void operator()(const Hash &hash, const JobInfoPtr &inf)
+    { if(inf && !inf->isFinished()) out.insert(hash); }
+  };
+
+  void getRunning(std::set<Hash> &out)
+  {
+    LockGuard l(mutex);
+
+    AddRunning add(out);
+    running.forEach(add);
+
+    InputMap::iterator it = inputs.begin();
+    while(it != inputs.end())
+      {
+        // Forget the inputs of finished jobs as we go
+        if(it->first->isFinished())
+          inputs.erase(it++);
+        else
+          {
+            out.insert(it->second.begin(), it->second.end());
+            it++;
+          }
+      }
+  }
 };
 
 JobManager::JobManager(Cache::Cache &_cache)
@@ -148,6 +209,16 @@ InstallerPtr JobManager::createInstaller(const std::string &destDir, RuleSet &ru
   return InstallerPtr(new DirInstaller(*ptr, rules, cache.index, destDir, doAsk));
 }
 
+void JobManager::getRunning(std::set<Hash> &hashes)
+{
+  ptr->getRunning(hashes);
+}
+
+void JobManager::setLinkMode(int mode)
+{
+  ptr->linkMode = mode;
+}
+
 JobInfoPtr JobManager::addInst(InstallerPtr p)
 {
   JobPtr job = boost::dynamic_pointer_cast<DirInstaller>(p);
@@ -7,6 +7,7 @@
 #include <rules/ruleset.hpp>
 #include <cache/cache.hpp>
 #include <misc/logger.hpp>
+#include <set>
 
 namespace Spread
 {
@@ -38,6 +39,28 @@ namespace Spread
                                  bool doAsk = false);
     JobInfoPtr addInst(InstallerPtr);
 
+    /* Make installers clone files from the cache store instead of
+       copying them, using one of the Cache::LinkMode values. Files
+       that are in the store are cloned straight from it, and new
+       files are cloned into the store as they are installed, so that
+       installing the same files elsewhere costs little extra disk
+       space. Every install still gets its own files, which are safe
+       to write to.
+
+       Files that can't be cloned (because the file system doesn't
+       support it, or the stored object is compressed) are copied as
+       usual. Changes to installed files are detected the same way in
+       any mode. The default is Cache::LM_Copy. Set this before
+       starting any installs.
+     */
+    void setLinkMode(int mode);
+
+    /* Add the hashes of all objects that running jobs are reading or
+       creating to 'hashes'. These must be kept in the cache until the
+       jobs are done.
+     */
+    void getRunning(std::set<Hash> &hashes);
+
     /* Set log output.
      */
     void setLogger(const std::string &filename);
@@ -99,7 +99,7 @@ struct Setup : Installer
   {
     assert(base != "");
     cache.tmpDir = base + "/tmp";
-    cache.files.basedir = base + "/cache";
+    cache.files.setBaseDir(base + "/cache");
     m.setLogger(Misc::LogPtr(new Misc::Logger()), false);
     m.finish();
     inst = m.createInstaller(base,rules);
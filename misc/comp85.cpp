@@ -21,24 +21,39 @@ static void fail85(const std::string &msg)
   throw std::runtime_error("Comp85 decode error: " + msg);
 }
 
+/* Reverse lookup table for comp85[], with XX (0xff) for invalid
+   characters. It's constant, so threads can decode at the same time.
+ */
+#define XX 0xff
+static const uint8_t dec85[256] =
+{
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX,  0, XX, XX, XX, XX, XX, XX,  1,  2,  3,  4,  5,  6,  7,  8,
+   9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19, 20, 21, 22, 23, XX,
+  24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39,
+  40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, XX, 52, 53, 54,
+  XX, 55, 56, 57, 58, 59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69,
+  70, 71, 72, 73, 74, 75, 76, 77, 78, 79, 80, 81, 82, 83, 84, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX,
+  XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX, XX
+};
+#undef XX
+
 static uint8_t decode85_char(char ch)
 {
-  if(ch < '!' || ch > '~' ||
-     (ch > '!' && ch < '(') ||
-     ch == '?' || ch == '\\' ||
-     ch == '`')
+  uint8_t v = dec85[(uint8_t)ch];
+  if(v == 0xff)
     fail85(std::string("Invalid character ") + ch);
 
-  // Subtract away missing ascii values
-  if(ch > '`') ch -= '!' + 9;
-  else if(ch > '\\') ch -= '!' + 8;
-  else if(ch > '?') ch -= '!' + 7;
-  else if(ch > '\'') ch -= '!' + 6;
-  else ch -= '!';
-
-  assert(ch >= 0 && ch < 85);
-
-  return ch;
+  assert(v < 85);
+  return v;
 }
 
 static uint32_t decode_value(const char *in)
@@ -0,0 +1,153 @@
+#ifndef __MISC_MAPPED_STREAM_HPP_
+#define __MISC_MAPPED_STREAM_HPP_
+
+#include <mangle/stream/stream.hpp>
+#include <stdexcept>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* Fast read-only file stream for hashing and copying large files.
+
+   If 'allowMap' is set, files of MIN_MAP bytes or more are memory
+   mapped, and the stream is then a pointer stream (hasPtr is set), so
+   users like HashStream::sum() can process the data in place without
+   any copying. The kernel is told we read sequentially, so it can
+   read ahead aggressively.
+
+   Otherwise (or if mmap() fails) the stream uses plain read() calls on
+   the file descriptor. read() always fills the caller's buffer
+   completely unless the end of the file is reached, so callers should
+   pass in large buffers (a Mb or so) to keep the number of system
+   calls down.
+
+   A mapped file that is truncated by someone else while we read it
+   crashes the process with SIGBUS. Mapping is therefore off by
+   default, and should only be turned on for files that nobody else
+   writes to, like the objects in a cache store.
+
+   Failing system calls throw a FileError, which carries the errno
+   value so callers can tell I/O errors from other failures.
+ */
+namespace Misc
+{
+  struct FileError : std::runtime_error
+  {
+    int err;
+
+    FileError(const std::string &msg, int _err)
+      : std::runtime_error(msg), err(_err) {}
+  };
+
+  class MappedFileStream : public Mangle::Stream::Stream
+  {
+    int fd;
+    const char *map;
+    size_t len, pos;
+    std::string name;
+
+  public:
+    // Smaller files are read normally, mapping them costs more than
+    // it saves.
+    static const size_t MIN_MAP = 256*1024;
+
+    MappedFileStream(const std::string &file, bool allowMap = false)
+      : map(NULL), len(0), pos(0), name(file)
+    {
+      fd = ::open(file.c_str(), O_RDONLY);
+      if(fd < 0)
+        throw FileError("Failed to open file " + file, errno);
+
+      struct stat st;
+      if(fstat(fd, &st) != 0)
+        {
+          int err = errno;
+          ::close(fd);
+          throw FileError("Failed to stat file " + file, err);
+        }
+      len = st.st_size;
+
+      // Skip mapping if the size doesn't fit in our address space
+      if(allowMap && len >= MIN_MAP && (off_t)len == st.st_size)
+        {
+          void *p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+          if(p != MAP_FAILED)
+            {
+              map = (const char*)p;
+              madvise(p, len, MADV_SEQUENTIAL);
+            }
+        }
+      if(!map)
+        posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+      isSeekable = true;
+      hasPosition = true;
+      hasSize = true;
+      hasPtr = (map != NULL);
+      isReadable = true;
+      isWritable = false;
+    }
+
+    ~MappedFileStream()
+    {
+      if(map) munmap((void*)map, len);
+      ::close(fd);
+    }
+
+    // True if the file was memory mapped
+    bool isMapped() const { return map != NULL; }
+
+    size_t read(void *buf, size_t count)
+    {
+      if(count > len-pos) count = len-pos;
+
+      if(map)
+        {
+          memcpy(buf, map+pos, count);
+          pos += count;
+          return count;
+        }
+
+      char *p = (char*)buf;
+      size_t done = 0;
+      while(done < count)
+        {
+          ssize_t res = ::read(fd, p+done, count-done);
+          if(res < 0 && errno == EINTR) continue;
+          if(res < 0)
+            throw FileError("Failed to read file " + name, errno);
+          if(res == 0) break;
+          done += res;
+        }
+      pos += done;
+      return done;
+    }
+
+    void seek(size_t p)
+    {
+      pos = p < len ? p : len;
+      if(!map) lseek(fd, pos, SEEK_SET);
+    }
+
+    size_t tell() const { return pos; }
+    size_t size() const { return len; }
+    bool eof() const { return pos >= len; }
+
+    const void *getPtr() { return map; }
+    const void *getPtr(size_t pos, size_t size) { return map+pos; }
+    const void *getPtr(size_t size)
+    {
+      const void *p = map+pos;
+      seek(pos+size);
+      return p;
+    }
+
+    static Mangle::Stream::StreamPtr Open(const std::string &file,
+                                          bool allowMap = false)
+    { return Mangle::Stream::StreamPtr(new MappedFileStream(file, allowMap)); }
+  };
+}
+#endif
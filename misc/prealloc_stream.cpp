@@ -0,0 +1,217 @@
+#include "prealloc_stream.hpp"
+
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <stdexcept>
+#include <vector>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#ifdef NEED_LOCKGUARD
+#include <boost/thread/lock_guard.hpp>
+#endif
+
+using namespace Misc;
+
+struct PreallocOutStream::_Internal
+{
+  int fd;
+  std::string file;
+
+  // Bytes accepted by write() so far
+  uint64_t total;
+
+  // The buffer currently being filled
+  std::vector<char> buf;
+  size_t used;
+
+  /* Async mode. 'pending' holds a full buffer for the writer thread,
+     which clears 'hasPending' when it's done. Errors are stored in
+     'error' and thrown in the main thread.
+   */
+  bool async;
+  boost::thread thread;
+  boost::mutex mutex;
+  boost::condition_variable cond;
+  std::vector<char> pending;
+  size_t pendingSize;
+  bool hasPending, quit;
+  std::string error;
+
+  _Internal() : fd(-1), total(0), used(0), async(false),
+                pendingSize(0), hasPending(false), quit(false) {}
+
+  ~_Internal()
+  {
+    if(async)
+      {
+        {
+          boost::lock_guard<boost::mutex> lock(mutex);
+          quit = true;
+        }
+        cond.notify_all();
+        thread.join();
+      }
+    if(fd >= 0) ::close(fd);
+  }
+
+  void fail(const std::string &msg)
+  {
+    throw std::runtime_error(msg + " " + file + ": " + strerror(errno));
+  }
+
+  void writeAll(const char *p, size_t count)
+  {
+    while(count)
+      {
+        ssize_t res = ::write(fd, p, count);
+        if(res < 0 && errno == EINTR) continue;
+        if(res <= 0) fail("Error writing");
+        p += res;
+        count -= res;
+      }
+  }
+
+  void writer()
+  {
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while(true)
+      {
+        while(!hasPending && !quit)
+          cond.wait(lock);
+        if(!hasPending) return;
+
+        // Do the actual writing without holding the lock
+        lock.unlock();
+        std::string err;
+        try { writeAll(&pending[0], pendingSize); }
+        catch(std::exception &e) { err = e.what(); }
+        lock.lock();
+
+        if(err != "" && error == "") error = err;
+        hasPending = false;
+        cond.notify_all();
+      }
+  }
+
+  // Wait for the writer thread to finish the pending buffer
+  void wait()
+  {
+    if(!async) return;
+    boost::unique_lock<boost::mutex> lock(mutex);
+    while(hasPending)
+      cond.wait(lock);
+    if(error != "")
+      throw std::runtime_error(error);
+  }
+
+  // Write out (or hand over) the current buffer
+  void submit()
+  {
+    if(!used) return;
+
+    if(!async)
+      writeAll(&buf[0], used);
+    else
+      {
+        wait();
+        {
+          boost::lock_guard<boost::mutex> lock(mutex);
+          pending.swap(buf);
+          pendingSize = used;
+          hasPending = true;
+        }
+        cond.notify_all();
+        if(buf.size() < pending.size())
+          buf.resize(pending.size());
+      }
+    used = 0;
+  }
+};
+
+PreallocOutStream::PreallocOutStream(const std::string &file, uint64_t size,
+                                     bool async)
+  : ptr(new _Internal)
+{
+  ptr->file = file;
+  ptr->fd = ::open(file.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+  if(ptr->fd < 0)
+    ptr->fail("Failed to open output file");
+
+  // Small files fit in one write anyway, so save the system calls
+  if(size >= PREALLOC_MIN && size != UNKNOWN)
+    {
+      // Not all file systems support this, so ignore any errors
+      fallocate(ptr->fd, FALLOC_FL_KEEP_SIZE, 0, size);
+      posix_fadvise(ptr->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+  // Don't allocate a big buffer for small files
+  uint64_t bufSize = BUFSIZE;
+  if(size < bufSize) bufSize = size;
+  ptr->buf.resize(bufSize);
+
+  /* Async write-back only pays off when there is more than one buffer
+     to write.
+   */
+  if(async && size > bufSize && size != UNKNOWN)
+    {
+      ptr->async = true;
+      ptr->thread = boost::thread(&_Internal::writer, ptr.get());
+    }
+
+  isSeekable = false;
+  hasPosition = true;
+  hasSize = false;
+  hasPtr = false;
+  isReadable = false;
+  isWritable = true;
+}
+
+PreallocOutStream::~PreallocOutStream()
+{
+  try { flush(); }
+  catch(...) {}
+}
+
+size_t PreallocOutStream::write(const void *buf, size_t count)
+{
+  _Internal &in = *ptr;
+  const char *p = (const char*)buf;
+  size_t left = count;
+
+  while(left)
+    {
+      // Large writes skip the buffer entirely
+      if(in.used == 0 && left >= in.buf.size())
+        {
+          in.wait();
+          in.writeAll(p, left);
+          break;
+        }
+
+      size_t num = in.buf.size() - in.used;
+      if(num > left) num = left;
+      memcpy(&in.buf[in.used], p, num);
+      in.used += num;
+      p += num;
+      left -= num;
+
+      if(in.used == in.buf.size())
+        in.submit();
+    }
+
+  in.total += count;
+  return count;
+}
+
+void PreallocOutStream::flush()
+{
+  ptr->submit();
+  ptr->wait();
+}
+
+size_t PreallocOutStream::tell() const { return ptr->total; }
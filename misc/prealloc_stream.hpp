@@ -0,0 +1,61 @@
+#ifndef __MISC_PREALLOC_STREAM_HPP_
+#define __MISC_PREALLOC_STREAM_HPP_
+
+#include <mangle/stream/stream.hpp>
+#include <boost/shared_ptr.hpp>
+#include <stdint.h>
+
+/* Output file stream for files of a known final size.
+
+   - the file is preallocated up front with fallocate(), so the file
+     system can lay it out in one piece. The visible file size is not
+     changed, so a partially written file still looks partial.
+   - small writes are collected in a buffer and written in large
+     blocks, so an unpacker handing us 4 Kb at a time doesn't cost one
+     system call per block.
+   - with 'async' set, full buffers are written by a background thread
+     while the caller fills the next one.
+
+   Write errors throw, either directly from write() or (in async mode)
+   from a later write() or flush(). flush() writes out everything
+   buffered so far, so the file can be copied or reopened right
+   after. The destructor also flushes, but ignores errors.
+
+   Pass UNKNOWN as the size if it isn't known. The file is then not
+   preallocated, but writes are still buffered. A size of zero gets
+   no buffer at all. Async mode is only used for files larger than
+   one buffer.
+ */
+namespace Misc
+{
+  class PreallocOutStream : public Mangle::Stream::Stream
+  {
+    struct _Internal;
+    boost::shared_ptr<_Internal> ptr;
+
+  public:
+    // Largest write buffer used
+    static const uint32_t BUFSIZE = 1024*1024;
+
+    // Smaller files are not preallocated
+    static const uint32_t PREALLOC_MIN = 64*1024;
+
+    // Size to use when the final size is not known
+    static const uint64_t UNKNOWN = ~(uint64_t)0;
+
+    PreallocOutStream(const std::string &file, uint64_t size = UNKNOWN,
+                      bool async = false);
+    ~PreallocOutStream();
+
+    size_t write(const void *buf, size_t count);
+    void flush();
+    size_t tell() const;
+    bool eof() const { return false; }
+
+    static Mangle::Stream::StreamPtr Open(const std::string &file,
+                                          uint64_t size = UNKNOWN,
+                                          bool async = false)
+    { return Mangle::Stream::StreamPtr(new PreallocOutStream(file, size, async)); }
+  };
+}
+#endif
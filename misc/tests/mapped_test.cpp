@@ -0,0 +1,65 @@
+#include <iostream>
+#include "mapped_stream.hpp"
+
+#include <fstream>
+#include <vector>
+
+using namespace std;
+using namespace Misc;
+
+vector<char> buf;
+
+void test(const string &file, size_t size, bool allowMap)
+{
+  {
+    ofstream out(file.c_str(), ios::binary);
+    out.write(&buf[0], size);
+  }
+
+  MappedFileStream str(file, allowMap);
+  cout << "\n" << size << " bytes, mapped=" << str.isMapped()
+       << " hasPtr=" << str.hasPtr << " size=" << str.size() << endl;
+
+  // Read in odd sized pieces and compare
+  vector<char> tmp(70000);
+  size_t total = 0;
+  bool same = true;
+  while(!str.eof())
+    {
+      size_t num = str.read(&tmp[0], tmp.size());
+      if(num != tmp.size() && !str.eof()) cout << "Short read!\n";
+      same = same && memcmp(&tmp[0], &buf[total], num) == 0;
+      total += num;
+    }
+  cout << "Read " << total << " bytes, same=" << same << endl;
+
+  str.seek(size/2);
+  cout << "After seek: tell=" << str.tell() << " eof=" << str.eof();
+  size_t num = str.read(&tmp[0], 10);
+  cout << " read=" << num
+       << " same=" << (memcmp(&tmp[0], &buf[size/2], num) == 0) << endl;
+
+  if(str.hasPtr)
+    cout << "Pointer same: "
+         << (memcmp(str.getPtr(), &buf[0], size) == 0) << endl;
+}
+
+int main()
+{
+  buf.resize(1000000);
+  for(size_t i=0; i<buf.size(); i++)
+    buf[i] = i*13 + (i>>10);
+
+  test("_mapped.bin", 1000, true);
+  test("_mapped.bin", 1000000, true);
+  test("_mapped.bin", 1000000, false);
+
+  try { MappedFileStream str("_does_not_exist"); }
+  catch(FileError &e)
+    {
+      cout << "\nERROR: " << e.what() << endl;
+      cout << "ENOENT: " << (e.err == ENOENT) << endl;
+    }
+
+  return 0;
+}
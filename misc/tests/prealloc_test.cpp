@@ -0,0 +1,61 @@
+#include <iostream>
+#include "prealloc_stream.hpp"
+
+#include <fstream>
+#include <iterator>
+#include <vector>
+#include <string.h>
+
+using namespace std;
+using namespace Misc;
+
+vector<char> buf;
+
+// Write 'size' bytes in pieces of 'step', then check the file
+void test(size_t size, size_t step, uint64_t hint, bool async)
+{
+  string file = "_prealloc.bin";
+  {
+    PreallocOutStream out(file, hint, async);
+    for(size_t i=0; i<size; i+=step)
+      out.write(&buf[i], min(step, size-i));
+    out.flush();
+    cout << size << " bytes in steps of " << step << ", hint=";
+    if(hint == PreallocOutStream::UNKNOWN) cout << "none";
+    else cout << hint;
+    cout << " async=" << async << ": tell=" << out.tell();
+
+    // Everything must be on disk after flush(), before closing
+    ifstream inf(file.c_str(), ios::binary);
+    vector<char> res((istreambuf_iterator<char>(inf)),
+                     istreambuf_iterator<char>());
+    cout << " size=" << res.size()
+         << " same=" << (res.size() == size &&
+                         (size == 0 || memcmp(&res[0], &buf[0], size) == 0))
+         << endl;
+  }
+}
+
+int main()
+{
+  buf.resize(5000000);
+  for(size_t i=0; i<buf.size(); i++)
+    buf[i] = i*11 + (i>>12);
+
+  test(0, 1, 0, false);
+  test(1000, 7, 1000, false);
+  test(1000, 7, PreallocOutStream::UNKNOWN, true);
+  test(0, 1, PreallocOutStream::UNKNOWN, false);
+  test(5000000, 4096, 5000000, false);
+  test(5000000, 4096, 5000000, true);
+  test(5000000, 3000000, 5000000, true);
+  test(5000000, 777777, 5000000, true);
+
+  // Short file, the hint should not show in the file size
+  test(1000, 100, 5000000, true);
+
+  try { PreallocOutStream out("_no_such_dir/file"); }
+  catch(exception &e) { cout << "ERROR: " << e.what() << endl; }
+
+  return 0;
+}
@@ -1,11 +1,12 @@
 #include "arcruleset.hpp"
 #include "arcrule.hpp"
+#include "hash/hash_map.hpp"
 #include <assert.h>
 
 using namespace Spread;
 
 typedef boost::shared_ptr<ArcRule> ArcPtr;
-typedef std::map<Hash, ArcPtr> AMap;
+typedef HashMap<ArcPtr> AMap;
 
 struct ArcRuleSet::_Internal
 {
@@ -13,11 +14,11 @@ struct ArcRuleSet::_Internal
 
   const ArcRule* findFile(const Hash &hash)
   {
-    AMap::iterator it = files.find(hash);
-    if(it == files.end())
+    ArcPtr *arc = files.find(hash);
+    if(!arc)
       return NULL;
 
-    return it->second.get();
+    return arc->get();
   }
 };
 
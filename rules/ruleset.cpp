@@ -3,6 +3,7 @@
 #include <vector>
 #include <map>
 #include "misc/random.hpp"
+#include "hash/hash_map.hpp"
 #include <boost/thread/recursive_mutex.hpp>
 #include <cstdio>
 
@@ -15,8 +16,8 @@ using namespace Spread;
 typedef boost::shared_ptr<URLRule> URLPtr;
 typedef boost::shared_ptr<ArcRuleData> ArcPtr;
 typedef std::vector<URLPtr> UVec;
-typedef std::map<Hash, UVec> UMap;
-typedef std::map<Hash, ArcPtr> AMap;
+typedef HashMap<UVec> UMap;
+typedef HashMap<ArcPtr> AMap;
 
 #define LOCK boost::lock_guard<boost::recursive_mutex> lock(ptr->mutex)
 
@@ -30,20 +31,20 @@ struct RuleSet::_RuleSetInternal
 
   const ArcRuleData* findArc(const Hash &hash) const
   {
-    AMap::const_iterator it = arcs.find(hash);
-    if(it == arcs.end())
+    const ArcPtr *arc = arcs.find(hash);
+    if(!arc)
       return NULL;
 
-    return it->second.get();
+    return arc->get();
   }
 
   // Adds all URL rules for 'hash' to the given vector
   void addURLs(const Hash &hash, RuleList &output) const
   {
-    UMap::const_iterator it = urls.find(hash);
-    if(it == urls.end()) return;
+    const UVec *found = urls.find(hash);
+    if(!found) return;
 
-    const UVec &vec = it->second;
+    const UVec &vec = *found;
     if(!vec.size()) return;
 
     for(int i=0; i<vec.size(); i++)
@@ -61,11 +62,11 @@ struct RuleSet::_RuleSetInternal
   // Returns an URL rule or NULL
   const Rule* findURL(const Hash &hash)
   {
-    UMap::const_iterator it = urls.find(hash);
-    if(it == urls.end())
+    const UVec *found = urls.find(hash);
+    if(!found)
       return NULL;
 
-    const UVec &vec = it->second;
+    const UVec &vec = *found;
 
     if(!vec.size())
       return NULL;
@@ -221,10 +222,10 @@ void RuleSet::reportBrokenURL(const Hash &hash, const std::string &url)
   LOCK;
 
   // Find all matching rules and disable them
-  UMap::iterator it = ptr->urls.find(hash);
-  if(it != ptr->urls.end())
+  UVec *found = ptr->urls.find(hash);
+  if(found)
     {
-      UVec &vec = it->second;
+      UVec &vec = *found;
 
       for(int i=0; i<vec.size(); i++)
         {
@@ -152,6 +152,80 @@ namespace Spread
     // Verify all entries in the file cache database
     void verifyCache();
 
+    /* Start re-reading and verifying the files in the cache in the
+       background, at idle I/O priority and within the given budget
+       (zero means no limit.) Unlike verifyCache(), this catches files
+       that were corrupted on disk without a change in time stamp.
+       Corrupt files in the cache storage directory are moved to the
+       "quarantine" directory, and removed from the cache.
+
+       Files are verified in order of when they were last verified,
+       and this is remembered across runs, so restarting the
+       scrubber does not start over. It keeps going until
+       stopScrubber() is called, or the SpreadLib object is deleted.
+       See Cache::ScrubJob for details.
+     */
+    JobInfoPtr startScrubber(uint64_t bytesPerSec, uint32_t opsPerSec = 0);
+    void stopScrubber();
+
+    /* Scan the whole cache storage directory for files that are
+       missing from the cache index. On startup, only directories
+       that changed since the last clean shutdown are scanned (see
+       Files::cacheChanged()), so use this if files were added to the
+       store behind our back while we were running.
+     */
+    void rescanCache();
+
+    /* Watch a directory for changes, so that cache lookups of files
+       in it can skip checking the disk (see CacheIndex::watch().)
+       Meant for long-running processes. With no parameter, watches
+       the cache storage directory. Install directories can be added
+       separately. Returns false if the directory couldn't be watched
+       completely, in which case lookups fall back to normal checks.
+     */
+    bool watchDir(const std::string &where = "");
+
+    /* Set size limits for the cache storage directory. Zero means no
+       limit, which is the default. When over a limit, trimCache()
+       removes files until the store is back under 90% of it.
+
+       Files are removed in order of their last use, or with
+       useLFU=true, the least used files first (see
+       CacheIndex::getAccess()). If 'bytesPerSec' is set, at most that
+       many bytes are deleted per second, so trimming a large store
+       doesn't starve other disk users.
+     */
+    void setCacheLimits(uint64_t maxBytes, uint64_t maxFiles = 0,
+                        bool useLFU = false, uint64_t bytesPerSec = 0);
+
+    /* Store new objects in the cache storage directory compressed,
+       when it pays off (see Cache::Packed.) Existing objects are
+       left as they are. Packed and plain objects can be mixed
+       freely, so this can be turned on and off at any time. The
+       default is off.
+     */
+    void setCacheCompression(bool enable);
+
+    /* Install files as copy-on-write clones of the cache storage
+       directory rather than as plain copies, using one of the
+       Cache::LinkMode values (see cache/files.hpp.) This makes
+       repeated installs of the same files nearly free on file systems
+       that support it. Files that can't be cloned are copied. The
+       default is Cache::LM_Copy.
+     */
+    void setLinkMode(int mode);
+
+    /* Remove files from the cache storage until it fits within the
+       limits given to setCacheLimits(). Directory objects of all
+       registered installs (see getStatusList()) are kept, since
+       upgrades and uninstalls need them, and so is everything that
+       running jobs are reading or creating.
+
+       Returns immediately if async=true. Does nothing useful if no
+       limits are set.
+     */
+    JobInfoPtr trimCache(bool async=true);
+
     /* Add a file to the local file cache. Any future requests for
        this data (as identified by the file's hashed value) will be
        copied from this location, instead of being downloaded or
@@ -4,6 +4,8 @@
 #include "tasks/download.hpp"
 #include "hash/hash_stream.hpp"
 #include "chanlist.hpp"
+#include "cache/evict.hpp"
+#include "cache/scrub.hpp"
 #include <mangle/stream/servers/file_stream.hpp>
 #include <mangle/stream/clients/copy_stream.hpp>
 #include <boost/filesystem.hpp>
@@ -72,6 +74,20 @@ struct SpreadLib::_Internal
 
   WasUpdated wasUpdated;
 
+  // See setCacheLimits()
+  Cache::Quota quota;
+
+  // Running background scrubber, if any. See startScrubber()
+  JobInfoPtr scrubber;
+
+  void stopScrubber()
+  {
+    if(!scrubber) return;
+    scrubber->abort();
+    scrubber->wait();
+    scrubber.reset();
+  }
+
   std::string getPath(const bf::path &file)
   {
     bf::path res = repoDir/file;
@@ -94,8 +110,13 @@ struct SpreadLib::_Internal
 
   ~_Internal()
   {
+    // The scrubber uses the cache, so it has to go first
+    stopScrubber();
     manager->finish();
     manager->getInfo()->abort();
+
+    // Let the next startup skip unchanged parts of the store
+    try { cache.files.saveScan(getPath("cache.scan")); } catch(...) {}
     try { bf::remove_all(cache.tmpDir); } catch(...) {}
   }
 };
@@ -109,12 +130,13 @@ SpreadLib::SpreadLib(const std::string &outDir, const std::string &tmpDir)
 
   PRINT("  repoDir=" << ptr->repoDir);
 
-  ptr->cache.index.load(ptr->getPath("cache.conf"));
+  // Several processes may use the same repository at once
+  ptr->cache.index.load(ptr->getPath("cache.conf"), true);
   ptr->cache.tmpDir = abs(tmpDir);
-  ptr->cache.files.basedir = ptr->getPath("cache/");
+  ptr->cache.files.setBaseDir(ptr->getPath("cache/"));
   ptr->manager.reset(new JobManager(ptr->cache));
 
-  ptr->cache.files.cacheAll();
+  ptr->cache.files.cacheChanged(ptr->getPath("cache.scan"));
 
   PRINT("  Starting JobManager");
   Thread::run(ptr->manager);
@@ -258,6 +280,7 @@ void SpreadLib::setLegacyPack(const std::string &channel, const std::string &pac
       if(src == "") continue;
 
       bf::copy_file(src, dest);
+      ptr->cache.files.addStored(dest, hash);
     }
 }
 
@@ -428,6 +451,87 @@ void SpreadLib::verifyCache()
   PRINT("verifyCache() done");
 }
 
+JobInfoPtr SpreadLib::startScrubber(uint64_t bytesPerSec, uint32_t opsPerSec)
+{
+  LOCK;
+  ptr->stopScrubber();
+
+  Cache::ScrubOptions opts;
+  opts.bytesPerSec = bytesPerSec;
+  opts.opsPerSec = opsPerSec;
+  opts.quarantine = ptr->getPath("quarantine/");
+  opts.loop = true;
+
+  Cache::ScrubJob *job = new Cache::ScrubJob(ptr->cache.files, ptr->cache.index,
+                                             ptr->getPath("cache.scrub"), opts);
+  ptr->scrubber = Thread::run(job);
+  return ptr->scrubber;
+}
+
+void SpreadLib::stopScrubber()
+{
+  LOCK;
+  ptr->stopScrubber();
+}
+
+void SpreadLib::rescanCache()
+{
+  ptr->cache.files.cacheAll();
+}
+
+bool SpreadLib::watchDir(const std::string &where)
+{
+  if(where == "")
+    return ptr->cache.index.watch(ptr->cache.files.basedir);
+  return ptr->cache.index.watch(abs(where));
+}
+
+void SpreadLib::setCacheLimits(uint64_t maxBytes, uint64_t maxFiles,
+                               bool useLFU, uint64_t bytesPerSec)
+{
+  LOCK;
+  Cache::Quota &q = ptr->quota;
+  q.maxBytes = maxBytes;
+  q.maxFiles = maxFiles;
+  q.policy = useLFU ? Cache::Quota::LFU : Cache::Quota::LRU;
+  q.bytesPerSec = bytesPerSec;
+}
+
+void SpreadLib::setCacheCompression(bool enable)
+{
+  LOCK;
+  ptr->cache.files.compress = enable;
+}
+
+void SpreadLib::setLinkMode(int mode)
+{
+  LOCK;
+  ptr->manager->setLinkMode(mode);
+}
+
+JobInfoPtr SpreadLib::trimCache(bool async)
+{
+  LOCK;
+
+  // Keep the directory objects of everything that is installed
+  Cache::HashSet pinned;
+  PackStatusList lst;
+  ptr->chan.getStatusList().getList(lst);
+  for(PackStatusList::const_iterator it = lst.begin(); it != lst.end(); it++)
+    {
+      const StrVec &dirs = (*it)->info.dirs;
+      for(int i=0; i<dirs.size(); i++)
+        pinned.insert(Hash(dirs[i]));
+    }
+
+  // And everything that running jobs are reading or creating
+  ptr->manager->getRunning(pinned);
+
+  Cache::EvictJob *job = new Cache::EvictJob(ptr->cache.files, ptr->cache.index,
+                                             ptr->quota, pinned);
+  return Thread::run(job, async);
+}
+
 std::string SpreadLib::cacheFile(const std::string &file)
 {
   // Doesn't need LOCK, since CacheIndex does its own internal locking
@@ -71,7 +71,7 @@ void test(const std::string &src, const std::string &dest, bool kill=true)
   Cache::Cache cache;
   JobManagerPtr man(new JobManager(cache));
   cache.tmpDir = "_tmpdir/";
-  cache.files.basedir = "_tmpdir/cache/";
+  cache.files.setBaseDir("_tmpdir/cache/");
   //man->setLogger(Misc::LogPtr(new Misc::Logger()), false);
 
   if(kill) bf::remove_all(dest);
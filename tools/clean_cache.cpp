@@ -15,7 +15,9 @@ int main(int argc, char **argv)
 
   string file = argv[1];
   cout << "Loading " << file << "\n";
-  CacheIndex cache(argv[1]);
+  // Other processes may be using the file at the same time
+  CacheIndex cache;
+  cache.load(file, true);
   cout << "Cleaning...\n";
   cache.verify();
   cout << "Done!\n";
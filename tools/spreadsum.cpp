@@ -1,17 +1,32 @@
 #include <hash/hash.hpp>
+#include <hash/hash_stream.hpp>
+#include <cache/index.hpp>
 
+#include <boost/filesystem.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/date_time/posix_time/posix_time.hpp>
+#include <algorithm>
 #include <fstream>
 #include <vector>
 #include <iostream>
+#include <iomanip>
 #include <stdexcept>
+#include <stdlib.h>
+
+#ifdef NEED_LOCKGUARD
+#include <boost/thread/lock_guard.hpp>
+#endif
 
 using namespace std;
 using namespace Spread;
+namespace bf = boost::filesystem;
+namespace pt = boost::posix_time;
 
 Hash hashStream(istream &inf)
 {
-  vector<char> buf(1024);
-  Hash res;
+  vector<char> buf(1024*1024);
+  HashBuilder res;
 
   while(!inf.eof())
     {
@@ -32,17 +47,104 @@ Hash hashStream(istream &inf)
 
 Hash hashFile(const std::string &src)
 {
-  // Input file
-  ifstream inf(src.c_str(), ios::binary);
-  if(!inf) return Hash();
+  // Read in large blocks. Files aren't mapped, as someone else
+  // truncating one would kill us with SIGBUS.
+  try { return HashStream::sum(src); }
+  catch(std::exception &e) { return Hash(); }
+}
 
-  return hashStream(inf);
+// Seconds since 'start'
+double since(const pt::ptime &start)
+{
+  return (pt::microsec_clock::universal_time() - start).total_microseconds() / 1000000.0;
+}
+
+/* Hashes a list of files on several threads. Each thread grabs the
+   next file in the list until there are none left.
+ */
+struct Hasher
+{
+  const vector<string> *files;
+  vector<Hash> *out;
+
+  boost::mutex mutex;
+  size_t next;
+  uint64_t bytes;
+
+  void operator()()
+  {
+    while(true)
+      {
+        size_t i;
+        {
+          boost::lock_guard<boost::mutex> lock(mutex);
+          if(next >= files->size()) return;
+          i = next++;
+        }
+
+        Hash h = hashFile((*files)[i]);
+        (*out)[i] = h;
+
+        boost::lock_guard<boost::mutex> lock(mutex);
+        bytes += h.size();
+      }
+  }
+};
+
+// Functor wrapper, since boost::thread copies its function object
+struct HashThread
+{
+  Hasher *h;
+  void operator()() { (*h)(); }
+};
+
+uint64_t hashAll(const vector<string> &files, vector<Hash> &out, int threads)
+{
+  Hasher h;
+  h.files = &files;
+  h.out = &out;
+  h.next = 0;
+  h.bytes = 0;
+
+  out.resize(files.size());
+
+  if(threads > files.size()) threads = files.size();
+  if(threads <= 1)
+    h();
+  else
+    {
+      boost::thread_group group;
+      for(int i=0; i<threads; i++)
+        {
+          HashThread t = { &h };
+          group.create_thread(t);
+        }
+      group.join_all();
+    }
+  return h.bytes;
+}
+
+// Add all regular files under 'dir' to 'files', sorted by name
+void walk(const string &dir, vector<string> &files)
+{
+  vector<string> found;
+  bf::recursive_directory_iterator it(dir), end;
+  for(; it != end; ++it)
+    if(bf::is_regular_file(it->status()))
+      found.push_back(it->path().string());
+
+  sort(found.begin(), found.end());
+  files.insert(files.end(), found.begin(), found.end());
 }
 
 int main(int argc, char**argv)
 {
   bool json = false;
   bool cleanup = false;
+  bool recurse = false;
+  bool stats = false;
+  int threads = 0;
+  string conf;
 
   /*
     0 = hex
@@ -65,13 +167,26 @@ int main(int argc, char**argv)
         format = 1;
       else if(par == "-x")
         format = 0;
+      else if(par == "-r")
+        recurse = true;
+      else if(par == "-s")
+        stats = true;
+      else if(par == "-t" && i+1 < argc)
+        threads = atoi(argv[++i]);
+      else if(par == "-i" && i+1 < argc)
+        conf = argv[++i];
       else if(par == "--help")
         {
           cout << "spreadsum [options] <files>\n\n";
-          cout << "  -j    Output in JSON format\n";
-          cout << "  -c    Remove leading ./ from filenames\n";
-          cout << "  -x    Output in hex format\n";
-          cout << "  -b    Output in base64 format (default)\n";
+          cout << "  -j         Output in JSON format\n";
+          cout << "  -c         Remove leading ./ from filenames\n";
+          cout << "  -x         Output in hex format\n";
+          cout << "  -b         Output in base64 format (default)\n";
+          cout << "  -r         Hash all files in the given directories, recursively\n";
+          cout << "  -t <num>   Number of hashing threads (default: one per core)\n";
+          cout << "  -i <file>  Use and update a cache index file, so unchanged files\n";
+          cout << "             are not rehashed\n";
+          cout << "  -s         Print statistics to stderr\n";
           return 0;
         }
       else
@@ -81,6 +196,90 @@ int main(int argc, char**argv)
   if(files.size() == 0)
     files.push_back("-");
 
+  if(threads <= 0) threads = boost::thread::hardware_concurrency();
+  if(threads <= 0) threads = 1;
+
+  pt::ptime start = pt::microsec_clock::universal_time();
+
+  // Expand directories
+  if(recurse)
+    {
+      vector<string> list;
+      for(int i=0; i<files.size(); i++)
+        {
+          if(files[i] != "-" && bf::is_directory(files[i]))
+            walk(files[i], list);
+          else
+            list.push_back(files[i]);
+        }
+      files.swap(list);
+    }
+  double tScan = since(start);
+
+  vector<Hash> hashes(files.size());
+
+  /* With an index, checkMany() does all the work: unchanged files
+     are taken from the index, and the rest are hashed on 'threads'
+     threads and added to it. Otherwise we hash everything ourselves.
+     Standard input is always done separately.
+
+     The index is loaded as shared, since it may be the cache.conf of
+     a running spread process.
+   */
+  start = pt::microsec_clock::universal_time();
+  vector<string> list;
+  for(int i=0; i<files.size(); i++)
+    if(files[i] == "-")
+      hashes[i] = hashStream(cin);
+    else
+      list.push_back(files[i]);
+
+  uint64_t bytes = 0;
+
+  // Files and bytes taken from the index as they were, see -s
+  uint64_t idxFiles = 0, idxBytes = 0, numHashed = 0;
+  if(conf != "")
+    {
+      Cache::CacheIndex index;
+      index.load(conf, true);
+      index.setThreads(threads);
+
+      Hash::DirMap check;
+      for(int i=0; i<list.size(); i++)
+        check[list[i]] = Hash();
+
+      // Files that fail keep their null hash
+      try { index.checkMany(check); }
+      catch(std::exception &e) { cerr << "ERROR: " << e.what() << endl; }
+
+      for(int i=0; i<files.size(); i++)
+        if(files[i] != "-")
+          hashes[i] = check[files[i]];
+
+      /* The index tells us how much it hashed, the rest of the data
+         it took from its entries.
+       */
+      index.getHashStats(numHashed, bytes);
+      Hash::DirMap::const_iterator it;
+      for(it = check.begin(); it != check.end(); it++)
+        if(!it->second.isNull())
+          {
+            idxFiles++;
+            idxBytes += it->second.size();
+          }
+      idxFiles -= std::min(idxFiles, numHashed);
+      idxBytes -= std::min(idxBytes, bytes);
+    }
+  else
+    {
+      vector<Hash> res;
+      bytes = hashAll(list, res, threads);
+      for(int i=0, j=0; i<files.size(); i++)
+        if(files[i] != "-")
+          hashes[i] = res[j++];
+    }
+  double tHash = since(start);
+
   if(json)
     cout << "{\n";
 
@@ -91,11 +290,7 @@ int main(int argc, char**argv)
       if(cleanup && file.substr(0,2) == "./")
         file = file.substr(2);
 
-      Hash h;
-      if(file == "-")
-        h = hashStream(cin);
-      else
-        h = hashFile(file);
+      const Hash &h = hashes[i];
 
       string hstring;
 
@@ -123,5 +318,21 @@ int main(int argc, char**argv)
   if(json)
     cout << "}\n";
 
+  if(stats)
+    {
+      cerr << fixed << setprecision(2)
+           << "Files: " << files.size() << "  Threads: " << threads << "\n";
+      double mb = bytes / (1024.0*1024.0);
+      if(conf != "")
+        cerr << "From index: " << idxFiles << " files, "
+             << idxBytes / (1024.0*1024.0) << " Mb\n"
+             << "Hashed: " << numHashed << " files, ";
+      else
+        cerr << "Hashed: ";
+      cerr << mb << " Mb in " << tHash << "s";
+      if(tHash > 0) cerr << " (" << mb/tHash << " Mb/s)";
+      cerr << "\nScan: " << tScan << "s\n";
+    }
+
   return 0;
 }